@@ -1,7 +1,30 @@
 #include "3a.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "agora_audio_processing.h"
+#include "3a_capture.h"
+#include "3a_cost_model.h"
+#include "3a_dump.h"
+#include "3a_flight_recorder.h"
+#include "3a_log.h"
+#include "3a_memory.h"
+#include "3a_metrics.h"
+#include "3a_mix.h"
+#include "3a_rcu.h"
+#include "3a_stats.h"
+#include "3a_task_runner.h"
+#include "3a_trace.h"
+#include "3a_worker_pool.h"
 
 using namespace std;
 
@@ -9,28 +32,36 @@ using namespace std;
 extern "C" {
 #endif
 
+static void ap_processor_on_malfunction(void* processor_impl);
+static void ap_processor_on_anomaly(void* processor_impl, const char* reason);
+
 class APHandler : public AgoraUAP::AgoraAudioProcessingEventHandler {
     public:
     void onEvent(AgoraAudioProcessingEventType event) override {
-            
+        if (event == kAecMalfunction) {
+            ap_processor_on_malfunction(user_data_);
+        }
+        ap_processor_on_anomaly(user_data_, event == kAecMalfunction ? "aec_malfunction" : "event");
         if (event_handler_ != nullptr) {
             event_handler_->on_event(user_data_, (int)event);
         }
     }
     void onError(int err) override {
-        printf("onError: %d\n", err);
+        AP_LOG_ERROR("onError: %d\n", err);
+        ApTraceAnomaly("error");
+        ap_processor_on_anomaly(user_data_, "error");
         if (event_handler_ != nullptr) {
             event_handler_->on_error(user_data_, (int)err);
         }
     }
     public:
     APHandler(void* user_data, struct _agora_ap_processor_event_handler *event_handler) {
-        printf("APHandler constructor\n");
+        AP_LOG_INFO("APHandler constructor\n");
         this->user_data_ = user_data;
         this->event_handler_ = event_handler;
     }
     ~APHandler() {
-        printf("APHandler destructor\n");
+        AP_LOG_INFO("APHandler destructor\n");
         user_data_ = nullptr;
     }
 
@@ -39,21 +70,225 @@ class APHandler : public AgoraUAP::AgoraAudioProcessingEventHandler {
     struct _agora_ap_processor_event_handler *event_handler_;
 };
 
-typedef struct _agora_ap_processor_impl {
+// work requested from other threads, run by the capture thread at the next frame boundary
+enum {
+    kPendingRecovery = 1 << 0,
+    kPendingDegrade = 1 << 1,
+    kPendingDump = 1 << 2,
+    kPendingCapture = 1 << 3,
+    kPendingReset = 1 << 4,
+    kPendingConfig = 1 << 5,
+};
+
+struct _agora_ap_service_impl;
+
+typedef struct _agora_ap_processor_impl : public ApMemoryCounted {
     AgoraUAP::AgoraAudioProcessing* processor;
     std::shared_ptr<APHandler> handler;
     bool aec_enabled;
     AgoraUAP::AgoraAudioFrame* aec_ref_frame;
+    struct _agora_ap_service_impl* service;
+    // process unique, names the processor in traces
+    uint32_t id;
+
+    // bit set of kPending*
+    std::atomic<uint32_t> pending_ops;
+
+    // kAecMalfunction recovery
+    _agora_ap_recovery_config recovery_config;
+    // swapped with |processor| on the capture thread, other threads read has_spare
+    AgoraUAP::AgoraAudioProcessing* spare_processor;
+    std::atomic<bool> has_spare;        // spare_processor is set, for the metrics
+    std::atomic<bool> spare_ready;      // spare is reset and may be swapped in
+    std::atomic<bool> spare_resetting;  // a background Reset() of the spare is in flight
+    std::atomic<uint64_t> malfunction_events;
+    std::atomic<uint64_t> recovery_count;
+    std::atomic<uint64_t> spare_swap_count;
+    std::atomic<uint64_t> last_recovery_us;
+    std::atomic<uint64_t> max_recovery_us;
+    std::atomic<uint64_t> total_recovery_us;
+    std::atomic<uint64_t> last_spare_reset_us;
+
+    // config the processor was created with
+    _agora_ap_processor_config config;
+    // config currently set on |processor|, |config| with the degradation applied
+    _agora_ap_processor_config applied_config;
+    // config set on |spare_processor|
+    _agora_ap_processor_config spare_config;
+    // agora_ap_processor_set_config publishes here, the capture thread takes it
+    ApRcuSlot<_agora_ap_processor_config> config_slot;
+    // serializes agora_ap_processor_set_config, guards cost_key and the reservation after create
+    std::mutex config_mutex;
+    std::atomic<uint64_t> config_version;  // last version taken
+    std::atomic<uint64_t> config_changes;
+
+    // cpu budget degradation, the controller writes the target, the capture thread applies it
+    _agora_ap_qos_config qos_config;
+    std::atomic<uint32_t> degrade_mask;  // bit set of 1 << _agora_ap_degrade_step
+    std::atomic<int> degrade_level;
+    uint32_t applied_degrade_mask;       // capture thread only
+    uint32_t frame_cost_ewma_q4;         // capture thread only, us << 4
+    std::atomic<uint32_t> avg_frame_cost_us;
+    std::atomic<uint64_t> last_frame_us;  // ap_now_us() at the end of the last frame, 0 before the first
+
+    // admission reservation, given back on release
+    ApCostKey cost_key;
+    long long reserved_cpu_us;
+    long long reserved_memory_bytes;
+    // what the stream really runs at, written by the capture thread
+    int stream_sample_rate;
+    int stream_channels;
+    // mono mix of a stereo reference when stereo AEC is off, capture thread only
+    std::vector<int16_t> ref_downmix;
+    AgoraUAP::AgoraAudioFrame ref_downmix_frame;
+
+    // timings and counters, see agora_ap_processor_get_stats
+    ApProcessorStats stats;
+
+    // data dump, agora_ap_processor_set_dump stores the request, the capture thread applies it
+    std::mutex dump_mutex;
+    _agora_ap_dump_config dump_request;  // under dump_mutex, dir points to dump_request_dir
+    std::string dump_request_dir;
+    std::shared_ptr<ApDumpWriter> dump_writer;  // replaced by the capture thread under dump_mutex
+    std::shared_ptr<ApDumpCounters> dump_counters;
+    bool library_dump_enabled;  // capture thread only
+    std::string library_dump_dir;
+
+    // set before the processor exists, constant afterwards
+    std::shared_ptr<ApFlightRecorder> flight_recorder;
+    uint64_t flight_slow_frame_ns;
+
+    // set by the app from any thread, read once per frame
+    std::atomic<int> stream_delay_ms;
+    std::atomic<int> stream_analog_level;
+
+    // replay capture, agora_ap_processor_start_capture stores the path, the capture thread applies it
+    std::mutex capture_mutex;
+    std::string capture_request_path;  // under capture_mutex, empty to stop
+    std::shared_ptr<ApCaptureWriter> capture_writer;  // capture thread only
+
+    // filled by agora_ap_processor_create, first_frame_us by the capture thread
+    _agora_ap_create_timing create_timing;
+    std::atomic<long long> first_frame_us;
+
+    // RSS and counted wrapper heap growth over agora_ap_processor_create
+    long long create_rss_bytes;
+    long long create_wrapper_bytes;
 
     _agora_ap_processor_impl() {
         processor = nullptr;
         handler = nullptr;
         aec_enabled = false;
         aec_ref_frame = nullptr;
+        service = nullptr;
+        id = 0;
+        pending_ops = 0;
+        recovery_config.auto_recover = true;
+        recovery_config.use_spare_processor = false;
+        spare_processor = nullptr;
+        has_spare = false;
+        spare_ready = false;
+        spare_resetting = false;
+        malfunction_events = 0;
+        recovery_count = 0;
+        spare_swap_count = 0;
+        last_recovery_us = 0;
+        max_recovery_us = 0;
+        total_recovery_us = 0;
+        last_spare_reset_us = 0;
+        config_version = 0;
+        config_changes = 0;
+        qos_config.priority_class = 0;
+        qos_config.allow_degradation = true;
+        degrade_mask = 0;
+        degrade_level = 0;
+        applied_degrade_mask = 0;
+        frame_cost_ewma_q4 = 0;
+        avg_frame_cost_us = 0;
+        last_frame_us = 0;
+        reserved_cpu_us = 0;
+        reserved_memory_bytes = 0;
+        stream_sample_rate = 0;
+        stream_channels = 0;
+        dump_request.library_dump = false;
+        dump_request.wrapper_dump = false;
+        dump_counters = std::make_shared<ApDumpCounters>();
+        library_dump_enabled = false;
+        flight_slow_frame_ns = 0;
+        stream_delay_ms = 60;
+        stream_analog_level = 0;
+        memset(&create_timing, 0, sizeof(create_timing));
+        first_frame_us = 0;
+        create_rss_bytes = 0;
+        create_wrapper_bytes = 0;
+    }
+} ;
+
+// channel processors of a mic array and the per channel frames they are fed
+typedef struct _agora_ap_array_processor_impl : public ApMemoryCounted {
+    struct _agora_ap_service_impl* service;
+    int channels;
+    std::vector<AGORA_API_C_HDL> processors;
+
+    // capture thread only: one mono frame and one reference copy per channel,
+    // the buffers are slices of |planar| and |ref_copies|
+    int samples_capacity;
+    std::vector<int16_t> planar;
+    std::vector<int16_t> ref_copies;
+    std::vector<_agora_ap_audio_frame> frames;
+    std::vector<_agora_ap_audio_frame> ref_frames;
+    std::vector<int> results;
+    std::vector<uint64_t> cost_ns;
+
+    // see agora_ap_array_processor_get_stats, written by the capture thread
+    ApSeqLock lock;
+    ApLatencyHistogram total;
+    ApLatencyHistogram channel_sum;
+    std::atomic<uint64_t> frame_count;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> layout_ns;
+    std::atomic<uint64_t> channel_last_ns[AGORA_AP_ARRAY_MAX_CHANNELS];
+    std::atomic<uint64_t> channel_max_ns[AGORA_AP_ARRAY_MAX_CHANNELS];
+    std::atomic<uint64_t> channel_total_ns[AGORA_AP_ARRAY_MAX_CHANNELS];
+
+    _agora_ap_array_processor_impl() {
+        service = nullptr;
+        channels = 0;
+        samples_capacity = 0;
+        frame_count = 0;
+        overruns = 0;
+        layout_ns = 0;
+        for (int c = 0; c < AGORA_AP_ARRAY_MAX_CHANNELS; c++) {
+            channel_last_ns[c] = 0;
+            channel_max_ns[c] = 0;
+            channel_total_ns[c] = 0;
+        }
+    }
+} ;
+
+// far end reference mixer, mixed by one thread
+typedef struct _agora_ap_ref_mixer_impl : public ApMemoryCounted {
+    ApRefMixer mixer;
+    std::vector<ApRefMixer::Source> sources;  // mixing thread only
+
+    // see agora_ap_ref_mixer_get_stats, written by the mixing thread
+    ApSeqLock lock;
+    ApLatencyHistogram mix;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> sources_mixed;
+    std::atomic<uint64_t> sources_silent;
+    std::atomic<uint64_t> sources_resampled;
+
+    _agora_ap_ref_mixer_impl(const _agora_ap_ref_mixer_config& config)
+        : mixer(config.sample_rate, config.channels, config.silence_dbfs) {
+        frames = 0;
+        sources_mixed = 0;
+        sources_silent = 0;
+        sources_resampled = 0;
     }
 } ;
 
-typedef struct _agora_ap_service_impl {
+typedef struct _agora_ap_service_impl : public ApMemoryCounted {
     bool is_initialized;
     _agora_ap_service_config config;
 
@@ -65,15 +300,108 @@ typedef struct _agora_ap_service_impl {
     AgoraUAP::AgoraAudioProcessing::AiModelResourceConfig ainsll_model_config;  
     AgoraUAP::AgoraAudioProcessing::AiModelResourceConfig ainlp_model_config;
     AgoraUAP::AgoraAudioProcessing::AiModelResourceConfig ainlpll_model_config;  
+
+    // runs Reset() of swapped out processors off the capture thread
+    ApTaskRunner task_runner;
+    // fans the channels of array processors out within the frame
+    ApWorkerPool worker_pool;
+
+    // live processors, never locked by the capture thread
+    std::mutex processors_mutex;
+    std::vector<_agora_ap_processor_impl*> processors;
+
+    // cpu budget controller
+    _agora_ap_cpu_budget_config cpu_budget;
+    std::mutex budget_mutex;
+    std::condition_variable budget_cond;
+    std::thread budget_thread;
+    bool budget_stop;
+
+    // admission control
+    ApCostModel cost_model;
+    _agora_ap_admission_config admission;
+    std::mutex admission_mutex;
+    std::condition_variable admission_cond;
+    long long committed_cpu_us;
+    long long committed_memory_bytes;
+    unsigned long long admitted_count;
+    unsigned long long refused_count;
+    unsigned long long queued_count;
+    int waiting_count;
+
+    // metrics, per thread counters merged by the exporter
+    uint64_t generation;
+    std::mutex counters_mutex;
+    std::vector<ApThreadCounters*> thread_counters;
+    ApMetricsExporter metrics_exporter;
+    // last merged frame cost, the exporter reports quantiles of the difference
+    _agora_ap_latency_histogram metrics_last_frame_cost;
+
+    // agora_ap_service_initialize phases, see agora_ap_service_get_startup_timing
+    _agora_ap_startup_timing startup_timing;
+    // RSS growth over agora_ap_service_initialize and over each model load
+    long long init_rss_bytes;
+    long long model_rss_bytes[AGORA_AP_MODEL_COUNT];
 } ;
 
+static uint64_t ap_now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t ap_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// counters of the calling thread, registered with the service on first use
+static ApThreadCounters* ap_thread_counters(_agora_ap_service_impl* service_impl)
+{
+    static thread_local ApThreadCounters* counters = nullptr;
+    static thread_local uint64_t generation = 0;
+    if (generation != service_impl->generation) {
+        counters = new ApThreadCounters();
+        std::lock_guard<std::mutex> lock(service_impl->counters_mutex);
+        service_impl->thread_counters.push_back(counters);
+        generation = service_impl->generation;
+    }
+    return counters;
+}
+
+static void ap_processor_on_malfunction(void* user_data)
+{
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(user_data);
+    if (processor_impl == nullptr) {
+        return;
+    }
+    processor_impl->malfunction_events.fetch_add(1, std::memory_order_relaxed);
+    ApTraceAnomaly("aec_malfunction");
+    if (processor_impl->recovery_config.auto_recover) {
+        processor_impl->pending_ops.fetch_or(kPendingRecovery, std::memory_order_release);
+    }
+}
+
+static void ap_processor_on_anomaly(void* user_data, const char* reason)
+{
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(user_data);
+    if (processor_impl != nullptr && processor_impl->flight_recorder) {
+        processor_impl->flight_recorder->Trigger(reason);
+    }
+}
+
 static _agora_ap_service_impl  *g_ap_service_impl = nullptr;
+static std::atomic<uint32_t> g_ap_processor_id(0);
+// tells the thread local counters of a released service from those of a new one
+static uint64_t g_ap_service_generation = 0;
 AGORA_API_C_HDL agora_ap_service_create()
 {
     //check if g_ap_service_impl is nullptr, if nullptr, create a new one
     if (g_ap_service_impl == nullptr) {
         g_ap_service_impl = new _agora_ap_service_impl();
         g_ap_service_impl->event_handler = nullptr;
+        g_ap_service_impl->generation = ++g_ap_service_generation;
     }
    return g_ap_service_impl;
 }
@@ -86,6 +414,11 @@ AGORA_API_C_INT agora_ap_service_initialize(AGORA_API_C_HDL service_handle, cons
     if (g_ap_service_impl->is_initialized) {
         return 0;
     }
+    uint64_t init_begin_us = ap_now_us();
+    _agora_ap_startup_timing& timing = g_ap_service_impl->startup_timing;
+    memset(&timing, 0, sizeof(timing));
+    size_t init_rss_before = ApReadRssBytes();
+    memset(g_ap_service_impl->model_rss_bytes, 0, sizeof(g_ap_service_impl->model_rss_bytes));
     g_ap_service_impl->config = *config;
     g_ap_service_impl->is_initialized = true;
     g_ap_service_impl->event_handler = handler;
@@ -113,22 +446,27 @@ AGORA_API_C_INT agora_ap_service_initialize(AGORA_API_C_HDL service_handle, cons
     // sourceFile = "/home/sxb/loganxu/3a_test_demo/3atest/CLDNNWeights.bin";
     std::string ains_model_path = model_path + "CLDNNWeights.bin";
     sourceFile = "./CLDNNWeights.bin";
+    uint64_t load_begin_us = ap_now_us();
+    size_t load_rss_before = ApReadRssBytes();
     binFilePtr = fopen(ains_model_path.c_str(), "rb");
     if (binFilePtr != NULL) {
-        printf("open bin file ok!\n");
+        AP_LOG_INFO("open bin file ok!\n");
         fseek(binFilePtr, 0, SEEK_END);
         modelDataSize = ftell(binFilePtr);
         fseek(binFilePtr, 0, SEEK_SET);
         // ainsModelDataPtr.reset(new char[modelDataSize]);
-        ainsModelDataPtr.reset(new char[modelDataSize], std::default_delete<char[]>()); 
+        ainsModelDataPtr.reset(ApMemoryNewBytes(modelDataSize), ApMemoryBytesDeleter()); 
         fread(ainsModelDataPtr.get(), 1, modelDataSize, binFilePtr);
         fclose(binFilePtr);
+        timing.model_load_us[0] = (long long)(ap_now_us() - load_begin_us);
+        timing.model_bytes[0] = (long long)modelDataSize;
+        g_ap_service_impl->model_rss_bytes[0] = (long long)ApReadRssBytes() - (long long)load_rss_before;
         g_ap_service_impl->ains_model_config.modelDataPtr = ainsModelDataPtr;
         g_ap_service_impl->ains_model_config.modelDataSize = modelDataSize;
         g_ap_service_impl->ains_model_config.modelName = modelName;
         //ap->SetAIModelResource(g_ap_service_impl->ains_model_config);
     } else {
-        printf("open bin file error!\n");
+        AP_LOG_ERROR("open bin file error!\n");
     }
 
 
@@ -136,69 +474,134 @@ AGORA_API_C_INT agora_ap_service_initialize(AGORA_API_C_HDL service_handle, cons
     // sourceFile = "/home/sxb/loganxu/3a_test_demo/3atest/CLDNNWeights.bin";
     std::string ainsll_model_path = model_path + "CLDNNLLWeights.bin";
     sourceFile = "./CLDNNLLWeights.bin";
+    load_begin_us = ap_now_us();
+    load_rss_before = ApReadRssBytes();
     binFilePtr = fopen(ainsll_model_path.c_str(), "rb");
     if (binFilePtr != NULL) {
-        printf("open bin file ok!\n");
+        AP_LOG_INFO("open bin file ok!\n");
         fseek(binFilePtr, 0, SEEK_END);
         modelDataSize = ftell(binFilePtr);
         fseek(binFilePtr, 0, SEEK_SET);
-        ainsllModelDataPtr.reset(new char[modelDataSize], std::default_delete<char[]>());
+        ainsllModelDataPtr.reset(ApMemoryNewBytes(modelDataSize), ApMemoryBytesDeleter());
         fread(ainsllModelDataPtr.get(), 1, modelDataSize, binFilePtr);
         fclose(binFilePtr);
+        timing.model_load_us[1] = (long long)(ap_now_us() - load_begin_us);
+        timing.model_bytes[1] = (long long)modelDataSize;
+        g_ap_service_impl->model_rss_bytes[1] = (long long)ApReadRssBytes() - (long long)load_rss_before;
         g_ap_service_impl->ainsll_model_config.modelDataPtr = ainsllModelDataPtr;
         g_ap_service_impl->ainsll_model_config.modelDataSize = modelDataSize;
         g_ap_service_impl->ainsll_model_config.modelName = modelName;
         //ap->SetAIModelResource(g_ap_service_impl->ainsll_model_config);
     } else {
-        printf("open bin file error!\n");
+        AP_LOG_ERROR("open bin file error!\n");
     }
 
     modelName = (char*)"ainlp";
     std::string ainlp_model_path = model_path + "YNetWeights.bin";
     sourceFile = "./YNetWeights.bin";
+    load_begin_us = ap_now_us();
+    load_rss_before = ApReadRssBytes();
     binFilePtr = fopen(ainlp_model_path.c_str(), "rb");
     if (binFilePtr != NULL) {
-        printf("open bin file ok!\n");
+        AP_LOG_INFO("open bin file ok!\n");
         fseek(binFilePtr, 0, SEEK_END);
         modelDataSize = ftell(binFilePtr);
         fseek(binFilePtr, 0, SEEK_SET);
-        ainlpModeDataPtr.reset(new char[modelDataSize], std::default_delete<char[]>());
+        ainlpModeDataPtr.reset(ApMemoryNewBytes(modelDataSize), ApMemoryBytesDeleter());
         fread(ainlpModeDataPtr.get(), 1, modelDataSize, binFilePtr);
         fclose(binFilePtr);
+        timing.model_load_us[2] = (long long)(ap_now_us() - load_begin_us);
+        timing.model_bytes[2] = (long long)modelDataSize;
+        g_ap_service_impl->model_rss_bytes[2] = (long long)ApReadRssBytes() - (long long)load_rss_before;
         g_ap_service_impl->ainlp_model_config.modelDataPtr = ainlpModeDataPtr;
         g_ap_service_impl->ainlp_model_config.modelDataSize = modelDataSize;
         g_ap_service_impl->ainlp_model_config.modelName = modelName;
         //ap->SetAIModelResource(g_ap_service_impl->ainlp_model_config);
     } else {
-        printf("open bin file error!\n");
+        AP_LOG_ERROR("open bin file error!\n");
     }
 
     modelName = (char*)"ainlp_ll";
     std::string ainlpll_model_path = model_path + "YNetLLWeights.bin";
     sourceFile = "./YNetLLWeights.bin";
+    load_begin_us = ap_now_us();
+    load_rss_before = ApReadRssBytes();
     binFilePtr = fopen(ainlpll_model_path.c_str(), "rb");
     if (binFilePtr != NULL) {
-        printf("open bin file ok!\n");
+        AP_LOG_INFO("open bin file ok!\n");
         fseek(binFilePtr, 0, SEEK_END);
         modelDataSize = ftell(binFilePtr);
         fseek(binFilePtr, 0, SEEK_SET);
-        ainlpllModeDataPtr.reset(new char[modelDataSize], std::default_delete<char[]>());
+        ainlpllModeDataPtr.reset(ApMemoryNewBytes(modelDataSize), ApMemoryBytesDeleter());
         fread(ainlpllModeDataPtr.get(), 1, modelDataSize, binFilePtr);
         fclose(binFilePtr);
+        timing.model_load_us[3] = (long long)(ap_now_us() - load_begin_us);
+        timing.model_bytes[3] = (long long)modelDataSize;
+        g_ap_service_impl->model_rss_bytes[3] = (long long)ApReadRssBytes() - (long long)load_rss_before;
         g_ap_service_impl->ainlpll_model_config.modelDataPtr = ainlpllModeDataPtr;
         g_ap_service_impl->ainlpll_model_config.modelDataSize = modelDataSize;
         g_ap_service_impl->ainlpll_model_config.modelName = modelName;
         //ap->SetAIModelResource(g_ap_service_impl->ainlpll_model_config);
     } else {
-        printf("open bin file error!\n");
+        AP_LOG_ERROR("open bin file error!\n");
     }  
+    timing.service_init_us = (long long)(ap_now_us() - init_begin_us);
+    g_ap_service_impl->init_rss_bytes = (long long)ApReadRssBytes() - (long long)init_rss_before;
+    return 0;
+}
+
+static void ap_budget_controller_stop(_agora_ap_service_impl* service_impl);
+
+AGORA_API_C_INT agora_ap_service_get_startup_timing(AGORA_API_C_HDL service_handle, _agora_ap_startup_timing* timing)
+{
+    if (service_handle == nullptr || service_handle != g_ap_service_impl || timing == nullptr) {
+        return -1;
+    }
+    *timing = g_ap_service_impl->startup_timing;
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_service_get_memory_report(AGORA_API_C_HDL service_handle, _agora_ap_memory_report* report)
+{
+    if (service_handle == nullptr || service_handle != g_ap_service_impl || report == nullptr) {
+        return -1;
+    }
+    _agora_ap_service_impl* service_impl = g_ap_service_impl;
+    memset(report, 0, sizeof(*report));
+    report->rss_bytes = (long long)ApReadRssBytes();
+    report->pss_bytes = (long long)ApReadPssBytes();
+    report->service_init_rss_bytes = service_impl->init_rss_bytes;
+    for (int i = 0; i < AGORA_AP_MODEL_COUNT; i++) {
+        report->model_bytes[i] = service_impl->startup_timing.model_bytes[i];
+        report->model_rss_bytes[i] = service_impl->model_rss_bytes[i];
+    }
+    {
+        std::lock_guard<std::mutex> lock(service_impl->processors_mutex);
+        report->processor_count = (int)service_impl->processors.size();
+        for (size_t i = 0; i < service_impl->processors.size(); i++) {
+            report->processor_rss_bytes += service_impl->processors[i]->create_rss_bytes;
+            report->processor_wrapper_bytes += service_impl->processors[i]->create_wrapper_bytes;
+        }
+    }
+    ApMemoryUsage usage = ApMemoryGetUsage();
+    report->wrapper_bytes = usage.bytes;
+    report->wrapper_peak_bytes = usage.peak_bytes;
+    report->wrapper_allocations = usage.allocations;
     return 0;
 }
 
 AGORA_API_C_VOID agora_ap_service_release(AGORA_API_C_HDL service_handle)
 {
+    if (g_ap_service_impl != nullptr) {
+        ap_budget_controller_stop(g_ap_service_impl);
+        g_ap_service_impl->metrics_exporter.Stop();
+        for (ApThreadCounters* counters : g_ap_service_impl->thread_counters) {
+            delete counters;
+        }
+    }
     delete g_ap_service_impl;
     g_ap_service_impl = nullptr;
+    ApLogFlush();
 }
 
 _agora_ap_processor_config agora_ap_processor_config_create()
@@ -230,6 +633,21 @@ _agora_ap_processor_config agora_ap_processor_config_create()
     config.bghvs_config.bghvsEOSLenInMs = 500;
     config.bghvs_config.bghvsDelayInFrmNums = 12;
     config.bghvs_config.bghvsSppMode = (int)AgoraUAP::AgoraAudioProcessing::BghvsSuppressionMode::kBGHVS_Moderate;
+    // recovery config
+    config.recovery_config.auto_recover = true;
+    config.recovery_config.use_spare_processor = false;
+    // qos config
+    config.qos_config.priority_class = 0;
+    config.qos_config.allow_degradation = true;
+    config.qos_config.expected_sample_rate = 48000;
+    config.qos_config.expected_channels = 1;
+
+    // flight recorder
+    config.flight_recorder_config.enabled = false;
+    config.flight_recorder_config.seconds = 10;
+    config.flight_recorder_config.dir = "./flight/";
+    config.flight_recorder_config.slow_frame_us = 0;
+    config.flight_recorder_config.min_interval_ms = 10000;
  
 
     return config;
@@ -242,33 +660,33 @@ const char* agora_ap_processor_config_get_message(_agora_ap_processor_config *co
     // aec config
     //should map to c++ version define
     /*
-    printf("[APM_TEST]aecconfig:aec enable = %d\n",static_cast<int>(aecConfig.enabled.value()));
-    printf("[APM_TEST]aecconfig:stereoAecEnabled = %d\n",static_cast<int>(aecConfig.stereoAecEnabled.value()));
-    printf("[APM_TEST]aecconfig:enableAecAutoReset = %d\n",static_cast<int>(aecConfig.enableAecAutoReset.value()));    
-    printf("[APM_TEST]aecconfig:aecStartupMaxSuppressTimeInMs = %d\n",aecConfig.aecStartupMaxSuppressTimeInMs.value());   
-    printf("[APM_TEST]aecconfig:filterLength = %d\n",static_cast<int>(aecConfig.filterLength.value())); 
-    printf("[APM_TEST]aecconfig:aecModelType = %d\n",static_cast<int>(aecConfig.aecModelType.value())); 
-    printf("[APM_TEST]aecconfig:aecSuppressionMode = %d\n",static_cast<int>(aecConfig.aecSuppressionMode.value()));   
-    printf("[APM_TEST]aecconfig:aiaecSuppressionMode = %d\n",static_cast<int>(aecConfig.aiaecSuppressionMode.value()));         
+    AP_LOG_INFO("[APM_TEST]aecconfig:aec enable = %d\n",static_cast<int>(aecConfig.enabled.value()));
+    AP_LOG_INFO("[APM_TEST]aecconfig:stereoAecEnabled = %d\n",static_cast<int>(aecConfig.stereoAecEnabled.value()));
+    AP_LOG_INFO("[APM_TEST]aecconfig:enableAecAutoReset = %d\n",static_cast<int>(aecConfig.enableAecAutoReset.value()));    
+    AP_LOG_INFO("[APM_TEST]aecconfig:aecStartupMaxSuppressTimeInMs = %d\n",aecConfig.aecStartupMaxSuppressTimeInMs.value());   
+    AP_LOG_INFO("[APM_TEST]aecconfig:filterLength = %d\n",static_cast<int>(aecConfig.filterLength.value())); 
+    AP_LOG_INFO("[APM_TEST]aecconfig:aecModelType = %d\n",static_cast<int>(aecConfig.aecModelType.value())); 
+    AP_LOG_INFO("[APM_TEST]aecconfig:aecSuppressionMode = %d\n",static_cast<int>(aecConfig.aecSuppressionMode.value()));   
+    AP_LOG_INFO("[APM_TEST]aecconfig:aiaecSuppressionMode = %d\n",static_cast<int>(aecConfig.aiaecSuppressionMode.value()));         
 
     // ans config
-    printf("[APM_TEST]ansconfig:ans enable = %d\n",static_cast<int>(ansConfig.enabled.value()));
-    printf("[APM_TEST]ansconfig:ansModelType = %d\n",static_cast<int>(ansConfig.ansModelType.value()));  
-    printf("[APM_TEST]ansconfig:suppressionMode = %d\n",static_cast<int>(ansConfig.suppressionMode.value()));
-    printf("[APM_TEST]ansconfig:aec enable = %d\n",ansConfig.speechProtectThreshold.value());
+    AP_LOG_INFO("[APM_TEST]ansconfig:ans enable = %d\n",static_cast<int>(ansConfig.enabled.value()));
+    AP_LOG_INFO("[APM_TEST]ansconfig:ansModelType = %d\n",static_cast<int>(ansConfig.ansModelType.value()));  
+    AP_LOG_INFO("[APM_TEST]ansconfig:suppressionMode = %d\n",static_cast<int>(ansConfig.suppressionMode.value()));
+    AP_LOG_INFO("[APM_TEST]ansconfig:aec enable = %d\n",ansConfig.speechProtectThreshold.value());
 
     // agc config
-    printf("[APM_TEST]agcconfig:agc enable = %d\n",static_cast<int>(agcConfig.enabled.value()));
-    printf("[APM_TEST]agcconfig:maxDigitalGaindB = %d\n",agcConfig.maxDigitalGaindB.value());  
-    printf("[APM_TEST]agcconfig:targetleveldB = %d\n",agcConfig.targetleveldB.value());  
-    printf("[APM_TEST]agcconfig:curve_slope = %d\n",agcConfig.curve_slope.value());    
+    AP_LOG_INFO("[APM_TEST]agcconfig:agc enable = %d\n",static_cast<int>(agcConfig.enabled.value()));
+    AP_LOG_INFO("[APM_TEST]agcconfig:maxDigitalGaindB = %d\n",agcConfig.maxDigitalGaindB.value());  
+    AP_LOG_INFO("[APM_TEST]agcconfig:targetleveldB = %d\n",agcConfig.targetleveldB.value());  
+    AP_LOG_INFO("[APM_TEST]agcconfig:curve_slope = %d\n",agcConfig.curve_slope.value());    
 
     // bghvs config
-    printf("[APM_TEST]bgConfig:bgConfig.enabled = %d\n",static_cast<int>(bgConfig.enabled.value()));
-    printf("[APM_TEST]bgConfig:bgConfig.bghvsSOSLenInMs = %d\n",bgConfig.bghvsSOSLenInMs.value());  
-    printf("[APM_TEST]bgConfig:bgConfig.bghvsEOSLenInMs = %d\n",bgConfig.bghvsEOSLenInMs.value());  
-    printf("[APM_TEST]bgConfig:bgConfig.bghvsDelayInFrmNums = %d\n",bgConfig.bghvsDelayInFrmNums.value()); 
-    printf("[APM_TEST]bgConfig:bgConfig.bghvsSppMode = %d\n",static_cast<int>(bgConfig.bghvsSppMode.value()));   
+    AP_LOG_INFO("[APM_TEST]bgConfig:bgConfig.enabled = %d\n",static_cast<int>(bgConfig.enabled.value()));
+    AP_LOG_INFO("[APM_TEST]bgConfig:bgConfig.bghvsSOSLenInMs = %d\n",bgConfig.bghvsSOSLenInMs.value());  
+    AP_LOG_INFO("[APM_TEST]bgConfig:bgConfig.bghvsEOSLenInMs = %d\n",bgConfig.bghvsEOSLenInMs.value());  
+    AP_LOG_INFO("[APM_TEST]bgConfig:bgConfig.bghvsDelayInFrmNums = %d\n",bgConfig.bghvsDelayInFrmNums.value()); 
+    AP_LOG_INFO("[APM_TEST]bgConfig:bgConfig.bghvsSppMode = %d\n",static_cast<int>(bgConfig.bghvsSppMode.value()));   
     */
 
     return "config";
@@ -336,42 +754,191 @@ AgoraUAP::AgoraAudioProcessing::BGHVSCfg mapbghvsconfig(const _agora_ap_processo
     return bghvsConfig;
 }
 
-AGORA_API_C_HDL agora_ap_processor_create(AGORA_API_C_HDL service_handle, const _agora_ap_processor_config& config)
+static bool ap_aec_config_equal(const _agora_ap_aec_config& a, const _agora_ap_aec_config& b)
 {
-    if (service_handle == nullptr || service_handle != g_ap_service_impl || g_ap_service_impl == nullptr) {
-        return nullptr;
+    return a.enabled == b.enabled && a.stereoAecEnabled == b.stereoAecEnabled &&
+           a.enableAecAutoReset == b.enableAecAutoReset &&
+           a.aecStartupMaxSuppressTimeInMs == b.aecStartupMaxSuppressTimeInMs &&
+           a.filterLength == b.filterLength && a.aecModelType == b.aecModelType &&
+           a.aiaecSuppressionMode == b.aiaecSuppressionMode && a.aecSuppressionMode == b.aecSuppressionMode;
+}
+
+static bool ap_ans_config_equal(const _agora_ap_ans_config& a, const _agora_ap_ans_config& b)
+{
+    return a.enabled == b.enabled && a.suppressionMode == b.suppressionMode &&
+           a.ansModelType == b.ansModelType && a.speechProtectThreshold == b.speechProtectThreshold;
+}
+
+static bool ap_agc_config_equal(const _agora_ap_agc_config& a, const _agora_ap_agc_config& b)
+{
+    return a.enabled == b.enabled && a.useAnalogMode == b.useAnalogMode &&
+           a.maxDigitalGaindB == b.maxDigitalGaindB && a.targetleveldB == b.targetleveldB &&
+           a.curve_slope == b.curve_slope;
+}
+
+static bool ap_bghvs_config_equal(const _agora_ap_bghvs_config& a, const _agora_ap_bghvs_config& b)
+{
+    return a.enabled == b.enabled && a.bghvsSOSLenInMs == b.bghvsSOSLenInMs &&
+           a.bghvsEOSLenInMs == b.bghvsEOSLenInMs && a.bghvsSppMode == b.bghvsSppMode &&
+           a.bghvsDelayInFrmNums == b.bghvsDelayInFrmNums;
+}
+
+// |config| with the degradation steps in |mask| applied
+static _agora_ap_processor_config ap_degrade_config(const _agora_ap_processor_config& config, uint32_t mask)
+{
+    _agora_ap_processor_config degraded = config;
+    if (mask & (1u << AGORA_AP_DEGRADE_AI_STD_TO_LL)) {
+        if (degraded.aec_config.aecModelType == (int)AgoraUAP::AgoraAudioProcessing::AecModelType::kSTDAIAEC) {
+            degraded.aec_config.aecModelType = (int)AgoraUAP::AgoraAudioProcessing::AecModelType::kLLAIAEC;
+        }
+        if (degraded.ans_config.ansModelType == (int)AgoraUAP::AgoraAudioProcessing::AnsModelType::kSTDAIANS) {
+            degraded.ans_config.ansModelType = (int)AgoraUAP::AgoraAudioProcessing::AnsModelType::kLLAIANS;
+        }
+    }
+    if (mask & (1u << AGORA_AP_DEGRADE_AI_TO_TRADITIONAL)) {
+        degraded.aec_config.aecModelType = (int)AgoraUAP::AgoraAudioProcessing::AecModelType::kTRAEC;
+        degraded.ans_config.ansModelType = (int)AgoraUAP::AgoraAudioProcessing::AnsModelType::kTRANS;
+    }
+    if (mask & (1u << AGORA_AP_DEGRADE_AGC_OFF)) {
+        degraded.agc_config.enabled = false;
+    }
+    if (mask & (1u << AGORA_AP_DEGRADE_BGHVS_OFF)) {
+        degraded.bghvs_config.enabled = false;
+    }
+    return degraded;
+}
+
+// capture thread only: set the sections of |config| that differ from the applied one
+static void ap_processor_apply_config(struct _agora_ap_processor_impl* processor_impl, const _agora_ap_processor_config& config)
+{
+    AgoraUAP::AgoraAudioProcessing* processor = processor_impl->processor;
+    _agora_ap_processor_config& applied = processor_impl->applied_config;
+    if (!ap_aec_config_equal(applied.aec_config, config.aec_config)) {
+        processor->SetAecConfiguration(mapaecconfig(config));
+    }
+    if (!ap_ans_config_equal(applied.ans_config, config.ans_config)) {
+        processor->SetAnsConfiguration(mapansconfig(config));
     }
+    if (!ap_agc_config_equal(applied.agc_config, config.agc_config)) {
+        processor->SetAgcConfiguration(mapagcconfig(config));
+    }
+    if (!ap_bghvs_config_equal(applied.bghvs_config, config.bghvs_config)) {
+        processor->SetBGHVSConfiguration(mapbghvsconfig(config));
+    }
+    applied = config;
+    if (processor_impl->capture_writer) {
+        processor_impl->capture_writer->WriteConfig(ap_now_ns(), applied);
+    }
+}
 
-    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
-    if (service_impl->is_initialized == false) {
-        return nullptr;
+static ApCostKey ap_cost_key(const _agora_ap_processor_config& config, int sample_rate, int channels)
+{
+    ApCostKey key;
+    key.aec_model = config.aec_config.enabled ? config.aec_config.aecModelType : -1;
+    key.ans_model = config.ans_config.enabled ? config.ans_config.ansModelType : -1;
+    key.sample_rate = sample_rate;
+    key.channels = channels;
+    return key;
+}
+
+static bool ap_cost_key_equal(const ApCostKey& a, const ApCostKey& b)
+{
+    return a.aec_model == b.aec_model && a.ans_model == b.ans_model && a.sample_rate == b.sample_rate && a.channels == b.channels;
+}
+
+// projected cost of one library processor running |key|: what the cost
+// model measured, the admission defaults for a cost it has not measured yet
+static void ap_admission_estimate(_agora_ap_service_impl* service_impl, const ApCostKey& key, long long* cpu_us, long long* memory_bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(service_impl->admission_mutex);
+        *cpu_us = service_impl->admission.default_cpu_us;
+        *memory_bytes = service_impl->admission.default_memory_bytes;
+    }
+    ApCostEstimate estimate;
+    if (service_impl->cost_model.Lookup(key, &estimate)) {
+        if (estimate.cpu_samples > 0) {
+            *cpu_us = (long long)estimate.us_per_frame;
+        }
+        if (estimate.memory_samples > 0) {
+            *memory_bytes = (long long)estimate.bytes;
+        }
     }
+}
 
-    // create processor
-    _agora_ap_processor_impl* processor_impl = new _agora_ap_processor_impl();
-    AgoraUAP::AgoraAudioProcessing* processor =  CreateAgoraAudioProcessing();
-    std::shared_ptr<APHandler> handler = std::make_shared<APHandler>(processor_impl, service_impl->event_handler);
-    if (processor == nullptr) {
+// reserve the projected cost of a new processor, or the extra cost of a
+// live config change if !|new_processor|; may wait with AGORA_AP_ADMISSION_QUEUE
+static bool ap_admission_acquire(_agora_ap_service_impl* service_impl, long long cpu_us, long long memory_bytes, bool new_processor = true)
+{
+    std::unique_lock<std::mutex> lock(service_impl->admission_mutex);
+    const _agora_ap_admission_config& admission = service_impl->admission;
+    auto fits = [service_impl, &admission, cpu_us, memory_bytes]() {
+        return (admission.max_cpu_us <= 0 || service_impl->committed_cpu_us + cpu_us <= admission.max_cpu_us) &&
+               (admission.max_memory_bytes <= 0 || service_impl->committed_memory_bytes + memory_bytes <= admission.max_memory_bytes);
+    };
+
+    if (admission.policy != AGORA_AP_ADMISSION_OFF && !fits()) {
+        // waiting is pointless if it would not fit on an empty host
+        bool never_fits = (admission.max_cpu_us > 0 && cpu_us > admission.max_cpu_us) ||
+                          (admission.max_memory_bytes > 0 && memory_bytes > admission.max_memory_bytes);
+        if (admission.policy != AGORA_AP_ADMISSION_QUEUE || never_fits) {
+            service_impl->refused_count++;
+            return false;
+        }
+        service_impl->queued_count++;
+        service_impl->waiting_count++;
+        uint64_t wait_begin_ns = ap_now_ns();
+        bool admitted = service_impl->admission_cond.wait_for(lock, std::chrono::milliseconds(admission.queue_timeout_ms), fits);
+        service_impl->waiting_count--;
+        if (ApTraceEnabled()) {
+            ApTraceSpan("admission_wait", wait_begin_ns, ap_now_ns(), admitted ? 1 : 0);
+        }
+        if (!admitted) {
+            service_impl->refused_count++;
+            return false;
+        }
+    }
+    service_impl->committed_cpu_us += cpu_us;
+    service_impl->committed_memory_bytes += memory_bytes;
+    if (new_processor) {
+        service_impl->admitted_count++;
+    }
+    return true;
+}
 
-        //should close
+static void ap_admission_release(_agora_ap_service_impl* service_impl, long long cpu_us, long long memory_bytes)
+{
+    std::lock_guard<std::mutex> lock(service_impl->admission_mutex);
+    service_impl->committed_cpu_us -= cpu_us;
+    service_impl->committed_memory_bytes -= memory_bytes;
+    service_impl->admission_cond.notify_all();
+}
 
+// create a library processor and apply the service models and the config to it
+// |timing| may be nullptr
+static AgoraUAP::AgoraAudioProcessing* create_configured_processor(_agora_ap_service_impl* service_impl, const _agora_ap_processor_config& config, APHandler* handler, _agora_ap_create_timing* timing)
+{
+    uint64_t create_begin_us = ap_now_us();
+    AgoraUAP::AgoraAudioProcessing* processor =  CreateAgoraAudioProcessing();
+    if (processor == nullptr) {
         return nullptr;
     }
-    processor_impl->processor = processor;
-    processor_impl->handler = handler;
+    uint64_t init_begin_us = ap_now_us();
 
     const char* APPID = service_impl->config.app_id;
     const char* LICENSE = service_impl->config.license;
    
 
     // init processor
-    int ret = processor->Init(AgoraUAP::AgoraAudioProcessing::UapConfig(APPID, LICENSE, handler.get()));
+    int ret = processor->Init(AgoraUAP::AgoraAudioProcessing::UapConfig(APPID, LICENSE, handler));
+    uint64_t model_begin_us = ap_now_us();
     
     // set ai model resource
     processor->SetAIModelResource(service_impl->ains_model_config);
     processor->SetAIModelResource(service_impl->ainsll_model_config);
     processor->SetAIModelResource(service_impl->ainlp_model_config);
     processor->SetAIModelResource(service_impl->ainlpll_model_config);
+    uint64_t config_begin_us = ap_now_us();
 
     // Must map c type to c++
     AgoraUAP::AgoraAudioProcessing::AecConfig aec_config;
@@ -392,13 +959,267 @@ AGORA_API_C_HDL agora_ap_processor_create(AGORA_API_C_HDL service_handle, const
     ret = processor->SetAgcConfiguration(agc_config);
     ret = processor->SetBGHVSConfiguration(bghvs_config);
 
-    //dump option
-    AgoraUAP::AgoraAudioProcessing::DumpOption dumpOption(true, "./dump/"); //directory
-    ret = processor->EnableDataDump(dumpOption);
+    // data dump is off until agora_ap_processor_set_dump
+
+    if (timing != nullptr) {
+        uint64_t end_us = ap_now_us();
+        timing->create_us = (long long)(init_begin_us - create_begin_us);
+        timing->init_us = (long long)(model_begin_us - init_begin_us);
+        timing->model_resource_us = (long long)(config_begin_us - model_begin_us);
+        timing->config_us = (long long)(end_us - config_begin_us);
+    }
+
+    return processor;
+}
+
+AGORA_API_C_HDL agora_ap_processor_create(AGORA_API_C_HDL service_handle, const _agora_ap_processor_config& config)
+{
+    if (service_handle == nullptr || service_handle != g_ap_service_impl || g_ap_service_impl == nullptr) {
+        return nullptr;
+    }
+
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    if (service_impl->is_initialized == false) {
+        return nullptr;
+    }
+    uint64_t create_begin_us = ap_now_us();
+
+    // admission control, the projected cost comes from the cost model
+    ApCostKey cost_key = ap_cost_key(config, config.qos_config.expected_sample_rate, config.qos_config.expected_channels);
+    long long cpu_us = 0;
+    long long memory_bytes = 0;
+    ap_admission_estimate(service_impl, cost_key, &cpu_us, &memory_bytes);
+    int processor_count = config.recovery_config.auto_recover && config.recovery_config.use_spare_processor ? 2 : 1;
+    if (!ap_admission_acquire(service_impl, cpu_us, memory_bytes * processor_count)) {
+        AP_LOG_WARNING("agora_ap_processor_create: refused by admission control, cpu %lld us, memory %lld bytes\n", cpu_us, memory_bytes * processor_count);
+        return nullptr;
+    }
+    size_t rss_before = ApReadRssBytes();
+    long long wrapper_before = ApMemoryGetUsage().bytes;
+
+    // create processor
+    _agora_ap_processor_impl* processor_impl = new _agora_ap_processor_impl();
+    std::shared_ptr<APHandler> handler = std::make_shared<APHandler>(processor_impl, service_impl->event_handler);
+    processor_impl->service = service_impl;
+    processor_impl->id = ++g_ap_processor_id;
+    processor_impl->cost_key = cost_key;
+    processor_impl->reserved_cpu_us = cpu_us;
+    processor_impl->reserved_memory_bytes = memory_bytes * processor_count;
+    processor_impl->recovery_config = config.recovery_config;
+    processor_impl->qos_config = config.qos_config;
+    processor_impl->config = config;
+    processor_impl->applied_config = config;
+    processor_impl->spare_config = config;
+    processor_impl->handler = handler;
+
+    // before the processor can report events
+    const _agora_ap_flight_recorder_config& flight_config = config.flight_recorder_config;
+    if (flight_config.enabled && flight_config.seconds > 0 && flight_config.dir != nullptr) {
+        char name[32];
+        snprintf(name, sizeof(name), "ap%u", processor_impl->id);
+        // the hints are not a limit, size for the largest frame the library takes
+        size_t frame_bytes = (size_t)std::max(config.qos_config.expected_sample_rate, 48000) / 100 *
+                             std::max(config.qos_config.expected_channels, 2) * 2;
+        processor_impl->flight_recorder = ApFlightRecorder::Create(flight_config.seconds * 100, frame_bytes,
+            flight_config.dir, name, flight_config.min_interval_ms);
+        processor_impl->flight_slow_frame_ns = (uint64_t)std::max(flight_config.slow_frame_us, 0) * 1000;
+    }
+
+    AgoraUAP::AgoraAudioProcessing* processor = create_configured_processor(service_impl, config, handler.get(), &processor_impl->create_timing);
+    if (processor == nullptr) {
+        ap_admission_release(service_impl, cpu_us, memory_bytes * processor_count);
+        delete processor_impl;
+        return nullptr;
+    }
+    processor_impl->processor = processor;
+    // rough, other threads allocate at the same time
+    size_t rss_after = ApReadRssBytes();
+    if (rss_after > rss_before) {
+        service_impl->cost_model.Observe(cost_key, 0, (double)(rss_after - rss_before));
+    }
+
+    // the spare shares the handler, its events are reported for this processor
+    if (config.recovery_config.auto_recover && config.recovery_config.use_spare_processor) {
+        uint64_t spare_begin_us = ap_now_us();
+        processor_impl->spare_processor = create_configured_processor(service_impl, config, handler.get(), nullptr);
+        processor_impl->has_spare = processor_impl->spare_processor != nullptr;
+        processor_impl->spare_ready = processor_impl->spare_processor != nullptr;
+        processor_impl->create_timing.spare_us = (long long)(ap_now_us() - spare_begin_us);
+    }
+    processor_impl->create_timing.total_us = (long long)(ap_now_us() - create_begin_us);
+    processor_impl->create_rss_bytes = (long long)ApReadRssBytes() - (long long)rss_before;
+    processor_impl->create_wrapper_bytes = ApMemoryGetUsage().bytes - wrapper_before;
 
+    {
+        std::lock_guard<std::mutex> lock(service_impl->processors_mutex);
+        service_impl->processors.push_back(processor_impl);
+    }
 
     return processor_impl;
 }
+
+// run at a frame boundary on the capture thread: swap in the spare processor if it is
+// ready, else fall back to an inline Reset()
+static void ap_processor_recover(_agora_ap_processor_impl* processor_impl)
+{
+    uint64_t begin_us = ap_now_us();
+
+    if (processor_impl->spare_processor != nullptr && processor_impl->spare_ready.load(std::memory_order_acquire)) {
+        AgoraUAP::AgoraAudioProcessing* broken = processor_impl->processor;
+        processor_impl->processor = processor_impl->spare_processor;
+        processor_impl->spare_processor = broken;
+        processor_impl->spare_ready.store(false, std::memory_order_relaxed);
+        processor_impl->spare_resetting.store(true, std::memory_order_relaxed);
+        processor_impl->spare_swap_count.fetch_add(1, std::memory_order_relaxed);
+
+        // the spare may lag behind degradation changes made since it was configured
+        std::swap(processor_impl->applied_config, processor_impl->spare_config);
+        ap_processor_apply_config(processor_impl, processor_impl->spare_config);
+
+        // the library dump follows the active processor
+        bool library_dump = processor_impl->library_dump_enabled;
+        if (library_dump) {
+            processor_impl->processor->EnableDataDump(
+                AgoraUAP::AgoraAudioProcessing::DumpOption(true, processor_impl->library_dump_dir.c_str()));
+        }
+
+        processor_impl->service->task_runner.Post([processor_impl, broken, library_dump]() {
+            uint64_t reset_begin_us = ap_now_us();
+            if (library_dump) {
+                broken->EnableDataDump(AgoraUAP::AgoraAudioProcessing::DumpOption(false, nullptr));
+            }
+            broken->Reset();
+            processor_impl->last_spare_reset_us.store(ap_now_us() - reset_begin_us, std::memory_order_relaxed);
+            processor_impl->spare_ready.store(true, std::memory_order_release);
+            processor_impl->spare_resetting.store(false, std::memory_order_release);
+        });
+    } else {
+        processor_impl->processor->Reset();
+    }
+
+    uint64_t cost_us = ap_now_us() - begin_us;
+    ApThreadCounters::Bump(ap_thread_counters(processor_impl->service)->recoveries);
+    processor_impl->recovery_count.fetch_add(1, std::memory_order_relaxed);
+    processor_impl->last_recovery_us.store(cost_us, std::memory_order_relaxed);
+    processor_impl->total_recovery_us.fetch_add(cost_us, std::memory_order_relaxed);
+    if (cost_us > processor_impl->max_recovery_us.load(std::memory_order_relaxed)) {
+        processor_impl->max_recovery_us.store(cost_us, std::memory_order_relaxed);
+    }
+}
+
+// apply the request of agora_ap_processor_set_dump, capture thread only
+static void ap_processor_apply_dump(_agora_ap_processor_impl* processor_impl)
+{
+    _agora_ap_dump_config request;
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> lock(processor_impl->dump_mutex);
+        request = processor_impl->dump_request;
+        dir = processor_impl->dump_request_dir;
+    }
+
+    if (request.library_dump != processor_impl->library_dump_enabled ||
+        (request.library_dump && dir != processor_impl->library_dump_dir)) {
+        if (processor_impl->library_dump_enabled) {
+            processor_impl->processor->EnableDataDump(AgoraUAP::AgoraAudioProcessing::DumpOption(false, nullptr));
+        }
+        processor_impl->library_dump_enabled = false;
+        if (request.library_dump) {
+            processor_impl->library_dump_dir = dir;
+            int ret = processor_impl->processor->EnableDataDump(
+                AgoraUAP::AgoraAudioProcessing::DumpOption(true, processor_impl->library_dump_dir.c_str()));
+            processor_impl->library_dump_enabled = ret == 0;
+            if (ret != 0) {
+                AP_LOG_ERROR("EnableDataDump %s failed: %d\n", dir, ret);
+            }
+        }
+    }
+
+    std::shared_ptr<ApDumpWriter> writer;
+    if (request.wrapper_dump) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "ap%u_%ld", processor_impl->id, (long)time(NULL));
+        writer = ApDumpWriter::Create(dir, prefix, (size_t)request.buffer_bytes, request.max_file_bytes,
+                                      request.max_files, processor_impl->dump_counters);
+    }
+    std::shared_ptr<ApDumpWriter> old_writer;
+    {
+        std::lock_guard<std::mutex> lock(processor_impl->dump_mutex);
+        old_writer = processor_impl->dump_writer;
+        processor_impl->dump_writer = writer;
+    }
+    if (old_writer) {
+        old_writer->Close();
+    }
+}
+
+// apply the request of agora_ap_processor_start/stop_capture, capture thread only
+static void ap_processor_apply_capture(_agora_ap_processor_impl* processor_impl)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(processor_impl->capture_mutex);
+        path = processor_impl->capture_request_path;
+    }
+    if (processor_impl->capture_writer) {
+        processor_impl->capture_writer->Close();
+        processor_impl->capture_writer = nullptr;
+    }
+    if (!path.empty()) {
+        processor_impl->capture_writer = ApCaptureWriter::Create(path, processor_impl->id, 1024 * 1024);
+        if (processor_impl->capture_writer) {
+            processor_impl->capture_writer->WriteConfig(ap_now_ns(), processor_impl->applied_config);
+        }
+    }
+}
+
+// capture thread only: apply the config last published by agora_ap_processor_set_config
+static void ap_processor_take_config(_agora_ap_processor_impl* processor_impl)
+{
+    _agora_ap_processor_config published;
+    uint64_t version = 0;
+    if (!processor_impl->config_slot.Take(&published, &version)) {
+        return;
+    }
+    // only the algorithm sections change at runtime, the rest stays as created
+    _agora_ap_processor_config& config = processor_impl->config;
+    config.aec_config = published.aec_config;
+    config.ans_config = published.ans_config;
+    config.agc_config = published.agc_config;
+    config.bghvs_config = published.bghvs_config;
+    // the degradation in force still applies on top
+    ap_processor_apply_config(processor_impl, ap_degrade_config(config, processor_impl->applied_degrade_mask));
+    processor_impl->config_version.store(version, std::memory_order_relaxed);
+    processor_impl->config_changes.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void ap_processor_run_pending_ops(_agora_ap_processor_impl* processor_impl)
+{
+    uint32_t pending = processor_impl->pending_ops.exchange(0, std::memory_order_acquire);
+    if (pending & kPendingRecovery) {
+        ap_processor_recover(processor_impl);
+    } else if (pending & kPendingReset) {
+        // a recovery resets or swaps in a reset spare already
+        processor_impl->processor->Reset();
+    }
+    if (pending & kPendingConfig) {
+        ap_processor_take_config(processor_impl);
+    }
+    if (pending & kPendingDegrade) {
+        uint32_t mask = processor_impl->degrade_mask.load(std::memory_order_acquire);
+        if (mask != processor_impl->applied_degrade_mask) {
+            ap_processor_apply_config(processor_impl, ap_degrade_config(processor_impl->config, mask));
+            processor_impl->applied_degrade_mask = mask;
+        }
+    }
+    if (pending & kPendingDump) {
+        ap_processor_apply_dump(processor_impl);
+    }
+    if (pending & kPendingCapture) {
+        ap_processor_apply_capture(processor_impl);
+    }
+}
+
 AGORA_API_C_INT agora_ap_processor_release(AGORA_API_C_HDL processor_handle)
 {
     if (processor_handle == nullptr ) {
@@ -408,6 +1229,49 @@ AGORA_API_C_INT agora_ap_processor_release(AGORA_API_C_HDL processor_handle)
     if (processor_impl->processor == nullptr) {
         return -2;
     }
+    if (processor_impl->service) {
+        _agora_ap_service_impl* service_impl = processor_impl->service;
+        {
+            std::lock_guard<std::mutex> lock(service_impl->processors_mutex);
+            std::vector<_agora_ap_processor_impl*>& processors = service_impl->processors;
+            processors.erase(std::remove(processors.begin(), processors.end(), processor_impl), processors.end());
+        }
+        // refine the cost model with what the stream really cost: under the
+        // config it ran, and under the key admission looks up for the next
+        // create with the same hints and config unless it ran degraded
+        if (processor_impl->stats.frames.load(std::memory_order_relaxed) >= 100) {
+            double cost_us = processor_impl->avg_frame_cost_us.load(std::memory_order_relaxed);
+            ApCostKey key = ap_cost_key(processor_impl->applied_config, processor_impl->stream_sample_rate, processor_impl->stream_channels);
+            service_impl->cost_model.Observe(key, cost_us, 0);
+            std::lock_guard<std::mutex> lock(processor_impl->config_mutex);
+            if (!ap_cost_key_equal(key, processor_impl->cost_key) &&
+                processor_impl->degrade_level.load(std::memory_order_relaxed) == 0) {
+                service_impl->cost_model.Observe(processor_impl->cost_key, cost_us, 0);
+            }
+        }
+        ap_admission_release(service_impl, processor_impl->reserved_cpu_us, processor_impl->reserved_memory_bytes);
+    }
+    // wait for a background Reset() of the spare, it still uses processor_impl
+    while (processor_impl->spare_resetting.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (processor_impl->spare_processor) {
+        processor_impl->spare_processor->Release();
+        processor_impl->spare_processor = nullptr;
+        processor_impl->has_spare.store(false, std::memory_order_relaxed);
+    }
+    // the library dump files are only complete once dumping is disabled
+    if (processor_impl->library_dump_enabled) {
+        processor_impl->processor->EnableDataDump(AgoraUAP::AgoraAudioProcessing::DumpOption(false, nullptr));
+    }
+    if (processor_impl->dump_writer) {
+        processor_impl->dump_writer->Close();
+        processor_impl->dump_writer = nullptr;
+    }
+    if (processor_impl->capture_writer) {
+        processor_impl->capture_writer->Close();
+        processor_impl->capture_writer = nullptr;
+    }
     processor_impl->processor->Release();
     processor_impl->processor = nullptr;
     processor_impl->handler = nullptr;
@@ -435,9 +1299,27 @@ AGORA_API_C_INT agora_ap_processor_process_stream(AGORA_API_C_HDL processor_hand
         return -2;
     }
 
+    // read once, all spans of the frame are recorded in one branch at the end
+    const bool tracing = ApTraceEnabled();
+    uint64_t begin_ns = ap_now_ns();
+
+    // one load per frame in the common case, nothing pending
+    bool ran_pending_ops = false;
+    if (processor_impl->pending_ops.load(std::memory_order_relaxed) != 0) {
+        ap_processor_run_pending_ops(processor_impl);
+        ran_pending_ops = true;
+    }
+    processor_impl->stream_sample_rate = frame->sampleRate;
+    processor_impl->stream_channels = frame->channels;
+
+    int stream_delay_ms = processor_impl->stream_delay_ms.load(std::memory_order_relaxed);
+    int stream_analog_level = processor_impl->stream_analog_level.load(std::memory_order_relaxed);
+
     int ret = 0;
-    ret = processor_impl->processor->SetStreamDelayMs(60);
-    ret = processor_impl->processor->SetStreamAnalogLevel(0);
+    uint64_t delay_begin_ns = ap_now_ns();
+    ret = processor_impl->processor->SetStreamDelayMs(stream_delay_ms);
+    uint64_t analog_begin_ns = ap_now_ns();
+    ret = processor_impl->processor->SetStreamAnalogLevel(stream_analog_level);
   
   
     //check ref_frame is nullptr, use mute frame as ref_frame
@@ -453,9 +1335,1046 @@ AGORA_API_C_INT agora_ap_processor_process_stream(AGORA_API_C_HDL processor_hand
     AgoraUAP::AgoraAudioFrame* agora_frame = reinterpret_cast<AgoraUAP::AgoraAudioFrame*>(frame);
     AgoraUAP::AgoraAudioFrame* agora_ref_frame = reinterpret_cast<AgoraUAP::AgoraAudioFrame*>(ref_frame);
 
-    ret = processor_impl->processor->ProcessReverseStream(agora_ref_frame);
+    // the near input is copied before ProcessStream overwrites it
+    ApDumpWriter* dump_writer = processor_impl->dump_writer.get();
+    if (dump_writer != nullptr) {
+        dump_writer->Write(ApDumpWriter::kNear, frame->sampleRate, frame->channels, frame->buffer,
+                           (size_t)frame->channels * frame->samplesPerChannel * frame->bytesPerSample);
+        dump_writer->Write(ApDumpWriter::kRef, ref_frame->sampleRate, ref_frame->channels, ref_frame->buffer,
+                           (size_t)ref_frame->channels * ref_frame->samplesPerChannel * ref_frame->bytesPerSample);
+    }
+    if (processor_impl->capture_writer) {
+        processor_impl->capture_writer->WriteFrame(begin_ns, processor_impl->stats.frames.load(std::memory_order_relaxed),
+                                                   stream_delay_ms, stream_analog_level, frame, ref_frame);
+    }
+    ApFlightRecorder* flight_recorder = processor_impl->flight_recorder.get();
+    if (flight_recorder != nullptr) {
+        flight_recorder->BeginFrame(frame, ref_frame);
+    }
+
+    // without stereo AEC one reference channel is all the canceller uses, mixing down
+    // here spares the library the stereo reverse stream
+    if (ref_frame->channels > 1 && !processor_impl->applied_config.aec_config.stereoAecEnabled) {
+        size_t samples = (size_t)ref_frame->samplesPerChannel;
+        if (processor_impl->ref_downmix.size() < samples) {
+            processor_impl->ref_downmix.resize(samples);
+        }
+        ApMixDownmixToMono(static_cast<const int16_t*>(ref_frame->buffer), ref_frame->channels,
+                           ref_frame->samplesPerChannel, processor_impl->ref_downmix.data());
+        AgoraUAP::AgoraAudioFrame& mono = processor_impl->ref_downmix_frame;
+        mono.sampleRate = ref_frame->sampleRate;
+        mono.channels = 1;
+        mono.samplesPerChannel = ref_frame->samplesPerChannel;
+        mono.buffer = processor_impl->ref_downmix.data();
+        agora_ref_frame = &mono;
+    }
+
+    uint64_t reverse_begin_ns = ap_now_ns();
+    int reverse_ret = processor_impl->processor->ProcessReverseStream(agora_ref_frame);
+    uint64_t stream_begin_ns = ap_now_ns();
     ret = processor_impl->processor->ProcessStream(agora_frame);
-    return ret;
+    uint64_t end_ns = ap_now_ns();
+
+    if (flight_recorder != nullptr) {
+        ApFlightFrameTiming timing;
+        timing.begin_ns = begin_ns;
+        timing.reverse_ns = (uint32_t)(stream_begin_ns - reverse_begin_ns);
+        timing.stream_ns = (uint32_t)(end_ns - stream_begin_ns);
+        timing.total_ns = (uint32_t)(end_ns - begin_ns);
+        timing.ret = ret;
+        timing.reverse_ret = reverse_ret;
+        flight_recorder->EndFrame(frame, timing);
+        if (processor_impl->flight_slow_frame_ns != 0 && end_ns - begin_ns > processor_impl->flight_slow_frame_ns) {
+            flight_recorder->Trigger("slow_frame");
+        }
+    }
+    if (dump_writer != nullptr) {
+        dump_writer->Write(ApDumpWriter::kOut, frame->sampleRate, frame->channels, frame->buffer,
+                           (size_t)frame->channels * frame->samplesPerChannel * frame->bytesPerSample);
+    }
+
+    ApProcessorStats& stats = processor_impl->stats;
+    uint64_t frames = stats.frames.load(std::memory_order_relaxed) + 1;
+    // GetState once per second of audio, outside of the write section
+    AgoraUAP::AgoraAudioProcessing::State state;
+    bool state_ok = frames % 100 == 1 && processor_impl->processor->GetState(state, frame->sampleRate) == 0;
+
+    stats.lock.BeginWrite();
+    stats.frames.store(frames, std::memory_order_relaxed);
+    stats.process_reverse_stream.Record(stream_begin_ns - reverse_begin_ns);
+    stats.process_stream.Record(end_ns - stream_begin_ns);
+    stats.total.Record(end_ns - begin_ns);
+    if (reverse_ret < 0) {
+        stats.reverse_stream_errors.store(stats.reverse_stream_errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    if (ret < 0) {
+        stats.stream_errors.store(stats.stream_errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    if (state_ok) {
+        stats.algorithm_latency_ms.store(state.algorithmLatency.value_or(0u), std::memory_order_relaxed);
+        stats.algorithm_latency_sp.store(state.algorithmLatency_sp.value_or(0u), std::memory_order_relaxed);
+        stats.aec_estimated_delay_ms.store(state.aecEstimatedDelay.value_or(0u), std::memory_order_relaxed);
+    }
+    stats.lock.EndWrite();
+    if (frames == 1) {
+        processor_impl->first_frame_us.store((long long)((end_ns - begin_ns) / 1000), std::memory_order_relaxed);
+    }
+
+    ApThreadCounters* counters = ap_thread_counters(processor_impl->service);
+    counters->frame_cost.Record(end_ns - begin_ns);
+    ApThreadCounters::Bump(counters->frames);
+    if (ret < 0 || reverse_ret < 0) {
+        ApThreadCounters::Bump(counters->errors);
+    }
+
+    // frame cost average for the cpu budget controller, 1/16 weight for the new frame
+    uint32_t cost_us = (uint32_t)((end_ns - begin_ns) / 1000);
+    processor_impl->frame_cost_ewma_q4 += cost_us - (processor_impl->frame_cost_ewma_q4 >> 4);
+    processor_impl->avg_frame_cost_us.store(processor_impl->frame_cost_ewma_q4 >> 4, std::memory_order_relaxed);
+    processor_impl->last_frame_us.store(end_ns / 1000, std::memory_order_relaxed);
+
+    if (tracing) {
+        uint64_t done_ns = ap_now_ns();
+        uint32_t id = processor_impl->id;
+        if (ran_pending_ops) {
+            ApTraceSpan("pending_ops", begin_ns, delay_begin_ns, id);
+        }
+        ApTraceSpan("SetStreamDelayMs", delay_begin_ns, analog_begin_ns, id);
+        ApTraceSpan("SetStreamAnalogLevel", analog_begin_ns, reverse_begin_ns, id);
+        ApTraceSpan("ProcessReverseStream", reverse_begin_ns, stream_begin_ns, id);
+        ApTraceSpan("ProcessStream", stream_begin_ns, end_ns, id);
+        ApTraceSpan("record_stats", end_ns, done_ns, id);
+        ApTraceSpan("agora_ap_processor_process_stream", begin_ns, done_ns, id);
+        uint64_t anomaly_frame_ns = ApTraceAnomalyFrameNs();
+        if (anomaly_frame_ns != 0 && done_ns - begin_ns > anomaly_frame_ns) {
+            ApTraceAnomaly("slow_frame");
+        }
+    }
+    return ret;
+}
+
+AGORA_API_C_INT agora_ap_processor_get_recovery_stats(AGORA_API_C_HDL processor_handle, _agora_ap_recovery_stats* stats)
+{
+    if (processor_handle == nullptr || stats == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    stats->malfunction_events = processor_impl->malfunction_events.load(std::memory_order_relaxed);
+    stats->recovery_count = processor_impl->recovery_count.load(std::memory_order_relaxed);
+    stats->spare_swap_count = processor_impl->spare_swap_count.load(std::memory_order_relaxed);
+    stats->last_recovery_us = processor_impl->last_recovery_us.load(std::memory_order_relaxed);
+    stats->max_recovery_us = processor_impl->max_recovery_us.load(std::memory_order_relaxed);
+    stats->total_recovery_us = processor_impl->total_recovery_us.load(std::memory_order_relaxed);
+    stats->last_spare_reset_us = processor_impl->last_spare_reset_us.load(std::memory_order_relaxed);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_get_create_timing(AGORA_API_C_HDL processor_handle, _agora_ap_create_timing* timing)
+{
+    if (processor_handle == nullptr || timing == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    *timing = processor_impl->create_timing;
+    timing->first_frame_us = processor_impl->first_frame_us.load(std::memory_order_relaxed);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_get_memory(AGORA_API_C_HDL processor_handle, _agora_ap_processor_memory* memory)
+{
+    if (processor_handle == nullptr || memory == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    memory->create_rss_bytes = processor_impl->create_rss_bytes;
+    memory->create_wrapper_bytes = processor_impl->create_wrapper_bytes;
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_get_degrade_level(AGORA_API_C_HDL processor_handle)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    return processor_impl->degrade_level.load(std::memory_order_relaxed);
+}
+
+_agora_ap_cpu_budget_config agora_ap_cpu_budget_config_create()
+{
+    _agora_ap_cpu_budget_config config;
+    config.enabled = false;
+    config.budget_us = 10000 * (int)std::max(1u, std::thread::hardware_concurrency()) * 7 / 10;
+    config.high_watermark = 90;
+    config.low_watermark = 60;
+    config.hold_ms = 3000;
+    config.interval_ms = 200;
+    config.ladder[0] = AGORA_AP_DEGRADE_AI_STD_TO_LL;
+    config.ladder[1] = AGORA_AP_DEGRADE_AI_TO_TRADITIONAL;
+    config.ladder[2] = AGORA_AP_DEGRADE_AGC_OFF;
+    config.ladder[3] = AGORA_AP_DEGRADE_BGHVS_OFF;
+    config.ladder_length = 4;
+    return config;
+}
+
+// controller side: publish a new level, the capture thread applies it at the next frame
+static void ap_processor_set_degrade_level(_agora_ap_processor_impl* processor_impl, int level, const _agora_ap_cpu_budget_config& budget)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < level && i < budget.ladder_length; i++) {
+        mask |= 1u << budget.ladder[i];
+    }
+    processor_impl->degrade_level.store(level, std::memory_order_relaxed);
+    processor_impl->degrade_mask.store(mask, std::memory_order_release);
+    processor_impl->pending_ops.fetch_or(kPendingDegrade, std::memory_order_release);
+}
+
+// The frame cost average keeps 15/16 of the old cost per frame, so a step
+// shows in the load after ~48 frames (95%). Stepping down again before then
+// would act on the cost the last step already removed.
+static const uint64_t kBudgetSettleUs = 500 * 1000;
+// a frame gap up to this is capture jitter, the stream still runs at full cost
+static const uint64_t kBudgetFrameGapUs = 20 * 1000;
+
+// load of one stream: its frame cost average while it runs, fading out as its
+// frames stop coming, none once it had no frame for kBudgetSettleUs
+static uint64_t ap_budget_stream_load_us(const _agora_ap_processor_impl* processor_impl, uint64_t now_us)
+{
+    uint64_t last_frame_us = processor_impl->last_frame_us.load(std::memory_order_relaxed);
+    uint64_t idle_us = now_us > last_frame_us ? now_us - last_frame_us : 0;
+    if (last_frame_us == 0 || idle_us >= kBudgetSettleUs) {
+        return 0;
+    }
+    uint64_t cost_us = processor_impl->avg_frame_cost_us.load(std::memory_order_relaxed);
+    if (idle_us <= kBudgetFrameGapUs) {
+        return cost_us;
+    }
+    return cost_us * (kBudgetSettleUs - idle_us) / (kBudgetSettleUs - kBudgetFrameGapUs);
+}
+
+// one controller evaluation: step at most one stream down or up
+static void ap_budget_controller_evaluate(_agora_ap_service_impl* service_impl, const _agora_ap_cpu_budget_config& budget,
+                                          uint64_t* below_since_us, uint64_t* stepped_at_us)
+{
+    std::lock_guard<std::mutex> lock(service_impl->processors_mutex);
+
+    uint64_t now_us = ap_now_us();
+    uint64_t load_us = 0;
+    for (_agora_ap_processor_impl* processor_impl : service_impl->processors) {
+        load_us += ap_budget_stream_load_us(processor_impl, now_us);
+    }
+    uint64_t high_us = (uint64_t)budget.budget_us * budget.high_watermark / 100;
+    uint64_t low_us = (uint64_t)budget.budget_us * budget.low_watermark / 100;
+
+    if (load_us > high_us) {
+        *below_since_us = 0;
+        if (*stepped_at_us != 0 && now_us - *stepped_at_us < kBudgetSettleUs) {
+            return;
+        }
+        // lowest priority class first, the most expensive stream of that class;
+        // degrading a stream that adds nothing to the load would not lower it
+        _agora_ap_processor_impl* victim = nullptr;
+        uint64_t victim_load_us = 0;
+        for (_agora_ap_processor_impl* processor_impl : service_impl->processors) {
+            uint64_t stream_load_us = ap_budget_stream_load_us(processor_impl, now_us);
+            if (!processor_impl->qos_config.allow_degradation || stream_load_us == 0 ||
+                processor_impl->degrade_level.load(std::memory_order_relaxed) >= budget.ladder_length) {
+                continue;
+            }
+            if (victim == nullptr ||
+                processor_impl->qos_config.priority_class < victim->qos_config.priority_class ||
+                (processor_impl->qos_config.priority_class == victim->qos_config.priority_class &&
+                 stream_load_us > victim_load_us)) {
+                victim = processor_impl;
+                victim_load_us = stream_load_us;
+            }
+        }
+        if (victim) {
+            ap_processor_set_degrade_level(victim, victim->degrade_level.load(std::memory_order_relaxed) + 1, budget);
+            *stepped_at_us = now_us;
+        }
+    } else if (load_us < low_us) {
+        if (*below_since_us == 0) {
+            *below_since_us = now_us;
+            return;
+        }
+        if (now_us - *below_since_us < (uint64_t)budget.hold_ms * 1000) {
+            return;
+        }
+        // highest priority class first; the hold restarts so step ups stay hold_ms apart
+        *below_since_us = now_us;
+        _agora_ap_processor_impl* restored = nullptr;
+        for (_agora_ap_processor_impl* processor_impl : service_impl->processors) {
+            if (processor_impl->degrade_level.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            if (restored == nullptr || processor_impl->qos_config.priority_class > restored->qos_config.priority_class) {
+                restored = processor_impl;
+            }
+        }
+        if (restored) {
+            ap_processor_set_degrade_level(restored, restored->degrade_level.load(std::memory_order_relaxed) - 1, budget);
+            *stepped_at_us = now_us;
+        }
+    } else {
+        *below_since_us = 0;
+    }
+}
+
+static void ap_budget_controller_run(_agora_ap_service_impl* service_impl)
+{
+    uint64_t below_since_us = 0;
+    uint64_t stepped_at_us = 0;
+    std::unique_lock<std::mutex> lock(service_impl->budget_mutex);
+    while (!service_impl->budget_stop) {
+        service_impl->budget_cond.wait_for(lock, std::chrono::milliseconds(service_impl->cpu_budget.interval_ms));
+        if (service_impl->budget_stop) {
+            break;
+        }
+        ap_budget_controller_evaluate(service_impl, service_impl->cpu_budget, &below_since_us, &stepped_at_us);
+    }
+}
+
+static void ap_budget_controller_stop(_agora_ap_service_impl* service_impl)
+{
+    {
+        std::lock_guard<std::mutex> lock(service_impl->budget_mutex);
+        service_impl->budget_stop = true;
+        service_impl->budget_cond.notify_one();
+    }
+    if (service_impl->budget_thread.joinable()) {
+        service_impl->budget_thread.join();
+    }
+}
+
+AGORA_API_C_INT agora_ap_service_set_cpu_budget(AGORA_API_C_HDL service_handle, const _agora_ap_cpu_budget_config* config)
+{
+    if (!service_handle || service_handle != g_ap_service_impl || config == nullptr) {
+        return -1;
+    }
+    if (config->ladder_length < 0 || config->ladder_length > AGORA_AP_MAX_DEGRADE_STEPS ||
+        config->budget_us <= 0 || config->interval_ms <= 0 || config->low_watermark > config->high_watermark) {
+        return -2;
+    }
+    for (int i = 0; i < config->ladder_length; i++) {
+        if (config->ladder[i] < AGORA_AP_DEGRADE_AI_STD_TO_LL || config->ladder[i] > AGORA_AP_DEGRADE_BGHVS_OFF) {
+            return -2;
+        }
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+
+    ap_budget_controller_stop(service_impl);
+
+    // a new ladder invalidates the levels, start again from the configs the apps asked for
+    {
+        std::lock_guard<std::mutex> lock(service_impl->processors_mutex);
+        for (_agora_ap_processor_impl* processor_impl : service_impl->processors) {
+            ap_processor_set_degrade_level(processor_impl, 0, *config);
+        }
+    }
+
+    service_impl->cpu_budget = *config;
+    if (config->enabled) {
+        service_impl->budget_stop = false;
+        service_impl->budget_thread = std::thread(ap_budget_controller_run, service_impl);
+    }
+    return 0;
+}
+
+_agora_ap_admission_config agora_ap_admission_config_create()
+{
+    _agora_ap_admission_config config;
+    config.policy = AGORA_AP_ADMISSION_OFF;
+    config.max_cpu_us = 0;
+    config.max_memory_bytes = 0;
+    config.queue_timeout_ms = 1000;
+    config.default_cpu_us = 1000;
+    config.default_memory_bytes = 32 * 1024 * 1024;
+    return config;
+}
+
+AGORA_API_C_INT agora_ap_service_set_admission(AGORA_API_C_HDL service_handle, const _agora_ap_admission_config* config)
+{
+    if (!service_handle || service_handle != g_ap_service_impl || config == nullptr) {
+        return -1;
+    }
+    if (config->policy < AGORA_AP_ADMISSION_OFF || config->policy > AGORA_AP_ADMISSION_QUEUE) {
+        return -2;
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    std::lock_guard<std::mutex> lock(service_impl->admission_mutex);
+    service_impl->admission = *config;
+    // new limits may let queued creations through
+    service_impl->admission_cond.notify_all();
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_service_get_admission_stats(AGORA_API_C_HDL service_handle, _agora_ap_admission_stats* stats)
+{
+    if (!service_handle || service_handle != g_ap_service_impl || stats == nullptr) {
+        return -1;
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    std::lock_guard<std::mutex> lock(service_impl->admission_mutex);
+    stats->admitted = service_impl->admitted_count;
+    stats->refused = service_impl->refused_count;
+    stats->queued = service_impl->queued_count;
+    stats->waiting = service_impl->waiting_count;
+    stats->committed_cpu_us = service_impl->committed_cpu_us;
+    stats->committed_memory_bytes = service_impl->committed_memory_bytes;
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_service_load_cost_model(AGORA_API_C_HDL service_handle, const char* path)
+{
+    if (!service_handle || service_handle != g_ap_service_impl || path == nullptr) {
+        return -1;
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    return service_impl->cost_model.Load(path);
+}
+
+AGORA_API_C_INT agora_ap_service_save_cost_model(AGORA_API_C_HDL service_handle, const char* path)
+{
+    if (!service_handle || service_handle != g_ap_service_impl || path == nullptr) {
+        return -1;
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    return service_impl->cost_model.Save(path);
+}
+
+AGORA_API_C_INT agora_ap_processor_get_stats(AGORA_API_C_HDL processor_handle, _agora_ap_processor_stats* stats)
+{
+    if (processor_handle == nullptr || stats == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    const ApProcessorStats& source = processor_impl->stats;
+    source.lock.Read([stats, &source]() {
+        stats->frames = source.frames.load(std::memory_order_relaxed);
+        stats->stream_errors = source.stream_errors.load(std::memory_order_relaxed);
+        stats->reverse_stream_errors = source.reverse_stream_errors.load(std::memory_order_relaxed);
+        stats->algorithm_latency_ms = source.algorithm_latency_ms.load(std::memory_order_relaxed);
+        stats->algorithm_latency_sp = source.algorithm_latency_sp.load(std::memory_order_relaxed);
+        stats->aec_estimated_delay_ms = source.aec_estimated_delay_ms.load(std::memory_order_relaxed);
+        source.process_stream.CopyTo(&stats->process_stream);
+        source.process_reverse_stream.CopyTo(&stats->process_reverse_stream);
+        source.total.CopyTo(&stats->total);
+    });
+    stats->degrade_level = processor_impl->degrade_level.load(std::memory_order_relaxed);
+    stats->recovery_count = processor_impl->recovery_count.load(std::memory_order_relaxed);
+    stats->config_version = processor_impl->config_version.load(std::memory_order_relaxed);
+    stats->config_changes = processor_impl->config_changes.load(std::memory_order_relaxed);
+    return 0;
+}
+
+unsigned long long agora_ap_histogram_percentile(const _agora_ap_latency_histogram* histogram, double percentile)
+{
+    if (histogram == nullptr) {
+        return 0;
+    }
+    return ap_histogram_percentile(*histogram, percentile);
+}
+
+// service wide aggregates in Prometheus text format, called by the exporter thread
+static std::string ap_render_metrics(_agora_ap_service_impl* service_impl)
+{
+    std::unique_ptr<_agora_ap_latency_histogram> merged(new _agora_ap_latency_histogram());
+    std::unique_ptr<_agora_ap_latency_histogram> thread_cost(new _agora_ap_latency_histogram());
+    memset(merged.get(), 0, sizeof(_agora_ap_latency_histogram));
+    uint64_t frames = 0;
+    uint64_t errors = 0;
+    uint64_t recoveries = 0;
+    {
+        std::lock_guard<std::mutex> lock(service_impl->counters_mutex);
+        for (ApThreadCounters* counters : service_impl->thread_counters) {
+            counters->frame_cost.CopyTo(thread_cost.get());
+            merged->count += thread_cost->count;
+            merged->sum_ns += thread_cost->sum_ns;
+            merged->max_ns = std::max(merged->max_ns, thread_cost->max_ns);
+            for (int i = 0; i < AGORA_AP_HIST_BUCKETS; i++) {
+                merged->buckets[i] += thread_cost->buckets[i];
+            }
+            frames += counters->frames.load(std::memory_order_relaxed);
+            errors += counters->errors.load(std::memory_order_relaxed);
+            recoveries += counters->recoveries.load(std::memory_order_relaxed);
+        }
+    }
+
+    // quantiles of the frames since the last refresh
+    _agora_ap_latency_histogram& last = service_impl->metrics_last_frame_cost;
+    _agora_ap_latency_histogram* interval = thread_cost.get();
+    memset(interval, 0, sizeof(_agora_ap_latency_histogram));
+    for (int i = 0; i < AGORA_AP_HIST_BUCKETS; i++) {
+        interval->buckets[i] = merged->buckets[i] - last.buckets[i];
+        interval->count += interval->buckets[i];
+        if (interval->buckets[i] != 0) {
+            interval->max_ns = ap_histogram_bucket_upper(i);
+        }
+    }
+    interval->max_ns = std::min(interval->max_ns, merged->max_ns);
+    last = *merged;
+
+    int active = 0;
+    int spares = 0;
+    int spares_ready = 0;
+    int degraded = 0;
+    {
+        std::lock_guard<std::mutex> lock(service_impl->processors_mutex);
+        for (_agora_ap_processor_impl* processor_impl : service_impl->processors) {
+            active++;
+            if (processor_impl->has_spare.load(std::memory_order_relaxed)) {
+                spares++;
+                spares_ready += processor_impl->spare_ready.load(std::memory_order_relaxed) ? 1 : 0;
+            }
+            degraded += processor_impl->degrade_level.load(std::memory_order_relaxed) > 0 ? 1 : 0;
+        }
+    }
+    _agora_ap_admission_stats admission;
+    agora_ap_service_get_admission_stats(service_impl, &admission);
+
+    std::string out;
+    ApAppendMetricHeader(out, "agora_ap_frame_cost_seconds", "summary", "Wrapper time per 10ms frame, quantiles over the last refresh period.");
+    ApAppendMetric(out, "agora_ap_frame_cost_seconds", "quantile=\"0.5\"", ap_histogram_percentile(*interval, 50) / 1e9);
+    ApAppendMetric(out, "agora_ap_frame_cost_seconds", "quantile=\"0.99\"", ap_histogram_percentile(*interval, 99) / 1e9);
+    ApAppendMetric(out, "agora_ap_frame_cost_seconds", "quantile=\"0.999\"", ap_histogram_percentile(*interval, 99.9) / 1e9);
+    ApAppendMetric(out, "agora_ap_frame_cost_seconds_sum", NULL, merged->sum_ns / 1e9);
+    ApAppendMetric(out, "agora_ap_frame_cost_seconds_count", NULL, (double)merged->count);
+    ApAppendMetricHeader(out, "agora_ap_frames_total", "counter", "Frames processed.");
+    ApAppendMetric(out, "agora_ap_frames_total", NULL, (double)frames);
+    ApAppendMetricHeader(out, "agora_ap_frame_errors_total", "counter", "Frames the library returned an error for.");
+    ApAppendMetric(out, "agora_ap_frame_errors_total", NULL, (double)errors);
+    ApAppendMetricHeader(out, "agora_ap_recoveries_total", "counter", "kAecMalfunction recoveries.");
+    ApAppendMetric(out, "agora_ap_recoveries_total", NULL, (double)recoveries);
+    ApAppendMetricHeader(out, "agora_ap_active_processors", "gauge", "Live processors.");
+    ApAppendMetric(out, "agora_ap_active_processors", NULL, active);
+    ApAppendMetricHeader(out, "agora_ap_degraded_processors", "gauge", "Processors degraded by the cpu budget controller.");
+    ApAppendMetric(out, "agora_ap_degraded_processors", NULL, degraded);
+    ApAppendMetricHeader(out, "agora_ap_spare_processors", "gauge", "Pre-warmed spare processors, and those ready to be swapped in.");
+    ApAppendMetric(out, "agora_ap_spare_processors", "state=\"allocated\"", spares);
+    ApAppendMetric(out, "agora_ap_spare_processors", "state=\"ready\"", spares_ready);
+    ApAppendMetricHeader(out, "agora_ap_admission_waiting", "gauge", "Processor creations waiting for capacity.");
+    ApAppendMetric(out, "agora_ap_admission_waiting", NULL, admission.waiting);
+    ApAppendMetricHeader(out, "agora_ap_admission_refused_total", "counter", "Processor creations refused by admission control.");
+    ApAppendMetric(out, "agora_ap_admission_refused_total", NULL, (double)admission.refused);
+    ApAppendMetricHeader(out, "agora_ap_admission_committed_cpu_seconds", "gauge", "Projected cost per 10ms frame of the live processors.");
+    ApAppendMetric(out, "agora_ap_admission_committed_cpu_seconds", NULL, admission.committed_cpu_us / 1e6);
+    ApAppendMetricHeader(out, "agora_ap_admission_committed_memory_bytes", "gauge", "Projected memory of the live processors.");
+    ApAppendMetric(out, "agora_ap_admission_committed_memory_bytes", NULL, (double)admission.committed_memory_bytes);
+    ApAppendMetricHeader(out, "agora_ap_model_memory_bytes", "gauge", "Size of the loaded AI models.");
+    ApAppendMetric(out, "agora_ap_model_memory_bytes", "model=\"ains\"", (double)service_impl->ains_model_config.modelDataSize.value_or((size_t)0));
+    ApAppendMetric(out, "agora_ap_model_memory_bytes", "model=\"ains_ll\"", (double)service_impl->ainsll_model_config.modelDataSize.value_or((size_t)0));
+    ApAppendMetric(out, "agora_ap_model_memory_bytes", "model=\"ainlp\"", (double)service_impl->ainlp_model_config.modelDataSize.value_or((size_t)0));
+    ApAppendMetric(out, "agora_ap_model_memory_bytes", "model=\"ainlp_ll\"", (double)service_impl->ainlpll_model_config.modelDataSize.value_or((size_t)0));
+    return out;
+}
+
+_agora_ap_metrics_config agora_ap_metrics_config_create()
+{
+    _agora_ap_metrics_config config;
+    config.path = nullptr;
+    config.unix_socket = false;
+    config.interval_ms = 10000;
+    return config;
+}
+
+AGORA_API_C_INT agora_ap_service_start_metrics_exporter(AGORA_API_C_HDL service_handle, const _agora_ap_metrics_config* config)
+{
+    if (!service_handle || service_handle != g_ap_service_impl || config == nullptr) {
+        return -1;
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    service_impl->metrics_exporter.Stop();
+    memset(&service_impl->metrics_last_frame_cost, 0, sizeof(service_impl->metrics_last_frame_cost));
+    int ret = service_impl->metrics_exporter.Start(config->path, config->unix_socket, config->interval_ms,
+                                                   [service_impl]() { return ap_render_metrics(service_impl); });
+    return ret < 0 ? -2 : 0;
+}
+
+AGORA_API_C_VOID agora_ap_service_stop_metrics_exporter(AGORA_API_C_HDL service_handle)
+{
+    if (!service_handle || service_handle != g_ap_service_impl) {
+        return;
+    }
+    _agora_ap_service_impl* service_impl = static_cast<_agora_ap_service_impl*>(service_handle);
+    service_impl->metrics_exporter.Stop();
+}
+
+_agora_ap_trace_config agora_ap_trace_config_create()
+{
+    _agora_ap_trace_config config;
+    config.enabled = false;
+    config.events_per_thread = 16384;
+    config.anomaly_dir = nullptr;
+    config.anomaly_frame_us = 0;
+    return config;
+}
+
+AGORA_API_C_INT agora_ap_trace_configure(const _agora_ap_trace_config* config)
+{
+    if (config == nullptr || config->events_per_thread < 0 || config->anomaly_frame_us < 0) {
+        return -1;
+    }
+    ApTraceConfigure(config->enabled, config->events_per_thread, config->anomaly_dir, config->anomaly_frame_us);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_trace_flush(const char* path)
+{
+    if (path == nullptr) {
+        return -1;
+    }
+    return ApTraceFlush(path);
+}
+
+_agora_ap_log_config agora_ap_log_config_create()
+{
+    _agora_ap_log_config config;
+    config.path = nullptr;
+    config.level = kApLogInfo;
+    config.ring_slots = 256;
+    config.max_lines_per_second = 200;
+    config.library_output = true;
+    return config;
+}
+
+AGORA_API_C_INT agora_ap_log_configure(const _agora_ap_log_config* config)
+{
+    if (config == nullptr || config->ring_slots < 0 || config->max_lines_per_second < 0) {
+        return -1;
+    }
+    int ret = ApLogConfigure(config->path, config->level, config->ring_slots, config->max_lines_per_second);
+    if (ret != 0) {
+        return ret;
+    }
+    if (config->library_output) {
+        AgoraUAP::AgoraAudioProcessing::LogOption option(true, false, ApLogLibraryOutput,
+            (AgoraUAP::AgoraAudioProcessing::LogLevel)config->level);
+        AgoraUAP::AgoraAudioProcessing::EnableLogOutput(option);
+    }
+    return 0;
+}
+
+AGORA_API_C_VOID agora_ap_log_flush()
+{
+    ApLogFlush();
+}
+
+_agora_ap_dump_config agora_ap_dump_config_create()
+{
+    _agora_ap_dump_config config;
+    config.dir = "./dump/";
+    config.library_dump = false;
+    config.wrapper_dump = false;
+    config.buffer_bytes = 256 * 1024;
+    config.max_file_bytes = 64ll * 1024 * 1024;
+    config.max_files = 4;
+    return config;
+}
+
+AGORA_API_C_INT agora_ap_processor_set_dump(AGORA_API_C_HDL processor_handle, const _agora_ap_dump_config* config)
+{
+    if (processor_handle == nullptr || config == nullptr) {
+        return -1;
+    }
+    if ((config->library_dump || config->wrapper_dump) && (config->dir == nullptr || config->dir[0] == '\0')) {
+        return -2;
+    }
+    if (config->wrapper_dump && (config->buffer_bytes <= 0 || config->max_file_bytes < 0 || config->max_files < 0)) {
+        return -2;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    {
+        std::lock_guard<std::mutex> lock(processor_impl->dump_mutex);
+        processor_impl->dump_request = *config;
+        processor_impl->dump_request_dir = config->dir != nullptr ? config->dir : "";
+        processor_impl->dump_request.dir = processor_impl->dump_request_dir.c_str();
+    }
+    processor_impl->pending_ops.fetch_or(kPendingDump, std::memory_order_release);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_get_dump_stats(AGORA_API_C_HDL processor_handle, _agora_ap_dump_stats* stats)
+{
+    if (processor_handle == nullptr || stats == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    std::lock_guard<std::mutex> lock(processor_impl->dump_mutex);
+    stats->written_bytes = processor_impl->dump_counters->written_bytes.load(std::memory_order_relaxed);
+    stats->dropped_bytes = processor_impl->dump_counters->dropped_bytes.load(std::memory_order_relaxed);
+    stats->library_dump = processor_impl->dump_request.library_dump;
+    stats->wrapper_dump = processor_impl->dump_writer != nullptr;
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_save_flight_recording(AGORA_API_C_HDL processor_handle, const char* reason)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    if (!processor_impl->flight_recorder) {
+        return -2;
+    }
+    return processor_impl->flight_recorder->Trigger(reason != nullptr ? reason : "api") ? 0 : -2;
+}
+
+AGORA_API_C_INT agora_ap_processor_set_stream_delay_ms(AGORA_API_C_HDL processor_handle, int delay_ms)
+{
+    if (processor_handle == nullptr || delay_ms < 0) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    processor_impl->stream_delay_ms.store(delay_ms, std::memory_order_relaxed);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_set_stream_analog_level(AGORA_API_C_HDL processor_handle, int level)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    processor_impl->stream_analog_level.store(level, std::memory_order_relaxed);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_reset(AGORA_API_C_HDL processor_handle)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    if (processor_impl->processor == nullptr) {
+        return -2;
+    }
+    processor_impl->pending_ops.fetch_or(kPendingReset, std::memory_order_release);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_set_config(AGORA_API_C_HDL processor_handle, const _agora_ap_processor_config* config)
+{
+    if (processor_handle == nullptr || config == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    if (processor_impl->processor == nullptr) {
+        return -2;
+    }
+    std::lock_guard<std::mutex> lock(processor_impl->config_mutex);
+    // another model costs something else: the difference goes through
+    // admission control like a new processor, what is saved is given back
+    _agora_ap_service_impl* service_impl = processor_impl->service;
+    const _agora_ap_qos_config& qos_config = processor_impl->qos_config;
+    ApCostKey cost_key = ap_cost_key(*config, qos_config.expected_sample_rate, qos_config.expected_channels);
+    if (service_impl != nullptr && !ap_cost_key_equal(cost_key, processor_impl->cost_key)) {
+        long long cpu_us = 0;
+        long long memory_bytes = 0;
+        ap_admission_estimate(service_impl, cost_key, &cpu_us, &memory_bytes);
+        const _agora_ap_recovery_config& recovery_config = processor_impl->recovery_config;
+        memory_bytes *= recovery_config.auto_recover && recovery_config.use_spare_processor ? 2 : 1;
+        long long cpu_delta = cpu_us - processor_impl->reserved_cpu_us;
+        long long memory_delta = memory_bytes - processor_impl->reserved_memory_bytes;
+        if (!ap_admission_acquire(service_impl, std::max(cpu_delta, 0LL), std::max(memory_delta, 0LL), false)) {
+            AP_LOG_WARNING("agora_ap_processor_set_config: model change refused by admission control, cpu %lld us, memory %lld bytes\n",
+                           cpu_us, memory_bytes);
+            return -2;
+        }
+        ap_admission_release(service_impl, std::max(-cpu_delta, 0LL), std::max(-memory_delta, 0LL));
+        processor_impl->cost_key = cost_key;
+        processor_impl->reserved_cpu_us = cpu_us;
+        processor_impl->reserved_memory_bytes = memory_bytes;
+    }
+    // published before the bit is set, the capture thread finds it when it sees the bit
+    processor_impl->config_slot.Publish(*config);
+    processor_impl->pending_ops.fetch_or(kPendingConfig, std::memory_order_release);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_start_capture(AGORA_API_C_HDL processor_handle, const char* path)
+{
+    if (processor_handle == nullptr || path == nullptr || path[0] == '\0') {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    {
+        std::lock_guard<std::mutex> lock(processor_impl->capture_mutex);
+        processor_impl->capture_request_path = path;
+    }
+    processor_impl->pending_ops.fetch_or(kPendingCapture, std::memory_order_release);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_processor_stop_capture(AGORA_API_C_HDL processor_handle)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_processor_impl* processor_impl = static_cast<_agora_ap_processor_impl*>(processor_handle);
+    {
+        std::lock_guard<std::mutex> lock(processor_impl->capture_mutex);
+        processor_impl->capture_request_path.clear();
+    }
+    processor_impl->pending_ops.fetch_or(kPendingCapture, std::memory_order_release);
+    return 0;
+}
+
+AGORA_API_C_HDL agora_ap_array_processor_create(AGORA_API_C_HDL service_handle, const _agora_ap_processor_config& config, int channels)
+{
+    if (service_handle == nullptr || service_handle != g_ap_service_impl || channels < 1 || channels > AGORA_AP_ARRAY_MAX_CHANNELS) {
+        return nullptr;
+    }
+    // each channel is a mono stream, admission accounts for them one by one
+    _agora_ap_processor_config channel_config = config;
+    channel_config.qos_config.expected_channels = 1;
+
+    _agora_ap_array_processor_impl* array_impl = new _agora_ap_array_processor_impl();
+    array_impl->service = static_cast<_agora_ap_service_impl*>(service_handle);
+    array_impl->channels = channels;
+    for (int c = 0; c < channels; c++) {
+        AGORA_API_C_HDL processor = agora_ap_processor_create(service_handle, channel_config);
+        if (processor == nullptr) {
+            AP_LOG_ERROR("agora_ap_array_processor_create: channel %d of %d failed\n", c, channels);
+            agora_ap_array_processor_release(array_impl);
+            return nullptr;
+        }
+        array_impl->processors.push_back(processor);
+    }
+    array_impl->frames.resize(channels);
+    array_impl->ref_frames.resize(channels);
+    array_impl->results.resize(channels);
+    array_impl->cost_ns.resize(channels);
+    AP_LOG_INFO("agora_ap_array_processor_create: %d channels, %d worker threads\n", channels, array_impl->service->worker_pool.threads());
+    return array_impl;
+}
+
+AGORA_API_C_INT agora_ap_array_processor_release(AGORA_API_C_HDL array_handle)
+{
+    if (array_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_array_processor_impl* array_impl = static_cast<_agora_ap_array_processor_impl*>(array_handle);
+    for (AGORA_API_C_HDL processor : array_impl->processors) {
+        agora_ap_processor_release(processor);
+    }
+    delete array_impl;
+    return 0;
+}
+
+// pool task, runs channel |index| of the frame set up by agora_ap_array_processor_process_stream
+static void ap_array_run_channel(void* context, int index)
+{
+    _agora_ap_array_processor_impl* array_impl = static_cast<_agora_ap_array_processor_impl*>(context);
+    uint64_t begin_ns = ap_now_ns();
+    array_impl->results[index] = agora_ap_processor_process_stream(array_impl->processors[index],
+                                                                   &array_impl->frames[index], &array_impl->ref_frames[index]);
+    array_impl->cost_ns[index] = ap_now_ns() - begin_ns;
+}
+
+AGORA_API_C_INT agora_ap_array_processor_process_stream(AGORA_API_C_HDL array_handle, _agora_ap_audio_frame* frame, _agora_ap_audio_frame* ref_frame)
+{
+    if (array_handle == nullptr || frame == nullptr || ref_frame == nullptr) {
+        return -1;
+    }
+    _agora_ap_array_processor_impl* array_impl = static_cast<_agora_ap_array_processor_impl*>(array_handle);
+    const int channels = array_impl->channels;
+    if (frame->channels != channels || frame->bytesPerSample != 2 || ref_frame->bytesPerSample != 2) {
+        return -1;
+    }
+    uint64_t begin_ns = ap_now_ns();
+
+    const int samples = frame->samplesPerChannel;
+    const int ref_samples = ref_frame->channels * ref_frame->samplesPerChannel;
+    if (samples > array_impl->samples_capacity || ref_samples > array_impl->samples_capacity * 2) {
+        // 10 ms frames, grown once on the first frame or a rate change
+        array_impl->samples_capacity = std::max(samples, (ref_samples + 1) / 2);
+        array_impl->planar.resize((size_t)channels * array_impl->samples_capacity);
+        array_impl->ref_copies.resize((size_t)channels * array_impl->samples_capacity * 2);
+    }
+    int16_t* planes[AGORA_AP_ARRAY_MAX_CHANNELS];
+    for (int c = 0; c < channels; c++) {
+        planes[c] = array_impl->planar.data() + (size_t)c * array_impl->samples_capacity;
+        _agora_ap_audio_frame& mono = array_impl->frames[c];
+        mono = *frame;
+        mono.channels = 1;
+        mono.buffer = planes[c];
+        // the library takes the reference non-const, no two channels share a buffer
+        int16_t* ref_copy = array_impl->ref_copies.data() + (size_t)c * array_impl->samples_capacity * 2;
+        memcpy(ref_copy, ref_frame->buffer, (size_t)ref_samples * sizeof(int16_t));
+        array_impl->ref_frames[c] = *ref_frame;
+        array_impl->ref_frames[c].buffer = ref_copy;
+    }
+    ApMixDeinterleave(static_cast<const int16_t*>(frame->buffer), channels, samples, planes);
+    uint64_t fan_out_ns = ap_now_ns();
+
+    array_impl->service->worker_pool.ParallelFor(channels, ap_array_run_channel, array_impl);
+
+    uint64_t join_ns = ap_now_ns();
+    ApMixInterleave(planes, channels, samples, static_cast<int16_t*>(frame->buffer));
+    uint64_t end_ns = ap_now_ns();
+
+    int ret = 0;
+    uint64_t channel_sum_ns = 0;
+    for (int c = 0; c < channels; c++) {
+        if (ret == 0 && array_impl->results[c] < 0) {
+            ret = array_impl->results[c];
+        }
+        channel_sum_ns += array_impl->cost_ns[c];
+    }
+    uint64_t frame_period_ns = frame->sampleRate > 0 ? (uint64_t)samples * 1000000000ull / frame->sampleRate : 0;
+
+    array_impl->lock.BeginWrite();
+    array_impl->frame_count.store(array_impl->frame_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (end_ns - begin_ns > frame_period_ns) {
+        array_impl->overruns.store(array_impl->overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    array_impl->total.Record(end_ns - begin_ns);
+    array_impl->channel_sum.Record(channel_sum_ns);
+    array_impl->layout_ns.store(array_impl->layout_ns.load(std::memory_order_relaxed) + (fan_out_ns - begin_ns) + (end_ns - join_ns),
+                                std::memory_order_relaxed);
+    for (int c = 0; c < channels; c++) {
+        uint64_t cost_ns = array_impl->cost_ns[c];
+        array_impl->channel_last_ns[c].store(cost_ns, std::memory_order_relaxed);
+        if (cost_ns > array_impl->channel_max_ns[c].load(std::memory_order_relaxed)) {
+            array_impl->channel_max_ns[c].store(cost_ns, std::memory_order_relaxed);
+        }
+        array_impl->channel_total_ns[c].store(array_impl->channel_total_ns[c].load(std::memory_order_relaxed) + cost_ns, std::memory_order_relaxed);
+    }
+    array_impl->lock.EndWrite();
+
+    if (ApTraceEnabled()) {
+        ApTraceSpan("array_deinterleave", begin_ns, fan_out_ns, 0);
+        ApTraceSpan("array_fan_out", fan_out_ns, join_ns, 0);
+        ApTraceSpan("array_interleave", join_ns, end_ns, 0);
+    }
+    return ret;
+}
+
+AGORA_API_C_HDL agora_ap_array_processor_get_channel(AGORA_API_C_HDL array_handle, int index)
+{
+    if (array_handle == nullptr) {
+        return nullptr;
+    }
+    _agora_ap_array_processor_impl* array_impl = static_cast<_agora_ap_array_processor_impl*>(array_handle);
+    if (index < 0 || index >= (int)array_impl->processors.size()) {
+        return nullptr;
+    }
+    return array_impl->processors[index];
+}
+
+AGORA_API_C_INT agora_ap_array_processor_get_stats(AGORA_API_C_HDL array_handle, _agora_ap_array_stats* stats)
+{
+    if (array_handle == nullptr || stats == nullptr) {
+        return -1;
+    }
+    const _agora_ap_array_processor_impl* array_impl = static_cast<const _agora_ap_array_processor_impl*>(array_handle);
+    memset(stats, 0, sizeof(*stats));
+    stats->channels = array_impl->channels;
+    stats->worker_threads = array_impl->service->worker_pool.threads();
+    array_impl->lock.Read([stats, array_impl]() {
+        stats->frames = array_impl->frame_count.load(std::memory_order_relaxed);
+        stats->overruns = array_impl->overruns.load(std::memory_order_relaxed);
+        array_impl->total.CopyTo(&stats->total);
+        array_impl->channel_sum.CopyTo(&stats->channel_sum);
+        stats->layout_ns = array_impl->layout_ns.load(std::memory_order_relaxed);
+        for (int c = 0; c < array_impl->channels; c++) {
+            stats->channel_last_ns[c] = array_impl->channel_last_ns[c].load(std::memory_order_relaxed);
+            stats->channel_max_ns[c] = array_impl->channel_max_ns[c].load(std::memory_order_relaxed);
+            stats->channel_total_ns[c] = array_impl->channel_total_ns[c].load(std::memory_order_relaxed);
+        }
+    });
+    return 0;
+}
+
+_agora_ap_ref_mixer_config agora_ap_ref_mixer_config_create()
+{
+    _agora_ap_ref_mixer_config config;
+    config.sample_rate = 48000;
+    config.channels = 1;
+    config.silence_dbfs = -60.0f;
+    return config;
+}
+
+AGORA_API_C_HDL agora_ap_ref_mixer_create(const _agora_ap_ref_mixer_config* config)
+{
+    if (config == nullptr || config->sample_rate < 8000 || config->sample_rate % 100 != 0 ||
+        config->channels < 1 || config->channels > 2) {
+        return nullptr;
+    }
+    return new _agora_ap_ref_mixer_impl(*config);
+}
+
+AGORA_API_C_INT agora_ap_ref_mixer_release(AGORA_API_C_HDL mixer_handle)
+{
+    if (mixer_handle == nullptr) {
+        return -1;
+    }
+    delete static_cast<_agora_ap_ref_mixer_impl*>(mixer_handle);
+    return 0;
+}
+
+AGORA_API_C_INT agora_ap_ref_mixer_mix(AGORA_API_C_HDL mixer_handle, const _agora_ap_ref_source* sources, int count, _agora_ap_audio_frame* ref_frame)
+{
+    if (mixer_handle == nullptr || (sources == nullptr && count > 0) || count < 0 || ref_frame == nullptr || ref_frame->buffer == nullptr) {
+        return -1;
+    }
+    _agora_ap_ref_mixer_impl* mixer_impl = static_cast<_agora_ap_ref_mixer_impl*>(mixer_handle);
+    uint64_t begin_ns = ap_now_ns();
+    if (mixer_impl->sources.size() < (size_t)count) {
+        mixer_impl->sources.resize(count);
+    }
+    for (int i = 0; i < count; i++) {
+        const _agora_ap_audio_frame* frame = sources[i].frame;
+        ApRefMixer::Source& source = mixer_impl->sources[i];
+        source.samples = nullptr;
+        if (frame == nullptr || frame->buffer == nullptr) {
+            continue;
+        }
+        // 10 ms frames of 16 bit mono or stereo
+        if (frame->bytesPerSample != 2 || frame->channels < 1 || frame->channels > 2 ||
+            frame->sampleRate < 8000 || frame->samplesPerChannel != frame->sampleRate / 100) {
+            return -1;
+        }
+        float gain = std::min(std::max(sources[i].gain, 0.0f), 32767.0f / AP_MIX_GAIN_UNITY);
+        source.samples = static_cast<const int16_t*>(frame->buffer);
+        source.sample_rate = frame->sampleRate;
+        source.channels = frame->channels;
+        source.samples_per_channel = frame->samplesPerChannel;
+        source.gain_q14 = (int)(gain * AP_MIX_GAIN_UNITY + 0.5f);
+    }
+    ApRefMixer& mixer = mixer_impl->mixer;
+    int mixed = mixer.Mix(mixer_impl->sources.data(), count, static_cast<int16_t*>(ref_frame->buffer));
+    ref_frame->sampleRate = mixer.sample_rate();
+    ref_frame->channels = mixer.channels();
+    ref_frame->samplesPerChannel = mixer.samples_per_channel();
+    ref_frame->bytesPerSample = 2;
+    uint64_t end_ns = ap_now_ns();
+
+    mixer_impl->lock.BeginWrite();
+    mixer_impl->mix.Record(end_ns - begin_ns);
+    mixer_impl->frames.store(mixer_impl->frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mixer_impl->sources_mixed.store(mixer_impl->sources_mixed.load(std::memory_order_relaxed) + mixed, std::memory_order_relaxed);
+    mixer_impl->sources_silent.store(mixer_impl->sources_silent.load(std::memory_order_relaxed) + mixer.last_silent(), std::memory_order_relaxed);
+    mixer_impl->sources_resampled.store(mixer_impl->sources_resampled.load(std::memory_order_relaxed) + mixer.last_resampled(), std::memory_order_relaxed);
+    mixer_impl->lock.EndWrite();
+    return mixed;
+}
+
+AGORA_API_C_INT agora_ap_ref_mixer_get_stats(AGORA_API_C_HDL mixer_handle, _agora_ap_ref_mixer_stats* stats)
+{
+    if (mixer_handle == nullptr || stats == nullptr) {
+        return -1;
+    }
+    const _agora_ap_ref_mixer_impl* mixer_impl = static_cast<const _agora_ap_ref_mixer_impl*>(mixer_handle);
+    mixer_impl->lock.Read([stats, mixer_impl]() {
+        stats->frames = mixer_impl->frames.load(std::memory_order_relaxed);
+        stats->sources_mixed = mixer_impl->sources_mixed.load(std::memory_order_relaxed);
+        stats->sources_silent = mixer_impl->sources_silent.load(std::memory_order_relaxed);
+        stats->sources_resampled = mixer_impl->sources_resampled.load(std::memory_order_relaxed);
+        mixer_impl->mix.CopyTo(&stats->mix);
+    });
+    return 0;
 }
 
 
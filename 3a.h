@@ -107,6 +107,118 @@ typedef struct _agora_ap_bghvs_config {
     int bghvsDelayInFrmNums; //bghvs algorithm delay,frm number,10ms per frame;
 } ;
 
+typedef struct _agora_ap_recovery_config {
+    /**
+     * Whether the wrapper recovers the processor by itself when the
+     * library reports kAecMalfunction. The recovery runs at the next
+     * frame boundary of agora_ap_processor_process_stream, the event
+     * is still forwarded to on_event.
+     * - `true`: (Default) Recover automatically.
+     * - `false`: Only forward the event, the app handles it.
+     */
+    bool auto_recover;
+    /**
+     * Whether to keep a pre-warmed spare processor. On recovery the spare
+     * is swapped in and the broken one is reset on a background thread,
+     * so the Reset() cost does not land on the capture thread. Costs the
+     * memory of a second processor.
+     * - `true`: Swap in the spare processor.
+     * - `false`: (Default) Call Reset() inline at the frame boundary.
+     */
+    bool use_spare_processor;
+} ;
+
+typedef struct _agora_ap_qos_config {
+    /**
+     * Priority class used by the cpu budget controller. Streams with the
+     * lowest class are degraded first and restored last. Default is 0.
+     */
+    int priority_class;
+    /**
+     * Whether the cpu budget controller may degrade this stream.
+     * - `true`: (Default) Allow degradation.
+     * - `false`: Never degrade this stream.
+     */
+    bool allow_degradation;
+    /**
+     * Sample rate and channels the stream is expected to run at. Only used
+     * to look up the expected cost for admission control. Default is 48000
+     * and 1.
+     */
+    int expected_sample_rate;
+    int expected_channels;
+} ;
+
+typedef struct _agora_ap_flight_recorder_config {
+    /**
+     * Keep the last |seconds| of near input, reference, output and frame
+     * timing in memory, persisted on kAecMalfunction, onError, a slow
+     * frame or agora_ap_processor_save_flight_recording. Costs a copy of
+     * the frame per frame and the ring memory, 10 ms of 48 kHz stereo per
+     * stream and frame unless the qos hints ask for more. Larger frames
+     * are truncated and marked in frames.csv. Default is false.
+     */
+    bool enabled;
+    int seconds;
+    /**
+     * Directory recordings are written to, it must exist. Each recording
+     * is a directory with near.pcm, ref.pcm, out.pcm and frames.csv.
+     * Default is "./flight/".
+     */
+    const char* dir;
+    /**
+     * A frame slower than this triggers a recording, in us. 0 to disable.
+     */
+    int slow_frame_us;
+    /**
+     * Minimum time between two recordings of a processor, in ms.
+     * Default is 10000.
+     */
+    int min_interval_ms;
+} ;
+
+typedef struct _agora_ap_dump_config {
+    /**
+     * Directory the dump files are written to, it must exist.
+     * Default is "./dump/".
+     */
+    const char* dir;
+    /**
+     * Let the library dump its internal streams with EnableDataDump.
+     * Default is false.
+     */
+    bool library_dump;
+    /**
+     * Dump the near input, the reference and the output from the wrapper.
+     * Frames are batched and written on a background thread, they are
+     * dropped rather than block the capture thread. Default is false.
+     */
+    bool wrapper_dump;
+    /**
+     * Bytes per batched write. Default is 262144.
+     */
+    int buffer_bytes;
+    /**
+     * Start a new file of a stream after this many bytes, 0 for no limit.
+     * Default is 67108864.
+     */
+    long long max_file_bytes;
+    /**
+     * Files kept per stream, the oldest are deleted. 0 to keep all.
+     * Default is 4.
+     */
+    int max_files;
+} ;
+
+typedef struct _agora_ap_dump_stats {
+    // wrapper dump totals since the processor was created
+    unsigned long long written_bytes;
+    unsigned long long dropped_bytes;
+    // library dump requested, wrapper dump writing
+    bool library_dump;
+    bool wrapper_dump;
+} ;
+
 typedef struct _agora_ap_processor_config {
     // aec
     struct _agora_ap_aec_config aec_config;
@@ -116,8 +228,66 @@ typedef struct _agora_ap_processor_config {
     struct _agora_ap_agc_config agc_config;
     //bghvs
     struct _agora_ap_bghvs_config bghvs_config;    
+    // kAecMalfunction recovery
+    struct _agora_ap_recovery_config recovery_config;
+    // cpu budget degradation
+    struct _agora_ap_qos_config qos_config;
+    // last seconds of audio kept for anomalies
+    struct _agora_ap_flight_recorder_config flight_recorder_config;
+} ;
+
+/**
+ * Steps of the degradation ladder, see _agora_ap_cpu_budget_config.
+ */
+enum _agora_ap_degrade_step {
+    // kSTDAIAEC to kLLAIAEC and kSTDAIANS to kLLAIANS
+    AGORA_AP_DEGRADE_AI_STD_TO_LL = 0,
+    // any AI model to kTRAEC and kTRANS
+    AGORA_AP_DEGRADE_AI_TO_TRADITIONAL = 1,
+    // AGC off
+    AGORA_AP_DEGRADE_AGC_OFF = 2,
+    // BGHVS off
+    AGORA_AP_DEGRADE_BGHVS_OFF = 3,
+};
+
+#define AGORA_AP_MAX_DEGRADE_STEPS 8
+
+typedef struct _agora_ap_cpu_budget_config {
+    /**
+     * Whether the service degrades streams when the host is overloaded.
+     * Disabling it restores every stream to its own config.
+     */
+    bool enabled;
+    /**
+     * Processing time the host may spend per 10ms frame period, summed
+     * over all processors, in us. e.g. 4 cores at 70% is 28000. A stream
+     * whose frames stop coming counts less the longer it is idle, and not
+     * at all after 500 ms without a frame.
+     */
+    int budget_us;
+    /**
+     * Step one stream down when the measured load is above this
+     * percentage of budget_us, at most every 500 ms so the load can
+     * reflect the previous step first. Default is 90.
+     */
+    int high_watermark;
+    /**
+     * Step one stream back up when the load stayed below this
+     * percentage of budget_us for hold_ms. Default is 60.
+     */
+    int low_watermark;
+    int hold_ms;
+    // how often the controller looks at the load, in ms. Default is 200.
+    int interval_ms;
+    /**
+     * The degradation ladder, see #_agora_ap_degrade_step. Level n of a
+     * stream applies the first n steps.
+     */
+    int ladder[AGORA_AP_MAX_DEGRADE_STEPS];
+    int ladder_length;
 } ;
 
+
 typedef struct _agora_ap_audio_frame {
   /**
    * Audio frame types.
@@ -157,6 +327,121 @@ typedef struct _agora_ap_audio_frame {
   void* buffer;
 };
 
+// see agora_ap_histogram_percentile for the bucket layout
+#define AGORA_AP_HIST_SUB_BUCKETS 16
+#define AGORA_AP_HIST_BUCKETS 592
+
+typedef struct _agora_ap_latency_histogram {
+    unsigned long long count;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+    unsigned long long sum_ns;
+    /**
+     * Log-linear buckets in ns: values below AGORA_AP_HIST_SUB_BUCKETS
+     * have one bucket each, every power of two above is split into
+     * AGORA_AP_HIST_SUB_BUCKETS buckets.
+     */
+    unsigned long long buckets[AGORA_AP_HIST_BUCKETS];
+} ;
+
+typedef struct _agora_ap_processor_stats {
+    // frames handed to the library
+    unsigned long long frames;
+    // ProcessStream / ProcessReverseStream calls that returned < 0
+    unsigned long long stream_errors;
+    unsigned long long reverse_stream_errors;
+    // last GetState values, refreshed once per second of audio
+    unsigned int algorithm_latency_ms;
+    unsigned int algorithm_latency_sp;
+    unsigned int aec_estimated_delay_ms;
+    // current cpu budget degradation level and kAecMalfunction recoveries
+    int degrade_level;
+    unsigned long long recovery_count;
+    // agora_ap_processor_set_config: version of the config in force, 0 for
+    // the one of agora_ap_processor_create, and configs applied; calls
+    // coalesced between two frames are applied once
+    unsigned long long config_version;
+    unsigned long long config_changes;
+    // monotonic clock timings of the library calls and of the whole wrapper call
+    struct _agora_ap_latency_histogram process_stream;
+    struct _agora_ap_latency_histogram process_reverse_stream;
+    struct _agora_ap_latency_histogram total;
+} ;
+
+typedef struct _agora_ap_recovery_stats {
+    // kAecMalfunction events reported by the library
+    unsigned long long malfunction_events;
+    // recoveries run at a frame boundary
+    unsigned long long recovery_count;
+    // recoveries done by swapping in the spare processor, the rest called Reset() inline
+    unsigned long long spare_swap_count;
+    // time the recovery took on the capture thread, in us
+    unsigned long long last_recovery_us;
+    unsigned long long max_recovery_us;
+    unsigned long long total_recovery_us;
+    // time the background Reset() of the swapped out processor took, in us
+    unsigned long long last_spare_reset_us;
+} ;
+
+// ains, ains_ll, ainlp, ainlp_ll
+#define AGORA_AP_MODEL_COUNT 4
+
+// where agora_ap_service_initialize spent its time, in us
+typedef struct _agora_ap_startup_timing {
+    long long service_init_us;
+    // reading each model file, indexed like AGORA_AP_MODEL_COUNT, 0 if it failed to open
+    long long model_load_us[AGORA_AP_MODEL_COUNT];
+    long long model_bytes[AGORA_AP_MODEL_COUNT];
+} ;
+
+// where agora_ap_processor_create spent its time, in us
+typedef struct _agora_ap_create_timing {
+    // the whole call, including admission and the spare processor
+    long long total_us;
+    // CreateAgoraAudioProcessing
+    long long create_us;
+    // Init, license check included
+    long long init_us;
+    // the four SetAIModelResource calls
+    long long model_resource_us;
+    // the Set*Configuration calls
+    long long config_us;
+    // creating the spare processor, 0 without one
+    long long spare_us;
+    // first agora_ap_processor_process_stream call, 0 until it returned
+    long long first_frame_us;
+} ;
+
+/**
+ * Memory of the service. RSS deltas are measured around the calls and also
+ * include what other threads allocated meanwhile. Wrapper bytes count the
+ * wrapper's own heap (model copies, processor state, dump, capture and
+ * flight recorder buffers), not the library's.
+ */
+typedef struct _agora_ap_memory_report {
+    // whole process, 0 if /proc is unavailable
+    long long rss_bytes;
+    long long pss_bytes;
+    // agora_ap_service_initialize, and each model load within it
+    long long service_init_rss_bytes;
+    long long model_bytes[AGORA_AP_MODEL_COUNT];
+    long long model_rss_bytes[AGORA_AP_MODEL_COUNT];
+    // live processors, sums of their agora_ap_processor_create deltas
+    int processor_count;
+    long long processor_rss_bytes;
+    long long processor_wrapper_bytes;
+    // counted wrapper heap
+    long long wrapper_bytes;
+    long long wrapper_peak_bytes;
+    long long wrapper_allocations;
+} ;
+
+typedef struct _agora_ap_processor_memory {
+    // growth over agora_ap_processor_create, the spare processor included
+    long long create_rss_bytes;
+    long long create_wrapper_bytes;
+} ;
+
 
 AGORA_API_C_HDL agora_ap_service_create();
 
@@ -169,8 +454,170 @@ AGORA_API_C_INT agora_ap_service_initialize(AGORA_API_C_HDL service_handle, cons
  * @ANNOTATION:GROUP:agora_service
  */
 AGORA_API_C_VOID agora_ap_service_release(AGORA_API_C_HDL service_handle);
+// phase timings of the last agora_ap_service_initialize
+AGORA_API_C_INT agora_ap_service_get_startup_timing(AGORA_API_C_HDL service_handle, _agora_ap_startup_timing* timing);
+// reads /proc/self/smaps_rollup, keep it off the capture thread
+AGORA_API_C_INT agora_ap_service_get_memory_report(AGORA_API_C_HDL service_handle, _agora_ap_memory_report* report);
 
 
+/**
+ * Admission policies, see _agora_ap_admission_config.
+ */
+enum _agora_ap_admission_policy {
+    // always create
+    AGORA_AP_ADMISSION_OFF = 0,
+    // agora_ap_processor_create returns nullptr when the limits would be exceeded
+    AGORA_AP_ADMISSION_REFUSE = 1,
+    // agora_ap_processor_create waits up to queue_timeout_ms for capacity
+    AGORA_AP_ADMISSION_QUEUE = 2,
+};
+
+typedef struct _agora_ap_admission_config {
+    /**
+     * The admission policy. See #_agora_ap_admission_policy.
+     */
+    int policy;
+    /**
+     * Processing time per 10ms frame period the admitted processors may
+     * cost together, in us. 0 for no limit.
+     */
+    int max_cpu_us;
+    /**
+     * Memory the admitted processors may use together, in bytes.
+     * 0 for no limit.
+     */
+    long long max_memory_bytes;
+    int queue_timeout_ms;
+    /**
+     * Cost assumed for a configuration the cost model has not seen yet.
+     */
+    int default_cpu_us;
+    long long default_memory_bytes;
+} ;
+
+typedef struct _agora_ap_admission_stats {
+    unsigned long long admitted;
+    unsigned long long refused;
+    // creations that had to wait for capacity, and those waiting right now
+    unsigned long long queued;
+    int waiting;
+    // sum of the projected cost of the live processors
+    long long committed_cpu_us;
+    long long committed_memory_bytes;
+} ;
+
+// admission control
+// return a default admission config, AGORA_AP_ADMISSION_OFF
+_agora_ap_admission_config agora_ap_admission_config_create();
+AGORA_API_C_INT agora_ap_service_set_admission(AGORA_API_C_HDL service_handle, const _agora_ap_admission_config* config);
+AGORA_API_C_INT agora_ap_service_get_admission_stats(AGORA_API_C_HDL service_handle, _agora_ap_admission_stats* stats);
+/**
+ * Seed or persist the per config cost model used by admission control,
+ * e.g. with the output of a benchmark run. One config per line:
+ *   aec_model ans_model sample_rate channels us_per_frame bytes
+ * with -1 as model type when the module is disabled.
+ *
+ * @return number of entries read or written, < 0 on failure.
+ */
+AGORA_API_C_INT agora_ap_service_load_cost_model(AGORA_API_C_HDL service_handle, const char* path);
+AGORA_API_C_INT agora_ap_service_save_cost_model(AGORA_API_C_HDL service_handle, const char* path);
+
+typedef struct _agora_ap_metrics_config {
+    /**
+     * The file to write, or the Unix-domain socket to listen on.
+     */
+    const char* path;
+    /**
+     * - `true`: Serve on a Unix-domain socket, an HTTP GET gets an HTTP
+     *   response, any other client the bare text.
+     * - `false`: (Default) Rewrite the file atomically on every refresh,
+     *   e.g. for a node_exporter textfile collector.
+     */
+    bool unix_socket;
+    /**
+     * Refresh period in ms, the frame cost quantiles cover the last
+     * period. Default is 10000.
+     */
+    int interval_ms;
+} ;
+
+// metrics exporter, service wide aggregates in Prometheus text format
+_agora_ap_metrics_config agora_ap_metrics_config_create();
+AGORA_API_C_INT agora_ap_service_start_metrics_exporter(AGORA_API_C_HDL service_handle, const _agora_ap_metrics_config* config);
+AGORA_API_C_VOID agora_ap_service_stop_metrics_exporter(AGORA_API_C_HDL service_handle);
+
+typedef struct _agora_ap_trace_config {
+    /**
+     * Whether to record a span for every library call and wrapper stage.
+     * Disabled tracing costs one branch per frame. Default is false.
+     */
+    bool enabled;
+    /**
+     * Spans kept per thread, the oldest are overwritten. Only applies to
+     * threads that record their first span after the call. Default is 16384.
+     */
+    int events_per_thread;
+    /**
+     * Directory the trace is flushed to on kAecMalfunction, onError or a
+     * slow frame, at most once every 5 seconds. nullptr to not flush on
+     * anomalies.
+     */
+    const char* anomaly_dir;
+    /**
+     * A frame slower than this is an anomaly, in us. 0 to disable.
+     */
+    int anomaly_frame_us;
+} ;
+
+// tracing, process wide
+_agora_ap_trace_config agora_ap_trace_config_create();
+AGORA_API_C_INT agora_ap_trace_configure(const _agora_ap_trace_config* config);
+/**
+ * Write the recorded spans of all threads as Chrome trace JSON, which
+ * chrome://tracing and ui.perfetto.dev open.
+ *
+ * @return number of spans written, < 0 on failure.
+ */
+AGORA_API_C_INT agora_ap_trace_flush(const char* path);
+
+typedef struct _agora_ap_log_config {
+    /**
+     * File the log is appended to, nullptr for stdout.
+     */
+    const char* path;
+    /**
+     * Lowest level written, 0 debug, 1 info, 2 warning, 4 error. Default is 1.
+     */
+    int level;
+    /**
+     * Lines queued per thread before new ones are dropped. Only applies to
+     * threads that log their first line after the call. Default is 256.
+     */
+    int ring_slots;
+    /**
+     * Lines written per second, the rest are dropped and counted.
+     * 0 for no limit. Default is 200.
+     */
+    int max_lines_per_second;
+    /**
+     * Route the library's own log through this logger with
+     * AgoraAudioProcessing::EnableLogOutput. Default is true.
+     */
+    bool library_output;
+} ;
+
+// logging, process wide. Wrapper logs are formatted and written by a background thread
+_agora_ap_log_config agora_ap_log_config_create();
+AGORA_API_C_INT agora_ap_log_configure(const _agora_ap_log_config* config);
+// write all queued lines before returning
+AGORA_API_C_VOID agora_ap_log_flush();
+
+// cpu budget
+// return a default budget config, disabled
+_agora_ap_cpu_budget_config agora_ap_cpu_budget_config_create();
+// start, update or stop the cpu budget controller of the service
+AGORA_API_C_INT agora_ap_service_set_cpu_budget(AGORA_API_C_HDL service_handle, const _agora_ap_cpu_budget_config* config);
+
 // ap processor
 // return a default config
 _agora_ap_processor_config agora_ap_processor_config_create();
@@ -179,6 +626,171 @@ const char* agora_ap_processor_config_get_message(_agora_ap_processor_config *co
 AGORA_API_C_HDL agora_ap_processor_create(AGORA_API_C_HDL service_handle, const _agora_ap_processor_config& config);
 AGORA_API_C_INT agora_ap_processor_release(AGORA_API_C_HDL processor_handle);
 AGORA_API_C_INT agora_ap_processor_process_stream(AGORA_API_C_HDL processor_handle, _agora_ap_audio_frame* frame, _agora_ap_audio_frame* ref_frame);
+// recovery counters of one processor, safe to call from any thread
+AGORA_API_C_INT agora_ap_processor_get_recovery_stats(AGORA_API_C_HDL processor_handle, _agora_ap_recovery_stats* stats);
+// phase timings of agora_ap_processor_create and of the first frame
+AGORA_API_C_INT agora_ap_processor_get_create_timing(AGORA_API_C_HDL processor_handle, _agora_ap_create_timing* timing);
+AGORA_API_C_INT agora_ap_processor_get_memory(AGORA_API_C_HDL processor_handle, _agora_ap_processor_memory* memory);
+/**
+ * Snapshot of the processor statistics. Safe to call from any thread, it
+ * never blocks the capture thread.
+ */
+AGORA_API_C_INT agora_ap_processor_get_stats(AGORA_API_C_HDL processor_handle, _agora_ap_processor_stats* stats);
+// value in ns at or below which |percentile| (0-100) percent of the samples fall
+unsigned long long agora_ap_histogram_percentile(const _agora_ap_latency_histogram* histogram, double percentile);
+// current degradation level set by the cpu budget controller, 0 is not degraded
+AGORA_API_C_INT agora_ap_processor_get_degrade_level(AGORA_API_C_HDL processor_handle);
+// data dump, off unless agora_ap_processor_set_dump enables it
+_agora_ap_dump_config agora_ap_dump_config_create();
+/**
+ * Start, change or stop dumping of one processor. Safe to call from any
+ * thread, it takes effect at the next frame boundary.
+ */
+AGORA_API_C_INT agora_ap_processor_set_dump(AGORA_API_C_HDL processor_handle, const _agora_ap_dump_config* config);
+AGORA_API_C_INT agora_ap_processor_get_dump_stats(AGORA_API_C_HDL processor_handle, _agora_ap_dump_stats* stats);
+/**
+ * Persist the flight recorder of the processor on a background thread.
+ * Subject to min_interval_ms like the automatic triggers.
+ *
+ * @return 0 if a recording was started, -2 if the recorder is disabled or
+ * rate limited.
+ */
+AGORA_API_C_INT agora_ap_processor_save_flight_recording(AGORA_API_C_HDL processor_handle, const char* reason);
+
+// stream delay and analog level passed to the library every frame, default 60 ms and 0
+AGORA_API_C_INT agora_ap_processor_set_stream_delay_ms(AGORA_API_C_HDL processor_handle, int delay_ms);
+AGORA_API_C_INT agora_ap_processor_set_stream_analog_level(AGORA_API_C_HDL processor_handle, int level);
+/**
+ * Clear the algorithm state, e.g. before the processor is reused for an
+ * unrelated recording. Takes effect at the next frame boundary.
+ */
+AGORA_API_C_INT agora_ap_processor_reset(AGORA_API_C_HDL processor_handle);
+/**
+ * Change the config of a live processor from any thread, without stopping
+ * the stream. The config is published without locks and taken by the
+ * capture thread at the next frame boundary, which sets only the sections
+ * that changed; until then the capture thread pays one load per frame.
+ * The aec, ans, agc and bghvs sections follow, the others keep their values
+ * from agora_ap_processor_create. Calls made between two frames are
+ * coalesced, the last one wins.
+ *
+ * A change of AEC or ANS model goes through admission control for the
+ * cost difference, see _agora_ap_admission_config.
+ *
+ * @return -2 if admission control refused a model change, the old config
+ * stays in force.
+ */
+AGORA_API_C_INT agora_ap_processor_set_config(AGORA_API_C_HDL processor_handle, const _agora_ap_processor_config* config);
+/**
+ * Record every frame the processor is fed, with its config changes, stream
+ * delay, analog level and timestamps, to a capture file the replay tool
+ * re-drives. Written on a background thread; starting again replaces the
+ * current capture. Takes effect at the next frame boundary.
+ */
+AGORA_API_C_INT agora_ap_processor_start_capture(AGORA_API_C_HDL processor_handle, const char* path);
+AGORA_API_C_INT agora_ap_processor_stop_capture(AGORA_API_C_HDL processor_handle);
+
+// mic array
+#define AGORA_AP_ARRAY_MAX_CHANNELS 16
+
+typedef struct _agora_ap_array_stats {
+    int channels;
+    // threads of the service worker pool the channels are fanned out to, besides the caller
+    int worker_threads;
+    unsigned long long frames;
+    // frames whose total took longer than the frame period
+    unsigned long long overruns;
+    // whole agora_ap_array_processor_process_stream call
+    struct _agora_ap_latency_histogram total;
+    // per frame sum of the channel costs, the cpu time of the frame; the
+    // ratio of its mean to the mean total is the parallel speedup
+    struct _agora_ap_latency_histogram channel_sum;
+    // deinterleave and interleave time, summed, in ns
+    unsigned long long layout_ns;
+    // agora_ap_processor_process_stream of each channel, in ns
+    unsigned long long channel_last_ns[AGORA_AP_ARRAY_MAX_CHANNELS];
+    unsigned long long channel_max_ns[AGORA_AP_ARRAY_MAX_CHANNELS];
+    unsigned long long channel_total_ns[AGORA_AP_ARRAY_MAX_CHANNELS];
+} ;
+
+/**
+ * Processor of an N channel mic array: every channel is run through its own
+ * mono processor, created with |config|, and all of them share the
+ * reference stream. Each frame is deinterleaved, the channels are processed
+ * in parallel on the worker pool of the service and the outputs are
+ * interleaved back into the frame before the call returns.
+ *
+ * @param channels 1 to AGORA_AP_ARRAY_MAX_CHANNELS.
+ * @return nullptr if any of the channel processors cannot be created.
+ */
+AGORA_API_C_HDL agora_ap_array_processor_create(AGORA_API_C_HDL service_handle, const _agora_ap_processor_config& config, int channels);
+AGORA_API_C_INT agora_ap_array_processor_release(AGORA_API_C_HDL array_handle);
+/**
+ * Process one interleaved frame of the array in place. |frame| must have
+ * the channel count the array was created with.
+ *
+ * @return 0, or the first error a channel processor returned.
+ */
+AGORA_API_C_INT agora_ap_array_processor_process_stream(AGORA_API_C_HDL array_handle, _agora_ap_audio_frame* frame, _agora_ap_audio_frame* ref_frame);
+/**
+ * Mono processor of channel |index|, for its stats, dump, capture or reset.
+ * Owned by the array, never pass it to agora_ap_processor_release or
+ * agora_ap_processor_process_stream.
+ */
+AGORA_API_C_HDL agora_ap_array_processor_get_channel(AGORA_API_C_HDL array_handle, int index);
+// snapshot of the array statistics, safe to call from any thread
+AGORA_API_C_INT agora_ap_array_processor_get_stats(AGORA_API_C_HDL array_handle, _agora_ap_array_stats* stats);
+
+// far end reference mixer
+typedef struct _agora_ap_ref_mixer_config {
+    /**
+     * Rate and channel count (1 or 2) of the reference frames it produces.
+     * Default is 48000 and 1.
+     */
+    int sample_rate;
+    int channels;
+    /**
+     * Sources whose mean level is below this are skipped. Default is -60.
+     */
+    float silence_dbfs;
+} ;
+
+typedef struct _agora_ap_ref_source {
+    // 10 ms of one remote stream at any rate, 1 or 2 channels; nullptr when it sent nothing
+    const _agora_ap_audio_frame* frame;
+    // linear, 0 to just under 2.0
+    float gain;
+} ;
+
+typedef struct _agora_ap_ref_mixer_stats {
+    unsigned long long frames;
+    unsigned long long sources_mixed;
+    unsigned long long sources_silent;
+    unsigned long long sources_resampled;
+    // agora_ap_ref_mixer_mix calls
+    struct _agora_ap_latency_histogram mix;
+} ;
+
+// return a default config
+_agora_ap_ref_mixer_config agora_ap_ref_mixer_config_create();
+/**
+ * Mixer building the AEC reference of a multi party call from the streams
+ * of the remote participants. Independent of any service or processor.
+ */
+AGORA_API_C_HDL agora_ap_ref_mixer_create(const _agora_ap_ref_mixer_config* config);
+AGORA_API_C_INT agora_ap_ref_mixer_release(AGORA_API_C_HDL mixer_handle);
+/**
+ * Mix |count| sources into |ref_frame|, whose buffer has room for 10 ms at
+ * the mixer rate and channel count; the other fields of |ref_frame| are
+ * filled in. Sources are resampled and converted to the mixer layout as
+ * needed, silent ones are skipped. Source |i| must be the same remote
+ * stream every frame, the resampler keeps state per index.
+ *
+ * @return number of sources mixed, < 0 on invalid arguments.
+ */
+AGORA_API_C_INT agora_ap_ref_mixer_mix(AGORA_API_C_HDL mixer_handle, const _agora_ap_ref_source* sources, int count, _agora_ap_audio_frame* ref_frame);
+// safe to call from any thread
+AGORA_API_C_INT agora_ap_ref_mixer_get_stats(AGORA_API_C_HDL mixer_handle, _agora_ap_ref_mixer_stats* stats);
 
 
 
@@ -0,0 +1,235 @@
+#include "3a_capture.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "3a_log.h"
+#include "3a_task_runner.h"
+
+// batches per writer, records are dropped when all are queued for writing
+#define AP_CAPTURE_MAX_BUFFERS 8
+
+namespace {
+
+size_t frame_bytes(const _agora_ap_audio_frame* frame)
+{
+    if (frame == nullptr || frame->buffer == nullptr) {
+        return 0;
+    }
+    return (size_t)frame->channels * frame->samplesPerChannel * frame->bytesPerSample;
+}
+
+}  // namespace
+
+std::shared_ptr<ApCaptureWriter> ApCaptureWriter::Create(const std::string& path, uint32_t processor_id,
+                                                         size_t buffer_bytes)
+{
+    if (path.empty() || buffer_bytes < sizeof(ApCaptureFileHeader)) {
+        return nullptr;
+    }
+    return std::shared_ptr<ApCaptureWriter>(new ApCaptureWriter(path, processor_id, buffer_bytes));
+}
+
+ApCaptureWriter::ApCaptureWriter(const std::string& path, uint32_t processor_id, size_t buffer_bytes)
+    : path_(path), processor_id_(processor_id), buffer_bytes_(buffer_bytes), current_size_(0),
+      pool_(buffer_bytes, AP_CAPTURE_MAX_BUFFERS), file_(NULL), dropped_records_(0)
+{
+    pool_.Take(&current_);
+    ApCaptureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AP_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = AP_CAPTURE_VERSION;
+    header.header_bytes = sizeof(header);
+    header.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    header.processor_id = processor_id;
+    memcpy(current_.get(), &header, sizeof(header));
+    current_size_ = sizeof(header);
+}
+
+char* ApCaptureWriter::Reserve(uint32_t type, uint64_t time_ns, size_t payload_bytes)
+{
+    size_t record_bytes = sizeof(ApCaptureRecordHeader) + ap_capture_padded(payload_bytes);
+    if (record_bytes > buffer_bytes_) {
+        dropped_records_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (current_ && current_size_ + record_bytes > buffer_bytes_) {
+        Submit();
+    }
+    if (!current_ && !pool_.Take(&current_)) {
+        dropped_records_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    char* record = current_.get() + current_size_;
+    ApCaptureRecordHeader* header = reinterpret_cast<ApCaptureRecordHeader*>(record);
+    header->type = type;
+    header->bytes = (uint32_t)payload_bytes;
+    header->time_ns = time_ns;
+    // zero the padding, the file stays deterministic
+    memset(record + sizeof(ApCaptureRecordHeader) + payload_bytes, 0, ap_capture_padded(payload_bytes) - payload_bytes);
+    current_size_ += record_bytes;
+    return record + sizeof(ApCaptureRecordHeader);
+}
+
+void ApCaptureWriter::Submit()
+{
+    if (!current_ || current_size_ == 0) {
+        return;
+    }
+    std::shared_ptr<ApMemoryBytes> batch(new ApMemoryBytes(std::move(current_)));
+    size_t size = current_size_;
+    current_size_ = 0;
+    std::shared_ptr<ApCaptureWriter> self = shared_from_this();
+    ApIoRunner().Post([self, batch, size]() {
+        self->WriteBatch(batch->get(), size);
+        self->pool_.Give(std::move(*batch));
+    });
+}
+
+void ApCaptureWriter::WriteConfig(uint64_t time_ns, const _agora_ap_processor_config& config)
+{
+    char* payload = Reserve(kApCaptureConfig, time_ns, sizeof(ApCaptureConfig));
+    if (payload == nullptr) {
+        return;
+    }
+    ApCaptureConfig capture_config;
+    memset(&capture_config, 0, sizeof(capture_config));
+    capture_config.aec_config = config.aec_config;
+    capture_config.ans_config = config.ans_config;
+    capture_config.agc_config = config.agc_config;
+    capture_config.bghvs_config = config.bghvs_config;
+    memcpy(payload, &capture_config, sizeof(capture_config));
+}
+
+void ApCaptureWriter::WriteFrame(uint64_t time_ns, uint64_t frame, int stream_delay_ms, int stream_analog_level,
+                                 const _agora_ap_audio_frame* near, const _agora_ap_audio_frame* ref)
+{
+    size_t near_bytes = frame_bytes(near);
+    size_t ref_bytes = frame_bytes(ref);
+    char* payload = Reserve(kApCaptureFrame, time_ns, sizeof(ApCaptureFrame) + near_bytes + ref_bytes);
+    if (payload == nullptr) {
+        return;
+    }
+    ApCaptureFrame record;
+    memset(&record, 0, sizeof(record));
+    record.frame = frame;
+    record.stream_delay_ms = stream_delay_ms;
+    record.stream_analog_level = stream_analog_level;
+    record.sample_rate = near->sampleRate;
+    record.channels = near->channels;
+    record.samples_per_channel = near->samplesPerChannel;
+    record.bytes_per_sample = near->bytesPerSample;
+    if (ref_bytes > 0) {
+        record.ref_sample_rate = ref->sampleRate;
+        record.ref_channels = ref->channels;
+        record.ref_samples_per_channel = ref->samplesPerChannel;
+        record.ref_bytes_per_sample = ref->bytesPerSample;
+    }
+    memcpy(payload, &record, sizeof(record));
+    if (near_bytes > 0) {
+        memcpy(payload + sizeof(record), near->buffer, near_bytes);
+    }
+    if (ref_bytes > 0) {
+        memcpy(payload + sizeof(record) + near_bytes, ref->buffer, ref_bytes);
+    }
+}
+
+void ApCaptureWriter::Close()
+{
+    Submit();
+    std::shared_ptr<ApCaptureWriter> self = shared_from_this();
+    ApIoRunner().Post([self]() {
+        if (self->file_ != NULL) {
+            fclose(self->file_);
+            self->file_ = NULL;
+        }
+        if (self->dropped_records_.load(std::memory_order_relaxed) > 0) {
+            AP_LOG_WARNING("capture %s: %llu records dropped\n", self->path_,
+                           (unsigned long long)self->dropped_records_.load(std::memory_order_relaxed));
+        }
+    });
+}
+
+void ApCaptureWriter::WriteBatch(const char* data, size_t size)
+{
+    if (file_ == NULL) {
+        file_ = fopen(path_.c_str(), "wb");
+        if (file_ == NULL) {
+            AP_LOG_ERROR("capture: cannot open %s\n", path_);
+            return;
+        }
+    }
+    if (fwrite(data, 1, size, file_) != size) {
+        AP_LOG_ERROR("capture: write to %s failed\n", path_);
+    }
+}
+
+ApCaptureReader::ApCaptureReader() : data_(NULL), size_(0), offset_(0) {}
+
+ApCaptureReader::~ApCaptureReader()
+{
+    if (data_ != NULL) {
+        munmap((void*)data_, size_);
+    }
+}
+
+bool ApCaptureReader::Open(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ApCaptureFileHeader)) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    data_ = (const char*)data;
+    size_ = (size_t)st.st_size;
+    // replay reads front to back
+    madvise(data, size_, MADV_SEQUENTIAL);
+    const ApCaptureFileHeader& file_header = header();
+    if (memcmp(file_header.magic, AP_CAPTURE_MAGIC, sizeof(file_header.magic)) != 0 ||
+        file_header.version != AP_CAPTURE_VERSION || file_header.header_bytes < sizeof(ApCaptureFileHeader) ||
+        file_header.header_bytes > size_) {
+        munmap(data, size_);
+        data_ = NULL;
+        size_ = 0;
+        return false;
+    }
+    offset_ = file_header.header_bytes;
+    return true;
+}
+
+bool ApCaptureReader::Next(const ApCaptureRecordHeader** record, const char** payload)
+{
+    if (data_ == NULL || offset_ + sizeof(ApCaptureRecordHeader) > size_) {
+        return false;
+    }
+    const ApCaptureRecordHeader* header = reinterpret_cast<const ApCaptureRecordHeader*>(data_ + offset_);
+    size_t record_bytes = sizeof(ApCaptureRecordHeader) + ap_capture_padded(header->bytes);
+    if (offset_ + record_bytes > size_) {
+        // the capturing process stopped in the middle of a batch
+        return false;
+    }
+    *record = header;
+    *payload = data_ + offset_ + sizeof(ApCaptureRecordHeader);
+    offset_ += record_bytes;
+    return true;
+}
+
+void ApCaptureReader::Rewind()
+{
+    offset_ = data_ != NULL ? header().header_bytes : 0;
+}
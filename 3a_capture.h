@@ -0,0 +1,140 @@
+#ifndef AGORA_API_3A_CAPTURE_H
+#define AGORA_API_3A_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "3a.h"
+#include "3a_memory.h"
+#include "3a_task_runner.h"
+
+// Capture file of what one processor was fed, for deterministic replay.
+//
+// Layout, little endian, every record starts 8 byte aligned so a mapped
+// file is read in place:
+//   ApCaptureFileHeader
+//   records: ApCaptureRecordHeader, |bytes| of payload, zero padding to 8
+// A config record is written when the capture starts and whenever the
+// processor configuration changes; every frame is one frame record
+// followed by the near and the reference pcm.
+
+#define AP_CAPTURE_MAGIC "AP3ACAP"  // 8 bytes with the terminator
+#define AP_CAPTURE_VERSION 1
+
+enum ApCaptureRecordType {
+    kApCaptureConfig = 1,
+    kApCaptureFrame = 2,
+};
+
+struct ApCaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t start_ns;  // steady clock of the capturing process
+    uint32_t processor_id;
+    uint32_t reserved;
+};
+
+struct ApCaptureRecordHeader {
+    uint32_t type;   // ApCaptureRecordType
+    uint32_t bytes;  // payload, without the padding
+    uint64_t time_ns;
+};
+
+// library sections of _agora_ap_processor_config, as applied
+struct ApCaptureConfig {
+    _agora_ap_aec_config aec_config;
+    _agora_ap_ans_config ans_config;
+    _agora_ap_agc_config agc_config;
+    _agora_ap_bghvs_config bghvs_config;
+};
+
+struct ApCaptureFrame {
+    uint64_t frame;
+    int32_t stream_delay_ms;
+    int32_t stream_analog_level;
+    // near frame, its pcm follows this struct
+    int32_t sample_rate;
+    int32_t channels;
+    int32_t samples_per_channel;
+    int32_t bytes_per_sample;
+    // reference frame, its pcm follows the near pcm
+    int32_t ref_sample_rate;
+    int32_t ref_channels;
+    int32_t ref_samples_per_channel;
+    int32_t ref_bytes_per_sample;
+};
+
+inline size_t ap_capture_padded(size_t bytes)
+{
+    return (bytes + 7) & ~(size_t)7;
+}
+
+// Writes a capture from the capture thread. Records are batched in memory
+// and written by a background thread shared by all writers; a record is
+// dropped and counted when the batches are all queued.
+class ApCaptureWriter : public ApMemoryCounted, public std::enable_shared_from_this<ApCaptureWriter> {
+    public:
+    static std::shared_ptr<ApCaptureWriter> Create(const std::string& path, uint32_t processor_id, size_t buffer_bytes);
+
+    // capture thread only
+    void WriteConfig(uint64_t time_ns, const _agora_ap_processor_config& config);
+    void WriteFrame(uint64_t time_ns, uint64_t frame, int stream_delay_ms, int stream_analog_level,
+                    const _agora_ap_audio_frame* near, const _agora_ap_audio_frame* ref);
+    void Close();
+
+    uint64_t dropped_records() const { return dropped_records_.load(std::memory_order_relaxed); }
+
+    private:
+    ApCaptureWriter(const std::string& path, uint32_t processor_id, size_t buffer_bytes);
+
+    // space for one record in the current batch, nullptr if dropped
+    char* Reserve(uint32_t type, uint64_t time_ns, size_t payload_bytes);
+    void Submit();
+
+    // background thread
+    void WriteBatch(const char* data, size_t size);
+
+    const std::string path_;
+    const uint32_t processor_id_;
+    const size_t buffer_bytes_;
+
+    // capture thread
+    ApMemoryBytes current_;
+    size_t current_size_;
+
+    ApBufferPool pool_;
+
+    FILE* file_;  // background thread
+    std::atomic<uint64_t> dropped_records_;
+};
+
+// Reads a capture file through a read only mapping, records point into it.
+class ApCaptureReader {
+    public:
+    ApCaptureReader();
+    ~ApCaptureReader();
+
+    bool Open(const char* path);
+    const ApCaptureFileHeader& header() const { return *reinterpret_cast<const ApCaptureFileHeader*>(data_); }
+
+    /**
+     * Next record, @return false at the end or on a truncated record.
+     * |payload| stays valid until the reader is destroyed.
+     */
+    bool Next(const ApCaptureRecordHeader** record, const char** payload);
+    void Rewind();
+
+    private:
+    const char* data_;
+    size_t size_;
+    size_t offset_;
+};
+
+#endif // AGORA_API_3A_CAPTURE_H
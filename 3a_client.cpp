@@ -0,0 +1,288 @@
+#include "3a_client.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "3a_ipc.h"
+#include "3a_log.h"
+#include "3a_memory.h"
+
+// how long a frame may take in the daemon before the call gives up
+#define AP_CLIENT_FRAME_TIMEOUT_MS 1000
+
+struct _agora_ap_client_processor_impl;
+
+typedef struct _agora_ap_client_impl : public ApMemoryCounted {
+    int socket;
+    // one request in flight on the socket
+    std::mutex mutex;
+    std::vector<_agora_ap_client_processor_impl*> processors;  // under mutex
+} ;
+
+typedef struct _agora_ap_client_processor_impl : public ApMemoryCounted {
+    _agora_ap_client_impl* client;
+    uint32_t stream;
+    int ring_fd;
+    ApIpcRing* ring;
+    // frames submitted so far, the producer side of the ring
+    uint32_t next;
+} ;
+
+// send |request| and wait for its response, under client->mutex
+static bool ap_client_call(_agora_ap_client_impl* client, ApIpcRequest* request, ApIpcResponse* response, int* fd = nullptr)
+{
+    request->version = AP_IPC_VERSION;
+    if (!ApIpcSend(client->socket, request, sizeof(*request))) {
+        return false;
+    }
+    return ApIpcReceive(client->socket, response, sizeof(*response), fd) && response->type == request->type;
+}
+
+// control call on a processor, -2 if the daemon refused it or is gone
+static int ap_client_processor_call(_agora_ap_client_processor_impl* processor_impl, uint32_t type, int value,
+                                    _agora_ap_processor_stats* stats = nullptr,
+                                    const _agora_ap_processor_config* config = nullptr)
+{
+    _agora_ap_client_impl* client = processor_impl->client;
+    static thread_local ApIpcRequest request;
+    static thread_local ApIpcResponse response;
+    memset(&request, 0, sizeof(request));
+    request.type = type;
+    request.stream = processor_impl->stream;
+    request.value = value;
+    if (config != nullptr) {
+        request.config = *config;
+        request.config.flight_recorder_config.dir = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (!ap_client_call(client, &request, &response)) {
+        return -2;
+    }
+    if (stats != nullptr && response.ret == 0) {
+        *stats = response.stats;
+    }
+    return response.ret;
+}
+
+AGORA_API_C_HDL agora_ap_client_connect(const char* socket_path)
+{
+    if (socket_path == nullptr || strlen(socket_path) >= sizeof(((struct sockaddr_un*)nullptr)->sun_path)) {
+        return nullptr;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        AP_LOG_ERROR("agora_ap_client_connect: cannot reach %s\n", socket_path);
+        close(fd);
+        return nullptr;
+    }
+    _agora_ap_client_impl* client = new _agora_ap_client_impl();
+    client->socket = fd;
+    ApIpcRequest request;
+    ApIpcResponse response;
+    memset(&request, 0, sizeof(request));
+    request.type = kApIpcHello;
+    if (!ap_client_call(client, &request, &response) || response.ret != 0) {
+        AP_LOG_ERROR("agora_ap_client_connect: %s does not speak protocol version %d\n", socket_path, AP_IPC_VERSION);
+        close(fd);
+        delete client;
+        return nullptr;
+    }
+    return client;
+}
+
+AGORA_API_C_VOID agora_ap_client_disconnect(AGORA_API_C_HDL client_handle)
+{
+    if (client_handle == nullptr) {
+        return;
+    }
+    _agora_ap_client_impl* client = static_cast<_agora_ap_client_impl*>(client_handle);
+    std::vector<_agora_ap_client_processor_impl*> processors;
+    {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        processors = client->processors;
+    }
+    for (_agora_ap_client_processor_impl* processor_impl : processors) {
+        agora_ap_client_processor_release(processor_impl);
+    }
+    close(client->socket);
+    delete client;
+}
+
+_agora_ap_processor_config agora_ap_client_processor_config_create(AGORA_API_C_HDL client_handle)
+{
+    _agora_ap_processor_config config;
+    memset(&config, 0, sizeof(config));
+    if (client_handle == nullptr) {
+        return config;
+    }
+    _agora_ap_client_impl* client = static_cast<_agora_ap_client_impl*>(client_handle);
+    static thread_local ApIpcRequest request;
+    static thread_local ApIpcResponse response;
+    memset(&request, 0, sizeof(request));
+    request.type = kApIpcConfigDefaults;
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (ap_client_call(client, &request, &response) && response.ret == 0) {
+        config = response.config;
+    }
+    return config;
+}
+
+AGORA_API_C_HDL agora_ap_client_processor_create(AGORA_API_C_HDL client_handle, const _agora_ap_processor_config& config)
+{
+    if (client_handle == nullptr) {
+        return nullptr;
+    }
+    _agora_ap_client_impl* client = static_cast<_agora_ap_client_impl*>(client_handle);
+    static thread_local ApIpcRequest request;
+    static thread_local ApIpcResponse response;
+    memset(&request, 0, sizeof(request));
+    request.type = kApIpcProcessorCreate;
+    request.config = config;
+    request.config.flight_recorder_config.dir = nullptr;
+
+    std::lock_guard<std::mutex> lock(client->mutex);
+    int ring_fd = -1;
+    if (!ap_client_call(client, &request, &response, &ring_fd) || response.ret != 0 || ring_fd < 0) {
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+        return nullptr;
+    }
+    ApIpcRing* ring = ApIpcMapRing(ring_fd);
+    if (ring == nullptr) {
+        close(ring_fd);
+        return nullptr;
+    }
+    _agora_ap_client_processor_impl* processor_impl = new _agora_ap_client_processor_impl();
+    processor_impl->client = client;
+    processor_impl->stream = response.stream;
+    processor_impl->ring_fd = ring_fd;
+    processor_impl->ring = ring;
+    processor_impl->next = ring->submitted.load(std::memory_order_relaxed);
+    client->processors.push_back(processor_impl);
+    return processor_impl;
+}
+
+AGORA_API_C_INT agora_ap_client_processor_release(AGORA_API_C_HDL processor_handle)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    _agora_ap_client_processor_impl* processor_impl = static_cast<_agora_ap_client_processor_impl*>(processor_handle);
+    int ret = ap_client_processor_call(processor_impl, kApIpcProcessorRelease, 0);
+    _agora_ap_client_impl* client = processor_impl->client;
+    {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        std::vector<_agora_ap_client_processor_impl*>& processors = client->processors;
+        processors.erase(std::remove(processors.begin(), processors.end(), processor_impl), processors.end());
+    }
+    ApIpcUnmapRing(processor_impl->ring);
+    close(processor_impl->ring_fd);
+    delete processor_impl;
+    return ret;
+}
+
+AGORA_API_C_INT agora_ap_client_processor_process_stream(AGORA_API_C_HDL processor_handle, _agora_ap_audio_frame* frame, _agora_ap_audio_frame* ref_frame)
+{
+    if (processor_handle == nullptr || frame == nullptr || ref_frame == nullptr) {
+        return -1;
+    }
+    size_t near_samples = (size_t)frame->channels * frame->samplesPerChannel;
+    size_t ref_samples = (size_t)ref_frame->channels * ref_frame->samplesPerChannel;
+    if (frame->bytesPerSample != 2 || ref_frame->bytesPerSample != 2 ||
+        near_samples > AP_IPC_MAX_FRAME_SAMPLES || ref_samples > AP_IPC_MAX_FRAME_SAMPLES) {
+        return -1;
+    }
+    _agora_ap_client_processor_impl* processor_impl = static_cast<_agora_ap_client_processor_impl*>(processor_handle);
+    ApIpcRing* ring = processor_impl->ring;
+    uint32_t sequence = processor_impl->next;
+    // frames that timed out may still be in the daemon, their slots are not ours to reuse
+    if (sequence - ring->completed.load(std::memory_order_acquire) >= AP_IPC_RING_SLOTS) {
+        return -2;
+    }
+    ApIpcFrameSlot& slot = ring->slot[sequence % AP_IPC_RING_SLOTS];
+    slot.sample_rate = frame->sampleRate;
+    slot.channels = frame->channels;
+    slot.samples_per_channel = frame->samplesPerChannel;
+    slot.ref_sample_rate = ref_frame->sampleRate;
+    slot.ref_channels = ref_frame->channels;
+    slot.ref_samples_per_channel = ref_frame->samplesPerChannel;
+    memcpy(slot.near, frame->buffer, near_samples * sizeof(int16_t));
+    memcpy(slot.ref, ref_frame->buffer, ref_samples * sizeof(int16_t));
+    processor_impl->next = sequence + 1;
+    ring->submitted.store(sequence + 1, std::memory_order_release);
+    ApIpcWake(&ring->submitted);
+
+    // frames run in order, ours is done once completed passed it
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(AP_CLIENT_FRAME_TIMEOUT_MS);
+    while (true) {
+        uint32_t completed = ring->completed.load(std::memory_order_acquire);
+        if ((int32_t)(completed - (sequence + 1)) >= 0) {
+            break;
+        }
+        int remaining_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (remaining_ms <= 0) {
+            AP_LOG_WARNING("agora_ap_client_processor_process_stream: no answer from the daemon for stream %u\n", processor_impl->stream);
+            return -2;
+        }
+        ApIpcWait(&ring->completed, completed, std::min(remaining_ms, 100));
+    }
+    memcpy(frame->buffer, slot.near, near_samples * sizeof(int16_t));
+    return slot.ret;
+}
+
+AGORA_API_C_INT agora_ap_client_processor_get_stats(AGORA_API_C_HDL processor_handle, _agora_ap_processor_stats* stats)
+{
+    if (processor_handle == nullptr || stats == nullptr) {
+        return -1;
+    }
+    return ap_client_processor_call(static_cast<_agora_ap_client_processor_impl*>(processor_handle), kApIpcGetStats, 0, stats);
+}
+
+AGORA_API_C_INT agora_ap_client_processor_set_stream_delay_ms(AGORA_API_C_HDL processor_handle, int delay_ms)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    return ap_client_processor_call(static_cast<_agora_ap_client_processor_impl*>(processor_handle), kApIpcSetStreamDelayMs, delay_ms);
+}
+
+AGORA_API_C_INT agora_ap_client_processor_set_stream_analog_level(AGORA_API_C_HDL processor_handle, int level)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    return ap_client_processor_call(static_cast<_agora_ap_client_processor_impl*>(processor_handle), kApIpcSetStreamAnalogLevel, level);
+}
+
+AGORA_API_C_INT agora_ap_client_processor_reset(AGORA_API_C_HDL processor_handle)
+{
+    if (processor_handle == nullptr) {
+        return -1;
+    }
+    return ap_client_processor_call(static_cast<_agora_ap_client_processor_impl*>(processor_handle), kApIpcProcessorReset, 0);
+}
+
+AGORA_API_C_INT agora_ap_client_processor_set_config(AGORA_API_C_HDL processor_handle, const _agora_ap_processor_config* config)
+{
+    if (processor_handle == nullptr || config == nullptr) {
+        return -1;
+    }
+    return ap_client_processor_call(static_cast<_agora_ap_client_processor_impl*>(processor_handle), kApIpcSetConfig, 0, nullptr, config);
+}
@@ -0,0 +1,59 @@
+#ifndef AGORA_API_3A_CLIENT_H
+#define AGORA_API_3A_CLIENT_H
+
+#include "3a.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+// Client of the processing daemon. The processor calls mirror those of 3a.h
+// but run in the daemon, which owns the service and the loaded models;
+// frames go through a shared memory ring, only control goes through the
+// socket. Errors are -1 for bad handles or arguments and -2 when the daemon
+// refused the call or cannot be reached.
+
+/**
+ * Connect to the daemon listening on |socket_path|.
+ *
+ * @return nullptr if it cannot be reached or speaks another protocol version.
+ */
+AGORA_API_C_HDL agora_ap_client_connect(const char* socket_path);
+// release the processors still open and close the connection
+AGORA_API_C_VOID agora_ap_client_disconnect(AGORA_API_C_HDL client_handle);
+
+/**
+ * Default processor config of the daemon's library, see
+ * agora_ap_processor_config_create. Returned zeroed if the daemon cannot
+ * be reached.
+ */
+_agora_ap_processor_config agora_ap_client_processor_config_create(AGORA_API_C_HDL client_handle);
+/**
+ * Create a processor in the daemon. Pointers in |config| do not cross the
+ * process boundary: the flight recorder writes to the directory of the
+ * daemon.
+ */
+AGORA_API_C_HDL agora_ap_client_processor_create(AGORA_API_C_HDL client_handle, const _agora_ap_processor_config& config);
+AGORA_API_C_INT agora_ap_client_processor_release(AGORA_API_C_HDL processor_handle);
+/**
+ * Process one frame in place, like agora_ap_processor_process_stream.
+ * Frames of one processor must come from one thread; processors are
+ * independent. Up to 48 kHz stereo.
+ *
+ * @return the result of the daemon side call, -2 if the daemon did not
+ * answer within a second.
+ */
+AGORA_API_C_INT agora_ap_client_processor_process_stream(AGORA_API_C_HDL processor_handle, _agora_ap_audio_frame* frame, _agora_ap_audio_frame* ref_frame);
+AGORA_API_C_INT agora_ap_client_processor_get_stats(AGORA_API_C_HDL processor_handle, _agora_ap_processor_stats* stats);
+AGORA_API_C_INT agora_ap_client_processor_set_stream_delay_ms(AGORA_API_C_HDL processor_handle, int delay_ms);
+AGORA_API_C_INT agora_ap_client_processor_set_stream_analog_level(AGORA_API_C_HDL processor_handle, int level);
+AGORA_API_C_INT agora_ap_client_processor_reset(AGORA_API_C_HDL processor_handle);
+// see agora_ap_processor_set_config
+AGORA_API_C_INT agora_ap_client_processor_set_config(AGORA_API_C_HDL processor_handle, const _agora_ap_processor_config* config);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AGORA_API_3A_CLIENT_H
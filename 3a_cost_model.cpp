@@ -0,0 +1,136 @@
+#include "3a_cost_model.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+// weight of a new observation once the estimate has this many samples
+#define AP_COST_MODEL_MIN_WEIGHT 0.1
+
+uint64_t ApCostModel::Pack(const ApCostKey& key)
+{
+    // models are small enums or -1, shift them to be non negative
+    return ((uint64_t)(uint8_t)(key.aec_model + 1) << 56) |
+           ((uint64_t)(uint8_t)(key.ans_model + 1) << 48) |
+           ((uint64_t)(uint32_t)key.sample_rate << 8) |
+           (uint64_t)(uint8_t)key.channels;
+}
+
+ApCostKey ApCostModel::Unpack(uint64_t packed)
+{
+    ApCostKey key;
+    key.aec_model = (int)((packed >> 56) & 0xff) - 1;
+    key.ans_model = (int)((packed >> 48) & 0xff) - 1;
+    key.sample_rate = (int)((packed >> 8) & 0xffffffff);
+    key.channels = (int)(packed & 0xff);
+    return key;
+}
+
+bool ApCostModel::Lookup(const ApCostKey& key, ApCostEstimate* estimate) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<uint64_t, ApCostEstimate>::const_iterator it = entries_.find(Pack(key));
+    if (it == entries_.end()) {
+        return false;
+    }
+    *estimate = it->second;
+    return true;
+}
+
+namespace {
+
+// running mean for the first samples, then an exponential average so the
+// model follows library and host changes
+void ap_cost_fold(double value, double* estimate, uint32_t* samples)
+{
+    if (value <= 0) {
+        return;
+    }
+    double weight = 1.0 / (*samples + 1);
+    if (weight < AP_COST_MODEL_MIN_WEIGHT) {
+        weight = AP_COST_MODEL_MIN_WEIGHT;
+    }
+    *estimate = *samples == 0 ? value : *estimate + (value - *estimate) * weight;
+    (*samples)++;
+}
+
+}  // namespace
+
+void ApCostModel::Seed(const ApCostKey& key, double us_per_frame, double bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ApCostEstimate& estimate = entries_[Pack(key)];
+    estimate.us_per_frame = us_per_frame > 0 ? us_per_frame : 0;
+    estimate.bytes = bytes > 0 ? bytes : 0;
+    estimate.cpu_samples = us_per_frame > 0 ? 1 : 0;
+    estimate.memory_samples = bytes > 0 ? 1 : 0;
+}
+
+void ApCostModel::Observe(const ApCostKey& key, double us_per_frame, double bytes)
+{
+    if (us_per_frame <= 0 && bytes <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ApCostEstimate& estimate = entries_[Pack(key)];
+    ap_cost_fold(us_per_frame, &estimate.us_per_frame, &estimate.cpu_samples);
+    ap_cost_fold(bytes, &estimate.bytes, &estimate.memory_samples);
+}
+
+int ApCostModel::Load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int count = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        ApCostKey key;
+        double us_per_frame = 0;
+        double bytes = 0;
+        if (sscanf(line, "%d %d %d %d %lf %lf", &key.aec_model, &key.ans_model, &key.sample_rate,
+                   &key.channels, &us_per_frame, &bytes) != 6) {
+            continue;
+        }
+        Seed(key, us_per_frame, bytes);
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+int ApCostModel::Save(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    fprintf(file, "# aec_model ans_model sample_rate channels us_per_frame bytes\n");
+    for (std::map<uint64_t, ApCostEstimate>::const_iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        ApCostKey key = Unpack(it->first);
+        fprintf(file, "%d %d %d %d %.1f %.0f\n", key.aec_model, key.ans_model, key.sample_rate, key.channels,
+                it->second.us_per_frame, it->second.bytes);
+    }
+    fclose(file);
+    return (int)entries_.size();
+}
+
+size_t ApReadRssBytes()
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int n = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+    if (n != 2) {
+        return 0;
+    }
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,65 @@
+#ifndef AGORA_API_3A_COST_MODEL_H
+#define AGORA_API_3A_COST_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+
+// One processor configuration as seen by the cost model.
+// aec_model/ans_model are the AecModelType/AnsModelType values, or -1 when
+// the module is disabled.
+struct ApCostKey {
+    int aec_model;
+    int ans_model;
+    int sample_rate;
+    int channels;
+};
+
+// The two costs are measured at different times (memory at create, time at
+// release), each has its own count; 0 means that cost was never measured
+// and its value is meaningless.
+struct ApCostEstimate {
+    double us_per_frame;    // wrapper time per 10ms frame
+    double bytes;           // resident memory of one processor
+    uint32_t cpu_samples;   // observations behind us_per_frame, a seed counts as one
+    uint32_t memory_samples;
+};
+
+// Expected cost of a processor per configuration. Seeded from a benchmark
+// run (see Load) and refined online with what live processors measured.
+// All methods are thread safe.
+class ApCostModel {
+    public:
+    // exact match only; false if the configuration has never been seen
+    bool Lookup(const ApCostKey& key, ApCostEstimate* estimate) const;
+
+    // replace the estimate of |key|, a value <= 0 leaves that cost unmeasured
+    void Seed(const ApCostKey& key, double us_per_frame, double bytes);
+
+    // fold one measurement into the estimate, a value <= 0 is not a measurement
+    void Observe(const ApCostKey& key, double us_per_frame, double bytes);
+
+    /**
+     * Text format, one configuration per line, '#' starts a comment:
+     *   aec_model ans_model sample_rate channels us_per_frame bytes
+     * A cost that was never measured is saved as 0.
+     *
+     * @return number of entries read, or < 0 if the file can not be opened.
+     */
+    int Load(const char* path);
+    int Save(const char* path) const;
+
+    private:
+    static uint64_t Pack(const ApCostKey& key);
+    static ApCostKey Unpack(uint64_t packed);
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, ApCostEstimate> entries_;
+};
+
+// resident set size of this process, 0 if unknown
+size_t ApReadRssBytes();
+
+#endif // AGORA_API_3A_COST_MODEL_H
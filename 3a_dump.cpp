@@ -0,0 +1,175 @@
+#include "3a_dump.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "3a_log.h"
+#include "3a_task_runner.h"
+
+// batch buffers per writer, frames are dropped when all are queued for writing
+#define AP_DUMP_MAX_BUFFERS 12
+
+namespace {
+
+const char* const kStreamNames[ApDumpWriter::kStreamCount] = {"near", "ref", "out"};
+
+}  // namespace
+
+std::shared_ptr<ApDumpWriter> ApDumpWriter::Create(const std::string& dir, const std::string& prefix,
+                                                   size_t buffer_bytes, long long max_file_bytes, int max_files,
+                                                   std::shared_ptr<ApDumpCounters> counters)
+{
+    if (dir.empty() || access(dir.c_str(), W_OK) != 0) {
+        AP_LOG_ERROR("dump directory %s is not writable\n", dir);
+        return nullptr;
+    }
+    std::string directory = dir.back() == '/' ? dir : dir + "/";
+    return std::shared_ptr<ApDumpWriter>(new ApDumpWriter(directory, prefix, buffer_bytes, max_file_bytes, max_files, counters));
+}
+
+ApDumpWriter::ApDumpWriter(const std::string& dir, const std::string& prefix, size_t buffer_bytes,
+                           long long max_file_bytes, int max_files, std::shared_ptr<ApDumpCounters> counters)
+    : dir_(dir), prefix_(prefix), buffer_bytes_(buffer_bytes), max_file_bytes_(max_file_bytes),
+      max_files_(max_files), pool_(buffer_bytes, AP_DUMP_MAX_BUFFERS), counters_(counters)
+{
+    for (int i = 0; i < kStreamCount; i++) {
+        current_[i].size = 0;
+        current_[i].sample_rate = 0;
+        current_[i].channels = 0;
+        files_[i].file = NULL;
+        files_[i].bytes = 0;
+        files_[i].sample_rate = 0;
+        files_[i].channels = 0;
+        files_[i].index = 0;
+    }
+}
+
+ApDumpWriter::~ApDumpWriter()
+{
+    CloseFiles();
+}
+
+void ApDumpWriter::Write(int stream, int sample_rate, int channels, const void* data, size_t bytes)
+{
+    if (stream < 0 || stream >= kStreamCount || bytes == 0) {
+        return;
+    }
+    Batch& batch = current_[stream];
+    bool format_changed = batch.size > 0 && (batch.sample_rate != sample_rate || batch.channels != channels);
+    if (format_changed || batch.size + bytes > buffer_bytes_) {
+        Submit(stream);
+    }
+    if (!batch.data && !pool_.Take(&batch.data)) {
+        counters_->dropped_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        return;
+    }
+    if (bytes > buffer_bytes_) {
+        // a frame larger than a batch, keep what fits
+        counters_->dropped_bytes.fetch_add(bytes - buffer_bytes_, std::memory_order_relaxed);
+        bytes = buffer_bytes_;
+    }
+    batch.sample_rate = sample_rate;
+    batch.channels = channels;
+    memcpy(batch.data.get() + batch.size, data, bytes);
+    batch.size += bytes;
+}
+
+void ApDumpWriter::Submit(int stream)
+{
+    Batch& current = current_[stream];
+    if (current.size == 0) {
+        return;
+    }
+    std::shared_ptr<Batch> batch(new Batch());
+    batch->data = std::move(current.data);
+    batch->size = current.size;
+    batch->sample_rate = current.sample_rate;
+    batch->channels = current.channels;
+    current.size = 0;
+
+    std::shared_ptr<ApDumpWriter> self = shared_from_this();
+    ApIoRunner().Post([self, stream, batch]() {
+        self->WriteBatch(stream, batch.get());
+        self->pool_.Give(std::move(batch->data));
+    });
+}
+
+void ApDumpWriter::Close()
+{
+    for (int i = 0; i < kStreamCount; i++) {
+        Submit(i);
+    }
+    std::shared_ptr<ApDumpWriter> self = shared_from_this();
+    ApIoRunner().Post([self]() { self->CloseFiles(); });
+}
+
+void ApDumpWriter::OpenFile(int stream, int sample_rate, int channels)
+{
+    File& file = files_[stream];
+    if (file.file != NULL) {
+        fclose(file.file);
+        file.file = NULL;
+    }
+    char name[256];
+    snprintf(name, sizeof(name), "%s_%s_%dhz_%dch_%04d.pcm", prefix_.c_str(), kStreamNames[stream],
+             sample_rate, channels, file.index++);
+    std::string path = dir_ + name;
+    file.file = fopen(path.c_str(), "wb");
+    file.bytes = 0;
+    file.sample_rate = sample_rate;
+    file.channels = channels;
+    if (file.file == NULL) {
+        AP_LOG_ERROR("dump: cannot open %s\n", path);
+        return;
+    }
+    file.paths.push_back(path);
+    while (max_files_ > 0 && (int)file.paths.size() > max_files_) {
+        unlink(file.paths.front().c_str());
+        file.paths.pop_front();
+    }
+}
+
+void ApDumpWriter::WriteBatch(int stream, Batch* batch)
+{
+    File& file = files_[stream];
+    size_t offset = 0;
+    while (offset < batch->size) {
+        if (file.file == NULL || file.sample_rate != batch->sample_rate || file.channels != batch->channels ||
+            (max_file_bytes_ > 0 && file.bytes >= max_file_bytes_)) {
+            OpenFile(stream, batch->sample_rate, batch->channels);
+            if (file.file == NULL) {
+                counters_->dropped_bytes.fetch_add(batch->size - offset, std::memory_order_relaxed);
+                return;
+            }
+        }
+        size_t bytes = batch->size - offset;
+        if (max_file_bytes_ > 0 && (long long)bytes > max_file_bytes_ - file.bytes) {
+            // split at the cap on a whole sample frame, the wrapper only runs 16 bit pcm
+            size_t frame_bytes = (size_t)batch->channels * 2;
+            bytes = (size_t)(max_file_bytes_ - file.bytes) / frame_bytes * frame_bytes;
+            if (bytes == 0) {
+                bytes = std::min(frame_bytes, batch->size - offset);
+            }
+        }
+        size_t written = fwrite(batch->data.get() + offset, 1, bytes, file.file);
+        file.bytes += written;
+        counters_->written_bytes.fetch_add(written, std::memory_order_relaxed);
+        if (written != bytes) {
+            counters_->dropped_bytes.fetch_add(batch->size - offset - written, std::memory_order_relaxed);
+            return;
+        }
+        offset += bytes;
+    }
+}
+
+void ApDumpWriter::CloseFiles()
+{
+    for (int i = 0; i < kStreamCount; i++) {
+        if (files_[i].file != NULL) {
+            fclose(files_[i].file);
+            files_[i].file = NULL;
+        }
+    }
+}
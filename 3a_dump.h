@@ -0,0 +1,104 @@
+#ifndef AGORA_API_3A_DUMP_H
+#define AGORA_API_3A_DUMP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "3a_memory.h"
+#include "3a_task_runner.h"
+
+// Wrapper side PCM dump of one processor. The capture thread copies frames
+// into a batch buffer per stream; full buffers are written by a background
+// thread shared by all writers, so the capture thread never touches the
+// disk. When the background thread falls behind, frames are dropped and
+// counted instead of blocking.
+//
+// Files are raw interleaved PCM named
+// <dir>/<prefix>_<stream>_<rate>hz_<channels>ch_<index>.pcm, a new file is
+// started when |max_file_bytes| is reached or the stream format changes,
+// and only the last |max_files| files of a stream are kept.
+// totals of all the writers a processor had, outlive the writers
+struct ApDumpCounters {
+    std::atomic<uint64_t> written_bytes;
+    std::atomic<uint64_t> dropped_bytes;
+
+    ApDumpCounters() : written_bytes(0), dropped_bytes(0) {}
+};
+
+class ApDumpWriter : public ApMemoryCounted, public std::enable_shared_from_this<ApDumpWriter> {
+    public:
+    enum Stream {
+        kNear = 0,  // capture input, before processing
+        kRef = 1,   // far end reference
+        kOut = 2,   // capture output
+        kStreamCount = 3,
+    };
+
+    /**
+     * @param buffer_bytes size of one batch, a write is issued per batch.
+     * @param max_file_bytes rotate after this many bytes, 0 for no limit.
+     * @param max_files files kept per stream, 0 to keep all.
+     * @return nullptr if |dir| is not writable.
+     */
+    static std::shared_ptr<ApDumpWriter> Create(const std::string& dir, const std::string& prefix,
+                                                size_t buffer_bytes, long long max_file_bytes, int max_files,
+                                                std::shared_ptr<ApDumpCounters> counters);
+    ~ApDumpWriter();
+
+    // capture thread only
+    void Write(int stream, int sample_rate, int channels, const void* data, size_t bytes);
+    // capture thread only, queues the partial batches and closes the files once they are written
+    void Close();
+
+    private:
+    struct Batch {
+        ApMemoryBytes data;
+        size_t size;
+        int sample_rate;
+        int channels;
+    };
+
+    struct File {
+        FILE* file;
+        long long bytes;
+        int sample_rate;
+        int channels;
+        int index;
+        std::deque<std::string> paths;  // oldest first
+    };
+
+    ApDumpWriter(const std::string& dir, const std::string& prefix, size_t buffer_bytes,
+                 long long max_file_bytes, int max_files, std::shared_ptr<ApDumpCounters> counters);
+
+    // capture thread
+    void Submit(int stream);
+
+    // background thread
+    void WriteBatch(int stream, Batch* batch);
+    void CloseFiles();
+    void OpenFile(int stream, int sample_rate, int channels);
+
+    const std::string dir_;
+    const std::string prefix_;
+    const size_t buffer_bytes_;
+    const long long max_file_bytes_;
+    const int max_files_;
+
+    Batch current_[kStreamCount];  // capture thread
+
+    // buffers handed back by the background thread
+    ApBufferPool pool_;
+
+    File files_[kStreamCount];  // background thread
+
+    std::shared_ptr<ApDumpCounters> counters_;
+};
+
+#endif // AGORA_API_3A_DUMP_H
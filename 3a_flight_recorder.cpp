@@ -0,0 +1,191 @@
+#include "3a_flight_recorder.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <chrono>
+#include <vector>
+
+#include "3a_log.h"
+#include "3a_task_runner.h"
+
+namespace {
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+std::shared_ptr<ApFlightRecorder> ApFlightRecorder::Create(int frames, size_t frame_bytes, const std::string& dir,
+                                                           const std::string& name, int min_interval_ms)
+{
+    if (frames <= 0 || frame_bytes == 0 || dir.empty()) {
+        return nullptr;
+    }
+    std::string directory = dir.back() == '/' ? dir : dir + "/";
+    return std::shared_ptr<ApFlightRecorder>(new ApFlightRecorder(frames, frame_bytes, directory, name, min_interval_ms));
+}
+
+ApFlightRecorder::ApFlightRecorder(int frames, size_t frame_bytes, const std::string& dir, const std::string& name,
+                                   int min_interval_ms)
+    : frames_(frames), frame_bytes_(frame_bytes), dir_(dir), name_(name),
+      min_interval_ns_((uint64_t)min_interval_ms * 1000000), slots_(new Slot[frames]),
+      audio_(ApMemoryNewBytes((size_t)frames * 3 * frame_bytes)), head_(0), last_trigger_ns_(0), persisted_count_(0),
+      truncated_count_(0)
+{
+    // touch the ring now rather than on the capture thread
+    memset(audio_.get(), 0, (size_t)frames * 3 * frame_bytes);
+    for (int i = 0; i < frames; i++) {
+        slots_[i].sequence.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t ApFlightRecorder::CopyFrame(char* to, const _agora_ap_audio_frame* frame, uint32_t* truncated)
+{
+    if (frame == nullptr || frame->buffer == nullptr) {
+        return 0;
+    }
+    size_t bytes = (size_t)frame->channels * frame->samplesPerChannel * frame->bytesPerSample;
+    if (bytes > frame_bytes_) {
+        bytes = frame_bytes_;
+        (*truncated)++;
+        truncated_count_.store(truncated_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    memcpy(to, frame->buffer, bytes);
+    return (uint32_t)bytes;
+}
+
+void ApFlightRecorder::BeginFrame(const _agora_ap_audio_frame* near, const _agora_ap_audio_frame* ref)
+{
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t index = head % frames_;
+    Slot& slot = slots_[index];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sample_rate.store(near->sampleRate, std::memory_order_relaxed);
+    slot.channels.store(near->channels, std::memory_order_relaxed);
+    uint32_t truncated = 0;
+    slot.near_bytes.store(CopyFrame(Audio(index, 0), near, &truncated), std::memory_order_relaxed);
+    slot.ref_bytes.store(CopyFrame(Audio(index, 1), ref, &truncated), std::memory_order_relaxed);
+    slot.truncated.store(truncated, std::memory_order_relaxed);
+}
+
+void ApFlightRecorder::EndFrame(const _agora_ap_audio_frame* out, const ApFlightFrameTiming& timing)
+{
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t index = head % frames_;
+    Slot& slot = slots_[index];
+    uint32_t truncated = slot.truncated.load(std::memory_order_relaxed);
+    slot.out_bytes.store(CopyFrame(Audio(index, 2), out, &truncated), std::memory_order_relaxed);
+    slot.truncated.store(truncated, std::memory_order_relaxed);
+    slot.begin_ns.store(timing.begin_ns, std::memory_order_relaxed);
+    slot.reverse_ns.store(timing.reverse_ns, std::memory_order_relaxed);
+    slot.stream_ns.store(timing.stream_ns, std::memory_order_relaxed);
+    slot.total_ns.store(timing.total_ns, std::memory_order_relaxed);
+    slot.ret.store(timing.ret, std::memory_order_relaxed);
+    slot.reverse_ret.store(timing.reverse_ret, std::memory_order_relaxed);
+    slot.sequence.store(head + 1, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_release);
+}
+
+bool ApFlightRecorder::Trigger(const char* reason)
+{
+    uint64_t now = now_ns();
+    uint64_t last = last_trigger_ns_.load(std::memory_order_relaxed);
+    if (last != 0 && now - last < min_interval_ns_) {
+        return false;
+    }
+    if (!last_trigger_ns_.compare_exchange_strong(last, now)) {
+        return false;
+    }
+    char name[256];
+    snprintf(name, sizeof(name), "flight_%s_%ld_%s", name_.c_str(), (long)time(NULL), reason);
+    // the reason may come from the app, keep the name a plain file name
+    for (char* c = name; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-') {
+            *c = '_';
+        }
+    }
+    std::string path = dir_ + name;
+    uint64_t end = head_.load(std::memory_order_acquire);
+    std::shared_ptr<ApFlightRecorder> self = shared_from_this();
+    ApIoRunner().Post([self, path, end]() { self->Persist(path, end); });
+    return true;
+}
+
+void ApFlightRecorder::Persist(const std::string& path, uint64_t end)
+{
+    if (mkdir(path.c_str(), 0755) != 0) {
+        AP_LOG_ERROR("flight recorder: cannot create %s\n", path);
+        return;
+    }
+    const char* const names[3] = {"/near.pcm", "/ref.pcm", "/out.pcm"};
+    FILE* audio_files[3] = {NULL, NULL, NULL};
+    for (int i = 0; i < 3; i++) {
+        audio_files[i] = fopen((path + names[i]).c_str(), "wb");
+    }
+    FILE* timing_file = fopen((path + "/frames.csv").c_str(), "w");
+    if (audio_files[0] == NULL || audio_files[1] == NULL || audio_files[2] == NULL || timing_file == NULL) {
+        AP_LOG_ERROR("flight recorder: cannot write %s\n", path);
+    } else {
+        fprintf(timing_file, "frame,begin_us,sample_rate,channels,reverse_us,stream_us,total_us,ret,reverse_ret,truncated\n");
+        std::vector<char> audio(3 * frame_bytes_);
+        // frames recorded after the trigger are part of the recording too
+        uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t begin = head > (uint64_t)frames_ ? head - frames_ : 0;
+        int written = 0;
+        int skipped = 0;
+        for (uint64_t frame = begin; frame < head; frame++) {
+            uint64_t index = frame % frames_;
+            Slot& slot = slots_[index];
+            if (slot.sequence.load(std::memory_order_acquire) != frame + 1) {
+                skipped++;
+                continue;
+            }
+            ApFlightFrameTiming timing;
+            timing.begin_ns = slot.begin_ns.load(std::memory_order_relaxed);
+            timing.reverse_ns = slot.reverse_ns.load(std::memory_order_relaxed);
+            timing.stream_ns = slot.stream_ns.load(std::memory_order_relaxed);
+            timing.total_ns = slot.total_ns.load(std::memory_order_relaxed);
+            timing.ret = slot.ret.load(std::memory_order_relaxed);
+            timing.reverse_ret = slot.reverse_ret.load(std::memory_order_relaxed);
+            int sample_rate = slot.sample_rate.load(std::memory_order_relaxed);
+            int channels = slot.channels.load(std::memory_order_relaxed);
+            uint32_t bytes[3] = {slot.near_bytes.load(std::memory_order_relaxed), slot.ref_bytes.load(std::memory_order_relaxed),
+                                 slot.out_bytes.load(std::memory_order_relaxed)};
+            uint32_t truncated = slot.truncated.load(std::memory_order_relaxed);
+            // a torn copy of the audio is caught by the sequence check below
+            memcpy(audio.data(), Audio(index, 0), 3 * frame_bytes_);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != frame + 1) {
+                // overwritten while copied
+                skipped++;
+                continue;
+            }
+            for (int i = 0; i < 3; i++) {
+                fwrite(audio.data() + i * frame_bytes_, 1, bytes[i], audio_files[i]);
+            }
+            fprintf(timing_file, "%llu,%llu,%d,%d,%.1f,%.1f,%.1f,%d,%d,%u\n", (unsigned long long)frame,
+                    (unsigned long long)(timing.begin_ns / 1000), sample_rate, channels, timing.reverse_ns / 1000.0,
+                    timing.stream_ns / 1000.0, timing.total_ns / 1000.0, timing.ret, timing.reverse_ret, truncated);
+            written++;
+        }
+        persisted_count_.fetch_add(1, std::memory_order_relaxed);
+        AP_LOG_INFO("flight recorder: %d frames to %s, trigger at frame %llu, %d skipped, %llu truncated so far\n",
+                    written, path, (unsigned long long)end, skipped, (unsigned long long)truncated_count());
+    }
+    for (int i = 0; i < 3; i++) {
+        if (audio_files[i] != NULL) {
+            fclose(audio_files[i]);
+        }
+    }
+    if (timing_file != NULL) {
+        fclose(timing_file);
+    }
+}
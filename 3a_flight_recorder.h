@@ -0,0 +1,103 @@
+#ifndef AGORA_API_3A_FLIGHT_RECORDER_H
+#define AGORA_API_3A_FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "3a.h"
+#include "3a_memory.h"
+
+// Per frame timing kept next to the audio, see ApFlightRecorder.
+struct ApFlightFrameTiming {
+    uint64_t begin_ns;
+    uint32_t reverse_ns;  // ProcessReverseStream
+    uint32_t stream_ns;   // ProcessStream
+    uint32_t total_ns;    // agora_ap_processor_process_stream up to ProcessStream return
+    int32_t ret;
+    int32_t reverse_ret;
+};
+
+// Always-on recorder of the last frames of one processor: near input,
+// reference, output and timing in a preallocated ring. The capture thread
+// only copies into the ring; Trigger() persists the ring from a background
+// thread, rate limited, into <dir>/flight_<name>_<time>_<reason>/ as
+// near.pcm, ref.pcm, out.pcm and frames.csv.
+//
+// Every slot is a sequence lock: the persisting thread skips slots the
+// capture thread overwrote while they were copied.
+class ApFlightRecorder : public ApMemoryCounted, public std::enable_shared_from_this<ApFlightRecorder> {
+    public:
+    /**
+     * @param frames ring length in frames.
+     * @param frame_bytes audio bytes kept per stream and frame, the largest frame the caller
+     *        takes; larger frames are truncated and counted in truncated_count().
+     * @param min_interval_ms minimum time between two persisted recordings.
+     */
+    static std::shared_ptr<ApFlightRecorder> Create(int frames, size_t frame_bytes, const std::string& dir,
+                                                    const std::string& name, int min_interval_ms);
+
+    // capture thread only, around the library calls of one frame
+    void BeginFrame(const _agora_ap_audio_frame* near, const _agora_ap_audio_frame* ref);
+    void EndFrame(const _agora_ap_audio_frame* out, const ApFlightFrameTiming& timing);
+
+    /**
+     * Persist the ring on a background thread, any thread.
+     *
+     * @param reason part of the directory name.
+     * @return false if rate limited.
+     */
+    bool Trigger(const char* reason);
+
+    uint64_t persisted_count() const { return persisted_count_.load(std::memory_order_relaxed); }
+    // near, ref and out frames that did not fit into frame_bytes
+    uint64_t truncated_count() const { return truncated_count_.load(std::memory_order_relaxed); }
+
+    private:
+    struct Slot : public ApMemoryCounted {
+        // frame number + 1 once complete, 0 while the capture thread writes it
+        std::atomic<uint64_t> sequence;
+        // ApFlightFrameTiming and the frame format as relaxed atomics: the
+        // persisting thread reads them while the capture thread may be
+        // rewriting the slot, the sequence check discards such a read
+        std::atomic<uint64_t> begin_ns;
+        std::atomic<uint32_t> reverse_ns;
+        std::atomic<uint32_t> stream_ns;
+        std::atomic<uint32_t> total_ns;
+        std::atomic<int32_t> ret;
+        std::atomic<int32_t> reverse_ret;
+        std::atomic<int32_t> sample_rate;
+        std::atomic<int32_t> channels;
+        std::atomic<uint32_t> near_bytes;
+        std::atomic<uint32_t> ref_bytes;
+        std::atomic<uint32_t> out_bytes;
+        std::atomic<uint32_t> truncated;  // streams of the frame cut at frame_bytes
+    };
+
+    ApFlightRecorder(int frames, size_t frame_bytes, const std::string& dir, const std::string& name,
+                     int min_interval_ms);
+
+    char* Audio(uint64_t index, int stream) { return audio_.get() + ((index * 3) + stream) * frame_bytes_; }
+    // bytes stored, counts the frame in truncated_count_ if it did not fit
+    uint32_t CopyFrame(char* to, const _agora_ap_audio_frame* frame, uint32_t* truncated);
+    // background thread
+    void Persist(const std::string& path, uint64_t end);
+
+    const int frames_;
+    const size_t frame_bytes_;
+    const std::string dir_;
+    const std::string name_;
+    const uint64_t min_interval_ns_;
+
+    std::unique_ptr<Slot[]> slots_;
+    ApMemoryBytes audio_;            // near, ref, out of every slot
+    std::atomic<uint64_t> head_;     // frames recorded
+
+    std::atomic<uint64_t> last_trigger_ns_;
+    std::atomic<uint64_t> persisted_count_;
+    std::atomic<uint64_t> truncated_count_;  // written by the capture thread only
+};
+
+#endif // AGORA_API_3A_FLIGHT_RECORDER_H
@@ -0,0 +1,162 @@
+#include "3a_ipc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "3a_log.h"
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+bool ApIpcWait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    // shared between processes, FUTEX_PRIVATE_FLAG must not be set
+    long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    return ret == 0 || errno != ETIMEDOUT;
+}
+
+void ApIpcWake(std::atomic<uint32_t>* word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+int ApIpcCreateRing()
+{
+    int fd = (int)syscall(SYS_memfd_create, "agora_ap_ring", MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        AP_LOG_ERROR("memfd_create: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(ApIpcRing)) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        AP_LOG_ERROR("cannot size and seal the ring: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(nullptr, sizeof(ApIpcRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    ApIpcRing* ring = new (map) ApIpcRing();
+    ring->version = AP_IPC_VERSION;
+    ring->submitted.store(0, std::memory_order_relaxed);
+    ring->completed.store(0, std::memory_order_relaxed);
+    ring->magic = AP_IPC_RING_MAGIC;
+    munmap(map, sizeof(ApIpcRing));
+    return fd;
+}
+
+ApIpcRing* ApIpcMapRing(int fd)
+{
+    void* map = mmap(nullptr, sizeof(ApIpcRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    ApIpcRing* ring = static_cast<ApIpcRing*>(map);
+    if (ring->magic != AP_IPC_RING_MAGIC || ring->version != AP_IPC_VERSION) {
+        munmap(map, sizeof(ApIpcRing));
+        return nullptr;
+    }
+    return ring;
+}
+
+void ApIpcUnmapRing(ApIpcRing* ring)
+{
+    if (ring != nullptr) {
+        munmap(ring, sizeof(ApIpcRing));
+    }
+}
+
+bool ApIpcSend(int socket, const void* data, size_t bytes, int fd)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = bytes;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    while (true) {
+        ssize_t n = sendmsg(socket, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n == (ssize_t)bytes;
+    }
+}
+
+bool ApIpcReceive(int socket, void* data, size_t bytes, int* fd)
+{
+    if (fd != nullptr) {
+        *fd = -1;
+    }
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = bytes;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    // on error the kernel leaves |msg| as it was, there is no control data to walk
+    if (n < 0) {
+        return false;
+    }
+    int passed = -1;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+            memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    // a short or truncated message, or one whose descriptors did not fit, is
+    // a protocol error, not a frame to act on
+    if (n != (ssize_t)bytes || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (passed >= 0) {
+            close(passed);
+        }
+        return false;
+    }
+    if (fd != nullptr) {
+        *fd = passed;
+    } else if (passed >= 0) {
+        close(passed);
+    }
+    return true;
+}
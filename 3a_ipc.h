@@ -0,0 +1,98 @@
+#ifndef AGORA_API_3A_IPC_H
+#define AGORA_API_3A_IPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+#include "3a.h"
+
+// Transport between the processing daemon and 3a_client. Control requests
+// and their responses are fixed size messages on a SOCK_SEQPACKET Unix
+// domain socket; audio never goes through the socket but through a ring of
+// frame slots in a memfd the daemon creates, seals and passes to the
+// client, one ring per processor.
+
+#define AP_IPC_VERSION 1
+#define AP_IPC_RING_MAGIC 0x33414952  // "3AIR"
+// 10 ms of 48 kHz stereo
+#define AP_IPC_MAX_FRAME_SAMPLES 960
+#define AP_IPC_RING_SLOTS 4
+
+enum ApIpcType {
+    kApIpcHello = 1,
+    kApIpcProcessorCreate = 2,
+    kApIpcProcessorRelease = 3,
+    kApIpcSetStreamDelayMs = 4,
+    kApIpcSetStreamAnalogLevel = 5,
+    kApIpcProcessorReset = 6,
+    kApIpcGetStats = 7,
+    kApIpcConfigDefaults = 8,
+    kApIpcSetConfig = 9,
+};
+
+struct ApIpcRequest {
+    uint32_t type;
+    uint32_t version;
+    // processor id returned by kApIpcProcessorCreate
+    uint32_t stream;
+    int32_t value;
+    // kApIpcProcessorCreate and kApIpcSetConfig; pointers do not cross processes, the sender clears them
+    _agora_ap_processor_config config;
+};
+
+struct ApIpcResponse {
+    uint32_t type;
+    int32_t ret;
+    uint32_t stream;
+    // kApIpcGetStats
+    _agora_ap_processor_stats stats;
+    // kApIpcConfigDefaults, pointers cleared
+    _agora_ap_processor_config config;
+};
+
+// One frame. The client fills in both halves, the daemon processes the near
+// half in place and sets |ret|.
+struct ApIpcFrameSlot {
+    int32_t sample_rate;
+    int32_t channels;
+    int32_t samples_per_channel;
+    int32_t ref_sample_rate;
+    int32_t ref_channels;
+    int32_t ref_samples_per_channel;
+    int32_t ret;
+    int32_t reserved;
+    int16_t near[AP_IPC_MAX_FRAME_SAMPLES];
+    int16_t ref[AP_IPC_MAX_FRAME_SAMPLES];
+};
+
+// Single producer (the client submits frames), single consumer (the daemon
+// completes them). |submitted| and |completed| are frame counts that only
+// grow, frame n lives in slot[n % AP_IPC_RING_SLOTS]; both are futex words
+// the other side waits on.
+struct ApIpcRing {
+    uint32_t magic;
+    uint32_t version;
+    alignas(64) std::atomic<uint32_t> submitted;
+    alignas(64) std::atomic<uint32_t> completed;
+    alignas(64) ApIpcFrameSlot slot[AP_IPC_RING_SLOTS];
+};
+
+// futex wait while |*word| == |expected|, false on timeout
+bool ApIpcWait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms);
+void ApIpcWake(std::atomic<uint32_t>* word);
+
+// memfd holding an initialized ring, sealed against resizing so a client
+// cannot truncate it under the daemon; -1 on failure
+int ApIpcCreateRing();
+// nullptr if |fd| is not a ring of this version
+ApIpcRing* ApIpcMapRing(int fd);
+void ApIpcUnmapRing(ApIpcRing* ring);
+
+// one message, with |fd| passed along unless it is -1
+bool ApIpcSend(int socket, const void* data, size_t bytes, int fd = -1);
+// one message of exactly |bytes|; |fd| gets a passed descriptor or -1
+bool ApIpcReceive(int socket, void* data, size_t bytes, int* fd = nullptr);
+
+#endif // AGORA_API_3A_IPC_H
@@ -0,0 +1,363 @@
+#include "3a_log.h"
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "3a_thread_ring.h"
+
+// how often the flusher drains the rings
+#define AP_LOG_FLUSH_INTERVAL_MS 20
+
+std::atomic<int> g_ap_log_level(kApLogInfo);
+
+namespace {
+
+// Single producer (the owning thread), single consumer (whoever holds
+// ApLogger::drain_mutex).
+struct ApLogRing {
+    explicit ApLogRing(int capacity)
+        : capacity(capacity), records(new ApLogRecord[capacity]), head(0), tail(0), dropped(0),
+          tid((int)syscall(SYS_gettid)) {}
+
+    const int capacity;
+    std::unique_ptr<ApLogRecord[]> records;
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped;  // ring full, written by the producer
+    uint64_t dropped_reported;      // consumer only
+    const int tid;
+};
+
+struct ApLogger {
+    ApLogger()
+        : file(stdout), ring_slots(256), max_lines_per_second(0), running(false), stop(false),
+          tokens(0), window_begin_ns(0), rate_dropped(0) {}
+
+    ApThreadRings<ApLogRing> rings;
+    std::mutex mutex;  // file, settings
+    FILE* file;
+    int ring_slots;
+    int max_lines_per_second;
+
+    std::condition_variable cond;
+    std::thread thread;
+    bool running;
+    bool stop;
+
+    // held while draining so the flusher and ApLogFlush() never consume together
+    std::mutex drain_mutex;
+    long long tokens;
+    uint64_t window_begin_ns;
+    uint64_t rate_dropped;
+};
+
+ApLogger& logger()
+{
+    static ApLogger* instance = new ApLogger();
+    return *instance;
+}
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// wall clock seconds at steady clock 0, for printing timestamps
+double steady_to_wall_offset()
+{
+    static const double offset = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - now_ns() / 1e9;
+    return offset;
+}
+
+void drain();
+
+void flusher_run()
+{
+    ApLogger& l = logger();
+    std::unique_lock<std::mutex> lock(l.mutex);
+    while (!l.stop) {
+        l.cond.wait_for(lock, std::chrono::milliseconds(AP_LOG_FLUSH_INTERVAL_MS));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+void flush_at_exit()
+{
+    ApLogger& l = logger();
+    {
+        std::lock_guard<std::mutex> lock(l.mutex);
+        l.stop = true;
+        l.cond.notify_one();
+    }
+    if (l.thread.joinable()) {
+        l.thread.join();
+    }
+    drain();
+}
+
+ApLogRing* thread_ring()
+{
+    ApLogger& l = logger();
+    return l.rings.Get([&l]() {
+        std::lock_guard<std::mutex> lock(l.mutex);
+        ApLogRing* ring = new ApLogRing(l.ring_slots);
+        ring->dropped_reported = 0;
+        if (!l.running) {
+            l.running = true;
+            l.thread = std::thread(flusher_run);
+            atexit(flush_at_exit);
+        }
+        return ring;
+    });
+}
+
+// Format |record| the way printf would have. Length modifiers in the format
+// are replaced since every argument was widened when it was packed.
+int format_record(const ApLogRecord& record, char* out, size_t size)
+{
+    size_t used = 0;
+    int arg_index = 0;
+    const char* p = record.format;
+    while (*p != '\0' && used + 1 < size) {
+        if (*p != '%') {
+            out[used++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[used++] = '%';
+            p += 2;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion
+        char spec[32];
+        size_t spec_length = 0;
+        spec[spec_length++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && spec_length < sizeof(spec) - 4) {
+            spec[spec_length++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+            p++;
+        }
+        char conversion = *p;
+        if (conversion == '\0') {
+            break;
+        }
+        p++;
+        if (arg_index >= record.arg_count) {
+            // more conversions than arguments
+            continue;
+        }
+        const ApLogArg& arg = record.args[arg_index++];
+        size_t room = size - used;
+        int written = 0;
+        switch (conversion) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c': {
+            if (conversion != 'c') {
+                spec[spec_length++] = 'l';
+                spec[spec_length++] = 'l';
+            }
+            spec[spec_length++] = conversion;
+            spec[spec_length] = '\0';
+            long long value = arg.type == ApLogArg::kDouble ? (long long)arg.d : arg.i;
+            written = conversion == 'c' ? snprintf(out + used, room, spec, (int)value)
+                                        : snprintf(out + used, room, spec, value);
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+            spec[spec_length++] = conversion;
+            spec[spec_length] = '\0';
+            double value = arg.type == ApLogArg::kDouble ? arg.d
+                         : arg.type == ApLogArg::kUint ? (double)arg.u : (double)arg.i;
+            written = snprintf(out + used, room, spec, value);
+            break;
+        }
+        case 's': {
+            spec[spec_length++] = 's';
+            spec[spec_length] = '\0';
+            const char* value = arg.type == ApLogArg::kString ? record.payload + arg.offset : "(?)";
+            written = snprintf(out + used, room, spec, value);
+            break;
+        }
+        case 'p':
+            written = snprintf(out + used, room, "%p", arg.p);
+            break;
+        default:
+            break;
+        }
+        if (written > 0) {
+            used += (size_t)written < room ? (size_t)written : room - 1;
+        }
+    }
+    out[used] = '\0';
+    return (int)used;
+}
+
+const char* level_name(int level)
+{
+    switch (level) {
+    case kApLogDebug: return "D";
+    case kApLogInfo: return "I";
+    case kApLogWarning: return "W";
+    case kApLogError: return "E";
+    default: return "?";
+    }
+}
+
+// the caller holds drain_mutex, returns false if the line is over the rate limit
+bool take_token(ApLogger& l, int max_lines_per_second, uint64_t now)
+{
+    if (max_lines_per_second <= 0) {
+        return true;
+    }
+    if (now - l.window_begin_ns >= 1000000000ull) {
+        l.window_begin_ns = now;
+        l.tokens = max_lines_per_second;
+    }
+    if (l.tokens <= 0) {
+        l.rate_dropped++;
+        return false;
+    }
+    l.tokens--;
+    return true;
+}
+
+void drain()
+{
+    ApLogger& l = logger();
+    std::lock_guard<std::mutex> drain_lock(l.drain_mutex);
+    // only drain() sweeps, so no ring of the snapshot is freed under it
+    std::vector<ApLogRing*> rings = l.rings.Snapshot();
+    FILE* file;
+    int max_lines_per_second;
+    {
+        std::lock_guard<std::mutex> lock(l.mutex);
+        file = l.file;
+        max_lines_per_second = l.max_lines_per_second;
+    }
+
+    uint64_t rate_dropped = l.rate_dropped;
+    char line[1024];
+    int lines = 0;
+    for (size_t r = 0; r < rings.size(); r++) {
+        ApLogRing* ring = rings[r];
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        for (; tail < head; tail++) {
+            const ApLogRecord& record = ring->records[tail % ring->capacity];
+            if (!take_token(l, max_lines_per_second, now_ns())) {
+                continue;
+            }
+            double wall = steady_to_wall_offset() + record.time_ns / 1e9;
+            time_t seconds = (time_t)wall;
+            struct tm local;
+            localtime_r(&seconds, &local);
+            int prefix = snprintf(line, sizeof(line), "%02d:%02d:%02d.%03d %s %d ", local.tm_hour, local.tm_min,
+                                  local.tm_sec, (int)((wall - seconds) * 1000), level_name(record.level), ring->tid);
+            int length = prefix + format_record(record, line + prefix, sizeof(line) - prefix - 1);
+            if (length == 0 || line[length - 1] != '\n') {
+                line[length++] = '\n';
+            }
+            fwrite(line, 1, length, file);
+            lines++;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+        if (dropped != ring->dropped_reported) {
+            fprintf(file, "[3a log] thread %d dropped %llu lines, ring full\n", ring->tid,
+                    (unsigned long long)(dropped - ring->dropped_reported));
+            ring->dropped_reported = dropped;
+            lines++;
+        }
+    }
+    if (l.rate_dropped != rate_dropped) {
+        fprintf(file, "[3a log] dropped %llu lines over %d lines/s\n",
+                (unsigned long long)(l.rate_dropped - rate_dropped), max_lines_per_second);
+        lines++;
+    }
+    if (lines > 0) {
+        fflush(file);
+    }
+
+    // the threads of retired rings are gone, what they wrote is out now
+    l.rings.Sweep(0, [](const ApLogRing& ring) {
+        return ring.tail.load(std::memory_order_relaxed) == ring.head.load(std::memory_order_acquire) &&
+               ring.dropped.load(std::memory_order_relaxed) == ring.dropped_reported;
+    });
+}
+
+}  // namespace
+
+ApLogRecord* ApLogBegin(int level, const char* format)
+{
+    ApLogRing* ring = thread_ring();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= (uint64_t)ring->capacity) {
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    ApLogRecord* record = &ring->records[head % ring->capacity];
+    record->time_ns = now_ns();
+    record->format = format;
+    record->level = (uint8_t)level;
+    record->arg_count = 0;
+    record->payload_used = 0;
+    return record;
+}
+
+void ApLogCommit()
+{
+    ApLogRing* ring = thread_ring();
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void ApLogLibraryOutput(const char* log)
+{
+    ApLog(kApLogInfo, "%s", log);
+}
+
+int ApLogConfigure(const char* path, int level, int ring_slots, int max_lines_per_second)
+{
+    FILE* file = stdout;
+    if (path != NULL && path[0] != '\0') {
+        file = fopen(path, "a");
+        if (file == NULL) {
+            return -2;
+        }
+    }
+    ApLogger& l = logger();
+    // write what was queued for the old file first
+    ApLogFlush();
+    {
+        std::lock_guard<std::mutex> drain_lock(l.drain_mutex);
+        std::lock_guard<std::mutex> lock(l.mutex);
+        if (l.file != stdout) {
+            fclose(l.file);
+        }
+        l.file = file;
+        if (ring_slots > 0) {
+            l.ring_slots = ring_slots;
+        }
+        l.max_lines_per_second = max_lines_per_second > 0 ? max_lines_per_second : 0;
+    }
+    g_ap_log_level.store(level, std::memory_order_relaxed);
+    return 0;
+}
+
+void ApLogFlush()
+{
+    drain();
+}
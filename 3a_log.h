@@ -0,0 +1,158 @@
+#ifndef AGORA_API_3A_LOG_H
+#define AGORA_API_3A_LOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+// Asynchronous logger. A log call copies the format pointer and the raw
+// arguments into a fixed-size slot of the calling thread's lock-free ring;
+// a background thread formats and writes them, rate limited. A call never
+// blocks: when the ring is full the line is dropped and counted.
+//
+// The format must be a string literal, string arguments are copied.
+
+// same values as AgoraAudioProcessing::LogLevel
+enum ApLogLevel {
+    kApLogDebug = 0x00,
+    kApLogInfo = 0x01,
+    kApLogWarning = 0x02,
+    kApLogError = 0x04,
+};
+
+#define AP_LOG_MAX_ARGS 8
+#define AP_LOG_PAYLOAD_SIZE 352
+
+struct ApLogArg {
+    enum Type { kInt, kUint, kDouble, kPointer, kString };
+    uint8_t type;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void* p;
+        uint32_t offset;  // kString: offset in the record payload
+    };
+};
+
+struct ApLogRecord {
+    uint64_t time_ns;
+    const char* format;
+    uint8_t level;
+    uint8_t arg_count;
+    uint16_t payload_used;
+    ApLogArg args[AP_LOG_MAX_ARGS];
+    char payload[AP_LOG_PAYLOAD_SIZE];
+
+    void Add(long long value) {
+        ApLogArg& arg = args[arg_count++];
+        arg.type = ApLogArg::kInt;
+        arg.i = value;
+    }
+    void Add(unsigned long long value) {
+        ApLogArg& arg = args[arg_count++];
+        arg.type = ApLogArg::kUint;
+        arg.u = value;
+    }
+    void Add(double value) {
+        ApLogArg& arg = args[arg_count++];
+        arg.type = ApLogArg::kDouble;
+        arg.d = value;
+    }
+    void Add(const void* value) {
+        ApLogArg& arg = args[arg_count++];
+        arg.type = ApLogArg::kPointer;
+        arg.p = value;
+    }
+    void AddString(const char* value) {
+        ApLogArg& arg = args[arg_count++];
+        arg.type = ApLogArg::kString;
+        if (value == NULL) {
+            value = "(null)";
+        }
+        if (payload_used >= AP_LOG_PAYLOAD_SIZE) {
+            // payload full, the previous string's terminator reads as ""
+            arg.offset = AP_LOG_PAYLOAD_SIZE - 1;
+            return;
+        }
+        arg.offset = payload_used;
+        // truncate to what is left of the payload
+        size_t room = AP_LOG_PAYLOAD_SIZE - payload_used - 1;
+        size_t length = strlen(value);
+        if (length > room) {
+            length = room;
+        }
+        memcpy(payload + payload_used, value, length);
+        payload[payload_used + length] = '\0';
+        payload_used += (uint16_t)(length + 1);
+    }
+};
+
+// argument packing, integers widen to 64 bits, strings are copied
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+ApLogPack(ApLogRecord& record, T value) { record.Add((long long)value); }
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+ApLogPack(ApLogRecord& record, T value) { record.Add((unsigned long long)value); }
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+ApLogPack(ApLogRecord& record, T value) { record.Add((long long)value); }
+inline void ApLogPack(ApLogRecord& record, double value) { record.Add(value); }
+inline void ApLogPack(ApLogRecord& record, const char* value) { record.AddString(value); }
+inline void ApLogPack(ApLogRecord& record, char* value) { record.AddString(value); }
+inline void ApLogPack(ApLogRecord& record, const std::string& value) { record.AddString(value.c_str()); }
+inline void ApLogPack(ApLogRecord& record, const void* value) { record.Add(value); }
+
+inline void ApLogPackAll(ApLogRecord&) {}
+template <typename T, typename... Rest>
+inline void ApLogPackAll(ApLogRecord& record, const T& value, const Rest&... rest)
+{
+    if (record.arg_count < AP_LOG_MAX_ARGS) {
+        ApLogPack(record, value);
+    }
+    ApLogPackAll(record, rest...);
+}
+
+extern std::atomic<int> g_ap_log_level;
+
+// slot of the calling thread's ring, nullptr if the ring is full
+ApLogRecord* ApLogBegin(int level, const char* format);
+void ApLogCommit();
+
+template <typename... Args>
+inline void ApLog(int level, const char* format, const Args&... args)
+{
+    if (level < g_ap_log_level.load(std::memory_order_relaxed)) {
+        return;
+    }
+    ApLogRecord* record = ApLogBegin(level, format);
+    if (record == nullptr) {
+        return;
+    }
+    ApLogPackAll(*record, args...);
+    ApLogCommit();
+}
+
+#define AP_LOG_DEBUG(...) ApLog(kApLogDebug, __VA_ARGS__)
+#define AP_LOG_INFO(...) ApLog(kApLogInfo, __VA_ARGS__)
+#define AP_LOG_WARNING(...) ApLog(kApLogWarning, __VA_ARGS__)
+#define AP_LOG_ERROR(...) ApLog(kApLogError, __VA_ARGS__)
+
+// matches AgoraAudioProcessing::LogOutputFunc, install it with EnableLogOutput
+void ApLogLibraryOutput(const char* log);
+
+/**
+ * @param path the file to append to, nullptr for stdout.
+ * @param ring_slots slots per thread ring, only for rings created after the call.
+ * @param max_lines_per_second lines beyond are dropped and counted, 0 for no limit.
+ */
+int ApLogConfigure(const char* path, int level, int ring_slots, int max_lines_per_second);
+
+// write everything queued so far, from the calling thread
+void ApLogFlush();
+
+#endif // AGORA_API_3A_LOG_H
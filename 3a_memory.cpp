@@ -0,0 +1,71 @@
+#include "3a_memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+// keeps the payload aligned like malloc
+struct ApMemoryHeader {
+    size_t bytes;
+    size_t reserved;
+};
+
+static std::atomic<long long> g_ap_memory_bytes(0);
+static std::atomic<long long> g_ap_memory_peak_bytes(0);
+static std::atomic<long long> g_ap_memory_allocations(0);
+
+void* ApMemoryAllocate(size_t bytes)
+{
+    ApMemoryHeader* header = static_cast<ApMemoryHeader*>(malloc(sizeof(ApMemoryHeader) + bytes));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->bytes = bytes;
+    long long total = g_ap_memory_bytes.fetch_add((long long)bytes, std::memory_order_relaxed) + (long long)bytes;
+    g_ap_memory_allocations.fetch_add(1, std::memory_order_relaxed);
+    long long peak = g_ap_memory_peak_bytes.load(std::memory_order_relaxed);
+    while (total > peak && !g_ap_memory_peak_bytes.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {
+    }
+    return header + 1;
+}
+
+void ApMemoryFree(void* data)
+{
+    if (data == nullptr) {
+        return;
+    }
+    ApMemoryHeader* header = static_cast<ApMemoryHeader*>(data) - 1;
+    g_ap_memory_bytes.fetch_sub((long long)header->bytes, std::memory_order_relaxed);
+    g_ap_memory_allocations.fetch_sub(1, std::memory_order_relaxed);
+    free(header);
+}
+
+ApMemoryUsage ApMemoryGetUsage()
+{
+    ApMemoryUsage usage;
+    usage.bytes = g_ap_memory_bytes.load(std::memory_order_relaxed);
+    usage.peak_bytes = g_ap_memory_peak_bytes.load(std::memory_order_relaxed);
+    usage.allocations = g_ap_memory_allocations.load(std::memory_order_relaxed);
+    return usage;
+}
+
+size_t ApReadPssBytes()
+{
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    char line[256];
+    unsigned long long kb = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "Pss:", 4) == 0) {
+            sscanf(line + 4, "%llu", &kb);
+            break;
+        }
+    }
+    fclose(file);
+    return (size_t)kb * 1024;
+}
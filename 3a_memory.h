@@ -0,0 +1,50 @@
+#ifndef AGORA_API_3A_MEMORY_H
+#define AGORA_API_3A_MEMORY_H
+
+#include <stddef.h>
+
+#include <memory>
+
+// Accounting of the wrapper's own heap memory: the model copies, the
+// processor state and the dump, capture and flight recorder buffers.
+// Counted allocations carry a small header with their size; the library
+// and everything else still use the global operator new and are not
+// counted.
+
+// throws std::bad_alloc like operator new
+void* ApMemoryAllocate(size_t bytes);
+// |data| from ApMemoryAllocate or nullptr
+void ApMemoryFree(void* data);
+
+struct ApMemoryUsage {
+    long long bytes;        // live counted bytes
+    long long peak_bytes;
+    long long allocations;  // live counted allocations
+};
+ApMemoryUsage ApMemoryGetUsage();
+
+// Base of the wrapper objects whose instances are counted.
+class ApMemoryCounted {
+    public:
+    static void* operator new(size_t bytes) { return ApMemoryAllocate(bytes); }
+    static void operator delete(void* data) { ApMemoryFree(data); }
+    static void* operator new[](size_t bytes) { return ApMemoryAllocate(bytes); }
+    static void operator delete[](void* data) { ApMemoryFree(data); }
+};
+
+// counted byte buffer, the counted replacement of std::unique_ptr<char[]>
+struct ApMemoryBytesDeleter {
+    void operator()(char* data) const { ApMemoryFree(data); }
+};
+typedef std::unique_ptr<char[], ApMemoryBytesDeleter> ApMemoryBytes;
+
+inline char* ApMemoryNewBytes(size_t bytes)
+{
+    return static_cast<char*>(ApMemoryAllocate(bytes));
+}
+
+// proportional set size of the process from /proc/self/smaps_rollup, 0 if
+// unavailable. Walks every mapping, keep it off the capture thread.
+size_t ApReadPssBytes();
+
+#endif // AGORA_API_3A_MEMORY_H
@@ -0,0 +1,185 @@
+#include "3a_metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "3a_log.h"
+
+void ApAppendMetricHeader(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+void ApAppendMetric(std::string& out, const char* name, const char* labels, double value)
+{
+    char line[256];
+    if (labels != NULL && labels[0] != '\0') {
+        snprintf(line, sizeof(line), "%s{%s} %.9g\n", name, labels, value);
+    } else {
+        snprintf(line, sizeof(line), "%s %.9g\n", name, value);
+    }
+    out += line;
+}
+
+ApMetricsExporter::ApMetricsExporter()
+    : unix_socket_(false), interval_ms_(1000), listen_fd_(-1), stop_(false)
+{
+}
+
+ApMetricsExporter::~ApMetricsExporter()
+{
+    Stop();
+}
+
+int ApMetricsExporter::Start(const char* path, bool unix_socket, int interval_ms, RenderFunc render)
+{
+    Stop();
+    if (path == NULL || path[0] == '\0' || interval_ms <= 0) {
+        return -1;
+    }
+    path_ = path;
+    unix_socket_ = unix_socket;
+    interval_ms_ = interval_ms;
+    render_ = render;
+
+    if (unix_socket_) {
+        struct sockaddr_un addr;
+        if (path_.size() >= sizeof(addr.sun_path)) {
+            return -2;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd_ < 0) {
+            AP_LOG_ERROR("metrics exporter: socket: %s\n", strerror(errno));
+            return -3;
+        }
+        unlink(path_.c_str());
+        if (bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd_, 8) != 0) {
+            AP_LOG_ERROR("metrics exporter: cannot listen on %s: %s\n", path_.c_str(), strerror(errno));
+            close(listen_fd_);
+            listen_fd_ = -1;
+            return -3;
+        }
+        fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+    }
+
+    stop_ = false;
+    thread_ = std::thread(&ApMetricsExporter::Run, this);
+    return 0;
+}
+
+void ApMetricsExporter::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        cond_.notify_one();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+        unlink(path_.c_str());
+    }
+}
+
+void ApMetricsExporter::WriteFile(const std::string& text)
+{
+    std::string tmp_path = path_ + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "w");
+    if (file == NULL) {
+        return;
+    }
+    fwrite(text.data(), 1, text.size(), file);
+    fclose(file);
+    // readers never see a half written file
+    rename(tmp_path.c_str(), path_.c_str());
+}
+
+void ApMetricsExporter::ServeClient(int client_fd, const std::string& text)
+{
+    // give the client a moment to send its request line, if any
+    char request[512];
+    struct pollfd pfd = {client_fd, POLLIN, 0};
+    ssize_t n = 0;
+    if (poll(&pfd, 1, 50) > 0) {
+        n = recv(client_fd, request, sizeof(request) - 1, 0);
+    }
+    std::string response;
+    if (n >= 4 && strncmp(request, "GET ", 4) == 0) {
+        char header[128];
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", text.size());
+        response = header;
+    }
+    response += text;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t w = send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (w <= 0) {
+            break;
+        }
+        sent += (size_t)w;
+    }
+    close(client_fd);
+}
+
+void ApMetricsExporter::Run()
+{
+    std::string text = render_();
+    if (!unix_socket_) {
+        WriteFile(text);
+    }
+    std::chrono::steady_clock::time_point next_refresh =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(interval_ms_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        if (unix_socket_) {
+            // wait for scrapes until the next refresh, in short slices so Stop() is quick
+            lock.unlock();
+            struct pollfd pfd = {listen_fd_, POLLIN, 0};
+            if (poll(&pfd, 1, 100) > 0) {
+                int client_fd = accept(listen_fd_, NULL, NULL);
+                if (client_fd >= 0) {
+                    ServeClient(client_fd, text);
+                }
+            }
+            lock.lock();
+        } else {
+            cond_.wait_until(lock, next_refresh);
+        }
+        if (stop_) {
+            break;
+        }
+        if (std::chrono::steady_clock::now() >= next_refresh) {
+            lock.unlock();
+            text = render_();
+            if (!unix_socket_) {
+                WriteFile(text);
+            }
+            lock.lock();
+            next_refresh = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval_ms_);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef AGORA_API_3A_METRICS_H
+#define AGORA_API_3A_METRICS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "3a_stats.h"
+
+// Counters of one capture thread. Only the owner thread writes them, the
+// exporter merges all threads on read, so the hot path touches no shared
+// cache line. A block outlives its thread so the totals stay monotonic.
+struct ApThreadCounters {
+    ApLatencyHistogram frame_cost;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> recoveries;
+
+    ApThreadCounters() {
+        frames = 0;
+        errors = 0;
+        recoveries = 0;
+    }
+
+    // owner thread only
+    static void Bump(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// Prometheus text format helpers
+void ApAppendMetricHeader(std::string& out, const char* name, const char* type, const char* help);
+void ApAppendMetric(std::string& out, const char* name, const char* labels, double value);
+
+// Serves the text rendered by a callback, refreshed every interval_ms by a
+// background thread, either as a file (written to a temporary file and
+// renamed, for a textfile collector) or on a Unix-domain socket. Socket
+// clients that send an HTTP GET get an HTTP response, others the bare text.
+class ApMetricsExporter {
+    public:
+    typedef std::function<std::string()> RenderFunc;
+
+    ApMetricsExporter();
+    ~ApMetricsExporter();
+
+    // @return 0 on success, < 0 if the socket can not be set up
+    int Start(const char* path, bool unix_socket, int interval_ms, RenderFunc render);
+    void Stop();
+
+    private:
+    void Run();
+    void WriteFile(const std::string& text);
+    void ServeClient(int client_fd, const std::string& text);
+
+    std::string path_;
+    bool unix_socket_;
+    int interval_ms_;
+    int listen_fd_;
+    RenderFunc render_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
+};
+
+#endif // AGORA_API_3A_METRICS_H
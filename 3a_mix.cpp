@@ -0,0 +1,533 @@
+#include "3a_mix.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void ApMixDownmixToMono(const int16_t* in, int channels, int samples_per_channel, int16_t* out)
+{
+    // out[i] is written after in[i * channels ...] is read, in place is safe
+    if (channels == 2) {
+        for (int i = 0; i < samples_per_channel; i++) {
+            out[i] = (int16_t)(((int32_t)in[2 * i] + in[2 * i + 1]) >> 1);
+        }
+        return;
+    }
+    for (int i = 0; i < samples_per_channel; i++) {
+        int32_t sum = 0;
+        for (int c = 0; c < channels; c++) {
+            sum += in[i * channels + c];
+        }
+        out[i] = (int16_t)(sum / channels);
+    }
+}
+
+#if defined(__SSE2__)
+// 8 vectors of 8 lanes, row r lane c to row c lane r
+static inline void ap_mix_transpose8x8(__m128i* r)
+{
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+#endif
+
+// blocks of 8 sample frames, returns how many frames were converted
+static int ap_mix_deinterleave_simd(const int16_t* in, int channels, int samples_per_channel, int16_t* const* out)
+{
+    int blocks = samples_per_channel / 8;
+#if defined(__SSE2__)
+    if (channels == 2) {
+        for (int b = 0; b < blocks; b++) {
+            const __m128i* src = (const __m128i*)(in + b * 16);
+            __m128i v0 = _mm_loadu_si128(src);
+            __m128i v1 = _mm_loadu_si128(src + 1);
+            // sign extended 32 bit lanes, the pack cannot saturate
+            __m128i left = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 16), _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16));
+            __m128i right = _mm_packs_epi32(_mm_srai_epi32(v0, 16), _mm_srai_epi32(v1, 16));
+            _mm_storeu_si128((__m128i*)(out[0] + b * 8), left);
+            _mm_storeu_si128((__m128i*)(out[1] + b * 8), right);
+        }
+        return blocks * 8;
+    }
+    if (channels == 4) {
+        for (int b = 0; b < blocks; b++) {
+            const __m128i* src = (const __m128i*)(in + b * 32);
+            // two frames per vector
+            __m128i v0 = _mm_loadu_si128(src);
+            __m128i v1 = _mm_loadu_si128(src + 1);
+            __m128i v2 = _mm_loadu_si128(src + 2);
+            __m128i v3 = _mm_loadu_si128(src + 3);
+            __m128i a = _mm_unpacklo_epi16(v0, v1);
+            __m128i c = _mm_unpackhi_epi16(v0, v1);
+            __m128i d = _mm_unpacklo_epi16(v2, v3);
+            __m128i e = _mm_unpackhi_epi16(v2, v3);
+            __m128i lo01 = _mm_unpacklo_epi16(a, c);  // channels 0 and 1 of frames 0-3
+            __m128i lo23 = _mm_unpackhi_epi16(a, c);
+            __m128i hi01 = _mm_unpacklo_epi16(d, e);  // frames 4-7
+            __m128i hi23 = _mm_unpackhi_epi16(d, e);
+            _mm_storeu_si128((__m128i*)(out[0] + b * 8), _mm_unpacklo_epi64(lo01, hi01));
+            _mm_storeu_si128((__m128i*)(out[1] + b * 8), _mm_unpackhi_epi64(lo01, hi01));
+            _mm_storeu_si128((__m128i*)(out[2] + b * 8), _mm_unpacklo_epi64(lo23, hi23));
+            _mm_storeu_si128((__m128i*)(out[3] + b * 8), _mm_unpackhi_epi64(lo23, hi23));
+        }
+        return blocks * 8;
+    }
+    if (channels == 8) {
+        for (int b = 0; b < blocks; b++) {
+            const __m128i* src = (const __m128i*)(in + b * 64);
+            __m128i r[8];
+            for (int i = 0; i < 8; i++) {
+                r[i] = _mm_loadu_si128(src + i);
+            }
+            ap_mix_transpose8x8(r);
+            for (int c = 0; c < 8; c++) {
+                _mm_storeu_si128((__m128i*)(out[c] + b * 8), r[c]);
+            }
+        }
+        return blocks * 8;
+    }
+#elif defined(__ARM_NEON)
+    if (channels == 2) {
+        for (int b = 0; b < blocks; b++) {
+            int16x8x2_t v = vld2q_s16(in + b * 16);
+            vst1q_s16(out[0] + b * 8, v.val[0]);
+            vst1q_s16(out[1] + b * 8, v.val[1]);
+        }
+        return blocks * 8;
+    }
+    if (channels == 4) {
+        for (int b = 0; b < blocks; b++) {
+            int16x8x4_t v = vld4q_s16(in + b * 32);
+            for (int c = 0; c < 4; c++) {
+                vst1q_s16(out[c] + b * 8, v.val[c]);
+            }
+        }
+        return blocks * 8;
+    }
+    if (channels == 8) {
+        for (int b = 0; b < blocks; b++) {
+            // lane pairs of channels c and c + 4, frames 0-3 and 4-7
+            int16x8x4_t lo = vld4q_s16(in + b * 64);
+            int16x8x4_t hi = vld4q_s16(in + b * 64 + 32);
+            for (int c = 0; c < 4; c++) {
+                int16x8x2_t v = vuzpq_s16(lo.val[c], hi.val[c]);
+                vst1q_s16(out[c] + b * 8, v.val[0]);
+                vst1q_s16(out[c + 4] + b * 8, v.val[1]);
+            }
+        }
+        return blocks * 8;
+    }
+#endif
+    (void)in;
+    (void)channels;
+    (void)out;
+    (void)blocks;
+    return 0;
+}
+
+static int ap_mix_interleave_simd(const int16_t* const* in, int channels, int samples_per_channel, int16_t* out)
+{
+    int blocks = samples_per_channel / 8;
+#if defined(__SSE2__)
+    if (channels == 2) {
+        for (int b = 0; b < blocks; b++) {
+            __m128i left = _mm_loadu_si128((const __m128i*)(in[0] + b * 8));
+            __m128i right = _mm_loadu_si128((const __m128i*)(in[1] + b * 8));
+            __m128i* dst = (__m128i*)(out + b * 16);
+            _mm_storeu_si128(dst, _mm_unpacklo_epi16(left, right));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(left, right));
+        }
+        return blocks * 8;
+    }
+    if (channels == 4) {
+        for (int b = 0; b < blocks; b++) {
+            __m128i p0 = _mm_loadu_si128((const __m128i*)(in[0] + b * 8));
+            __m128i p1 = _mm_loadu_si128((const __m128i*)(in[1] + b * 8));
+            __m128i p2 = _mm_loadu_si128((const __m128i*)(in[2] + b * 8));
+            __m128i p3 = _mm_loadu_si128((const __m128i*)(in[3] + b * 8));
+            __m128i lo01 = _mm_unpacklo_epi16(p0, p1);  // frames 0-3
+            __m128i hi01 = _mm_unpackhi_epi16(p0, p1);  // frames 4-7
+            __m128i lo23 = _mm_unpacklo_epi16(p2, p3);
+            __m128i hi23 = _mm_unpackhi_epi16(p2, p3);
+            __m128i* dst = (__m128i*)(out + b * 32);
+            _mm_storeu_si128(dst, _mm_unpacklo_epi32(lo01, lo23));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi32(lo01, lo23));
+            _mm_storeu_si128(dst + 2, _mm_unpacklo_epi32(hi01, hi23));
+            _mm_storeu_si128(dst + 3, _mm_unpackhi_epi32(hi01, hi23));
+        }
+        return blocks * 8;
+    }
+    if (channels == 8) {
+        for (int b = 0; b < blocks; b++) {
+            __m128i r[8];
+            for (int c = 0; c < 8; c++) {
+                r[c] = _mm_loadu_si128((const __m128i*)(in[c] + b * 8));
+            }
+            ap_mix_transpose8x8(r);
+            __m128i* dst = (__m128i*)(out + b * 64);
+            for (int i = 0; i < 8; i++) {
+                _mm_storeu_si128(dst + i, r[i]);
+            }
+        }
+        return blocks * 8;
+    }
+#elif defined(__ARM_NEON)
+    if (channels == 2) {
+        for (int b = 0; b < blocks; b++) {
+            int16x8x2_t v;
+            v.val[0] = vld1q_s16(in[0] + b * 8);
+            v.val[1] = vld1q_s16(in[1] + b * 8);
+            vst2q_s16(out + b * 16, v);
+        }
+        return blocks * 8;
+    }
+    if (channels == 4) {
+        for (int b = 0; b < blocks; b++) {
+            int16x8x4_t v;
+            for (int c = 0; c < 4; c++) {
+                v.val[c] = vld1q_s16(in[c] + b * 8);
+            }
+            vst4q_s16(out + b * 32, v);
+        }
+        return blocks * 8;
+    }
+    if (channels == 8) {
+        for (int b = 0; b < blocks; b++) {
+            int16x8x4_t lo;
+            int16x8x4_t hi;
+            for (int c = 0; c < 4; c++) {
+                int16x8x2_t v = vzipq_s16(vld1q_s16(in[c] + b * 8), vld1q_s16(in[c + 4] + b * 8));
+                lo.val[c] = v.val[0];
+                hi.val[c] = v.val[1];
+            }
+            vst4q_s16(out + b * 64, lo);
+            vst4q_s16(out + b * 64 + 32, hi);
+        }
+        return blocks * 8;
+    }
+#endif
+    (void)in;
+    (void)channels;
+    (void)out;
+    (void)blocks;
+    return 0;
+}
+
+void ApMixDeinterleave(const int16_t* in, int channels, int samples_per_channel, int16_t* const* out)
+{
+    int done = ap_mix_deinterleave_simd(in, channels, samples_per_channel, out);
+    for (int i = done; i < samples_per_channel; i++) {
+        for (int c = 0; c < channels; c++) {
+            out[c][i] = in[i * channels + c];
+        }
+    }
+}
+
+void ApMixInterleave(const int16_t* const* in, int channels, int samples_per_channel, int16_t* out)
+{
+    int done = ap_mix_interleave_simd(in, channels, samples_per_channel, out);
+    for (int i = done; i < samples_per_channel; i++) {
+        for (int c = 0; c < channels; c++) {
+            out[i * channels + c] = in[c][i];
+        }
+    }
+}
+
+static inline int16_t ap_mix_saturate(int32_t value)
+{
+    return (int16_t)(value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+}
+
+void ApMixAddScaled(int16_t* acc, const int16_t* src, int count, int gain_q14)
+{
+    int i = 0;
+    if (gain_q14 == AP_MIX_GAIN_UNITY) {
+#if defined(__AVX2__)
+        for (; i + 16 <= count; i += 16) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+            _mm256_storeu_si256((__m256i*)(acc + i), _mm256_adds_epi16(a, b));
+        }
+#endif
+#if defined(__SSE2__)
+        for (; i + 8 <= count; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(acc + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(acc + i), _mm_adds_epi16(a, b));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 8 <= count; i += 8) {
+            vst1q_s16(acc + i, vqaddq_s16(vld1q_s16(acc + i), vld1q_s16(src + i)));
+        }
+#endif
+        for (; i < count; i++) {
+            acc[i] = ap_mix_saturate((int32_t)acc[i] + src[i]);
+        }
+        return;
+    }
+    // 32 bit products, rounded back to Q0 and narrowed with saturation
+#if defined(__AVX2__)
+    {
+        const __m256i gain = _mm256_set1_epi16((int16_t)gain_q14);
+        const __m256i round = _mm256_set1_epi32(1 << 13);
+        for (; i + 16 <= count; i += 16) {
+            __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+            __m256i lo = _mm256_mullo_epi16(b, gain);
+            __m256i hi = _mm256_mulhi_epi16(b, gain);
+            __m256i p0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round), 14);
+            __m256i p1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round), 14);
+            // unpack and pack both work within 128 bit lanes, the order is kept
+            __m256i scaled = _mm256_packs_epi32(p0, p1);
+            __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+            _mm256_storeu_si256((__m256i*)(acc + i), _mm256_adds_epi16(a, scaled));
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i gain = _mm_set1_epi16((int16_t)gain_q14);
+        const __m128i round = _mm_set1_epi32(1 << 13);
+        for (; i + 8 <= count; i += 8) {
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo = _mm_mullo_epi16(b, gain);
+            __m128i hi = _mm_mulhi_epi16(b, gain);
+            __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), 14);
+            __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), 14);
+            __m128i a = _mm_loadu_si128((const __m128i*)(acc + i));
+            _mm_storeu_si128((__m128i*)(acc + i), _mm_adds_epi16(a, _mm_packs_epi32(p0, p1)));
+        }
+    }
+#elif defined(__ARM_NEON)
+    {
+        const int16x4_t gain = vdup_n_s16((int16_t)gain_q14);
+        for (; i + 8 <= count; i += 8) {
+            int16x8_t b = vld1q_s16(src + i);
+            int16x4_t s0 = vqrshrn_n_s32(vmull_s16(vget_low_s16(b), gain), 14);
+            int16x4_t s1 = vqrshrn_n_s32(vmull_s16(vget_high_s16(b), gain), 14);
+            vst1q_s16(acc + i, vqaddq_s16(vld1q_s16(acc + i), vcombine_s16(s0, s1)));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        int16_t scaled = ap_mix_saturate(((int32_t)src[i] * gain_q14 + (1 << 13)) >> 14);
+        acc[i] = ap_mix_saturate((int32_t)acc[i] + scaled);
+    }
+}
+
+uint64_t ApMixEnergy(const int16_t* samples, int count)
+{
+    uint64_t energy = 0;
+    int i = 0;
+    // a pair of squares is at most 2^31, it fits a 32 bit lane read as unsigned
+#if defined(__AVX2__)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i sum = zero;
+        for (; i + 16 <= count; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(samples + i));
+            __m256i squares = _mm256_madd_epi16(v, v);
+            sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(squares, zero));
+            sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(squares, zero));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, sum);
+        energy += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = zero;
+        for (; i + 8 <= count; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(samples + i));
+            __m128i squares = _mm_madd_epi16(v, v);
+            sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(squares, zero));
+            sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(squares, zero));
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, sum);
+        energy += lanes[0] + lanes[1];
+    }
+#elif defined(__ARM_NEON)
+    {
+        int64x2_t sum = vdupq_n_s64(0);
+        for (; i + 8 <= count; i += 8) {
+            int16x8_t v = vld1q_s16(samples + i);
+            sum = vpadalq_s32(sum, vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+            sum = vpadalq_s32(sum, vmull_s16(vget_high_s16(v), vget_high_s16(v)));
+        }
+        energy += (uint64_t)(vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1));
+    }
+#endif
+    for (; i < count; i++) {
+        energy += (uint64_t)((int32_t)samples[i] * samples[i]);
+    }
+    return energy;
+}
+
+ApRefMixer::ApRefMixer(int sample_rate, int channels, float silence_dbfs)
+    : sample_rate_(sample_rate), channels_(channels), last_silent_(0), last_resampled_(0)
+{
+    silence_mean_square_ = 32768.0 * 32768.0 * pow(10.0, silence_dbfs / 10.0);
+}
+
+const int16_t* ApRefMixer::ConvertChannels(const Source& source)
+{
+    if (source.channels == channels_) {
+        return source.samples;
+    }
+    size_t samples = (size_t)source.samples_per_channel;
+    if (layout_.size() < samples * channels_) {
+        layout_.resize(samples * channels_);
+    }
+    if (channels_ == 1) {
+        ApMixDownmixToMono(source.samples, source.channels, source.samples_per_channel, layout_.data());
+    } else {
+        // mono to every output channel
+        for (size_t i = 0; i < samples; i++) {
+            for (int c = 0; c < channels_; c++) {
+                layout_[i * channels_ + c] = source.samples[i];
+            }
+        }
+    }
+    return layout_.data();
+}
+
+const int16_t* ApRefMixer::AntiAlias(int index, const int16_t* in, int in_samples)
+{
+    AntiAliasFilter& filter = anti_alias_[index];
+    if (filter.in_samples != in_samples) {
+        // the Butterworth poles in pairs, RBJ low-pass biquads at 0.4 of the output rate
+        double w0 = 2.0 * M_PI * 0.4 * samples_per_channel() / in_samples;
+        double cos_w0 = cos(w0);
+        for (int s = 0; s < AP_MIX_ANTI_ALIAS_SECTIONS; s++) {
+            double q = 1.0 / (2.0 * cos((2 * s + 1) * M_PI / (4 * AP_MIX_ANTI_ALIAS_SECTIONS)));
+            double alpha = sin(w0) / (2.0 * q);
+            double a0 = 1.0 + alpha;
+            filter.coefficients[s][0] = (float)((1.0 - cos_w0) / 2.0 / a0);
+            filter.coefficients[s][1] = (float)((1.0 - cos_w0) / a0);
+            filter.coefficients[s][2] = filter.coefficients[s][0];
+            filter.coefficients[s][3] = (float)(-2.0 * cos_w0 / a0);
+            filter.coefficients[s][4] = (float)((1.0 - alpha) / a0);
+        }
+        memset(filter.state, 0, sizeof(filter.state));
+        filter.in_samples = in_samples;
+    }
+    if (filtered_.size() < (size_t)in_samples * channels_) {
+        filtered_.resize((size_t)in_samples * channels_);
+    }
+    for (int c = 0; c < channels_; c++) {
+        for (int i = 0; i < in_samples; i++) {
+            float x = in[(size_t)i * channels_ + c];
+            for (int s = 0; s < AP_MIX_ANTI_ALIAS_SECTIONS; s++) {
+                // transposed direct form II
+                const float* k = filter.coefficients[s];
+                float* z = filter.state[c][s];
+                float y = k[0] * x + z[0];
+                z[0] = k[1] * x - k[3] * y + z[1];
+                z[1] = k[2] * x - k[4] * y;
+                x = y;
+            }
+            filtered_[(size_t)i * channels_ + c] = ap_mix_saturate((int32_t)lrintf(x));
+        }
+    }
+    return filtered_.data();
+}
+
+const int16_t* ApRefMixer::Resample(int index, const int16_t* in, int in_samples)
+{
+    const int out_samples = samples_per_channel();
+    if (resampled_.size() < (size_t)out_samples * channels_) {
+        resampled_.resize((size_t)out_samples * channels_);
+    }
+    int16_t* history = &history_[(size_t)index * channels_];
+    // output j sits at input position (j + 1) * in / out - 1, the last
+    // samples line up and the position before the first input sample is
+    // the last sample of the previous frame
+    for (int j = 0; j < out_samples; j++) {
+        int64_t position = (int64_t)(j + 1) * in_samples - out_samples;
+        int64_t whole = position >= 0 ? position / out_samples : -1;
+        int64_t fraction = position - whole * out_samples;
+        for (int c = 0; c < channels_; c++) {
+            int32_t x0 = whole < 0 ? history[c] : in[whole * channels_ + c];
+            int32_t x1 = fraction == 0 ? x0 : in[(whole + 1) * channels_ + c];
+            resampled_[(size_t)j * channels_ + c] = (int16_t)(x0 + (int32_t)((x1 - x0) * fraction / out_samples));
+        }
+    }
+    return resampled_.data();
+}
+
+int ApRefMixer::Mix(const Source* sources, int count, int16_t* out)
+{
+    const int out_samples = samples_per_channel();
+    memset(out, 0, (size_t)out_samples * channels_ * sizeof(int16_t));
+    if (history_.size() < (size_t)count * channels_) {
+        history_.resize((size_t)count * channels_, 0);
+        anti_alias_.resize(count);
+    }
+    int mixed = 0;
+    last_silent_ = 0;
+    last_resampled_ = 0;
+    for (int i = 0; i < count; i++) {
+        const Source& source = sources[i];
+        int16_t* history = &history_[(size_t)i * channels_];
+        int in_count = source.samples_per_channel * source.channels;
+        if (source.samples == nullptr || source.gain_q14 <= 0 || in_count <= 0) {
+            memset(history, 0, channels_ * sizeof(int16_t));
+            anti_alias_[i].in_samples = 0;
+            continue;
+        }
+        if ((double)ApMixEnergy(source.samples, in_count) < silence_mean_square_ * in_count) {
+            memset(history, 0, channels_ * sizeof(int16_t));
+            anti_alias_[i].in_samples = 0;
+            last_silent_++;
+            continue;
+        }
+        const int16_t* converted = ConvertChannels(source);
+        if (source.samples_per_channel > out_samples) {
+            converted = AntiAlias(i, converted, source.samples_per_channel);
+        } else {
+            anti_alias_[i].in_samples = 0;
+        }
+        const int16_t* samples = converted;
+        if (source.samples_per_channel != out_samples) {
+            samples = Resample(i, converted, source.samples_per_channel);
+            last_resampled_++;
+        }
+        memcpy(history, converted + (size_t)(source.samples_per_channel - 1) * channels_, channels_ * sizeof(int16_t));
+        ApMixAddScaled(out, samples, out_samples * channels_, source.gain_q14);
+        mixed++;
+    }
+    return mixed;
+}
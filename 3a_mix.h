@@ -0,0 +1,94 @@
+#ifndef AGORA_API_3A_MIX_H
+#define AGORA_API_3A_MIX_H
+
+#include <stdint.h>
+
+#include <vector>
+
+// Channel layout conversions of interleaved 16 bit PCM frames.
+
+// mean of the |channels| channels of |in| into mono |out|, |out| may be |in|
+void ApMixDownmixToMono(const int16_t* in, int channels, int samples_per_channel, int16_t* out);
+
+// split interleaved |in| into one buffer per channel, out[c] gets channel c.
+// SSE2 or NEON for 2, 4 and 8 channels, scalar otherwise
+void ApMixDeinterleave(const int16_t* in, int channels, int samples_per_channel, int16_t* const* out);
+// inverse of ApMixDeinterleave
+void ApMixInterleave(const int16_t* const* in, int channels, int samples_per_channel, int16_t* out);
+
+// unity gain of ApMixAddScaled
+#define AP_MIX_GAIN_UNITY 16384
+
+// acc[i] = saturate(acc[i] + src[i] * gain_q14 / AP_MIX_GAIN_UNITY), gain_q14
+// 0 to 32767 (just under 2.0). AVX2, SSE2 or NEON
+void ApMixAddScaled(int16_t* acc, const int16_t* src, int count, int gain_q14);
+// sum of the squared samples, exact
+uint64_t ApMixEnergy(const int16_t* samples, int count);
+
+// sections of the anti-alias low-pass of ApRefMixer, an 8th order Butterworth
+#define AP_MIX_ANTI_ALIAS_SECTIONS 4
+
+// Mixes the remote streams of a call into one AEC reference frame. Each
+// source is converted to the output channel count, linearly resampled when
+// its rate differs and added with its gain, saturating. A source above the
+// output rate is low-passed at 0.8 of the output Nyquist first, or what is
+// above the output Nyquist would fold back into the band. A source whose
+// mean square is below the silence threshold costs one pass over its
+// samples and is skipped. The resampler and the low-pass carry state of
+// every source across frames, so source |i| has to be the same stream
+// every frame.
+class ApRefMixer {
+    public:
+    struct Source {
+        const int16_t* samples;  // interleaved, nullptr when the source has no audio this frame
+        int sample_rate;
+        int channels;            // 1 or 2
+        int samples_per_channel;
+        int gain_q14;            // AP_MIX_GAIN_UNITY is unity
+    };
+
+    ApRefMixer(int sample_rate, int channels, float silence_dbfs);
+
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+    int samples_per_channel() const { return sample_rate_ / 100; }
+
+    /**
+     * Mix one 10 ms frame of |count| sources into |out|, which has room for
+     * samples_per_channel() * channels() samples.
+     *
+     * @return sources mixed, silent and empty ones are not counted.
+     */
+    int Mix(const Source* sources, int count, int16_t* out);
+
+    // counters of the last Mix()
+    int last_silent() const { return last_silent_; }
+    int last_resampled() const { return last_resampled_; }
+
+    private:
+    // |source| in the output channel layout, at its own rate
+    const int16_t* ConvertChannels(const Source& source);
+    // |in| in the output channel layout, low-passed for decimation
+    const int16_t* AntiAlias(int index, const int16_t* in, int in_samples);
+    const int16_t* Resample(int index, const int16_t* in, int in_samples);
+
+    struct AntiAliasFilter {
+        int in_samples;  // the coefficients are for this input length, 0 restarts the filter
+        float coefficients[AP_MIX_ANTI_ALIAS_SECTIONS][5];  // b0 b1 b2 a1 a2, normalized
+        float state[2][AP_MIX_ANTI_ALIAS_SECTIONS][2];      // per channel and section
+    };
+
+    const int sample_rate_;
+    const int channels_;
+    double silence_mean_square_;
+    // previous frame's last sample per source and channel, for the resampler
+    std::vector<int16_t> history_;
+    std::vector<AntiAliasFilter> anti_alias_;
+    std::vector<int16_t> layout_;
+    std::vector<int16_t> filtered_;
+    std::vector<int16_t> resampled_;
+    int last_silent_;
+    int last_resampled_;
+};
+
+#endif // AGORA_API_3A_MIX_H
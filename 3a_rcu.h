@@ -0,0 +1,92 @@
+#ifndef AGORA_API_3A_RCU_H
+#define AGORA_API_3A_RCU_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+
+// Latest value published by any thread, taken by one consumer thread that
+// never locks.
+//
+// Publish() copies the value into a heap node and swaps it into an atomic
+// pointer. A node that is swapped out was never taken, so no reader can hold
+// it and it is freed at once. Take() swaps the pointer with nullptr: the
+// consumer owns the node it took, so no grace period has to be waited for.
+// It copies the value out and retires the node to a lock free list that the
+// next Publish() frees. The consumer never locks, allocates or frees.
+// Publishers are serialized among themselves, so the version of the value
+// in the slot is always version() and a newer value is never replaced by
+// an older one.
+template <typename T>
+class ApRcuSlot {
+    public:
+    ApRcuSlot() : latest_(nullptr), retired_(nullptr), version_(0) {}
+    ~ApRcuSlot() {
+        delete latest_.exchange(nullptr, std::memory_order_acquire);
+        FreeRetired();
+    }
+
+    // any thread; values published before the consumer took one are
+    // coalesced, the last one wins. Returns the version of |value|.
+    uint64_t Publish(const T& value) {
+        Node* node = new Node();
+        node->value = value;
+        std::lock_guard<std::mutex> lock(publish_mutex_);
+        uint64_t version = version_.load(std::memory_order_relaxed) + 1;
+        node->version = version;
+        version_.store(version, std::memory_order_relaxed);
+        delete latest_.exchange(node, std::memory_order_acq_rel);
+        FreeRetired();
+        return version;
+    }
+
+    // consumer thread only, lock free: copy out the value published since
+    // the last Take(), false if there is none
+    bool Take(T* value, uint64_t* version) {
+        Node* node = latest_.exchange(nullptr, std::memory_order_acquire);
+        if (node == nullptr) {
+            return false;
+        }
+        *value = node->value;
+        *version = node->version;
+        // the consumer is the only thread pushing, publishers only take the
+        // whole list, so the head cannot come back under the CAS (no ABA)
+        Node* head = retired_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!retired_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return true;
+    }
+
+    // version of the last Publish(), 0 before the first
+    uint64_t version() const {
+        return version_.load(std::memory_order_relaxed);
+    }
+
+    private:
+    struct Node {
+        T value;
+        uint64_t version;
+        Node* next;
+    };
+
+    void FreeRetired() {
+        Node* node = retired_.exchange(nullptr, std::memory_order_acquire);
+        while (node != nullptr) {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    ApRcuSlot(const ApRcuSlot&) = delete;
+    ApRcuSlot& operator=(const ApRcuSlot&) = delete;
+
+    std::mutex publish_mutex_;
+    std::atomic<Node*> latest_;
+    std::atomic<Node*> retired_;
+    std::atomic<uint64_t> version_;
+};
+
+#endif // AGORA_API_3A_RCU_H
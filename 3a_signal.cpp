@@ -0,0 +1,447 @@
+#include "3a_signal.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// seed of the instances that measure the level of a source type
+#define AP_SIGNAL_CALIBRATION_SEED 0x5eedull
+#define AP_SIGNAL_CALIBRATION_SECONDS 4
+
+namespace {
+
+// splitmix64, the same sequence everywhere
+class ApSignalRandom {
+    public:
+    explicit ApSignalRandom(uint64_t seed) : state_(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    // [0, 1)
+    float Uniform() { return (float)(Next() >> 40) * (1.0f / 16777216.0f); }
+    float Uniform(float low, float high) { return low + (high - low) * Uniform(); }
+    // unit variance, sum of four uniforms
+    float Gaussian() { return (Uniform() + Uniform() + Uniform() + Uniform() - 2.0f) * 1.7320508f; }
+
+    private:
+    uint64_t state_;
+};
+
+uint64_t ap_signal_seed(uint32_t seed, uint32_t stream)
+{
+    ApSignalRandom random(((uint64_t)seed << 32) | stream);
+    return random.Next();
+}
+
+// RBJ band pass, 0 dB peak gain
+class ApResonator {
+    public:
+    ApResonator() : b0_(0), a1_(0), a2_(0), x1_(0), x2_(0), y1_(0), y2_(0) {}
+
+    void Set(float frequency, float q, int sample_rate) {
+        double w0 = 2.0 * M_PI * frequency / sample_rate;
+        double alpha = sin(w0) / (2.0 * q);
+        double a0 = 1.0 + alpha;
+        b0_ = (float)(alpha / a0);
+        a1_ = (float)(-2.0 * cos(w0) / a0);
+        a2_ = (float)((1.0 - alpha) / a0);
+    }
+
+    float Process(float x) {
+        float y = b0_ * (x - x2_) - a1_ * y1_ - a2_ * y2_;
+        x2_ = x1_;
+        x1_ = x;
+        y2_ = y1_;
+        y1_ = y;
+        return y;
+    }
+
+    private:
+    float b0_, a1_, a2_;
+    float x1_, x2_, y1_, y2_;
+};
+
+} // namespace
+
+// One mono signal, roughly unit rms while active once calibrated.
+class ApSignalSource {
+    public:
+    virtual ~ApSignalSource() {}
+    virtual float Next() = 0;
+};
+
+namespace {
+
+class ApSpeechSource : public ApSignalSource {
+    public:
+    ApSpeechSource(int sample_rate, uint64_t seed)
+        : random_(seed), sample_rate_(sample_rate), talking_(false), state_left_(0), syllable_length_(1),
+          syllable_left_(0), voiced_(false), f0_(0), pitch_phase_(0) {
+        base_f0_ = random_.Uniform(100.0f, 220.0f);
+        // start inside a pause of random length, two generators drift apart
+        state_left_ = (int)(random_.Uniform(0.05f, 0.6f) * sample_rate_);
+    }
+
+    float Next() override {
+        if (state_left_ <= 0) {
+            talking_ = !talking_;
+            state_left_ = (int)((talking_ ? random_.Uniform(0.8f, 2.5f) : random_.Uniform(0.3f, 1.2f)) * sample_rate_);
+            syllable_left_ = 0;
+        }
+        state_left_--;
+        if (talking_ && syllable_left_ <= 0) {
+            StartSyllable();
+        }
+
+        float excitation = 0;
+        if (talking_ && voiced_) {
+            pitch_phase_ += f0_ / sample_rate_;
+            if (pitch_phase_ >= 1.0f) {
+                pitch_phase_ -= 1.0f;
+                // pulse energy per second independent of the pitch
+                excitation = 4.0f * sqrtf(150.0f / f0_);
+                // jitter
+                f0_ = std::max(60.0f, f0_ * random_.Uniform(0.98f, 1.02f));
+            }
+            excitation += 0.1f * random_.Gaussian();
+        } else if (talking_) {
+            excitation = 0.6f * random_.Gaussian();
+        }
+        float y = formants_[0].Process(excitation) + 0.5f * formants_[1].Process(excitation) +
+                  0.25f * formants_[2].Process(excitation);
+        if (!talking_) {
+            return 0;
+        }
+        float t = (float)(syllable_length_ - syllable_left_) / syllable_length_;
+        syllable_left_--;
+        float envelope = sinf((float)M_PI * t);
+        return y * envelope;
+    }
+
+    private:
+    void StartSyllable() {
+        syllable_length_ = std::max(1, (int)(random_.Uniform(0.12f, 0.3f) * sample_rate_));
+        syllable_left_ = syllable_length_;
+        voiced_ = random_.Uniform() < 0.75f;
+        f0_ = base_f0_ * random_.Uniform(0.85f, 1.15f);
+        float nyquist_margin = 0.45f * sample_rate_;
+        formants_[0].Set(std::min(random_.Uniform(300.0f, 800.0f), nyquist_margin), 5.0f, sample_rate_);
+        formants_[1].Set(std::min(random_.Uniform(900.0f, 2300.0f), nyquist_margin), 8.0f, sample_rate_);
+        formants_[2].Set(std::min(random_.Uniform(2300.0f, 3200.0f), nyquist_margin), 10.0f, sample_rate_);
+    }
+
+    ApSignalRandom random_;
+    const int sample_rate_;
+    float base_f0_;
+    bool talking_;
+    int state_left_;
+    int syllable_length_;
+    int syllable_left_;
+    bool voiced_;
+    float f0_;
+    float pitch_phase_;
+    ApResonator formants_[3];
+};
+
+class ApWhiteNoiseSource : public ApSignalSource {
+    public:
+    explicit ApWhiteNoiseSource(uint64_t seed) : random_(seed) {}
+    float Next() override { return random_.Gaussian(); }
+
+    private:
+    ApSignalRandom random_;
+};
+
+// Paul Kellet's pink filter
+class ApPinkNoiseSource : public ApSignalSource {
+    public:
+    explicit ApPinkNoiseSource(uint64_t seed) : random_(seed) {
+        std::fill(b_, b_ + 7, 0.0f);
+    }
+
+    float Next() override {
+        float white = random_.Gaussian();
+        b_[0] = 0.99886f * b_[0] + white * 0.0555179f;
+        b_[1] = 0.99332f * b_[1] + white * 0.0750759f;
+        b_[2] = 0.96900f * b_[2] + white * 0.1538520f;
+        b_[3] = 0.86650f * b_[3] + white * 0.3104856f;
+        b_[4] = 0.55000f * b_[4] + white * 0.5329522f;
+        b_[5] = -0.7616f * b_[5] - white * 0.0168980f;
+        float pink = b_[0] + b_[1] + b_[2] + b_[3] + b_[4] + b_[5] + b_[6] + white * 0.5362f;
+        b_[6] = white * 0.115926f;
+        return pink;
+    }
+
+    private:
+    ApSignalRandom random_;
+    float b_[7];
+};
+
+// pink noise whose level wanders by -12..+6 dB every 100 ms, with 5 ms
+// transients (keyboard, door) in about 2% of the 10 ms blocks
+class ApNonStationaryNoiseSource : public ApSignalSource {
+    public:
+    ApNonStationaryNoiseSource(int sample_rate, uint64_t seed)
+        : pink_(seed), random_(seed ^ 0x7a11ull), sample_rate_(sample_rate), sample_(0), level_(1.0f),
+          target_(1.0f), burst_left_(0), burst_level_(0) {
+        // ~200 ms time constant
+        smoothing_ = 1.0f - expf(-1.0f / (0.2f * sample_rate_));
+    }
+
+    float Next() override {
+        int block = sample_rate_ / 100;
+        if (sample_ % (block * 10) == 0) {
+            target_ = powf(10.0f, random_.Uniform(-12.0f, 6.0f) / 20.0f);
+        }
+        if (sample_ % block == 0 && burst_left_ == 0 && random_.Uniform() < 0.02f) {
+            burst_left_ = sample_rate_ / 200;
+            burst_level_ = 4.0f;
+        }
+        sample_++;
+        level_ += (target_ - level_) * smoothing_;
+        float value = pink_.Next() * level_;
+        if (burst_left_ > 0) {
+            burst_left_--;
+            value += random_.Gaussian() * burst_level_;
+            burst_level_ *= 0.999f;
+        }
+        return value;
+    }
+
+    private:
+    ApPinkNoiseSource pink_;
+    ApSignalRandom random_;
+    const int sample_rate_;
+    uint64_t sample_;
+    float level_;
+    float target_;
+    float smoothing_;
+    int burst_left_;
+    float burst_level_;
+};
+
+ApSignalSource* ap_signal_create_speech(int sample_rate, uint64_t seed)
+{
+    return new ApSpeechSource(sample_rate, seed);
+}
+
+ApSignalSource* ap_signal_create_noise(ApSignalNoise noise, int sample_rate, uint64_t seed)
+{
+    switch (noise) {
+        case kApSignalNoiseWhite:
+            return new ApWhiteNoiseSource(seed);
+        case kApSignalNoisePink:
+            return new ApPinkNoiseSource(seed);
+        case kApSignalNoiseNonStationary:
+            return new ApNonStationaryNoiseSource(sample_rate, seed);
+        default:
+            return nullptr;
+    }
+}
+
+// 1 / rms of the active (non zero) samples of a calibration instance
+float ap_signal_calibrate(ApSignalSource* source, int sample_rate)
+{
+    std::unique_ptr<ApSignalSource> owner(source);
+    double energy = 0;
+    uint64_t active = 0;
+    int samples = sample_rate * AP_SIGNAL_CALIBRATION_SECONDS;
+    for (int i = 0; i < samples; i++) {
+        float value = source->Next();
+        if (value != 0.0f) {
+            energy += (double)value * value;
+            active++;
+        }
+    }
+    return active > 0 && energy > 0 ? (float)(1.0 / sqrt(energy / active)) : 0.0f;
+}
+
+float ap_signal_amplitude(float dbfs)
+{
+    return 32768.0f * powf(10.0f, dbfs / 20.0f);
+}
+
+// direct sound, a few early reflections and an exponentially decaying
+// noise tail, unit energy
+std::vector<float> ap_signal_room_impulse_response(int sample_rate, int rir_ms, int rt60_ms, uint64_t seed)
+{
+    ApSignalRandom random(seed);
+    size_t length = std::max<size_t>(1, (size_t)rir_ms * sample_rate / 1000);
+    std::vector<float> rir(length, 0.0f);
+    rir[0] = 1.0f;
+    for (int i = 0; i < 6; i++) {
+        size_t tap = (size_t)(random.Uniform(0.001f, 0.02f) * sample_rate);
+        if (tap < length) {
+            rir[tap] += (random.Uniform() < 0.5f ? -1.0f : 1.0f) * random.Uniform(0.2f, 0.6f);
+        }
+    }
+    // 60 dB of decay over rt60
+    float decay = rt60_ms > 0 ? -6.9078f / (rt60_ms * 0.001f * sample_rate) : -1e9f;
+    for (size_t i = (size_t)(0.005f * sample_rate); i < length; i++) {
+        rir[i] += 0.3f * random.Gaussian() * expf(decay * i);
+    }
+    double energy = 0;
+    for (size_t i = 0; i < length; i++) {
+        energy += (double)rir[i] * rir[i];
+    }
+    float scale = (float)(1.0 / sqrt(energy));
+    for (size_t i = 0; i < length; i++) {
+        rir[i] *= scale;
+    }
+    return rir;
+}
+
+int16_t ap_signal_saturate(float value)
+{
+    if (value > 32767.0f) {
+        return 32767;
+    }
+    if (value < -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)lrintf(value);
+}
+
+} // namespace
+
+ApSignalGenerator::ApSignalGenerator(const ApSignalConfig& config)
+    : config_(config), near_gain_(0), far_gain_(0), noise_gain_(0), far_pos_(0), echo_delay_(0)
+{
+    int sample_rate = std::max(config_.sample_rate, 8000);
+    int channel_count = std::max(config_.channels, 1);
+    ApSignalScenario scenario = config_.scenario;
+    bool near_speech = scenario == kApSignalNearOnly || scenario == kApSignalDoubleTalk;
+    bool far_speech = scenario == kApSignalFarOnly || scenario == kApSignalDoubleTalk;
+    bool noise = scenario != kApSignalSilence && config_.noise != kApSignalNoiseNone;
+
+    if (near_speech) {
+        near_speech_.reset(ap_signal_create_speech(sample_rate, ap_signal_seed(config_.seed, 1)));
+        near_gain_ = ap_signal_amplitude(config_.near_level_dbfs) *
+                     ap_signal_calibrate(ap_signal_create_speech(sample_rate, AP_SIGNAL_CALIBRATION_SEED), sample_rate);
+    }
+    if (far_speech) {
+        far_speech_.reset(ap_signal_create_speech(sample_rate, ap_signal_seed(config_.seed, 2)));
+        far_gain_ = ap_signal_amplitude(config_.far_level_dbfs) *
+                    ap_signal_calibrate(ap_signal_create_speech(sample_rate, AP_SIGNAL_CALIBRATION_SEED), sample_rate);
+    }
+    if (noise) {
+        noise_gain_ = ap_signal_amplitude(config_.noise_level_dbfs) *
+                      ap_signal_calibrate(ap_signal_create_noise(config_.noise, sample_rate, AP_SIGNAL_CALIBRATION_SEED), sample_rate);
+    }
+
+    size_t max_rir = 0;
+    channels_.resize(channel_count);
+    for (int c = 0; c < channel_count; c++) {
+        Channel& channel = channels_[c];
+        if (noise) {
+            channel.noise.reset(ap_signal_create_noise(config_.noise, sample_rate, ap_signal_seed(config_.seed, 100 + c)));
+        }
+        if (!far_speech) {
+            continue;
+        }
+        if (!config_.rir.empty()) {
+            channel.rir = config_.rir;
+        } else {
+            channel.rir = ap_signal_room_impulse_response(sample_rate, config_.rir_ms, config_.rt60_ms,
+                                                          ap_signal_seed(config_.seed, 200 + c));
+            float gain = powf(10.0f, config_.echo_gain_db / 20.0f);
+            for (size_t i = 0; i < channel.rir.size(); i++) {
+                channel.rir[i] *= gain;
+            }
+        }
+        // reversed, the convolution then walks the history forward
+        std::reverse(channel.rir.begin(), channel.rir.end());
+        max_rir = std::max(max_rir, channel.rir.size());
+    }
+    if (far_speech) {
+        echo_delay_ = (size_t)std::max(config_.echo_delay_ms, 0) * sample_rate / 1000;
+        // every sample is stored twice, a window never wraps
+        far_history_.assign(2 * (echo_delay_ + max_rir), 0.0f);
+    }
+}
+
+ApSignalGenerator::~ApSignalGenerator()
+{
+}
+
+void ApSignalGenerator::Generate(int16_t* near, int16_t* far, int samples_per_channel)
+{
+    int channel_count = (int)channels_.size();
+    size_t history = far_history_.size() / 2;
+    for (int i = 0; i < samples_per_channel; i++) {
+        float far_value = 0;
+        if (far_speech_) {
+            far_value = far_speech_->Next() * far_gain_;
+            far_history_[far_pos_] = far_value;
+            far_history_[far_pos_ + history] = far_value;
+            far_pos_ = far_pos_ + 1 == history ? 0 : far_pos_ + 1;
+        }
+        float near_value = near_speech_ ? near_speech_->Next() * near_gain_ : 0.0f;
+        for (int c = 0; c < channel_count; c++) {
+            Channel& channel = channels_[c];
+            float value = near_value;
+            if (far_speech_) {
+                size_t length = channel.rir.size();
+                const float* window = &far_history_[far_pos_ + history - echo_delay_ - length];
+                const float* rir = channel.rir.data();
+                float echo = 0;
+                for (size_t k = 0; k < length; k++) {
+                    echo += rir[k] * window[k];
+                }
+                value += echo;
+            }
+            if (channel.noise) {
+                value += channel.noise->Next() * noise_gain_;
+            }
+            if (near != nullptr) {
+                near[i * channel_count + c] = ap_signal_saturate(value);
+            }
+            if (far != nullptr) {
+                far[i * channel_count + c] = ap_signal_saturate(far_value);
+            }
+        }
+    }
+}
+
+static const char* const kApSignalScenarioNames[] = {"silence", "near", "far", "doubletalk", "noise"};
+static const char* const kApSignalNoiseNames[] = {"none", "white", "pink", "nonstationary"};
+
+const char* ApSignalGenerator::ScenarioName(ApSignalScenario scenario)
+{
+    return scenario >= kApSignalSilence && scenario <= kApSignalNoiseOnly ? kApSignalScenarioNames[scenario] : "unknown";
+}
+
+bool ApSignalGenerator::ParseScenario(const std::string& name, ApSignalScenario* scenario)
+{
+    for (int i = kApSignalSilence; i <= kApSignalNoiseOnly; i++) {
+        if (name == kApSignalScenarioNames[i]) {
+            *scenario = (ApSignalScenario)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* ApSignalGenerator::NoiseName(ApSignalNoise noise)
+{
+    return noise >= kApSignalNoiseNone && noise <= kApSignalNoiseNonStationary ? kApSignalNoiseNames[noise] : "unknown";
+}
+
+bool ApSignalGenerator::ParseNoise(const std::string& name, ApSignalNoise* noise)
+{
+    for (int i = kApSignalNoiseNone; i <= kApSignalNoiseNonStationary; i++) {
+        if (name == kApSignalNoiseNames[i]) {
+            *noise = (ApSignalNoise)i;
+            return true;
+        }
+    }
+    return false;
+}
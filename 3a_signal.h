@@ -0,0 +1,105 @@
+#ifndef AGORA_API_3A_SIGNAL_H
+#define AGORA_API_3A_SIGNAL_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// What the generator puts on the near (microphone) and far (reference) side.
+enum ApSignalScenario {
+    kApSignalSilence = 0,     // digital silence on both sides
+    kApSignalNearOnly = 1,    // near speech and noise, far silent
+    kApSignalFarOnly = 2,     // far speech, near is its echo and noise
+    kApSignalDoubleTalk = 3,  // far speech, near is near speech, echo and noise
+    kApSignalNoiseOnly = 4,   // near noise, far silent
+};
+
+enum ApSignalNoise {
+    kApSignalNoiseNone = 0,
+    kApSignalNoiseWhite = 1,
+    kApSignalNoisePink = 2,
+    // pink noise with a wandering level and short transients
+    kApSignalNoiseNonStationary = 3,
+};
+
+struct ApSignalConfig {
+    int sample_rate;
+    int channels;
+    uint32_t seed;
+    ApSignalScenario scenario;
+    ApSignalNoise noise;
+    // rms while talking, the noise rms
+    float near_level_dbfs;
+    float far_level_dbfs;
+    float noise_level_dbfs;
+    // echo path: a pure delay, then the room impulse response scaled to
+    // echo_gain_db of energy gain
+    int echo_delay_ms;
+    float echo_gain_db;
+    // synthesized impulse response: length and 60 dB decay time
+    int rir_ms;
+    int rt60_ms;
+    // impulse response at sample_rate used as is instead of the synthesized
+    // one, echo_gain_db is not applied to it
+    std::vector<float> rir;
+
+    ApSignalConfig()
+        : sample_rate(48000), channels(1), seed(1), scenario(kApSignalDoubleTalk), noise(kApSignalNoisePink),
+          near_level_dbfs(-26.0f), far_level_dbfs(-26.0f), noise_level_dbfs(-55.0f), echo_delay_ms(60),
+          echo_gain_db(-10.0f), rir_ms(64), rt60_ms(200) {}
+};
+
+class ApSignalSource;
+
+// Deterministic test signals for the process APIs: the same config and
+// seed give the same samples on every run. Frames are generated on
+// demand, nothing touches the disk.
+//
+// Speech is modulated noise and a jittered pulse train shaped by three
+// moving formants, in talk spurts and pauses. Echo is the far speech
+// delayed and convolved with the impulse response, directly in the time
+// domain: about rir_ms * sample_rate / 1000 multiply-adds per sample and
+// channel, pre-render when that matters.
+class ApSignalGenerator {
+    public:
+    explicit ApSignalGenerator(const ApSignalConfig& config);
+    ~ApSignalGenerator();
+
+    // next |samples_per_channel| samples of each side, interleaved, either may be nullptr
+    void Generate(int16_t* near, int16_t* far, int samples_per_channel);
+
+    const ApSignalConfig& config() const { return config_; }
+
+    static const char* ScenarioName(ApSignalScenario scenario);
+    // false if |name| is unknown
+    static bool ParseScenario(const std::string& name, ApSignalScenario* scenario);
+    static const char* NoiseName(ApSignalNoise noise);
+    static bool ParseNoise(const std::string& name, ApSignalNoise* noise);
+
+    private:
+    struct Channel {
+        std::vector<float> rir;
+        std::unique_ptr<ApSignalSource> noise;
+    };
+
+    ApSignalGenerator(const ApSignalGenerator&);
+    ApSignalGenerator& operator=(const ApSignalGenerator&);
+
+    const ApSignalConfig config_;
+    std::unique_ptr<ApSignalSource> near_speech_;
+    std::unique_ptr<ApSignalSource> far_speech_;
+    std::vector<Channel> channels_;
+    float near_gain_;
+    float far_gain_;
+    float noise_gain_;
+
+    // far speech history, the newest sample at far_history_[far_pos_ - 1]
+    std::vector<float> far_history_;
+    size_t far_pos_;
+    size_t echo_delay_;
+    std::vector<float> far_frame_;
+};
+
+#endif // AGORA_API_3A_SIGNAL_H
@@ -0,0 +1,178 @@
+#ifndef AGORA_API_3A_STATS_H
+#define AGORA_API_3A_STATS_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "3a.h"
+
+// Log-linear (HDR style) latency histogram in ns: values below
+// AGORA_AP_HIST_SUB_BUCKETS get one bucket each, every power of two above
+// is split into AGORA_AP_HIST_SUB_BUCKETS buckets, ~6% relative error.
+inline int ap_histogram_bucket(uint64_t value_ns)
+{
+    if (value_ns < AGORA_AP_HIST_SUB_BUCKETS) {
+        return (int)value_ns;
+    }
+    int msb = 63 - __builtin_clzll(value_ns);
+    int index = (msb - 3) * AGORA_AP_HIST_SUB_BUCKETS + (int)((value_ns >> (msb - 4)) & (AGORA_AP_HIST_SUB_BUCKETS - 1));
+    return index < AGORA_AP_HIST_BUCKETS ? index : AGORA_AP_HIST_BUCKETS - 1;
+}
+
+// smallest value that lands in |index|
+inline uint64_t ap_histogram_bucket_lower(int index)
+{
+    if (index < AGORA_AP_HIST_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int msb = index / AGORA_AP_HIST_SUB_BUCKETS + 3;
+    uint64_t sub = (uint64_t)(index % AGORA_AP_HIST_SUB_BUCKETS);
+    return (AGORA_AP_HIST_SUB_BUCKETS + sub) << (msb - 4);
+}
+
+// largest value that lands in |index|
+inline uint64_t ap_histogram_bucket_upper(int index)
+{
+    if (index < AGORA_AP_HIST_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int msb = index / AGORA_AP_HIST_SUB_BUCKETS + 3;
+    return ap_histogram_bucket_lower(index) + (1ull << (msb - 4)) - 1;
+}
+
+// value at or below which |percentile| (0-100) percent of the samples fall
+inline uint64_t ap_histogram_percentile(const _agora_ap_latency_histogram& histogram, double percentile)
+{
+    if (histogram.count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * histogram.count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < AGORA_AP_HIST_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= rank) {
+            // the bucket bound can overshoot the largest sample
+            uint64_t upper = ap_histogram_bucket_upper(i);
+            return upper < histogram.max_ns ? upper : histogram.max_ns;
+        }
+    }
+    return histogram.max_ns;
+}
+
+// Single writer histogram. The counters are relaxed atomics so a reader on
+// another thread is race free; use ApSeqLock for a consistent snapshot.
+class ApLatencyHistogram {
+    public:
+    ApLatencyHistogram() {
+        Clear();
+    }
+
+    void Clear() {
+        count_.store(0, std::memory_order_relaxed);
+        min_ns_.store(UINT64_MAX, std::memory_order_relaxed);
+        max_ns_.store(0, std::memory_order_relaxed);
+        sum_ns_.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < AGORA_AP_HIST_BUCKETS; i++) {
+            buckets_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // owner thread only
+    void Record(uint64_t value_ns) {
+        Bump(buckets_[ap_histogram_bucket(value_ns)], 1);
+        Bump(count_, 1);
+        Bump(sum_ns_, value_ns);
+        if (value_ns < min_ns_.load(std::memory_order_relaxed)) {
+            min_ns_.store(value_ns, std::memory_order_relaxed);
+        }
+        if (value_ns > max_ns_.load(std::memory_order_relaxed)) {
+            max_ns_.store(value_ns, std::memory_order_relaxed);
+        }
+    }
+
+    void CopyTo(_agora_ap_latency_histogram* out) const {
+        out->count = count_.load(std::memory_order_relaxed);
+        out->min_ns = out->count ? min_ns_.load(std::memory_order_relaxed) : 0;
+        out->max_ns = max_ns_.load(std::memory_order_relaxed);
+        out->sum_ns = sum_ns_.load(std::memory_order_relaxed);
+        for (int i = 0; i < AGORA_AP_HIST_BUCKETS; i++) {
+            out->buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    private:
+    // a load and a store, no locked instruction: there is one writer
+    static void Bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> min_ns_;
+    std::atomic<uint64_t> max_ns_;
+    std::atomic<uint64_t> sum_ns_;
+    std::atomic<uint64_t> buckets_[AGORA_AP_HIST_BUCKETS];
+};
+
+// Sequence lock for one writer and any number of readers. The writer never
+// blocks; a reader retries while a write is in progress or happened during
+// its copy.
+class ApSeqLock {
+    public:
+    ApSeqLock() : sequence_(0) {}
+
+    void BeginWrite() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    void EndWrite() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // |read| copies the protected data, it is called again until the copy is consistent
+    template <typename ReadFunc>
+    void Read(ReadFunc read) const {
+        while (true) {
+            uint64_t begin = sequence_.load(std::memory_order_acquire);
+            if (begin & 1) {
+                continue;
+            }
+            read();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence_.load(std::memory_order_relaxed) == begin) {
+                return;
+            }
+        }
+    }
+
+    private:
+    std::atomic<uint64_t> sequence_;
+};
+
+// Per processor statistics, written by the capture thread only.
+struct ApProcessorStats {
+    ApSeqLock lock;
+    ApLatencyHistogram process_stream;
+    ApLatencyHistogram process_reverse_stream;
+    ApLatencyHistogram total;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> stream_errors;
+    std::atomic<uint64_t> reverse_stream_errors;
+    std::atomic<uint32_t> algorithm_latency_ms;
+    std::atomic<uint32_t> algorithm_latency_sp;
+    std::atomic<uint32_t> aec_estimated_delay_ms;
+
+    ApProcessorStats() {
+        frames = 0;
+        stream_errors = 0;
+        reverse_stream_errors = 0;
+        algorithm_latency_ms = 0;
+        algorithm_latency_sp = 0;
+        aec_estimated_delay_ms = 0;
+    }
+};
+
+#endif // AGORA_API_3A_STATS_H
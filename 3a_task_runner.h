@@ -0,0 +1,139 @@
+#ifndef AGORA_API_3A_TASK_RUNNER_H
+#define AGORA_API_3A_TASK_RUNNER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "3a_memory.h"
+
+// A single background thread draining a FIFO of tasks.
+// Used by the wrapper to move slow work (Reset, file I/O, ...) off the
+// capture thread. The thread is started lazily on the first Post().
+class ApTaskRunner {
+    public:
+    ApTaskRunner() : running_(false), stop_(false) {}
+    ~ApTaskRunner() {
+        Stop();
+    }
+
+    void Post(std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+            return;
+        }
+        tasks_.push_back(std::move(task));
+        if (!running_) {
+            running_ = true;
+            thread_ = std::thread(&ApTaskRunner::Run, this);
+        }
+        cond_.notify_one();
+    }
+
+    // run all queued tasks, then join the thread
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            cond_.notify_one();
+        }
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cond_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                break;
+            }
+            std::function<void()> task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> tasks_;
+    std::thread thread_;
+    bool running_;
+    bool stop_;
+};
+
+// The one thread that writes the dump, capture, flight recorder and WAV
+// files of the whole process. Writers hand it whole batches, so the
+// capture threads never wait on the disk. Never destroyed, so a writer
+// closed during exit still finds it.
+inline ApTaskRunner& ApIoRunner()
+{
+    static ApTaskRunner* instance = new ApTaskRunner();
+    return *instance;
+}
+
+// Batch buffers of one writer, passed to ApIoRunner() and handed back once
+// written. Up to |max_buffers| are allocated on demand and then recycled.
+class ApBufferPool {
+    public:
+    ApBufferPool(size_t buffer_bytes, int max_buffers)
+        : buffer_bytes_(buffer_bytes), max_buffers_(max_buffers), allocated_(0) {}
+
+    size_t buffer_bytes() const { return buffer_bytes_; }
+
+    // false if every buffer is queued for writing
+    bool Take(ApMemoryBytes* data) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return TakeLocked(data);
+    }
+    // waits for a buffer to come back if every buffer is queued
+    void TakeWait(ApMemoryBytes* data) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this, data] { return TakeLocked(data); });
+    }
+    // any thread, usually the I/O thread once |data| is written
+    void Give(ApMemoryBytes data) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(data));
+        cond_.notify_all();
+    }
+    // waits until every buffer taken was given back
+    void WaitIdle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return (int)free_.size() == allocated_; });
+    }
+
+    private:
+    bool TakeLocked(ApMemoryBytes* data) {
+        if (!free_.empty()) {
+            *data = std::move(free_.back());
+            free_.pop_back();
+            return true;
+        }
+        if (allocated_ < max_buffers_) {
+            allocated_++;
+            data->reset(ApMemoryNewBytes(buffer_bytes_));
+            return true;
+        }
+        return false;
+    }
+
+    ApBufferPool(const ApBufferPool&) = delete;
+    ApBufferPool& operator=(const ApBufferPool&) = delete;
+
+    const size_t buffer_bytes_;
+    const int max_buffers_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<ApMemoryBytes> free_;
+    int allocated_;  // under mutex_
+};
+
+#endif // AGORA_API_3A_TASK_RUNNER_H
@@ -0,0 +1,103 @@
+#ifndef AGORA_API_3A_THREAD_RING_H
+#define AGORA_API_3A_THREAD_RING_H
+
+#include <stddef.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Rings that each belong to one writing thread, read by one consumer that
+// walks all of them, as the log and the trace keep their events.
+//
+// A thread gets its ring from Get() and keeps it in a thread_local holder.
+// When the thread exits the holder retires the ring: nothing writes to it
+// any more, but what it holds is still read. The consumer frees retired
+// rings with Sweep() once it has taken everything out of them. A ring is
+// only freed by Sweep(), so a Snapshot() stays valid for as long as the
+// caller keeps Sweep() from running, by calling both from the one consumer
+// or under one lock.
+//
+// The holder is per Ring type, so there is one ApThreadRings per Ring type.
+template <typename Ring>
+class ApThreadRings {
+    public:
+    // the ring of the calling thread, made by |make| on its first call
+    template <typename Make>
+    Ring* Get(Make make) {
+        Holder& holder = ThreadHolder();
+        if (holder.ring == nullptr) {
+            Ring* ring = make();
+            std::lock_guard<std::mutex> lock(mutex_);
+            live_.emplace_back(ring);
+            holder.ring = ring;
+            holder.owner = this;
+        }
+        return holder.ring;
+    }
+
+    // every ring, live or retired, in the order they were made
+    std::vector<Ring*> Snapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Ring*> rings;
+        rings.reserve(live_.size() + retired_.size());
+        for (size_t i = 0; i < retired_.size(); i++) {
+            rings.push_back(retired_[i].get());
+        }
+        for (size_t i = 0; i < live_.size(); i++) {
+            rings.push_back(live_[i].get());
+        }
+        return rings;
+    }
+
+    // frees the retired rings |drained| returns true for, except the |keep|
+    // most recently retired ones
+    template <typename Drained>
+    void Sweep(size_t keep, Drained drained) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t end = retired_.size() > keep ? retired_.size() - keep : 0;
+        size_t kept = 0;
+        for (size_t i = 0; i < retired_.size(); i++) {
+            if (i >= end || !drained(*retired_[i])) {
+                retired_[kept++] = std::move(retired_[i]);
+            }
+        }
+        retired_.resize(kept);
+    }
+
+    private:
+    struct Holder {
+        Holder() : ring(nullptr), owner(nullptr) {}
+        ~Holder() {
+            if (ring != nullptr) {
+                owner->Retire(ring);
+                ring = nullptr;
+            }
+        }
+
+        Ring* ring;
+        ApThreadRings* owner;
+    };
+
+    static Holder& ThreadHolder() {
+        static thread_local Holder holder;
+        return holder;
+    }
+
+    void Retire(Ring* ring) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < live_.size(); i++) {
+            if (live_[i].get() == ring) {
+                retired_.push_back(std::move(live_[i]));
+                live_.erase(live_.begin() + i);
+                return;
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Ring>> live_;
+    std::vector<std::unique_ptr<Ring>> retired_;  // oldest first
+};
+
+#endif  // AGORA_API_3A_THREAD_RING_H
@@ -0,0 +1,195 @@
+#include "3a_trace.h"
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "3a_task_runner.h"
+#include "3a_thread_ring.h"
+
+// minimum time between two anomaly flushes
+#define AP_TRACE_ANOMALY_INTERVAL_NS (5ull * 1000 * 1000 * 1000)
+// rings of exited threads kept for the next flush when none ran since
+#define AP_TRACE_RETIRED_RINGS 8
+
+std::atomic<bool> g_ap_trace_enabled(false);
+
+namespace {
+
+// Slots are relaxed atomics so a flush can read a ring while its thread
+// writes; slots overwritten during the copy are dropped.
+struct ApTraceEvent {
+    std::atomic<uintptr_t> name;
+    std::atomic<uint64_t> begin_ns;
+    std::atomic<uint64_t> duration_and_arg;  // duration ns << 32 | arg
+};
+
+struct ApTraceRing {
+    explicit ApTraceRing(int capacity)
+        : capacity(capacity), events(new ApTraceEvent[capacity]), head(0), tid((int)syscall(SYS_gettid)) {}
+
+    const int capacity;
+    std::unique_ptr<ApTraceEvent[]> events;
+    std::atomic<uint64_t> head;
+    const int tid;
+};
+
+struct ApTracer {
+    ApTracer() : events_per_thread(16384), anomaly_frame_ns(0), last_anomaly_ns(0) {}
+
+    ApThreadRings<ApTraceRing> rings;
+    // held while a flush reads the rings, retired rings are only swept under it
+    std::mutex flush_mutex;
+    std::mutex mutex;
+    int events_per_thread;
+    std::string anomaly_dir;
+    std::atomic<uint64_t> anomaly_frame_ns;
+    std::atomic<uint64_t> last_anomaly_ns;
+    ApTaskRunner flusher;
+};
+
+ApTracer& tracer()
+{
+    static ApTracer* instance = new ApTracer();
+    return *instance;
+}
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ApTraceRing* thread_ring()
+{
+    ApTracer& t = tracer();
+    return t.rings.Get([&t]() {
+        // threads come and go without a flush in between, keep the newest few
+        std::unique_lock<std::mutex> flush_lock(t.flush_mutex, std::try_to_lock);
+        if (flush_lock.owns_lock()) {
+            t.rings.Sweep(AP_TRACE_RETIRED_RINGS, [](const ApTraceRing&) { return true; });
+        }
+        std::lock_guard<std::mutex> lock(t.mutex);
+        return new ApTraceRing(t.events_per_thread);
+    });
+}
+
+}  // namespace
+
+void ApTraceSpan(const char* name, uint64_t begin_ns, uint64_t end_ns, uint32_t arg)
+{
+    ApTraceRing* ring = thread_ring();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ApTraceEvent& event = ring->events[head % ring->capacity];
+    uint64_t duration_ns = end_ns > begin_ns ? end_ns - begin_ns : 0;
+    if (duration_ns > 0xffffffffull) {
+        duration_ns = 0xffffffffull;
+    }
+    // pairs with the acquire fence of ApTraceFlush: a reader that sees one of
+    // these stores also sees |head| at least at this slot, like ApSeqLock
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store((uintptr_t)name, std::memory_order_relaxed);
+    event.begin_ns.store(begin_ns, std::memory_order_relaxed);
+    event.duration_and_arg.store(duration_ns << 32 | arg, std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t ApTraceAnomalyFrameNs()
+{
+    return tracer().anomaly_frame_ns.load(std::memory_order_relaxed);
+}
+
+void ApTraceAnomaly(const char* reason)
+{
+    if (!ApTraceEnabled()) {
+        return;
+    }
+    ApTracer& t = tracer();
+    uint64_t now = now_ns();
+    uint64_t last = t.last_anomaly_ns.load(std::memory_order_relaxed);
+    if (last != 0 && now - last < AP_TRACE_ANOMALY_INTERVAL_NS) {
+        return;
+    }
+    if (!t.last_anomaly_ns.compare_exchange_strong(last, now)) {
+        return;
+    }
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        dir = t.anomaly_dir;
+    }
+    if (dir.empty()) {
+        return;
+    }
+    if (dir.back() != '/') {
+        dir += '/';
+    }
+    char name[128];
+    snprintf(name, sizeof(name), "trace_%ld_%s.json", (long)time(NULL), reason);
+    std::string path = dir + name;
+    t.flusher.Post([path]() { ApTraceFlush(path.c_str()); });
+}
+
+int ApTraceFlush(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    ApTracer& t = tracer();
+    std::lock_guard<std::mutex> flush_lock(t.flush_mutex);
+    std::vector<ApTraceRing*> rings = t.rings.Snapshot();
+
+    int pid = (int)getpid();
+    int count = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t r = 0; r < rings.size(); r++) {
+        ApTraceRing* ring = rings[r];
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > (uint64_t)ring->capacity ? head - ring->capacity : 0;
+        for (uint64_t i = begin; i < head; i++) {
+            ApTraceEvent& event = ring->events[i % ring->capacity];
+            const char* name = (const char*)event.name.load(std::memory_order_relaxed);
+            uint64_t begin_ns = event.begin_ns.load(std::memory_order_relaxed);
+            uint64_t duration_and_arg = event.duration_and_arg.load(std::memory_order_relaxed);
+            // the writer lapped us while we copied this slot; it overwrites
+            // event i once head reaches i + capacity, before head moves on
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (ring->head.load(std::memory_order_relaxed) - i >= (uint64_t)ring->capacity) {
+                continue;
+            }
+            fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"3a\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"id\":%u}}\n",
+                    count ? "," : "", name, begin_ns / 1000.0, (duration_and_arg >> 32) / 1000.0, pid, ring->tid,
+                    (unsigned)(duration_and_arg & 0xffffffffu));
+            count++;
+        }
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+
+    // the rings of exited threads are in this file, later ones would repeat them
+    t.rings.Sweep(0, [](const ApTraceRing&) { return true; });
+    return count;
+}
+
+void ApTraceConfigure(bool enabled, int events_per_thread, const char* anomaly_dir, int anomaly_frame_us)
+{
+    ApTracer& t = tracer();
+    {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        // rings already created keep their size
+        if (events_per_thread > 0) {
+            t.events_per_thread = events_per_thread;
+        }
+        t.anomaly_dir = anomaly_dir != NULL ? anomaly_dir : "";
+    }
+    t.anomaly_frame_ns.store(anomaly_frame_us > 0 ? (uint64_t)anomaly_frame_us * 1000 : 0, std::memory_order_relaxed);
+    g_ap_trace_enabled.store(enabled, std::memory_order_relaxed);
+}
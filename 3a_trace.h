@@ -0,0 +1,41 @@
+#ifndef AGORA_API_3A_TRACE_H
+#define AGORA_API_3A_TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Opt-in span tracing into per-thread ring buffers, flushed as Chrome trace
+// JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Callers read ApTraceEnabled() once per frame and record all spans of the
+// frame from timestamps they take anyway, so disabled tracing costs one
+// predictable branch.
+
+extern std::atomic<bool> g_ap_trace_enabled;
+
+inline bool ApTraceEnabled()
+{
+    return g_ap_trace_enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * Record a completed span on the calling thread's ring.
+ *
+ * @param name must outlive the trace, use string literals.
+ * @param arg shown as "id" in the trace, e.g. the processor id.
+ */
+void ApTraceSpan(const char* name, uint64_t begin_ns, uint64_t end_ns, uint32_t arg);
+
+// frames slower than this are anomalies, 0 if disabled
+uint64_t ApTraceAnomalyFrameNs();
+
+// flush the rings to the anomaly directory on a background thread, rate limited
+void ApTraceAnomaly(const char* reason);
+
+// write all rings as Chrome trace JSON, @return number of events written or < 0
+int ApTraceFlush(const char* path);
+
+void ApTraceConfigure(bool enabled, int events_per_thread, const char* anomaly_dir, int anomaly_frame_us);
+
+#endif // AGORA_API_3A_TRACE_H
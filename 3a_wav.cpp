@@ -0,0 +1,481 @@
+#include "3a_wav.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "3a_log.h"
+#include "3a_task_runner.h"
+
+// read size of pipes and unmappable files
+#define AP_WAV_READ_CHUNK (4 << 20)
+// mapped pages behind the read position are dropped in steps of this size
+#define AP_WAV_RELEASE_STEP (8 << 20)
+
+namespace {
+
+uint16_t read_le16(const unsigned char* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t read_le32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void write_le16(unsigned char* p, uint32_t value)
+{
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+}
+
+void write_le32(unsigned char* p, uint32_t value)
+{
+    write_le16(p, value);
+    write_le16(p + 2, value >> 16);
+}
+
+int16_t convert_sample(const unsigned char* p, const ApWavFormat& format)
+{
+    if (format.format_tag == AP_WAV_FORMAT_FLOAT) {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        value = std::max(-1.0f, std::min(1.0f, value)) * 32767.0f;
+        return (int16_t)(value < 0 ? value - 0.5f : value + 0.5f);
+    }
+    switch (format.bits_per_sample) {
+        case 8:
+            return (int16_t)((p[0] - 128) << 8);
+        case 24:
+            return (int16_t)read_le16(p + 1);
+        case 32:
+            return (int16_t)read_le16(p + 2);
+        default:
+            return (int16_t)read_le16(p);
+    }
+}
+
+bool valid_format(const ApWavFormat& format)
+{
+    if (format.channels < 1 || format.sample_rate <= 0 || format.block_align != format.channels * format.bits_per_sample / 8) {
+        return false;
+    }
+    if (format.format_tag == AP_WAV_FORMAT_FLOAT) {
+        return format.bits_per_sample == 32;
+    }
+    return format.format_tag == AP_WAV_FORMAT_PCM &&
+           (format.bits_per_sample == 8 || format.bits_per_sample == 16 || format.bits_per_sample == 24 ||
+            format.bits_per_sample == 32);
+}
+
+// "-" is stdin, the reader owns a duplicate so closing it leaves stdin open
+int open_input(const std::string& path)
+{
+    if (path == "-") {
+        return dup(STDIN_FILENO);
+    }
+    return open(path.c_str(), O_RDONLY);
+}
+
+}  // namespace
+
+void ApWavMakeHeader(unsigned char* header, int sample_rate, int channels, uint64_t data_bytes)
+{
+    // past the 4 GB RIFF limit both sizes are 0xFFFFFFFF, readers take it as "to the end"
+    bool large = data_bytes > 0xFFFFFFFFu - 36;
+    memcpy(header, "RIFF", 4);
+    write_le32(header + 4, large ? 0xFFFFFFFFu : (uint32_t)data_bytes + 36);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    write_le32(header + 16, 16);
+    write_le16(header + 20, AP_WAV_FORMAT_PCM);
+    write_le16(header + 22, (uint32_t)channels);
+    write_le32(header + 24, (uint32_t)sample_rate);
+    write_le32(header + 28, (uint32_t)(sample_rate * channels * 2));
+    write_le16(header + 32, (uint32_t)(channels * 2));
+    write_le16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    write_le32(header + 40, large ? 0xFFFFFFFFu : (uint32_t)data_bytes);
+}
+
+std::unique_ptr<ApWavReader> ApWavReader::Open(const std::string& path)
+{
+    int fd = open_input(path);
+    if (fd < 0) {
+        AP_LOG_ERROR("cannot open %s: %s\n", path, strerror(errno));
+        return nullptr;
+    }
+    std::unique_ptr<ApWavReader> reader(new ApWavReader(path, fd));
+    if (!reader->Parse()) {
+        return nullptr;
+    }
+    return reader;
+}
+
+std::unique_ptr<ApWavReader> ApWavReader::OpenRaw(const std::string& path, const ApWavFormat& format)
+{
+    if (!valid_format(format)) {
+        AP_LOG_ERROR("unsupported raw format for %s\n", path);
+        return nullptr;
+    }
+    int fd = open_input(path);
+    if (fd < 0) {
+        AP_LOG_ERROR("cannot open %s: %s\n", path, strerror(errno));
+        return nullptr;
+    }
+    std::unique_ptr<ApWavReader> reader(new ApWavReader(path, fd));
+    reader->format_ = format;
+    reader->data_begin_ = 0;
+    reader->data_end_ = reader->map_ != nullptr ? reader->map_size_ : 0;
+    return reader;
+}
+
+ApWavReader::ApWavReader(const std::string& path, int fd)
+    : path_(path), fd_(fd), map_(nullptr), map_size_(0), data_begin_(0), data_end_(0), read_(0), released_(0),
+      data_remaining_(UINT64_MAX), buffer_read_(0), buffer_end_(0), eof_(false), position_(0)
+{
+    struct stat st;
+    if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
+        if (map != MAP_FAILED) {
+            map_ = static_cast<char*>(map);
+            map_size_ = (size_t)st.st_size;
+            madvise(map_, map_size_, MADV_SEQUENTIAL);
+        }
+    }
+    if (map_ == nullptr) {
+        buffer_.resize(AP_WAV_READ_CHUNK);
+    }
+}
+
+ApWavReader::~ApWavReader()
+{
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+    }
+    close(fd_);
+}
+
+long long ApWavReader::frames() const
+{
+    if (map_ != nullptr) {
+        return (long long)((data_end_ - data_begin_) / format_.block_align);
+    }
+    if (data_remaining_ == UINT64_MAX) {
+        return -1;
+    }
+    return position_ + (long long)((data_remaining_ + buffer_end_ - buffer_read_) / format_.block_align);
+}
+
+bool ApWavReader::ReadHeader(void* out, size_t bytes)
+{
+    if (map_ != nullptr) {
+        if (map_size_ - read_ < bytes) {
+            return false;
+        }
+        memcpy(out, map_ + read_, bytes);
+        read_ += bytes;
+        return true;
+    }
+    char* dest = static_cast<char*>(out);
+    while (bytes > 0) {
+        ssize_t n = read(fd_, dest, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        dest += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+bool ApWavReader::SkipHeader(uint64_t bytes)
+{
+    if (map_ != nullptr) {
+        if (map_size_ - read_ < bytes) {
+            return false;
+        }
+        read_ += (size_t)bytes;
+        return true;
+    }
+    char scratch[4096];
+    while (bytes > 0) {
+        size_t n = (size_t)std::min<uint64_t>(bytes, sizeof(scratch));
+        if (!ReadHeader(scratch, n)) {
+            return false;
+        }
+        bytes -= n;
+    }
+    return true;
+}
+
+bool ApWavReader::Parse()
+{
+    unsigned char riff[12];
+    if (!ReadHeader(riff, sizeof(riff)) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        AP_LOG_ERROR("%s is not a RIFF/WAVE file\n", path_);
+        return false;
+    }
+    bool has_format = false;
+    for (;;) {
+        unsigned char chunk[8];
+        if (!ReadHeader(chunk, sizeof(chunk))) {
+            AP_LOG_ERROR("%s has no data chunk\n", path_);
+            return false;
+        }
+        uint32_t size = read_le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            unsigned char fmt[40] = {0};
+            size_t used = std::min<size_t>(size, sizeof(fmt));
+            if (size < 16 || !ReadHeader(fmt, used) || !SkipHeader(size - used + (size & 1))) {
+                AP_LOG_ERROR("%s has a truncated fmt chunk\n", path_);
+                return false;
+            }
+            format_.format_tag = read_le16(fmt);
+            format_.channels = read_le16(fmt + 2);
+            format_.sample_rate = (int)read_le32(fmt + 4);
+            format_.block_align = read_le16(fmt + 12);
+            format_.bits_per_sample = read_le16(fmt + 14);
+            if (format_.format_tag == AP_WAV_FORMAT_EXTENSIBLE && size >= 40) {
+                // the first two bytes of the sub format GUID are the format tag
+                format_.format_tag = read_le16(fmt + 24);
+            }
+            has_format = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!has_format || !valid_format(format_)) {
+                AP_LOG_ERROR("%s: unsupported format %d, %d bits, %d channels\n", path_, format_.format_tag,
+                             format_.bits_per_sample, format_.channels);
+                return false;
+            }
+            // 0 and 0xFFFFFFFF are left by writers that stream and never patch the header
+            bool unknown = size == 0 || size == 0xFFFFFFFF;
+            if (map_ != nullptr) {
+                data_begin_ = read_;
+                data_end_ = unknown ? map_size_ : std::min<size_t>(map_size_, read_ + size);
+                data_end_ -= (data_end_ - data_begin_) % format_.block_align;
+            } else if (!unknown) {
+                data_remaining_ = size;
+            }
+            return true;
+        } else if (!SkipHeader((uint64_t)size + (size & 1))) {
+            // LIST, fact, cue, ... chunks are padded to an even size
+            AP_LOG_ERROR("%s has a truncated %c%c%c%c chunk\n", path_, chunk[0], chunk[1], chunk[2], chunk[3]);
+            return false;
+        }
+    }
+}
+
+bool ApWavReader::Seek(long long frame)
+{
+    if (frame < 0) {
+        return false;
+    }
+    if (map_ != nullptr) {
+        uint64_t offset = (uint64_t)frame * format_.block_align;
+        if (offset > data_end_ - data_begin_) {
+            return false;
+        }
+        read_ = data_begin_ + (size_t)offset;
+        released_ = read_ & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+        position_ = frame;
+        return true;
+    }
+    // a stream only skips forward
+    while (position_ < frame) {
+        int samples = 0;
+        if (Next((int)std::min<long long>(frame - position_, 4800), &samples) == nullptr) {
+            return false;
+        }
+    }
+    return position_ == frame;
+}
+
+size_t ApWavReader::Fill(size_t bytes)
+{
+    if (map_ != nullptr) {
+        return std::min(bytes, data_end_ - read_);
+    }
+    if (buffer_end_ - buffer_read_ < bytes && !eof_) {
+        if (buffer_read_ + bytes > buffer_.size()) {
+            memmove(&buffer_[0], &buffer_[buffer_read_], buffer_end_ - buffer_read_);
+            buffer_end_ -= buffer_read_;
+            buffer_read_ = 0;
+            if (bytes > buffer_.size()) {
+                buffer_.resize(bytes);
+            }
+        }
+        while (buffer_end_ - buffer_read_ < bytes && data_remaining_ > 0) {
+            size_t want = (size_t)std::min<uint64_t>(buffer_.size() - buffer_end_, data_remaining_);
+            ssize_t n = read(fd_, &buffer_[buffer_end_], want);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            buffer_end_ += (size_t)n;
+            if (data_remaining_ != UINT64_MAX) {
+                data_remaining_ -= (uint64_t)n;
+            }
+        }
+        eof_ = buffer_end_ - buffer_read_ < bytes;
+    }
+    return std::min(bytes, buffer_end_ - buffer_read_);
+}
+
+void ApWavReader::ReleaseConsumed()
+{
+    static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (read_ - released_ < AP_WAV_RELEASE_STEP) {
+        return;
+    }
+    size_t end = read_ & ~(page - 1);
+    // drops the copy on write pages too, the read position never comes back
+    madvise(map_ + released_, end - released_, MADV_DONTNEED);
+    released_ = end;
+}
+
+int16_t* ApWavReader::Next(int samples_per_channel, int* samples)
+{
+    if (samples != nullptr) {
+        *samples = 0;
+    }
+    if (samples_per_channel <= 0) {
+        return nullptr;
+    }
+    size_t bytes = (size_t)samples_per_channel * format_.block_align;
+    size_t available = Fill(bytes);
+    available -= available % format_.block_align;
+    if (available == 0) {
+        return nullptr;
+    }
+    char* data;
+    if (map_ != nullptr) {
+        // the previous view is no longer in use
+        ReleaseConsumed();
+        data = map_ + read_;
+        read_ += available;
+    } else {
+        data = &buffer_[buffer_read_];
+        buffer_read_ += available;
+    }
+    int frames = (int)(available / format_.block_align);
+    position_ += frames;
+    if (samples != nullptr) {
+        *samples = frames;
+    }
+
+    bool pcm16 = format_.format_tag == AP_WAV_FORMAT_PCM && format_.bits_per_sample == 16;
+    if (pcm16 && available == bytes && ((uintptr_t)data & 1) == 0) {
+        return reinterpret_cast<int16_t*>(data);
+    }
+    frame_.assign((size_t)samples_per_channel * format_.channels, 0);
+    if (pcm16) {
+        memcpy(&frame_[0], data, available);
+    } else {
+        size_t count = (size_t)frames * format_.channels;
+        int sample_bytes = format_.bits_per_sample / 8;
+        for (size_t i = 0; i < count; i++) {
+            frame_[i] = convert_sample(reinterpret_cast<unsigned char*>(data) + i * sample_bytes, format_);
+        }
+    }
+    return &frame_[0];
+}
+
+std::unique_ptr<ApWavWriter> ApWavWriter::Create(const std::string& path, int sample_rate, int channels, bool header,
+                                                 size_t buffer_bytes)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        AP_LOG_ERROR("cannot create %s: %s\n", path, strerror(errno));
+        return nullptr;
+    }
+    std::unique_ptr<ApWavWriter> writer(
+        new ApWavWriter(file, sample_rate, channels, header, std::max<size_t>(buffer_bytes, 4096)));
+    if (header) {
+        // sizes are patched by Close()
+        unsigned char bytes[AP_WAV_HEADER_BYTES];
+        ApWavMakeHeader(bytes, sample_rate, channels, 0);
+        if (fwrite(bytes, 1, sizeof(bytes), file) != sizeof(bytes)) {
+            AP_LOG_ERROR("cannot write %s\n", path);
+            return nullptr;
+        }
+    }
+    return writer;
+}
+
+ApWavWriter::ApWavWriter(FILE* file, int sample_rate, int channels, bool header, size_t buffer_bytes)
+    : file_(file), sample_rate_(sample_rate), channels_(channels), header_(header), buffer_bytes_(buffer_bytes), pool_(buffer_bytes, 2), size_(0), data_bytes_(0), failed_(false)
+{
+}
+
+ApWavWriter::~ApWavWriter()
+{
+    Close();
+}
+
+void ApWavWriter::Write(const int16_t* samples, size_t count)
+{
+    const char* data = reinterpret_cast<const char*>(samples);
+    size_t bytes = count * sizeof(int16_t);
+    data_bytes_ += bytes;
+    while (bytes > 0) {
+        if (!current_) {
+            // waits only while the other buffer is still being written
+            pool_.TakeWait(&current_);
+        }
+        size_t n = std::min(bytes, buffer_bytes_ - size_);
+        memcpy(current_.get() + size_, data, n);
+        size_ += n;
+        data += n;
+        bytes -= n;
+        if (size_ == buffer_bytes_) {
+            Submit();
+        }
+    }
+}
+
+void ApWavWriter::Submit()
+{
+    if (size_ == 0) {
+        return;
+    }
+    std::shared_ptr<ApMemoryBytes> batch(new ApMemoryBytes(std::move(current_)));
+    size_t size = size_;
+    size_ = 0;
+    ApIoRunner().Post([this, batch, size] {
+        bool ok = fwrite(batch->get(), 1, size, file_) == size;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            failed_ = failed_ || !ok;
+        }
+        pool_.Give(std::move(*batch));
+    });
+}
+
+bool ApWavWriter::Close()
+{
+    if (file_ == NULL) {
+        return !failed_;
+    }
+    Submit();
+    pool_.WaitIdle();
+    bool ok = !failed_;
+    if (header_) {
+        unsigned char bytes[AP_WAV_HEADER_BYTES];
+        ApWavMakeHeader(bytes, sample_rate_, channels_, data_bytes_);
+        ok = fseek(file_, 0, SEEK_SET) == 0 && fwrite(bytes, 1, sizeof(bytes), file_) == sizeof(bytes) && ok;
+    }
+    ok = fclose(file_) == 0 && ok;
+    file_ = NULL;
+    failed_ = !ok;
+    return ok;
+}
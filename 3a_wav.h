@@ -0,0 +1,150 @@
+#ifndef AGORA_API_3A_WAV_H
+#define AGORA_API_3A_WAV_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "3a_memory.h"
+#include "3a_task_runner.h"
+
+#define AP_WAV_FORMAT_PCM 1
+#define AP_WAV_FORMAT_FLOAT 3
+#define AP_WAV_FORMAT_EXTENSIBLE 0xFFFE
+#define AP_WAV_HEADER_BYTES 44
+
+struct ApWavFormat {
+    int format_tag;  // AP_WAV_FORMAT_PCM or AP_WAV_FORMAT_FLOAT, extensible is resolved
+    int channels;
+    int sample_rate;
+    int bits_per_sample;
+    int block_align;  // bytes per sample frame
+
+    ApWavFormat() : format_tag(AP_WAV_FORMAT_PCM), channels(1), sample_rate(16000), bits_per_sample(16), block_align(2) {}
+};
+
+// Streaming reader of a RIFF/WAVE file or, with OpenRaw(), of headerless
+// PCM. The chunk list is walked instead of assuming a 44 byte
+// header: LIST, fact, cue and any other chunk before or after "data" is
+// skipped, WAVE_FORMAT_EXTENSIBLE is resolved to its sub format and a data
+// size of 0 or 0xFFFFFFFF (a writer that never patched it) means "up to the
+// end of the file".
+//
+// Regular files are mapped MAP_PRIVATE and read sequentially: Next() hands
+// out a view into the mapping for 16 bit PCM, nothing is copied, and the
+// pages behind the read position are released as it advances, so resident
+// memory stays at a few MB whatever the file length. The view is writable
+// (copy on write), processing a frame in place does not touch the file.
+// Pipes and other files that cannot be mapped are read in large chunks
+// into a buffer. 8, 24 and 32 bit PCM and 32 bit float are converted to
+// 16 bit into a frame buffer.
+class ApWavReader {
+    public:
+    // nullptr if |path| cannot be opened or is not a WAV file with PCM or float audio.
+    // "-" reads stdin
+    static std::unique_ptr<ApWavReader> Open(const std::string& path);
+    // headerless interleaved samples of |format|
+    static std::unique_ptr<ApWavReader> OpenRaw(const std::string& path, const ApWavFormat& format);
+    ~ApWavReader();
+
+    const ApWavFormat& format() const { return format_; }
+    // sample frames (samples per channel) of audio, -1 for a pipe
+    long long frames() const;
+    // sample frames handed out so far
+    long long position() const { return position_; }
+
+    // next |samples_per_channel| sample frames as interleaved 16 bit PCM,
+    // valid until the next call. A short last frame is zero padded; nullptr
+    // once the audio is exhausted. |samples| gets the number of real
+    // (unpadded) sample frames when not nullptr.
+    int16_t* Next(int samples_per_channel, int* samples = nullptr);
+    // continue at sample frame |frame|; mapped files seek anywhere, streams only forward
+    bool Seek(long long frame);
+
+    private:
+    ApWavReader(const std::string& path, int fd);
+
+    // header bytes from the mapping or the stream
+    bool ReadHeader(void* out, size_t bytes);
+    bool SkipHeader(uint64_t bytes);
+    bool Parse();
+    // make up to |bytes| of audio readable at the read position, returns how many are
+    size_t Fill(size_t bytes);
+    void ReleaseConsumed();
+
+    const std::string path_;
+    int fd_;
+    ApWavFormat format_;
+
+    // mapped files
+    char* map_;
+    size_t map_size_;
+    size_t data_begin_;
+    size_t data_end_;
+    size_t read_;       // offset of the next audio byte
+    size_t released_;   // pages before this offset were dropped
+
+    // pipes and unmappable files: audio bytes buffer_[buffer_read_, buffer_end_)
+    // and data_remaining_ more in the stream, UINT64_MAX if the size is unknown
+    uint64_t data_remaining_;
+    std::vector<char> buffer_;
+    size_t buffer_read_;
+    size_t buffer_end_;
+    bool eof_;
+
+    // padded tails and converted formats
+    std::vector<int16_t> frame_;
+    long long position_;
+};
+
+// canonical 44 byte header of 16 bit PCM, for writers that know the size up front
+void ApWavMakeHeader(unsigned char* header, int sample_rate, int channels, uint64_t data_bytes);
+
+// 16 bit PCM output written off the calling thread. Samples are copied into
+// one of two buffers; a full buffer is handed to ApIoRunner() while the
+// caller fills the other, and the caller only waits when the writer is
+// still busy with the previous buffer, so nothing is ever dropped. A WAV
+// file starts with a header whose sizes are patched by Close().
+class ApWavWriter {
+    public:
+    /**
+     * @param header false for raw interleaved PCM.
+     * @param buffer_bytes size of each of the two buffers.
+     * @return nullptr if |path| cannot be created.
+     */
+    static std::unique_ptr<ApWavWriter> Create(const std::string& path, int sample_rate, int channels,
+                                               bool header = true, size_t buffer_bytes = 1 << 20);
+    // closes the file if Close() was not called
+    ~ApWavWriter();
+
+    void Write(const int16_t* samples, size_t count);
+    // flush, patch the header and close; false if any write failed
+    bool Close();
+
+    uint64_t data_bytes() const { return data_bytes_; }
+
+    private:
+    ApWavWriter(FILE* file, int sample_rate, int channels, bool header, size_t buffer_bytes);
+
+    void Submit();
+
+    FILE* file_;
+    const int sample_rate_;
+    const int channels_;
+    const bool header_;
+    const size_t buffer_bytes_;
+
+    ApBufferPool pool_;      // the two buffers
+    ApMemoryBytes current_;  // being filled, taken from pool_ by Write()
+    size_t size_;
+    uint64_t data_bytes_;
+
+    std::mutex mutex_;
+    bool failed_;  // under mutex_
+};
+
+#endif // AGORA_API_3A_WAV_H
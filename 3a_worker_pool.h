@@ -0,0 +1,155 @@
+#ifndef AGORA_API_3A_WORKER_POOL_H
+#define AGORA_API_3A_WORKER_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork/join pool for work that has to finish within the current frame, e.g.
+// the channels of a mic array. ParallelFor() runs |count| tasks on the pool
+// threads and on the calling thread and returns once all of them are done;
+// nothing is allocated per call. Several threads may call ParallelFor() at
+// once, their jobs share the pool. The threads are started lazily by the
+// first ParallelFor() that has more than one task.
+class ApWorkerPool {
+    public:
+    typedef void (*TaskFunc)(void* context, int index);
+
+    // |threads| <= 0 sizes the pool to the cores besides the calling thread
+    explicit ApWorkerPool(int threads = 0) : threads_(threads), started_(false), stop_(false) {
+        if (threads_ <= 0) {
+            threads_ = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+        }
+    }
+    ~ApWorkerPool() {
+        Stop();
+    }
+
+    int threads() const { return threads_; }
+
+    void ParallelFor(int count, TaskFunc task, void* context) {
+        if (count <= 0) {
+            return;
+        }
+        if (count == 1) {
+            task(context, 0);
+            return;
+        }
+        Job job(count, task, context);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_) {
+                job.count = 0;
+            } else {
+                Start();
+                jobs_.push_back(&job);
+            }
+        }
+        if (job.count == 0) {
+            for (int i = 0; i < count; i++) {
+                task(context, i);
+            }
+            return;
+        }
+        work_cond_.notify_all();
+        RunTasks(&job);
+        // once the job is off the queue no worker can pick it up, wait for
+        // those that did before |job| goes out of scope
+        std::unique_lock<std::mutex> lock(mutex_);
+        Remove(&job);
+        done_cond_.wait(lock, [&job] {
+            return job.active == 0 && job.done.load(std::memory_order_acquire) == job.count;
+        });
+    }
+
+    // join the threads, later ParallelFor() calls run on the calling thread
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cond_.notify_all();
+        for (std::thread& thread : workers_) {
+            thread.join();
+        }
+        workers_.clear();
+    }
+
+    private:
+    struct Job {
+        Job(int count, TaskFunc task, void* context) : count(count), task(task), context(context), next(0), done(0), active(0) {}
+
+        int count;
+        TaskFunc task;
+        void* context;
+        std::atomic<int> next;  // next task index to hand out
+        std::atomic<int> done;
+        int active;             // under mutex_, workers running tasks of the job
+    };
+
+    // under mutex_
+    void Start() {
+        if (started_) {
+            return;
+        }
+        started_ = true;
+        for (int i = 0; i < threads_; i++) {
+            workers_.push_back(std::thread(&ApWorkerPool::Run, this));
+        }
+    }
+
+    // under mutex_
+    void Remove(Job* job) {
+        std::deque<Job*>::iterator it = std::find(jobs_.begin(), jobs_.end(), job);
+        if (it != jobs_.end()) {
+            jobs_.erase(it);
+        }
+    }
+
+    static void RunTasks(Job* job) {
+        while (true) {
+            int index = job->next.fetch_add(1, std::memory_order_relaxed);
+            if (index >= job->count) {
+                return;
+            }
+            job->task(job->context, index);
+            job->done.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_cond_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                break;
+            }
+            Job* job = jobs_.front();
+            job->active++;
+            lock.unlock();
+            RunTasks(job);
+            lock.lock();
+            // every index is handed out, the remaining tasks are already running
+            Remove(job);
+            job->active--;
+            if (job->active == 0) {
+                done_cond_.notify_all();
+            }
+        }
+    }
+
+    int threads_;
+    std::mutex mutex_;
+    std::condition_variable work_cond_;
+    std::condition_variable done_cond_;
+    std::deque<Job*> jobs_;  // under mutex_, jobs with task indices left to hand out
+    std::vector<std::thread> workers_;
+    bool started_;           // under mutex_
+    bool stop_;              // under mutex_
+};
+
+#endif // AGORA_API_3A_WORKER_POOL_H
@@ -0,0 +1,439 @@
+//
+//  Stand-in for the Agora Uplink Audio Processing Library, see
+//  agora_audio_processing_mock.h.
+
+#include "agora_audio_processing_mock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "agora_audio_processing.h"
+#include "agora_uap_base.h"
+
+namespace AgoraUAP {
+namespace Mock {
+
+namespace {
+
+std::mutex g_config_mutex;
+bool g_config_loaded = false;
+MockConfig g_config;
+
+std::atomic<uint64_t> g_created(0);
+std::atomic<uint64_t> g_live(0);
+std::atomic<uint64_t> g_stream_frames(0);
+std::atomic<uint64_t> g_reverse_frames(0);
+std::atomic<uint64_t> g_malfunction_events(0);
+std::atomic<uint64_t> g_error_events(0);
+std::atomic<uint64_t> g_resets(0);
+
+AgoraAudioProcessing::LogOutputFunc g_log_func = nullptr;
+
+void Log(const char* message) {
+  AgoraAudioProcessing::LogOutputFunc func = g_log_func;
+  if (func != nullptr) {
+    func(message);
+  }
+}
+
+// the environment once, unless MockSetConfig came first; under g_config_mutex
+void LoadConfigLocked() {
+  if (g_config_loaded) {
+    return;
+  }
+  g_config_loaded = true;
+  g_config = MockDefaultConfig();
+  const char* env = getenv("AGORA_UAP_MOCK");
+  if (env == nullptr) {
+    return;
+  }
+  std::string list(env);
+  size_t begin = 0;
+  while (begin < list.size()) {
+    size_t end = list.find(',', begin);
+    std::string item = list.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+    size_t equals = item.find('=');
+    if (equals != std::string::npos) {
+      std::string key = item.substr(0, equals);
+      if (!MockSetField(&g_config, key.c_str(), atoi(item.c_str() + equals + 1))) {
+        fprintf(stderr, "AGORA_UAP_MOCK: unknown key %s\n", key.c_str());
+      }
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+}
+
+// the CPU time the library would take, on the calling thread
+void Spin(int us) {
+  if (us <= 0) {
+    return;
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+bool ValidFrame(const AgoraAudioFrame* frame, int* error) {
+  if (frame == nullptr || frame->buffer == nullptr) {
+    *error = kNullPointerError;
+    return false;
+  }
+  int rate = frame->sampleRate;
+  if (rate != 8000 && rate != 16000 && rate != 24000 && rate != 32000 && rate != 44100 && rate != 48000) {
+    *error = kBadSampleRateError;
+    return false;
+  }
+  if (frame->channels < 1 || frame->channels > 2) {
+    *error = kBadNumberChannelsError;
+    return false;
+  }
+  if (frame->samplesPerChannel != rate / 100) {
+    *error = kBadDataLengthError;
+    return false;
+  }
+  return true;
+}
+
+class MockAudioProcessing : public AgoraAudioProcessing {
+ public:
+  MockAudioProcessing(const MockConfig& config, uint64_t index)
+      : config_(config),
+        random_(config.seed + index),
+        handler_(nullptr),
+        initialized_(false),
+        aec_enabled_(false),
+        aec_model_(kTRAEC),
+        ans_enabled_(false),
+        ans_model_(kTRANS),
+        agc_enabled_(false),
+        bghvs_enabled_(false),
+        stream_delay_ms_(0),
+        analog_level_(0),
+        frames_(0),
+        last_sample_rate_(48000) {
+    if (config_.state_kb > 0) {
+      // touched, it shows in RSS like real filter state
+      state_.assign((size_t)config_.state_kb * 1024, 1);
+    }
+    g_live.fetch_add(1, std::memory_order_relaxed);
+  }
+  ~MockAudioProcessing() override { g_live.fetch_sub(1, std::memory_order_relaxed); }
+
+  int Init(const UapConfig& config) override {
+    Spin(config_.init_us);
+    if (config_.init_error != 0) {
+      return config_.init_error;
+    }
+    handler_ = config.eventHandler;
+    initialized_ = true;
+    Log("AgoraUAP mock: Init");
+    return kNoError;
+  }
+
+  void Release() override { delete this; }
+
+  int EnableDataDump(const DumpOption /*option*/) override { return kNoError; }
+
+  int SetAecConfiguration(const AecConfig config) override {
+    if (config.enabled.has_value()) {
+      aec_enabled_ = *config.enabled;
+    }
+    if (config.aecModelType.has_value()) {
+      aec_model_ = *config.aecModelType;
+    }
+    return kNoError;
+  }
+
+  int SetAnsConfiguration(const AnsConfig config) override {
+    if (config.enabled.has_value()) {
+      ans_enabled_ = *config.enabled;
+    }
+    if (config.ansModelType.has_value()) {
+      ans_model_ = *config.ansModelType;
+    }
+    return kNoError;
+  }
+
+  int SetAgcConfiguration(const AgcConfig config) override {
+    if (config.enabled.has_value()) {
+      agc_enabled_ = *config.enabled;
+    }
+    return kNoError;
+  }
+
+  int SetBGHVSConfiguration(const BGHVSCfg config) override {
+    if (config.enabled.has_value()) {
+      bghvs_enabled_ = *config.enabled;
+    }
+    return kNoError;
+  }
+
+  int EnableBGHVSDataDump(const DumpOption /*option*/) override { return kNoError; }
+
+  int SetStreamDelayMs(int delay) override {
+    stream_delay_ms_ = delay;
+    return kNoError;
+  }
+
+  int SetStreamAnalogLevel(int level) override {
+    analog_level_ = level;
+    return kNoError;
+  }
+
+  int SetAIModelResource(const AiModelResourceConfig config) override {
+    Spin(config_.model_resource_us);
+    if (config.modelDataPtr.has_value()) {
+      // shared like the library does, no copy
+      models_.push_back(*config.modelDataPtr);
+    }
+    return kNoError;
+  }
+
+  int GetStreamAnalogLevel(int& level) override {
+    level = analog_level_;
+    return kNoError;
+  }
+
+  int SetGain(int /*gain*/) override { return kNoError; }
+
+  // "mock.<field>" changes the config of this processor
+  int SetParameter(const char* key, int value) override {
+    if (key == nullptr || strncmp(key, "mock.", 5) != 0) {
+      return kUnsupportedFunctionError;
+    }
+    return MockSetField(&config_, key + 5, value) ? kNoError : kBadParameterError;
+  }
+
+  int ProcessStream(AgoraAudioFrame* frame) override {
+    int error = kNoError;
+    if (!initialized_) {
+      return kUnspecifiedError;
+    }
+    if (!ValidFrame(frame, &error)) {
+      return error;
+    }
+    last_sample_rate_ = frame->sampleRate;
+    int cost = config_.stream_us;
+    if (aec_enabled_ && aec_model_ >= 0 && aec_model_ < 3) {
+      cost += config_.aec_us[aec_model_];
+    }
+    if (ans_enabled_ && ans_model_ >= 0 && ans_model_ < 3) {
+      cost += config_.ans_us[ans_model_];
+    }
+    if (agc_enabled_) {
+      cost += config_.agc_us;
+    }
+    if (bghvs_enabled_) {
+      cost += config_.bghvs_us;
+    }
+    cost = Scale(cost, frame);
+    if (config_.jitter_us > 0) {
+      cost += (int)(NextRandom() % (uint32_t)(config_.jitter_us + 1));
+    }
+    frames_++;
+    if (config_.spike_every > 0 && frames_ % (uint64_t)config_.spike_every == 0) {
+      cost += config_.spike_us;
+    }
+    Spin(cost);
+    g_stream_frames.fetch_add(1, std::memory_order_relaxed);
+
+    if (handler_ != nullptr && config_.malfunction_every > 0 && frames_ % (uint64_t)config_.malfunction_every == 0) {
+      g_malfunction_events.fetch_add(1, std::memory_order_relaxed);
+      handler_->onEvent(AgoraAudioProcessingEventHandler::kAecMalfunction);
+    }
+    if (handler_ != nullptr && config_.error_every > 0 && frames_ % (uint64_t)config_.error_every == 0) {
+      g_error_events.fetch_add(1, std::memory_order_relaxed);
+      handler_->onError(config_.error_code);
+    }
+    return kNoError;
+  }
+
+  int ProcessReverseStream(AgoraAudioFrame* frame) override {
+    int error = kNoError;
+    if (!initialized_) {
+      return kUnspecifiedError;
+    }
+    if (!ValidFrame(frame, &error)) {
+      return error;
+    }
+    Spin(Scale(config_.reverse_us, frame));
+    g_reverse_frames.fetch_add(1, std::memory_order_relaxed);
+    return kNoError;
+  }
+
+  int GetState(AgoraAudioProcessing::State& state, int insamplerate) override {
+    int rate = insamplerate > 0 ? insamplerate : last_sample_rate_;
+    state.algorithmLatency = (unsigned int)config_.algorithm_latency_ms;
+    state.algorithmLatency_sp = (unsigned int)((long long)config_.algorithm_latency_ms * rate / 1000);
+    state.aecEstimatedDelay = (unsigned int)(stream_delay_ms_ > 0 ? stream_delay_ms_ : 0);
+    return kNoError;
+  }
+
+  int Reset() override {
+    Spin(config_.reset_us);
+    g_resets.fetch_add(1, std::memory_order_relaxed);
+    return kNoError;
+  }
+
+ private:
+  static int Scale(int us, const AgoraAudioFrame* frame) {
+    return (int)((long long)us * frame->samplesPerChannel * frame->channels / 480);
+  }
+
+  // xorshift32
+  uint32_t NextRandom() {
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 17;
+    random_ ^= random_ << 5;
+    return random_;
+  }
+
+  MockConfig config_;
+  uint32_t random_;
+  AgoraAudioProcessingEventHandler* handler_;
+  bool initialized_;
+  bool aec_enabled_;
+  int aec_model_;
+  bool ans_enabled_;
+  int ans_model_;
+  bool agc_enabled_;
+  bool bghvs_enabled_;
+  int stream_delay_ms_;
+  int analog_level_;
+  uint64_t frames_;
+  int last_sample_rate_;
+  std::vector<std::shared_ptr<void>> models_;
+  std::vector<char> state_;
+};
+
+}  // namespace
+
+MockConfig MockDefaultConfig() {
+  MockConfig config;
+  memset(&config, 0, sizeof(config));
+  config.stream_us = 20;
+  config.aec_us[0] = 100;
+  config.aec_us[1] = 300;
+  config.aec_us[2] = 600;
+  config.ans_us[0] = 50;
+  config.ans_us[1] = 250;
+  config.ans_us[2] = 500;
+  config.agc_us = 20;
+  config.bghvs_us = 150;
+  config.reverse_us = 30;
+  config.init_us = 1000;
+  config.model_resource_us = 200;
+  config.reset_us = 2000;
+  config.state_kb = 256;
+  config.algorithm_latency_ms = 10;
+  config.error_code = kUnspecifiedError;
+  config.seed = 1;
+  return config;
+}
+
+MockConfig MockGetConfig() {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  LoadConfigLocked();
+  return g_config;
+}
+
+void MockSetConfig(const MockConfig& config) {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  g_config_loaded = true;
+  g_config = config;
+}
+
+bool MockSetField(MockConfig* config, const char* key, int value) {
+  struct Field {
+    const char* name;
+    int* field;
+  };
+  Field fields[] = {
+      {"stream_us", &config->stream_us},
+      {"aec_us.0", &config->aec_us[0]},
+      {"aec_us.1", &config->aec_us[1]},
+      {"aec_us.2", &config->aec_us[2]},
+      {"ans_us.0", &config->ans_us[0]},
+      {"ans_us.1", &config->ans_us[1]},
+      {"ans_us.2", &config->ans_us[2]},
+      {"agc_us", &config->agc_us},
+      {"bghvs_us", &config->bghvs_us},
+      {"reverse_us", &config->reverse_us},
+      {"jitter_us", &config->jitter_us},
+      {"spike_every", &config->spike_every},
+      {"spike_us", &config->spike_us},
+      {"init_us", &config->init_us},
+      {"model_resource_us", &config->model_resource_us},
+      {"reset_us", &config->reset_us},
+      {"state_kb", &config->state_kb},
+      {"algorithm_latency_ms", &config->algorithm_latency_ms},
+      {"malfunction_every", &config->malfunction_every},
+      {"error_every", &config->error_every},
+      {"error_code", &config->error_code},
+      {"init_error", &config->init_error},
+  };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    if (strcmp(key, fields[i].name) == 0) {
+      *fields[i].field = value;
+      return true;
+    }
+  }
+  if (strcmp(key, "seed") == 0) {
+    config->seed = (uint32_t)value;
+    return true;
+  }
+  return false;
+}
+
+MockStats MockGetStats() {
+  MockStats stats;
+  stats.created = g_created.load(std::memory_order_relaxed);
+  stats.live = g_live.load(std::memory_order_relaxed);
+  stats.stream_frames = g_stream_frames.load(std::memory_order_relaxed);
+  stats.reverse_frames = g_reverse_frames.load(std::memory_order_relaxed);
+  stats.malfunction_events = g_malfunction_events.load(std::memory_order_relaxed);
+  stats.error_events = g_error_events.load(std::memory_order_relaxed);
+  stats.resets = g_resets.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace Mock
+
+int WINAPI AgoraAudioProcessing::EnableLogOutput(const LogOption option) {
+  Mock::g_log_func = option.enabled ? option.func : nullptr;
+  return kNoError;
+}
+
+}  // namespace AgoraUAP
+
+extern "C" const char* GetSdkVersion() {
+  return "mock";
+}
+
+extern "C" AgoraUAP::AgoraAudioProcessing* CreateAgoraAudioProcessing() {
+  AgoraUAP::Mock::MockConfig config = AgoraUAP::Mock::MockGetConfig();
+  uint64_t index = AgoraUAP::Mock::g_created.fetch_add(1, std::memory_order_relaxed);
+  return new AgoraUAP::Mock::MockAudioProcessing(config, index);
+}
+
+extern "C" int GetAgoraDeviceUUID(const char* /*appId*/, char* uuid, int uuidBufLen) {
+  if (uuid == nullptr || uuidBufLen <= 0) {
+    return AgoraUAP::kNullPointerError;
+  }
+  snprintf(uuid, (size_t)uuidBufLen, "mock-device");
+  return AgoraUAP::kNoError;
+}
+
+extern "C" int SetAgoraAndroidDataDir(const char* /*dir*/) {
+  return AgoraUAP::kNoError;
+}
@@ -0,0 +1,79 @@
+//
+//  Stand-in for the Agora Uplink Audio Processing Library
+//
+//  agora_audio_processing_mock.cpp implements AgoraUAP::AgoraAudioProcessing
+//  and the exported functions of agora_audio_processing.h without a license
+//  or model files. Link it in place of the library to load-test the wrapper:
+//  every processor spends a configurable, deterministic amount of CPU per
+//  frame, reports a configurable algorithm latency and raises
+//  kAecMalfunction / onError on a fixed schedule. Audio passes through
+//  unchanged.
+//
+//  The config is read once from the AGORA_UAP_MOCK environment variable,
+//  a comma separated key=value list with the field names below, e.g.
+//    AGORA_UAP_MOCK=stream_us=200,jitter_us=50,malfunction_every=3000
+//  MockSetConfig() replaces it for processors created afterwards, and
+//  SetParameter("mock.<field>", value) changes one processor.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace AgoraUAP {
+namespace Mock {
+
+struct MockConfig {
+  // CPU burnt per ProcessStream at 48 kHz mono, scaled by samples * channels
+  int stream_us;
+  // added per enabled module, indexed by AecModelType / AnsModelType
+  int aec_us[3];
+  int ans_us[3];
+  int agc_us;
+  int bghvs_us;
+  // per ProcessReverseStream, scaled like stream_us
+  int reverse_us;
+  // uniform extra CPU of 0..jitter_us per ProcessStream
+  int jitter_us;
+  // every spike_every-th frame costs spike_us more, 0 for none
+  int spike_every;
+  int spike_us;
+  // Init, SetAIModelResource and Reset
+  int init_us;
+  int model_resource_us;
+  int reset_us;
+  // resident state allocated and touched per processor
+  int state_kb;
+  // GetState
+  int algorithm_latency_ms;
+  // kAecMalfunction after every n-th ProcessStream, 0 for never
+  int malfunction_every;
+  // onError(error_code) after every n-th ProcessStream, 0 for never
+  int error_every;
+  int error_code;
+  // Init returns this when non zero, e.g. a licensing error
+  int init_error;
+  // jitter, the n-th processor created uses seed + n
+  uint32_t seed;
+};
+
+// the built-in defaults, not the environment
+MockConfig MockDefaultConfig();
+// the config new processors get
+MockConfig MockGetConfig();
+void MockSetConfig(const MockConfig& config);
+// false if |key| is not a MockConfig field, aec_us / ans_us take aec_us.<type>
+bool MockSetField(MockConfig* config, const char* key, int value);
+
+struct MockStats {
+  uint64_t created;
+  uint64_t live;
+  uint64_t stream_frames;
+  uint64_t reverse_frames;
+  uint64_t malfunction_events;
+  uint64_t error_events;
+  uint64_t resets;
+};
+MockStats MockGetStats();
+
+}  // namespace Mock
+}  // namespace AgoraUAP
@@ -0,0 +1,408 @@
+// Process a directory or manifest of recordings with a pool of processors.
+//
+//   batch (--dir in_dir | --manifest list.txt) --out-dir dir [--jobs n] [--force]
+//         [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--agc 0|1] [--bghvs 0|1]
+//         [--near-suffix _near] [--far-suffix _far] [--report result.json]
+//         [--app-id id] [--license license] [--resource-path dir]
+//
+// The service loads the models once; every worker thread creates one
+// processor from it and resets it between recordings. Inputs are streamed
+// through ApWavReader and outputs through ApWavWriter (3a_wav.h), so memory
+// does not grow with the length of a recording.
+//
+// --dir pairs <name><near-suffix>.wav with <name><far-suffix>.wav, other
+// .wav files are near only; the output is <out-dir>/<name>.wav. A manifest
+// has one recording per line, "near.wav [far.wav|-] [out.wav]", # starts a
+// comment. An output is written as <out>.part and renamed when complete, a
+// recording whose output exists and is newer than its input is skipped
+// unless --force is given. Recordings are handed out longest first.
+//
+// The JSON report has the counts, the audio and wall seconds, files per
+// second and the real time factor (wall / audio, below 1 is faster than
+// real time).
+#include "3a.h"
+#include "3a_wav.h"
+#include "bench_common.h"
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Job {
+  std::string nearPath;
+  std::string farPath;  // empty if near only
+  std::string outPath;
+  long long bytes;
+};
+
+struct WorkerResult {
+  int processed;
+  int skipped;
+  int failed;
+  double audioSeconds;
+};
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+  return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static std::string baseName(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static bool fileStat(const std::string& path, struct stat* st) {
+  return stat(path.c_str(), st) == 0 && S_ISREG(st->st_mode);
+}
+
+static bool collectDirectory(const std::string& dir, const std::string& outDir, const std::string& nearSuffix,
+                             const std::string& farSuffix, std::vector<Job>* jobs) {
+  DIR* handle = opendir(dir.c_str());
+  if (handle == nullptr) {
+    fprintf(stderr, "cannot read %s\n", dir.c_str());
+    return false;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(handle)) {
+    std::string name = entry->d_name;
+    if (endsWith(name, ".wav")) {
+      names.push_back(name);
+    }
+  }
+  closedir(handle);
+  std::sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++) {
+    std::string stem = names[i].substr(0, names[i].size() - 4);
+    if (!farSuffix.empty() && endsWith(stem, farSuffix)) {
+      continue;
+    }
+    Job job;
+    job.nearPath = dir + "/" + names[i];
+    std::string name = stem;
+    if (!nearSuffix.empty() && endsWith(stem, nearSuffix)) {
+      name = stem.substr(0, stem.size() - nearSuffix.size());
+      struct stat st;
+      std::string farPath = dir + "/" + name + farSuffix + ".wav";
+      if (!farSuffix.empty() && fileStat(farPath, &st)) {
+        job.farPath = farPath;
+      }
+    }
+    job.outPath = outDir + "/" + name + ".wav";
+    jobs->push_back(job);
+  }
+  return true;
+}
+
+static bool collectManifest(const std::string& path, const std::string& outDir, std::vector<Job>* jobs) {
+  std::ifstream manifest(path.c_str());
+  if (!manifest) {
+    fprintf(stderr, "cannot read %s\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  int number = 0;
+  while (std::getline(manifest, line)) {
+    number++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::vector<std::string> values;
+    std::string value;
+    while (fields >> value) {
+      values.push_back(value);
+    }
+    if (values.empty()) {
+      continue;
+    }
+    if (values.size() > 3) {
+      fprintf(stderr, "%s:%d: expected near.wav [far.wav|-] [out.wav]\n", path.c_str(), number);
+      return false;
+    }
+    Job job;
+    job.nearPath = values[0];
+    if (values.size() > 1 && values[1] != "-") {
+      job.farPath = values[1];
+    }
+    job.outPath = values.size() > 2 ? values[2] : outDir + "/" + baseName(values[0]);
+    jobs->push_back(job);
+  }
+  return true;
+}
+
+// output exists and is not older than any input
+static bool upToDate(const Job& job) {
+  struct stat out, input;
+  if (!fileStat(job.outPath, &out) || !fileStat(job.nearPath, &input) || out.st_mtime < input.st_mtime) {
+    return false;
+  }
+  return job.farPath.empty() || (fileStat(job.farPath, &input) && out.st_mtime >= input.st_mtime);
+}
+
+static bool processJob(AGORA_API_C_HDL processor, const Job& job, double* audioSeconds) {
+  std::unique_ptr<ApWavReader> nearReader = ApWavReader::Open(job.nearPath);
+  if (!nearReader) {
+    fprintf(stderr, "%s: cannot read\n", job.nearPath.c_str());
+    return false;
+  }
+  const ApWavFormat& format = nearReader->format();
+  if (format.sample_rate % 100 != 0) {
+    fprintf(stderr, "%s: %d hz is not a 10ms frame rate\n", job.nearPath.c_str(), format.sample_rate);
+    return false;
+  }
+  std::unique_ptr<ApWavReader> farReader;
+  if (!job.farPath.empty()) {
+    farReader = ApWavReader::Open(job.farPath);
+    if (!farReader) {
+      fprintf(stderr, "%s: cannot read\n", job.farPath.c_str());
+      return false;
+    }
+  }
+  int farRate = farReader ? farReader->format().sample_rate : format.sample_rate;
+  int farChannels = farReader ? farReader->format().channels : format.channels;
+
+  std::string partPath = job.outPath + ".part";
+  std::unique_ptr<ApWavWriter> writer = ApWavWriter::Create(partPath, format.sample_rate, format.channels);
+  if (!writer) {
+    fprintf(stderr, "%s: cannot write\n", partPath.c_str());
+    return false;
+  }
+
+  int samplesPerChannel = format.sample_rate / 100;
+  int farSamplesPerChannel = farRate / 100;
+  // a near only recording and the far tail get silence as the reference
+  std::vector<int16_t> silence((size_t)farSamplesPerChannel * farChannels);
+  _agora_ap_audio_frame nearFrame = {0, format.sample_rate, format.channels, samplesPerChannel, 2, nullptr};
+  _agora_ap_audio_frame farFrame = {0, farRate, farChannels, farSamplesPerChannel, 2, nullptr};
+  int samples = 0;
+  bool ok = true;
+  while (int16_t* nearSamples = nearReader->Next(samplesPerChannel, &samples)) {
+    int16_t* farSamples = farReader ? farReader->Next(farSamplesPerChannel) : nullptr;
+    nearFrame.buffer = nearSamples;
+    farFrame.buffer = farSamples != nullptr ? farSamples : silence.data();
+    if (agora_ap_processor_process_stream(processor, &nearFrame, &farFrame) != 0) {
+      fprintf(stderr, "%s: processing failed at %.2f s\n", job.nearPath.c_str(),
+        (double)nearReader->position() / format.sample_rate);
+      ok = false;
+      break;
+    }
+    // the padding of a short last frame is not written
+    writer->Write(nearSamples, (size_t)samples * format.channels);
+  }
+  ok = writer->Close() && ok;
+  if (ok && rename(partPath.c_str(), job.outPath.c_str()) != 0) {
+    fprintf(stderr, "%s: cannot rename to %s\n", partPath.c_str(), job.outPath.c_str());
+    ok = false;
+  }
+  if (!ok) {
+    remove(partPath.c_str());
+    return false;
+  }
+  *audioSeconds = (double)nearReader->position() / format.sample_rate;
+  return true;
+}
+
+static void runWorker(AGORA_API_C_HDL processor, const std::vector<Job>* jobs, std::atomic<size_t>* next,
+                      bool force, WorkerResult* result) {
+  bool used = false;
+  for (size_t i = next->fetch_add(1); i < jobs->size(); i = next->fetch_add(1)) {
+    const Job& job = (*jobs)[i];
+    if (!force && upToDate(job)) {
+      result->skipped++;
+      continue;
+    }
+    // no echo path or noise estimate may leak from the previous recording
+    if (used) {
+      agora_ap_processor_reset(processor);
+    }
+    used = true;
+    double audioSeconds = 0;
+    if (processJob(processor, job, &audioSeconds)) {
+      result->processed++;
+      result->audioSeconds += audioSeconds;
+    } else {
+      result->failed++;
+    }
+  }
+}
+
+static uint64_t processCpuNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage() {
+  printf("usage: batch (--dir in_dir | --manifest list.txt) --out-dir dir [--jobs n] [--force]\n"
+         "             [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--agc 0|1] [--bghvs 0|1]\n"
+         "             [--near-suffix _near] [--far-suffix _far] [--report result.json]\n"
+         "             [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  std::string inputDir;
+  std::string manifestPath;
+  std::string outDir;
+  std::string nearSuffix = "_near";
+  std::string farSuffix = "_far";
+  int jobCount = (int)std::max(1u, std::thread::hardware_concurrency());
+  bool force = false;
+  int aecModel = 1;
+  int ansModel = 2;
+  bool agc = false;
+  bool bghvs = false;
+  const char* reportFile = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+      inputDir = argv[++i];
+    } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+      manifestPath = argv[++i];
+    } else if (strcmp(argv[i], "--out-dir") == 0 && i + 1 < argc) {
+      outDir = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--force") == 0) {
+      force = true;
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      aecModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      ansModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--agc") == 0 && i + 1 < argc) {
+      agc = atoi(argv[++i]) != 0;
+    } else if (strcmp(argv[i], "--bghvs") == 0 && i + 1 < argc) {
+      bghvs = atoi(argv[++i]) != 0;
+    } else if (strcmp(argv[i], "--near-suffix") == 0 && i + 1 < argc) {
+      nearSuffix = argv[++i];
+    } else if (strcmp(argv[i], "--far-suffix") == 0 && i + 1 < argc) {
+      farSuffix = argv[++i];
+    } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+      reportFile = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (inputDir.empty() == manifestPath.empty() || jobCount < 1 || (outDir.empty() && !inputDir.empty())) {
+    usage();
+    return 1;
+  }
+  if (outDir.empty()) {
+    outDir = ".";
+  } else if (mkdir(outDir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "cannot create %s\n", outDir.c_str());
+    return 1;
+  }
+
+  std::vector<Job> jobs;
+  if (!inputDir.empty() ? !collectDirectory(inputDir, outDir, nearSuffix, farSuffix, &jobs)
+                        : !collectManifest(manifestPath, outDir, &jobs)) {
+    return 1;
+  }
+  // longest first, the pool does not end waiting for one long recording
+  for (size_t i = 0; i < jobs.size(); i++) {
+    struct stat st;
+    jobs[i].bytes = fileStat(jobs[i].nearPath, &st) ? (long long)st.st_size : 0;
+  }
+  std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.bytes > b.bytes; });
+  jobCount = std::min<int>(jobCount, std::max<int>(1, (int)jobs.size()));
+
+  FILE* out = stdout;
+  if (reportFile != nullptr) {
+    out = fopen(reportFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", reportFile);
+      return 1;
+    }
+  }
+
+  benchLogToStderr();
+  uint64_t serviceBeginNs = benchNowNs();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+  double serviceSeconds = (benchNowNs() - serviceBeginNs) / 1e9;
+
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  config.aec_config.enabled = aecModel >= 0;
+  if (aecModel >= 0) {
+    config.aec_config.aecModelType = aecModel;
+  }
+  config.ans_config.enabled = ansModel >= 0;
+  if (ansModel >= 0) {
+    config.ans_config.ansModelType = ansModel;
+  }
+  config.agc_config.enabled = agc;
+  config.bghvs_config.enabled = bghvs;
+  // offline, there is no deadline to degrade for
+  config.qos_config.allow_degradation = false;
+
+  std::vector<AGORA_API_C_HDL> processors;
+  for (int t = 0; t < jobCount; t++) {
+    AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+    if (processor == nullptr) {
+      fprintf(stderr, "agora_ap_processor_create failed for worker %d\n", t);
+      break;
+    }
+    processors.push_back(processor);
+  }
+  if (processors.empty()) {
+    agora_ap_service_release(service);
+    return 1;
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<WorkerResult> results(processors.size());
+  std::vector<std::thread> workers;
+  uint64_t cpuBeginNs = processCpuNs();
+  uint64_t wallBeginNs = benchNowNs();
+  for (size_t t = 0; t < processors.size(); t++) {
+    results[t] = WorkerResult();
+    workers.push_back(std::thread(runWorker, processors[t], &jobs, &next, force, &results[t]));
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+  double wallSeconds = (benchNowNs() - wallBeginNs) / 1e9;
+  double cpuSeconds = (processCpuNs() - cpuBeginNs) / 1e9;
+
+  WorkerResult total = WorkerResult();
+  for (size_t t = 0; t < results.size(); t++) {
+    total.processed += results[t].processed;
+    total.skipped += results[t].skipped;
+    total.failed += results[t].failed;
+    total.audioSeconds += results[t].audioSeconds;
+  }
+  fprintf(out, "{\n  \"recordings\": %zu,\n  \"processed\": %d,\n  \"skipped\": %d,\n  \"failed\": %d,\n"
+    "  \"workers\": %zu,\n  \"service_init_seconds\": %.3f,\n  \"audio_seconds\": %.3f,\n"
+    "  \"wall_seconds\": %.3f,\n  \"cpu_seconds\": %.3f,\n  \"files_per_second\": %.2f,\n"
+    "  \"realtime_factor\": %.5f,\n  \"x_realtime\": %.1f\n}\n",
+    jobs.size(), total.processed, total.skipped, total.failed, processors.size(), serviceSeconds,
+    total.audioSeconds, wallSeconds, cpuSeconds, wallSeconds > 0 ? total.processed / wallSeconds : 0.0,
+    total.audioSeconds > 0 ? wallSeconds / total.audioSeconds : 0.0,
+    wallSeconds > 0 ? total.audioSeconds / wallSeconds : 0.0);
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  for (size_t t = 0; t < processors.size(); t++) {
+    agora_ap_processor_release(processors[t]);
+  }
+  agora_ap_service_release(service);
+  return total.failed == 0 ? 0 : 2;
+}
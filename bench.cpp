@@ -0,0 +1,328 @@
+// Benchmark the wrapper across the processor config matrix, non interactive.
+//
+//   bench [--frames n] [--warmup n] [--rates 8000,...,48000] [--channels 1,2]
+//         [--aec off,tr,ll,std] [--ans off,tr,ll,std] [--agc 0,1] [--bghvs 0,1]
+//         [--stereo-aec 0,1] [--signal silence|near|far|doubletalk|noise]
+//         [--ref-sources 1,4,16] [--out result.json] [--cost-model seed.txt]
+//         [--app-id id] [--license license] [--resource-path dir]
+//
+// Every combination gets a fresh processor fed with a deterministic signal,
+// band limited noise on both sides unless --signal picks a scenario of the
+// signal generator (3a_signal.h). Stereo runs take every --stereo-aec
+// mode, without stereo AEC the wrapper mixes the reference down to mono;
+// they report their cost relative to the mono run of the same config.
+// The JSON reports us per frame (mean, p50, p99, max), the real time
+// factor and user space instructions per frame when perf counters are
+// available. --cost-model writes a seed for agora_ap_service_load_cost_model
+// from the first --agc, --bghvs and --stereo-aec value of every config.
+// "ref_mixer" times agora_ap_ref_mixer_mix at every rate and channel count
+// for each --ref-sources count (0 skips it), the sources cycling through
+// 48000 to 8000 Hz, mono and stereo, so every resampling path is taken.
+#include "3a.h"
+#include "3a_cost_model.h"
+#include "3a_signal.h"
+#include "3a_stats.h"
+#include "bench_common.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+static void usage() {
+  printf("usage: bench [--frames n] [--warmup n] [--rates 8000,...] [--channels 1,2]\n"
+         "             [--aec off,tr,ll,std] [--ans off,tr,ll,std] [--agc 0,1] [--bghvs 0,1]\n"
+         "             [--stereo-aec 0,1] [--signal silence|near|far|doubletalk|noise]\n"
+         "             [--ref-sources 1,4,16] [--out result.json] [--cost-model seed.txt]\n"
+         "             [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+// one "ref_mixer" entry per mixer rate, channel count and source count
+static void benchRefMixer(FILE* out, const std::vector<int>& rates, const std::vector<int>& channelCounts,
+                          const std::vector<int>& sourceCounts, int frames, int warmupFrames) {
+  const int sourceRates[] = {48000, 44100, 32000, 16000, 8000};
+  static ApLatencyHistogram mixHist;
+  static _agora_ap_latency_histogram snapshot;
+  int runs = 0;
+  for (size_t r = 0; r < rates.size(); r++)
+  for (size_t c = 0; c < channelCounts.size(); c++)
+  for (size_t n = 0; n < sourceCounts.size(); n++) {
+    int count = sourceCounts[n];
+    if (count < 1) {
+      continue;
+    }
+    _agora_ap_ref_mixer_config config = agora_ap_ref_mixer_config_create();
+    config.sample_rate = rates[r];
+    config.channels = channelCounts[c];
+    AGORA_API_C_HDL mixer = agora_ap_ref_mixer_create(&config);
+    if (mixer == nullptr) {
+      fprintf(stderr, "agora_ap_ref_mixer_create failed, %d Hz %d channels\n", rates[r], channelCounts[c]);
+      continue;
+    }
+    std::vector<std::vector<int16_t>> buffers(count);
+    std::vector<_agora_ap_audio_frame> frameList(count);
+    std::vector<_agora_ap_ref_source> sources(count);
+    for (int i = 0; i < count; i++) {
+      int sampleRate = sourceRates[i % 5];
+      int channels = 1 + (i / 5) % 2;
+      buffers[i].resize((size_t)sampleRate / 100 * channels);
+      _agora_ap_audio_frame frame = {0, sampleRate, channels, sampleRate / 100, 2, buffers[i].data()};
+      frameList[i] = frame;
+      sources[i].frame = &frameList[i];
+      sources[i].gain = 1.0f / count;
+    }
+    int samplesPerChannel = rates[r] / 100;
+    std::vector<int16_t> refBuffer((size_t)samplesPerChannel * channelCounts[c]);
+    _agora_ap_audio_frame refFrame = {0, rates[r], channelCounts[c], samplesPerChannel, 2, refBuffer.data()};
+    uint32_t seed = 3;
+
+    mixHist.Clear();
+    int errors = 0;
+    for (int i = 0; i < warmupFrames + frames; i++) {
+      for (int s = 0; s < count; s++) {
+        benchFillSignal(buffers[s].data(), buffers[s].size(), &seed);
+      }
+      uint64_t beginNs = benchNowNs();
+      int ret = agora_ap_ref_mixer_mix(mixer, sources.data(), count, &refFrame);
+      uint64_t endNs = benchNowNs();
+      if (i >= warmupFrames) {
+        mixHist.Record(endNs - beginNs);
+        if (ret != count) {
+          errors++;
+        }
+      }
+    }
+    agora_ap_ref_mixer_release(mixer);
+
+    mixHist.CopyTo(&snapshot);
+    double meanUs = snapshot.sum_ns / 1000.0 / snapshot.count;
+    fprintf(out, "%s\n    {\"sample_rate\": %d, \"channels\": %d, \"sources\": %d, "
+      "\"us_per_frame\": {\"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}, \"rtf\": %.5f, \"errors\": %d}",
+      runs ? "," : "", rates[r], channelCounts[c], count, meanUs, ap_histogram_percentile(snapshot, 50) / 1000.0,
+      ap_histogram_percentile(snapshot, 99) / 1000.0, snapshot.max_ns / 1000.0, meanUs / 10000.0, errors);
+    fflush(out);
+    runs++;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  int frames = 1000;
+  int warmupFrames = 100;
+  std::vector<int> rates = benchParseIntList("8000,16000,24000,32000,44100,48000");
+  std::vector<int> channelCounts = benchParseIntList("1,2");
+  std::vector<int> aecModels = benchParseModelList("off,tr,ll,std");
+  std::vector<int> ansModels = benchParseModelList("off,tr,ll,std");
+  std::vector<int> agcModes = benchParseIntList("0,1");
+  std::vector<int> bghvsModes = benchParseIntList("0,1");
+  std::vector<int> stereoAecModes = benchParseIntList("0,1");
+  std::vector<int> refSourceCounts = benchParseIntList("1,4,16");
+  const char* outputFile = nullptr;
+  bool generated = false;
+  ApSignalScenario scenario = kApSignalDoubleTalk;
+  const char* costModelFile = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmupFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rates") == 0 && i + 1 < argc) {
+      rates = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+      channelCounts = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      aecModels = benchParseModelList(argv[++i]);
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      ansModels = benchParseModelList(argv[++i]);
+    } else if (strcmp(argv[i], "--agc") == 0 && i + 1 < argc) {
+      agcModes = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--bghvs") == 0 && i + 1 < argc) {
+      bghvsModes = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--stereo-aec") == 0 && i + 1 < argc) {
+      stereoAecModes = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--signal") == 0 && i + 1 < argc) {
+      if (!ApSignalGenerator::ParseScenario(argv[++i], &scenario)) {
+        usage();
+        return 1;
+      }
+      generated = true;
+    } else if (strcmp(argv[i], "--ref-sources") == 0 && i + 1 < argc) {
+      refSourceCounts = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else if (strcmp(argv[i], "--cost-model") == 0 && i + 1 < argc) {
+      costModelFile = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (frames < 1 || warmupFrames < 0 || stereoAecModes.empty()) {
+    usage();
+    return 1;
+  }
+
+  FILE* out = stdout;
+  if (outputFile != nullptr) {
+    out = fopen(outputFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", outputFile);
+      return 1;
+    }
+  }
+
+  benchLogToStderr();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+
+  BenchInstructionCounter instructionCounter;
+  ApCostModel costModel;
+  static ApLatencyHistogram frameHist;
+  static _agora_ap_latency_histogram snapshot;
+  int runs = 0;
+  double monoMeanUs = 0;
+  fprintf(out, "{\n  \"frames\": %d,\n  \"warmup_frames\": %d,\n  \"signal\": \"%s\",\n  \"perf_counters\": %s,\n  \"results\": [",
+    frames, warmupFrames, generated ? ApSignalGenerator::ScenarioName(scenario) : "bench_noise",
+    instructionCounter.available() ? "true" : "false");
+
+  for (size_t a = 0; a < aecModels.size(); a++)
+  for (size_t n = 0; n < ansModels.size(); n++)
+  for (size_t g = 0; g < agcModes.size(); g++)
+  for (size_t b = 0; b < bghvsModes.size(); b++)
+  for (size_t r = 0; r < rates.size(); r++)
+  for (size_t c = 0; c < channelCounts.size(); c++)
+  for (size_t s = 0; s < stereoAecModes.size(); s++) {
+    int sampleRate = rates[r];
+    int channels = channelCounts[c];
+    if (c == 0 && s == 0) {
+      monoMeanUs = 0;
+    }
+    // stereo AEC only means something for stereo
+    if (channels == 1 && s > 0) {
+      continue;
+    }
+    bool stereoAec = channels > 1 && stereoAecModes[s] != 0;
+    _agora_ap_processor_config config = agora_ap_processor_config_create();
+    config.aec_config.enabled = aecModels[a] >= 0;
+    config.aec_config.stereoAecEnabled = stereoAec;
+    if (aecModels[a] >= 0) {
+      config.aec_config.aecModelType = aecModels[a];
+    }
+    config.ans_config.enabled = ansModels[n] >= 0;
+    if (ansModels[n] >= 0) {
+      config.ans_config.ansModelType = ansModels[n];
+    }
+    config.agc_config.enabled = agcModes[g] != 0;
+    config.bghvs_config.enabled = bghvsModes[b] != 0;
+    // measure the configuration as asked for
+    config.qos_config.allow_degradation = false;
+    config.qos_config.expected_sample_rate = sampleRate;
+    config.qos_config.expected_channels = channels;
+
+    size_t rssBefore = ApReadRssBytes();
+    AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+    if (processor == nullptr) {
+      fprintf(stderr, "agora_ap_processor_create failed, aec %s ans %s\n", benchModelName(aecModels[a]), benchModelName(ansModels[n]));
+      continue;
+    }
+    size_t rssAfter = ApReadRssBytes();
+
+    int samplesPerChannel = sampleRate / 100;
+    std::vector<int16_t> nearBuffer((size_t)samplesPerChannel * channels);
+    std::vector<int16_t> farBuffer((size_t)samplesPerChannel * channels);
+    _agora_ap_audio_frame nearFrame = {0, sampleRate, channels, samplesPerChannel, 2, nearBuffer.data()};
+    _agora_ap_audio_frame farFrame = {0, sampleRate, channels, samplesPerChannel, 2, farBuffer.data()};
+    uint32_t nearSeed = 1;
+    uint32_t farSeed = 2;
+    std::unique_ptr<ApSignalGenerator> generator;
+    if (generated) {
+      ApSignalConfig signalConfig;
+      signalConfig.sample_rate = sampleRate;
+      signalConfig.channels = channels;
+      signalConfig.scenario = scenario;
+      generator.reset(new ApSignalGenerator(signalConfig));
+    }
+
+    frameHist.Clear();
+    int errors = 0;
+    uint64_t instructions = 0;
+    for (int i = 0; i < warmupFrames + frames; i++) {
+      if (generator) {
+        generator->Generate(nearBuffer.data(), farBuffer.data(), samplesPerChannel);
+      } else {
+        benchFillSignal(nearBuffer.data(), nearBuffer.size(), &nearSeed);
+        benchFillSignal(farBuffer.data(), farBuffer.size(), &farSeed);
+      }
+      bool measured = i >= warmupFrames;
+      if (measured) {
+        instructionCounter.Start();
+      }
+      uint64_t beginNs = benchNowNs();
+      int ret = agora_ap_processor_process_stream(processor, &nearFrame, &farFrame);
+      uint64_t endNs = benchNowNs();
+      if (measured) {
+        instructions += instructionCounter.Stop();
+        frameHist.Record(endNs - beginNs);
+        if (ret < 0) {
+          errors++;
+        }
+      }
+    }
+    agora_ap_processor_release(processor);
+
+    frameHist.CopyTo(&snapshot);
+    double meanUs = snapshot.sum_ns / 1000.0 / snapshot.count;
+    double frameUs = 1e6 * samplesPerChannel / sampleRate;
+    if (channels == 1) {
+      monoMeanUs = meanUs;
+    }
+    fprintf(out, "%s\n    {\"aec\": \"%s\", \"ans\": \"%s\", \"agc\": %s, \"bghvs\": %s, \"sample_rate\": %d, \"channels\": %d, "
+      "\"stereo_aec\": %s, \"us_per_frame\": {\"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}, \"rtf\": %.5f, ",
+      runs ? "," : "", benchModelName(aecModels[a]), benchModelName(ansModels[n]), agcModes[g] ? "true" : "false",
+      bghvsModes[b] ? "true" : "false", sampleRate, channels, stereoAec ? "true" : "false", meanUs,
+      ap_histogram_percentile(snapshot, 50) / 1000.0, ap_histogram_percentile(snapshot, 99) / 1000.0,
+      snapshot.max_ns / 1000.0, meanUs / frameUs);
+    if (instructionCounter.available()) {
+      fprintf(out, "\"instructions_per_frame\": %.0f, ", (double)instructions / frames);
+    } else {
+      fprintf(out, "\"instructions_per_frame\": null, ");
+    }
+    if (channels > 1 && monoMeanUs > 0) {
+      fprintf(out, "\"cost_vs_mono\": %.2f, ", meanUs / monoMeanUs);
+    }
+    fprintf(out, "\"rss_delta_bytes\": %lld, \"errors\": %d}",
+      (long long)rssAfter - (long long)rssBefore, errors);
+    fflush(out);
+    runs++;
+
+    // the model does not key on agc, bghvs or stereo AEC: only the first
+    // variant of each is seeded, off with the default lists
+    if (g == 0 && b == 0 && s == 0) {
+      ApCostKey key;
+      key.aec_model = aecModels[a];
+      key.ans_model = ansModels[n];
+      key.sample_rate = sampleRate;
+      key.channels = channels;
+      // a create that did not grow the RSS measured nothing, Seed leaves it unmeasured
+      costModel.Seed(key, meanUs, rssAfter > rssBefore ? (double)(rssAfter - rssBefore) : 0);
+    }
+  }
+  fprintf(out, "\n  ],\n  \"ref_mixer\": [");
+  benchRefMixer(out, rates, channelCounts, refSourceCounts, frames, warmupFrames);
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  if (costModelFile != nullptr && costModel.Save(costModelFile) < 0) {
+    fprintf(stderr, "cannot write %s\n", costModelFile);
+  }
+  agora_ap_service_release(service);
+  return 0;
+}
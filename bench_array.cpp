@@ -0,0 +1,164 @@
+// Benchmark mic array mode, N channel capture fanned out to N mono processors.
+//
+//   bench_array [--mics 2,4,8] [--frames n] [--warmup n] [--rate hz]
+//               [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--ref-channels n]
+//               [--out result.json] [--app-id id] [--license license] [--resource-path dir]
+//
+// For every mic count an array processor is fed noise on all channels and
+// a shared reference. The JSON reports the whole frame (deinterleave, the
+// parallel channels, interleave) against the sum of the channel costs,
+// whose ratio is the speedup of the worker pool, the time spent on the
+// channel layout and the mean and max cost of every channel.
+#include "3a.h"
+#include "3a_stats.h"
+#include "bench_common.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static void usage() {
+  printf("usage: bench_array [--mics 2,4,8] [--frames n] [--warmup n] [--rate hz]\n"
+         "                   [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--ref-channels n]\n"
+         "                   [--out result.json] [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  std::vector<int> micCounts = benchParseIntList("2,4,8");
+  int frames = 1000;
+  int warmupFrames = 100;
+  int sampleRate = 16000;
+  int aecModel = 1;
+  int ansModel = 1;
+  int refChannels = 1;
+  const char* outputFile = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--mics") == 0 && i + 1 < argc) {
+      micCounts = benchParseIntList(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmupFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      sampleRate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      aecModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      ansModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--ref-channels") == 0 && i + 1 < argc) {
+      refChannels = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (micCounts.empty() || frames < 1 || warmupFrames < 0 || sampleRate < 8000 || refChannels < 1 || refChannels > 2) {
+    usage();
+    return 1;
+  }
+  for (size_t m = 0; m < micCounts.size(); m++) {
+    if (micCounts[m] < 1 || micCounts[m] > AGORA_AP_ARRAY_MAX_CHANNELS) {
+      fprintf(stderr, "--mics: 1 to %d channels\n", AGORA_AP_ARRAY_MAX_CHANNELS);
+      return 1;
+    }
+  }
+
+  FILE* out = stdout;
+  if (outputFile != nullptr) {
+    out = fopen(outputFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", outputFile);
+      return 1;
+    }
+  }
+
+  benchLogToStderr();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  config.aec_config.enabled = aecModel >= 0;
+  config.aec_config.stereoAecEnabled = false;
+  if (aecModel >= 0) {
+    config.aec_config.aecModelType = aecModel;
+  }
+  config.ans_config.enabled = ansModel >= 0;
+  if (ansModel >= 0) {
+    config.ans_config.ansModelType = ansModel;
+  }
+  config.qos_config.allow_degradation = false;
+  config.qos_config.expected_sample_rate = sampleRate;
+  int samplesPerChannel = sampleRate / 100;
+
+  fprintf(out, "{\n  \"frames\": %d,\n  \"warmup_frames\": %d,\n  \"sample_rate\": %d,\n  \"ref_channels\": %d,\n"
+    "  \"hardware_threads\": %u,\n  \"aec\": \"%s\",\n  \"ans\": \"%s\",\n  \"results\": [",
+    frames, warmupFrames, sampleRate, refChannels, std::thread::hardware_concurrency(),
+    benchModelName(aecModel), benchModelName(ansModel));
+
+  static _agora_ap_array_stats warm;
+  static _agora_ap_array_stats stats;
+  int runs = 0;
+  for (size_t m = 0; m < micCounts.size(); m++) {
+    int mics = micCounts[m];
+    AGORA_API_C_HDL array = agora_ap_array_processor_create(service, config, mics);
+    if (array == nullptr) {
+      fprintf(stderr, "agora_ap_array_processor_create failed for %d mics\n", mics);
+      continue;
+    }
+    std::vector<int16_t> nearBuffer((size_t)samplesPerChannel * mics);
+    std::vector<int16_t> farBuffer((size_t)samplesPerChannel * refChannels);
+    _agora_ap_audio_frame nearFrame = {0, sampleRate, mics, samplesPerChannel, 2, nearBuffer.data()};
+    _agora_ap_audio_frame farFrame = {0, sampleRate, refChannels, samplesPerChannel, 2, farBuffer.data()};
+    uint32_t seed = (uint32_t)mics;
+    int errors = 0;
+    for (int i = 0; i < warmupFrames + frames; i++) {
+      if (i == warmupFrames) {
+        agora_ap_array_processor_get_stats(array, &warm);
+      }
+      benchFillSignal(nearBuffer.data(), nearBuffer.size(), &seed);
+      benchFillSignal(farBuffer.data(), farBuffer.size(), &seed);
+      if (agora_ap_array_processor_process_stream(array, &nearFrame, &farFrame) < 0) {
+        errors++;
+      }
+    }
+    agora_ap_array_processor_get_stats(array, &stats);
+
+    // measured frames only, the warmup is subtracted
+    uint64_t count = stats.total.count - warm.total.count;
+    double totalMeanUs = count ? (stats.total.sum_ns - warm.total.sum_ns) / 1000.0 / count : 0;
+    double channelSumMeanUs = count ? (stats.channel_sum.sum_ns - warm.channel_sum.sum_ns) / 1000.0 / count : 0;
+    double layoutMeanUs = count ? (stats.layout_ns - warm.layout_ns) / 1000.0 / count : 0;
+    fprintf(out, "%s\n    {\"mics\": %d, \"worker_threads\": %d, \"errors\": %d, \"overruns\": %llu, "
+      "\"total_mean_us\": %.1f, \"total_p99_us\": %.1f, \"total_max_us\": %.1f, "
+      "\"channel_sum_mean_us\": %.1f, \"speedup\": %.2f, \"layout_mean_us\": %.2f, \"channels\": [",
+      runs == 0 ? "" : ",", mics, stats.worker_threads, errors, (unsigned long long)(stats.overruns - warm.overruns),
+      totalMeanUs, agora_ap_histogram_percentile(&stats.total, 99) / 1000.0, stats.total.max_ns / 1000.0,
+      channelSumMeanUs, totalMeanUs > 0 ? channelSumMeanUs / totalMeanUs : 0.0, layoutMeanUs);
+    for (int c = 0; c < mics; c++) {
+      double meanUs = count ? (stats.channel_total_ns[c] - warm.channel_total_ns[c]) / 1000.0 / count : 0;
+      fprintf(out, "%s{\"mean_us\": %.1f, \"max_us\": %.1f}", c == 0 ? "" : ", ", meanUs, stats.channel_max_ns[c] / 1000.0);
+    }
+    fprintf(out, "]}");
+    fflush(out);
+    runs++;
+    agora_ap_array_processor_release(array);
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  agora_ap_service_release(service);
+  return 0;
+}
@@ -0,0 +1,169 @@
+#ifndef AGORA_API_BENCH_COMMON_H
+#define AGORA_API_BENCH_COMMON_H
+
+// Helpers shared by the bench_* tools.
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "3a.h"
+
+static inline uint64_t benchNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "8000,16000" -> {8000, 16000}
+static inline std::vector<int> benchParseIntList(const char* text) {
+  std::vector<int> values;
+  const char* p = text;
+  while (*p != '\0') {
+    char* end = nullptr;
+    long value = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    values.push_back((int)value);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return values;
+}
+
+// Deterministic speech band noise, the same for every run and seed.
+static inline void benchFillSignal(int16_t* samples, size_t count, uint32_t* seed) {
+  uint32_t state = *seed;
+  int32_t low = 0;
+  for (size_t i = 0; i < count; i++) {
+    state = state * 1664525u + 1013904223u;
+    int32_t white = (int32_t)(state >> 16) - 32768;
+    // one pole low pass, keeps the level well below full scale
+    low += (white - low) >> 2;
+    samples[i] = (int16_t)(low / 4);
+  }
+  *seed = state;
+}
+
+static const char* const kBenchModelNames[] = {"tr", "ll", "std"};
+
+// "off,tr" -> {-1, 0}, the model type values of AecModelType/AnsModelType
+static inline std::vector<int> benchParseModelList(const char* text) {
+  std::vector<int> models;
+  std::string list(text);
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    size_t end = list.find(',', begin);
+    std::string name = list.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+    if (name == "off") {
+      models.push_back(-1);
+    }
+    for (int i = 0; i < 3; i++) {
+      if (name == kBenchModelNames[i]) {
+        models.push_back(i);
+      }
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+  return models;
+}
+
+static inline const char* benchModelName(int model) {
+  return model >= 0 && model < 3 ? kBenchModelNames[model] : "off";
+}
+
+// Keep stdout for the JSON result, the wrapper and library log go to stderr.
+static inline void benchLogToStderr() {
+  _agora_ap_log_config config = agora_ap_log_config_create();
+  config.path = "/dev/stderr";
+  config.level = 2;
+  agora_ap_log_configure(&config);
+}
+
+// Options every bench tool takes to reach the library.
+struct BenchServiceOptions {
+  const char* appId;
+  const char* license;
+  const char* resourcePath;
+
+  BenchServiceOptions()
+      : appId(getenv("AGORA_APP_ID")), license(getenv("AGORA_LICENSE")), resourcePath("./") {}
+
+  // consume argv[*i] (and its value) if it is a service option
+  bool Parse(int argc, char* argv[], int* i) {
+    if (strcmp(argv[*i], "--app-id") == 0 && *i + 1 < argc) {
+      appId = argv[++*i];
+    } else if (strcmp(argv[*i], "--license") == 0 && *i + 1 < argc) {
+      license = argv[++*i];
+    } else if (strcmp(argv[*i], "--resource-path") == 0 && *i + 1 < argc) {
+      resourcePath = argv[++*i];
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  _agora_ap_service_config Config() const {
+    _agora_ap_service_config config;
+    config.app_id = appId != nullptr ? appId : "";
+    config.license = license != nullptr ? license : "";
+    config.resource_path = resourcePath;
+    return config;
+  }
+};
+
+// Retired user space instructions of the calling thread, where the kernel
+// lets us count them (perf_event_paranoid, containers).
+class BenchInstructionCounter {
+ public:
+  BenchInstructionCounter() : fd_(-1) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~BenchInstructionCounter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool available() const { return fd_ >= 0; }
+
+  void Start() {
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  // instructions since Start(), 0 if unavailable
+  uint64_t Stop() {
+    uint64_t count = 0;
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+      }
+    }
+    return count;
+  }
+
+ private:
+  int fd_;
+};
+
+#endif // AGORA_API_BENCH_COMMON_H
@@ -0,0 +1,212 @@
+// Break the memory footprint down: service init and each model copy, then
+// per AecModelType/AnsModelType combination the processor create, the
+// first frames and the release.
+//
+//   bench_memory [--aec off,tr,ll,std] [--ans off,tr,ll,std] [--count n] [--frames n]
+//                [--rate hz] [--channels n] [--trim] [--out result.json]
+//                [--app-id id] [--license license] [--resource-path dir]
+//
+// Every combination creates |count| processors one after the other, runs
+// |frames| frames through each (the library allocates part of its state
+// lazily) and releases them again. RSS and PSS are read from /proc around
+// every step, wrapper bytes come from the wrapper's counting allocator.
+// What a release does not give back is reported as retained; with --trim
+// malloc_trim() runs first, separating allocator caching from leaks.
+#include "3a.h"
+#include "3a_cost_model.h"
+#include "3a_memory.h"
+#include "bench_common.h"
+#include <malloc.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char* kModelResourceNames[AGORA_AP_MODEL_COUNT] = {"ains", "ains_ll", "ainlp", "ainlp_ll"};
+
+struct MemorySample {
+  long long rss;
+  long long pss;
+  long long wrapper;
+
+  static MemorySample Read() {
+    MemorySample sample;
+    sample.rss = (long long)ApReadRssBytes();
+    sample.pss = (long long)ApReadPssBytes();
+    sample.wrapper = ApMemoryGetUsage().bytes;
+    return sample;
+  }
+};
+
+static void printDelta(FILE* out, const char* name, const MemorySample& from, const MemorySample& to, int divisor) {
+  fprintf(out, "\"%s\": {\"rss_bytes\": %.0f, \"pss_bytes\": %.0f, \"wrapper_bytes\": %.0f}", name,
+    (double)(to.rss - from.rss) / divisor, (double)(to.pss - from.pss) / divisor,
+    (double)(to.wrapper - from.wrapper) / divisor);
+}
+
+static void usage() {
+  printf("usage: bench_memory [--aec off,tr,ll,std] [--ans off,tr,ll,std] [--count n] [--frames n]\n"
+         "                    [--rate hz] [--channels n] [--trim] [--out result.json]\n"
+         "                    [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  std::vector<int> aecModels = benchParseModelList("off,tr,ll,std");
+  std::vector<int> ansModels = benchParseModelList("off,tr,ll,std");
+  int count = 4;
+  int frames = 100;
+  int sampleRate = 48000;
+  int channels = 1;
+  bool trim = false;
+  const char* outputFile = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      aecModels = benchParseModelList(argv[++i]);
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      ansModels = benchParseModelList(argv[++i]);
+    } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+      count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      sampleRate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+      channels = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--trim") == 0) {
+      trim = true;
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (aecModels.empty() || ansModels.empty() || count < 1 || frames < 0 || sampleRate < 8000 || channels < 1) {
+    usage();
+    return 1;
+  }
+
+  FILE* out = stdout;
+  if (outputFile != nullptr) {
+    out = fopen(outputFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", outputFile);
+      return 1;
+    }
+  }
+
+  benchLogToStderr();
+  MemorySample baseline = MemorySample::Read();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+  MemorySample serviceReady = MemorySample::Read();
+  _agora_ap_memory_report report;
+  agora_ap_service_get_memory_report(service, &report);
+
+  fprintf(out, "{\n  \"sample_rate\": %d,\n  \"channels\": %d,\n  \"processors_per_config\": %d,\n"
+    "  \"frames\": %d,\n  \"trim\": %s,\n  \"baseline\": {\"rss_bytes\": %lld, \"pss_bytes\": %lld},\n  \"service\": {",
+    sampleRate, channels, count, frames, trim ? "true" : "false", baseline.rss, baseline.pss);
+  printDelta(out, "initialize", baseline, serviceReady, 1);
+  fprintf(out, ", \"models\": [");
+  for (int i = 0; i < AGORA_AP_MODEL_COUNT; i++) {
+    fprintf(out, "%s\n      {\"model\": \"%s\", \"file_bytes\": %lld, \"rss_bytes\": %lld}", i == 0 ? "" : ",",
+      kModelResourceNames[i], report.model_bytes[i], report.model_rss_bytes[i]);
+  }
+  fprintf(out, "\n    ]},\n  \"configs\": [");
+
+  int samplesPerChannel = sampleRate / 100;
+  std::vector<int16_t> nearBuffer((size_t)samplesPerChannel * channels);
+  std::vector<int16_t> farBuffer((size_t)samplesPerChannel * channels);
+  _agora_ap_audio_frame nearFrame = {0, sampleRate, channels, samplesPerChannel, 2, nearBuffer.data()};
+  _agora_ap_audio_frame farFrame = {0, sampleRate, channels, samplesPerChannel, 2, farBuffer.data()};
+  bool first = true;
+  for (size_t a = 0; a < aecModels.size(); a++) {
+    for (size_t n = 0; n < ansModels.size(); n++) {
+      _agora_ap_processor_config config = agora_ap_processor_config_create();
+      config.aec_config.enabled = aecModels[a] >= 0;
+      config.aec_config.stereoAecEnabled = channels > 1;
+      if (aecModels[a] >= 0) {
+        config.aec_config.aecModelType = aecModels[a];
+      }
+      config.ans_config.enabled = ansModels[n] >= 0;
+      if (ansModels[n] >= 0) {
+        config.ans_config.ansModelType = ansModels[n];
+      }
+      config.qos_config.allow_degradation = false;
+      config.qos_config.expected_sample_rate = sampleRate;
+      config.qos_config.expected_channels = channels;
+
+      MemorySample before = MemorySample::Read();
+      std::vector<AGORA_API_C_HDL> processors;
+      long long reportedRss = 0;
+      for (int i = 0; i < count; i++) {
+        AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+        if (processor == nullptr) {
+          fprintf(stderr, "agora_ap_processor_create failed, aec %s ans %s\n",
+            benchModelName(aecModels[a]), benchModelName(ansModels[n]));
+          break;
+        }
+        _agora_ap_processor_memory memory;
+        agora_ap_processor_get_memory(processor, &memory);
+        reportedRss += memory.create_rss_bytes;
+        processors.push_back(processor);
+      }
+      if (processors.empty()) {
+        continue;
+      }
+      int created = (int)processors.size();
+      MemorySample afterCreate = MemorySample::Read();
+
+      uint32_t seed = 1;
+      for (int f = 0; f < frames; f++) {
+        for (size_t p = 0; p < processors.size(); p++) {
+          benchFillSignal(nearBuffer.data(), nearBuffer.size(), &seed);
+          benchFillSignal(farBuffer.data(), farBuffer.size(), &seed);
+          agora_ap_processor_process_stream(processors[p], &nearFrame, &farFrame);
+        }
+      }
+      MemorySample afterFrames = MemorySample::Read();
+
+      for (size_t p = 0; p < processors.size(); p++) {
+        agora_ap_processor_release(processors[p]);
+      }
+      if (trim) {
+        malloc_trim(0);
+      }
+      MemorySample afterRelease = MemorySample::Read();
+
+      fprintf(out, "%s\n    {\"aec\": \"%s\", \"ans\": \"%s\", \"processors\": %d,\n      \"per_processor\": {",
+        first ? "" : ",", benchModelName(aecModels[a]), benchModelName(ansModels[n]), created);
+      printDelta(out, "create", before, afterCreate, created);
+      fprintf(out, ", ");
+      printDelta(out, "frames", afterCreate, afterFrames, created);
+      fprintf(out, ", ");
+      printDelta(out, "total", before, afterFrames, created);
+      fprintf(out, ", \"reported_create_rss_bytes\": %.0f},\n      ", (double)reportedRss / created);
+      printDelta(out, "returned_by_release", afterRelease, afterFrames, 1);
+      fprintf(out, ",\n      ");
+      printDelta(out, "retained", before, afterRelease, 1);
+      fprintf(out, "}");
+      fflush(out);
+      first = false;
+    }
+  }
+
+  agora_ap_service_get_memory_report(service, &report);
+  fprintf(out, "\n  ],\n  \"final\": {\"rss_bytes\": %lld, \"pss_bytes\": %lld, \"wrapper_bytes\": %lld, "
+    "\"wrapper_peak_bytes\": %lld, \"wrapper_allocations\": %lld}\n}\n",
+    report.rss_bytes, report.pss_bytes, report.wrapper_bytes, report.wrapper_peak_bytes, report.wrapper_allocations);
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  agora_ap_service_release(service);
+  return 0;
+}
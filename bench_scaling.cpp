@@ -0,0 +1,317 @@
+// Find how many concurrent processors the host sustains at the 10ms deadline.
+//
+//   bench_scaling [--threads t] [--start n] [--step n] [--max-streams n]
+//                 [--seconds s] [--miss-threshold percent] [--mode realtime|asap|both]
+//                 [--aec off,tr,ll,std] [--ans off,tr,ll,std] [--rate hz] [--channels n]
+//                 [--out result.json] [--app-id id] [--license license] [--resource-path dir]
+//
+// Processors are created from one service and added in steps. Each step
+// drives all of them from |t| threads, streams assigned round robin:
+// - realtime: every thread wakes each 10ms and processes one frame of each
+//   of its streams, a frame finished after the next tick is a deadline miss.
+// - asap: every thread processes its streams back to back, giving the
+//   throughput per cpu second.
+// The knee is the last stream count whose realtime miss ratio stayed below
+// the threshold. RSS is sampled after every step.
+#include "3a.h"
+#include "3a_cost_model.h"
+#include "3a_stats.h"
+#include "bench_common.h"
+#include <time.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Stream {
+  AGORA_API_C_HDL processor;
+  std::vector<int16_t> nearBuffer;
+  std::vector<int16_t> farBuffer;
+  _agora_ap_audio_frame nearFrame;
+  _agora_ap_audio_frame farFrame;
+  uint32_t seed;
+};
+
+struct ThreadResult {
+  uint64_t frames;
+  uint64_t misses;
+  ApLatencyHistogram tick;  // realtime: time to process all streams of the thread in one tick
+};
+
+static uint64_t processCpuNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void processFrame(Stream* stream) {
+  benchFillSignal(stream->nearBuffer.data(), stream->nearBuffer.size(), &stream->seed);
+  benchFillSignal(stream->farBuffer.data(), stream->farBuffer.size(), &stream->seed);
+  agora_ap_processor_process_stream(stream->processor, &stream->nearFrame, &stream->farFrame);
+}
+
+// realtime pacing, the threads start on a common tick
+static void runRealtime(std::vector<Stream*> streams, int frames, uint64_t startNs, ThreadResult* result) {
+  const uint64_t periodNs = 10000000ull;
+  for (int i = 0; i < frames; i++) {
+    uint64_t tickNs = startNs + i * periodNs;
+    uint64_t nowNs = benchNowNs();
+    if (nowNs < tickNs) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(tickNs - nowNs));
+    }
+    uint64_t beginNs = benchNowNs();
+    for (size_t s = 0; s < streams.size(); s++) {
+      processFrame(streams[s]);
+      if (benchNowNs() > tickNs + periodNs) {
+        result->misses++;
+      }
+    }
+    result->tick.Record(benchNowNs() - beginNs);
+    result->frames += streams.size();
+  }
+}
+
+static void runAsap(std::vector<Stream*> streams, int frames, ThreadResult* result) {
+  for (int i = 0; i < frames; i++) {
+    for (size_t s = 0; s < streams.size(); s++) {
+      processFrame(streams[s]);
+    }
+    result->frames += streams.size();
+  }
+}
+
+static void usage() {
+  printf("usage: bench_scaling [--threads t] [--start n] [--step n] [--max-streams n]\n"
+         "                     [--seconds s] [--miss-threshold percent] [--mode realtime|asap|both]\n"
+         "                     [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--rate hz] [--channels n]\n"
+         "                     [--out result.json] [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  int startStreams = 0;
+  int step = 0;
+  int maxStreams = 1024;
+  double seconds = 5;
+  double missThreshold = 1.0;
+  std::string mode = "both";
+  int aecModel = 1;
+  int ansModel = 2;
+  int sampleRate = 48000;
+  int channels = 1;
+  const char* outputFile = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+      startStreams = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+      step = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-streams") == 0 && i + 1 < argc) {
+      maxStreams = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--miss-threshold") == 0 && i + 1 < argc) {
+      missThreshold = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+      mode = argv[++i];
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      aecModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      ansModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      sampleRate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+      channels = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  bool realtime = mode == "realtime" || mode == "both";
+  bool asap = mode == "asap" || mode == "both";
+  if (threads < 1 || maxStreams < 1 || seconds <= 0 || (!realtime && !asap) || sampleRate < 8000 || channels < 1) {
+    usage();
+    return 1;
+  }
+  if (step <= 0) {
+    step = threads;
+  }
+  if (startStreams <= 0) {
+    startStreams = step;
+  }
+  int frames = (int)(seconds * 100);
+
+  FILE* out = stdout;
+  if (outputFile != nullptr) {
+    out = fopen(outputFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", outputFile);
+      return 1;
+    }
+  }
+
+  benchLogToStderr();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  config.aec_config.enabled = aecModel >= 0;
+  config.aec_config.stereoAecEnabled = channels > 1;
+  if (aecModel >= 0) {
+    config.aec_config.aecModelType = aecModel;
+  }
+  config.ans_config.enabled = ansModel >= 0;
+  if (ansModel >= 0) {
+    config.ans_config.ansModelType = ansModel;
+  }
+  config.qos_config.allow_degradation = false;
+  config.qos_config.expected_sample_rate = sampleRate;
+  config.qos_config.expected_channels = channels;
+  int samplesPerChannel = sampleRate / 100;
+
+  fprintf(out, "{\n  \"threads\": %d,\n  \"hardware_threads\": %u,\n  \"seconds_per_step\": %.1f,\n"
+    "  \"sample_rate\": %d,\n  \"channels\": %d,\n  \"miss_threshold_percent\": %.2f,\n  \"steps\": [",
+    threads, std::thread::hardware_concurrency(), seconds, sampleRate, channels, missThreshold);
+
+  size_t rssBase = ApReadRssBytes();
+  std::vector<Stream*> streams;
+  int knee = 0;
+  bool kneeFound = false;
+  double bestStreamsPerCore = 0;
+  for (int count = startStreams; count <= maxStreams; count += step) {
+    bool created = true;
+    while ((int)streams.size() < count) {
+      Stream* stream = new Stream();
+      stream->processor = agora_ap_processor_create(service, config);
+      if (stream->processor == nullptr) {
+        delete stream;
+        created = false;
+        break;
+      }
+      stream->nearBuffer.resize((size_t)samplesPerChannel * channels);
+      stream->farBuffer.resize((size_t)samplesPerChannel * channels);
+      stream->nearFrame = {0, sampleRate, channels, samplesPerChannel, 2, stream->nearBuffer.data()};
+      stream->farFrame = {0, sampleRate, channels, samplesPerChannel, 2, stream->farBuffer.data()};
+      stream->seed = (uint32_t)streams.size() + 1;
+      streams.push_back(stream);
+    }
+    if (!created) {
+      fprintf(stderr, "agora_ap_processor_create failed at %zu streams\n", streams.size());
+      break;
+    }
+    size_t rss = ApReadRssBytes();
+
+    std::vector<std::vector<Stream*>> assigned(threads);
+    for (size_t s = 0; s < streams.size(); s++) {
+      assigned[s % threads].push_back(streams[s]);
+    }
+
+    fprintf(out, "%s\n    {\"streams\": %d, \"rss_bytes\": %zu, \"rss_per_stream_bytes\": %.0f",
+      count == startStreams ? "" : ",", count, rss, rss > rssBase ? (double)(rss - rssBase) / count : 0.0);
+
+    double missRatio = 0;
+    if (realtime) {
+      std::vector<ThreadResult> results(threads);
+      for (int t = 0; t < threads; t++) {
+        results[t].frames = 0;
+        results[t].misses = 0;
+      }
+      std::vector<std::thread> workers;
+      uint64_t startNs = benchNowNs() + 20000000ull;
+      for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread(runRealtime, assigned[t], frames, startNs, &results[t]));
+      }
+      for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+      }
+      uint64_t totalFrames = 0;
+      uint64_t misses = 0;
+      static _agora_ap_latency_histogram tick;
+      uint64_t p99Ns = 0;
+      uint64_t maxNs = 0;
+      for (int t = 0; t < threads; t++) {
+        totalFrames += results[t].frames;
+        misses += results[t].misses;
+        results[t].tick.CopyTo(&tick);
+        p99Ns = std::max(p99Ns, (uint64_t)ap_histogram_percentile(tick, 99));
+        maxNs = std::max(maxNs, (uint64_t)tick.max_ns);
+      }
+      missRatio = totalFrames ? 100.0 * misses / totalFrames : 0;
+      fprintf(out, ", \"realtime\": {\"frames\": %llu, \"deadline_misses\": %llu, \"miss_percent\": %.3f, "
+        "\"tick_p99_us\": %.1f, \"tick_max_us\": %.1f}",
+        (unsigned long long)totalFrames, (unsigned long long)misses, missRatio, p99Ns / 1000.0, maxNs / 1000.0);
+    }
+    if (asap) {
+      std::vector<ThreadResult> results(threads);
+      for (int t = 0; t < threads; t++) {
+        results[t].frames = 0;
+      }
+      std::vector<std::thread> workers;
+      uint64_t cpuBeginNs = processCpuNs();
+      uint64_t wallBeginNs = benchNowNs();
+      for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread(runAsap, assigned[t], frames, &results[t]));
+      }
+      for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+      }
+      double wallSeconds = (benchNowNs() - wallBeginNs) / 1e9;
+      double cpuSeconds = (processCpuNs() - cpuBeginNs) / 1e9;
+      uint64_t totalFrames = 0;
+      for (int t = 0; t < threads; t++) {
+        totalFrames += results[t].frames;
+      }
+      // a stream needs 100 frames per second
+      double streamsPerCore = cpuSeconds > 0 ? totalFrames / cpuSeconds / 100.0 : 0;
+      bestStreamsPerCore = std::max(bestStreamsPerCore, streamsPerCore);
+      fprintf(out, ", \"asap\": {\"frames\": %llu, \"frames_per_second\": %.0f, \"cpu_seconds\": %.3f, "
+        "\"streams_per_core\": %.2f}",
+        (unsigned long long)totalFrames, totalFrames / wallSeconds, cpuSeconds, streamsPerCore);
+    }
+    fprintf(out, "}");
+    fflush(out);
+
+    if (realtime) {
+      if (missRatio > missThreshold) {
+        kneeFound = true;
+        break;
+      }
+      knee = count;
+    }
+  }
+  fprintf(out, "\n  ],\n");
+  if (realtime) {
+    fprintf(out, "  \"knee_streams\": %d,\n  \"knee_found\": %s,\n  \"knee_streams_per_thread\": %.2f,\n",
+      knee, kneeFound ? "true" : "false", (double)knee / threads);
+  }
+  if (asap) {
+    fprintf(out, "  \"asap_streams_per_core\": %.2f,\n", bestStreamsPerCore);
+  }
+  size_t rss = ApReadRssBytes();
+  fprintf(out, "  \"rss_growth_per_stream_bytes\": %.0f\n}\n",
+    !streams.empty() && rss > rssBase ? (double)(rss - rssBase) / streams.size() : 0.0);
+
+  for (size_t s = 0; s < streams.size(); s++) {
+    agora_ap_processor_release(streams[s]->processor);
+    delete streams[s];
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  agora_ap_service_release(service);
+  return 0;
+}
@@ -0,0 +1,402 @@
+// Measure time to ready: process start, service initialize with each model
+// load, processor create split by library call, and the first frame.
+//
+//   bench_startup [--repeat n] [--mode cold|warm|both]
+//                 [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--rate hz] [--channels n]
+//                 [--out result.json] [--app-id id] [--license license] [--resource-path dir]
+//
+// Every repetition runs in a fresh process (this binary re-executed with
+// --child), so nothing is shared between runs but the page cache. A cold run
+// first evicts the page cache: through /proc/sys/vm/drop_caches when it is
+// writable (root), else with posix_fadvise(DONTNEED) on the model files, the
+// executable and the shared libraries it maps. The second way cannot evict
+// pages another process still maps, the method used is in the result.
+#include "3a.h"
+#include "3a_stats.h"
+#include "bench_common.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char* kModelFiles[AGORA_AP_MODEL_COUNT] = {
+  "CLDNNWeights.bin", "CLDNNLLWeights.bin", "YNetWeights.bin", "YNetLLWeights.bin"};
+static const char* kModelNames[AGORA_AP_MODEL_COUNT] = {"ains", "ains_ll", "ainlp", "ainlp_ll"};
+
+// one child run, in us; -1 when the phase did not happen
+enum Phase {
+  kExecToMain,       // exec until main, dynamic loading and static init
+  kServiceInit,
+  kModelLoad,        // kModelLoad + i, i < AGORA_AP_MODEL_COUNT
+  kProcessorCreate = kModelLoad + AGORA_AP_MODEL_COUNT,
+  kCreateLibrary,    // CreateAgoraAudioProcessing
+  kCreateInit,
+  kCreateModelResource,
+  kCreateConfig,
+  kFirstFrame,
+  kSteadyFrame,      // mean of the next 99 frames
+  kTimeToReady,      // exec until the first frame returned
+  kPhaseCount
+};
+
+static const char* kPhaseNames[kPhaseCount] = {
+  "exec_to_main", "service_initialize",
+  "model_load_ains", "model_load_ains_ll", "model_load_ainlp", "model_load_ainlp_ll",
+  "processor_create", "create_library", "create_init", "create_model_resource", "create_config",
+  "first_frame", "steady_frame", "time_to_ready"};
+
+static void usage() {
+  printf("usage: bench_startup [--repeat n] [--mode cold|warm|both]\n"
+         "                     [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--rate hz] [--channels n]\n"
+         "                     [--out result.json] [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+// The child: run every phase once and print the timings as one line of
+// numbers on stdout, the library log goes to stderr.
+static int runChild(const BenchServiceOptions& serviceOptions, uint64_t spawnNs,
+                    int aecModel, int ansModel, int sampleRate, int channels) {
+  long long phases[kPhaseCount];
+  for (int i = 0; i < kPhaseCount; i++) {
+    phases[i] = -1;
+  }
+  phases[kExecToMain] = (long long)(benchNowNs() - spawnNs) / 1000;
+
+  benchLogToStderr();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  uint64_t beginNs = benchNowNs();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+  phases[kServiceInit] = (long long)(benchNowNs() - beginNs) / 1000;
+  _agora_ap_startup_timing startup;
+  agora_ap_service_get_startup_timing(service, &startup);
+  for (int i = 0; i < AGORA_AP_MODEL_COUNT; i++) {
+    phases[kModelLoad + i] = startup.model_bytes[i] > 0 ? startup.model_load_us[i] : -1;
+  }
+
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  config.aec_config.enabled = aecModel >= 0;
+  config.aec_config.stereoAecEnabled = channels > 1;
+  if (aecModel >= 0) {
+    config.aec_config.aecModelType = aecModel;
+  }
+  config.ans_config.enabled = ansModel >= 0;
+  if (ansModel >= 0) {
+    config.ans_config.ansModelType = ansModel;
+  }
+  config.qos_config.expected_sample_rate = sampleRate;
+  config.qos_config.expected_channels = channels;
+  AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+  if (processor == nullptr) {
+    fprintf(stderr, "agora_ap_processor_create failed\n");
+    agora_ap_service_release(service);
+    return 1;
+  }
+
+  int samplesPerChannel = sampleRate / 100;
+  std::vector<int16_t> nearBuffer((size_t)samplesPerChannel * channels);
+  std::vector<int16_t> farBuffer((size_t)samplesPerChannel * channels);
+  _agora_ap_audio_frame nearFrame = {0, sampleRate, channels, samplesPerChannel, 2, nearBuffer.data()};
+  _agora_ap_audio_frame farFrame = {0, sampleRate, channels, samplesPerChannel, 2, farBuffer.data()};
+  uint32_t seed = 1;
+  uint64_t steadyNs = 0;
+  for (int i = 0; i < 100; i++) {
+    benchFillSignal(nearBuffer.data(), nearBuffer.size(), &seed);
+    benchFillSignal(farBuffer.data(), farBuffer.size(), &seed);
+    uint64_t frameBeginNs = benchNowNs();
+    agora_ap_processor_process_stream(processor, &nearFrame, &farFrame);
+    uint64_t frameEndNs = benchNowNs();
+    if (i == 0) {
+      phases[kTimeToReady] = (long long)(frameEndNs - spawnNs) / 1000;
+    } else {
+      steadyNs += frameEndNs - frameBeginNs;
+    }
+  }
+  phases[kSteadyFrame] = (long long)(steadyNs / 99 / 1000);
+
+  _agora_ap_create_timing create;
+  agora_ap_processor_get_create_timing(processor, &create);
+  phases[kProcessorCreate] = create.total_us;
+  phases[kCreateLibrary] = create.create_us;
+  phases[kCreateInit] = create.init_us;
+  phases[kCreateModelResource] = create.model_resource_us;
+  phases[kCreateConfig] = create.config_us;
+  phases[kFirstFrame] = create.first_frame_us;
+
+  for (int i = 0; i < kPhaseCount; i++) {
+    printf("%s%lld", i == 0 ? "" : " ", phases[i]);
+  }
+  printf("\n");
+  fflush(stdout);
+
+  agora_ap_processor_release(processor);
+  agora_ap_service_release(service);
+  return 0;
+}
+
+static bool dropCachesGlobally() {
+  sync();
+  int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(fd, "3", 1) == 1;
+  close(fd);
+  return ok;
+}
+
+static void evictFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+// the model files, this executable and every shared library it maps
+static std::vector<std::string> startupFiles(const char* resourcePath) {
+  std::vector<std::string> files;
+  std::string dir = resourcePath;
+  if (!dir.empty() && dir.back() != '/') {
+    dir += '/';
+  }
+  for (int i = 0; i < AGORA_AP_MODEL_COUNT; i++) {
+    files.push_back(dir + kModelFiles[i]);
+  }
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps != nullptr) {
+    char line[1024];
+    while (fgets(line, sizeof(line), maps) != nullptr) {
+      const char* path = strchr(line, '/');
+      if (path == nullptr) {
+        continue;
+      }
+      std::string file(path);
+      while (!file.empty() && (file.back() == '\n' || file.back() == ' ')) {
+        file.pop_back();
+      }
+      if (std::find(files.begin(), files.end(), file) == files.end()) {
+        files.push_back(file);
+      }
+    }
+    fclose(maps);
+  }
+  return files;
+}
+
+// run one child, false if it failed
+static bool spawnChild(const std::vector<std::string>& childArgs, long long* phases) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  uint64_t spawnNs = benchNowNs();
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    std::string spawn = std::to_string((unsigned long long)spawnNs);
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("bench_startup"));
+    argv.push_back(const_cast<char*>("--child"));
+    argv.push_back(const_cast<char*>(spawn.c_str()));
+    for (size_t i = 0; i < childArgs.size(); i++) {
+      argv.push_back(const_cast<char*>(childArgs[i].c_str()));
+    }
+    argv.push_back(nullptr);
+    execv("/proc/self/exe", argv.data());
+    _exit(127);
+  }
+  close(fds[1]);
+  std::string output;
+  char buffer[512];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+    output.append(buffer, (size_t)n);
+  }
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return false;
+  }
+  const char* p = output.c_str();
+  for (int i = 0; i < kPhaseCount; i++) {
+    char* end = nullptr;
+    phases[i] = strtoll(p, &end, 10);
+    if (end == p) {
+      return false;
+    }
+    p = end;
+  }
+  return true;
+}
+
+// mean, p50 and max of the runs where the phase happened
+static void printPhases(FILE* out, const std::vector<std::vector<long long>>& runs) {
+  for (int phase = 0; phase < kPhaseCount; phase++) {
+    std::vector<long long> values;
+    for (size_t r = 0; r < runs.size(); r++) {
+      if (runs[r][phase] >= 0) {
+        values.push_back(runs[r][phase]);
+      }
+    }
+    fprintf(out, "%s\n      \"%s\": ", phase == 0 ? "" : ",", kPhaseNames[phase]);
+    if (values.empty()) {
+      fprintf(out, "null");
+      continue;
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+      sum += values[i];
+    }
+    fprintf(out, "{\"mean_us\": %.1f, \"p50_us\": %lld, \"min_us\": %lld, \"max_us\": %lld}",
+      sum / values.size(), values[values.size() / 2], values.front(), values.back());
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  int repeat = 10;
+  std::string mode = "both";
+  int aecModel = 1;
+  int ansModel = 2;
+  int sampleRate = 48000;
+  int channels = 1;
+  const char* outputFile = nullptr;
+  bool child = false;
+  uint64_t spawnNs = 0;
+  // forwarded to the children
+  std::vector<std::string> childArgs;
+  for (int i = 1; i < argc; i++) {
+    int first = i;
+    if (strcmp(argv[i], "--child") == 0 && i + 1 < argc) {
+      child = true;
+      spawnNs = strtoull(argv[++i], nullptr, 10);
+      continue;
+    } else if (serviceOptions.Parse(argc, argv, &i)) {
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+      continue;
+    } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+      mode = argv[++i];
+      continue;
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+      continue;
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      aecModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      ansModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      sampleRate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+      channels = atoi(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+    for (int j = first; j <= i; j++) {
+      childArgs.push_back(argv[j]);
+    }
+  }
+  if (sampleRate < 8000 || channels < 1) {
+    usage();
+    return 1;
+  }
+  if (child) {
+    return runChild(serviceOptions, spawnNs, aecModel, ansModel, sampleRate, channels);
+  }
+  bool cold = mode == "cold" || mode == "both";
+  bool warm = mode == "warm" || mode == "both";
+  if (repeat < 1 || (!cold && !warm)) {
+    usage();
+    return 1;
+  }
+
+  FILE* out = stdout;
+  if (outputFile != nullptr) {
+    out = fopen(outputFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", outputFile);
+      return 1;
+    }
+  }
+
+  std::vector<std::string> files = startupFiles(serviceOptions.resourcePath);
+  const char* evictMethod = nullptr;
+
+  fprintf(out, "{\n  \"repeat\": %d,\n  \"sample_rate\": %d,\n  \"channels\": %d,\n"
+    "  \"aec_model\": %d,\n  \"ans_model\": %d,\n  \"runs\": {",
+    repeat, sampleRate, channels, aecModel, ansModel);
+  const char* modes[] = {"cold", "warm"};
+  bool enabled[] = {cold, warm};
+  bool firstMode = true;
+  int failures = 0;
+  for (int m = 0; m < 2; m++) {
+    if (!enabled[m]) {
+      continue;
+    }
+    std::vector<std::vector<long long>> runs;
+    if (m == 1) {
+      // warm the cache, the first run after a cold one is not warm yet
+      long long phases[kPhaseCount];
+      spawnChild(childArgs, phases);
+    }
+    for (int r = 0; r < repeat; r++) {
+      if (m == 0) {
+        if (dropCachesGlobally()) {
+          evictMethod = "drop_caches";
+        } else {
+          for (size_t f = 0; f < files.size(); f++) {
+            evictFile(files[f]);
+          }
+          evictMethod = "fadvise";
+        }
+      }
+      std::vector<long long> phases(kPhaseCount);
+      if (!spawnChild(childArgs, phases.data())) {
+        failures++;
+        continue;
+      }
+      runs.push_back(phases);
+    }
+    fprintf(out, "%s\n    \"%s\": {\n      \"completed\": %zu,", firstMode ? "" : ",", modes[m], runs.size());
+    printPhases(out, runs);
+    fprintf(out, "\n    }");
+    firstMode = false;
+    fflush(out);
+  }
+  fprintf(out, "\n  },\n  \"cold_eviction\": ");
+  if (evictMethod != nullptr) {
+    fprintf(out, "\"%s\"", evictMethod);
+  } else {
+    fprintf(out, "null");
+  }
+  fprintf(out, ",\n  \"model_files\": {");
+  for (int i = 0; i < AGORA_AP_MODEL_COUNT; i++) {
+    fprintf(out, "%s\"%s\": \"%s\"", i == 0 ? "" : ", ", kModelNames[i], kModelFiles[i]);
+  }
+  fprintf(out, "},\n  \"failed_runs\": %d\n}\n", failures);
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+// Long lived processing daemon: owns the service, the loaded models and the
+// processors; short lived media processes drive them through 3a_client.h.
+//
+//   daemon --socket path [--flight-dir dir] [--app-id id] [--license license] [--resource-path dir]
+//
+// Control requests arrive on a SOCK_SEQPACKET Unix domain socket, served by
+// one session thread per client connection. Every processor gets a sealed
+// memfd ring of frame slots (3a_ipc.h), passed to the client with the
+// create response, and a stream thread that waits on the ring, processes
+// each frame in place and completes it; audio never crosses the socket.
+// A client that disconnects or crashes only takes its own streams along:
+// its session releases them, and the frame layout read from shared memory
+// is checked before a frame is processed. SIGINT or SIGTERM stop the daemon.
+#include "3a.h"
+#include "3a_ipc.h"
+#include "bench_common.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Stream {
+  uint32_t id;
+  AGORA_API_C_HDL processor;
+  int ringFd;
+  ApIpcRing* ring;
+  std::atomic<bool> stop;
+  std::thread thread;
+};
+
+struct Session {
+  int socket;
+  std::thread thread;
+  std::map<uint32_t, Stream*> streams;  // session thread only
+  std::atomic<bool> done;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static AGORA_API_C_HDL service = nullptr;
+static const char* flightDir = "./flight/";
+static std::atomic<uint32_t> nextStreamId(1);
+static std::atomic<uint64_t> streamsCreated(0);
+static std::atomic<uint64_t> framesProcessed(0);
+static std::atomic<uint64_t> framesRejected(0);
+
+static void onSignal(int) {
+  stopRequested = 1;
+}
+
+// frame layout from shared memory, the client may have written anything
+static bool validLayout(int sampleRate, int channels, int samplesPerChannel) {
+  return sampleRate >= 8000 && sampleRate <= 48000 && sampleRate % 100 == 0 && channels >= 1 && channels <= 2 &&
+         samplesPerChannel == sampleRate / 100 && samplesPerChannel * channels <= AP_IPC_MAX_FRAME_SAMPLES;
+}
+
+static void runStream(Stream* stream) {
+  ApIpcRing* ring = stream->ring;
+  uint32_t processed = ring->completed.load(std::memory_order_relaxed);
+  while (!stream->stop.load(std::memory_order_acquire)) {
+    uint32_t submitted = ring->submitted.load(std::memory_order_acquire);
+    if (submitted == processed) {
+      ApIpcWait(&ring->submitted, processed, 100);
+      continue;
+    }
+    if (submitted - processed > AP_IPC_RING_SLOTS) {
+      fprintf(stderr, "daemon: stream %u submitted past the ring, stopped\n", stream->id);
+      break;
+    }
+    ApIpcFrameSlot& slot = ring->slot[processed % AP_IPC_RING_SLOTS];
+    // the layout is read once, the processor only sees these copies
+    _agora_ap_audio_frame frame = {0, slot.sample_rate, slot.channels, slot.samples_per_channel, 2, slot.near};
+    _agora_ap_audio_frame refFrame = {0, slot.ref_sample_rate, slot.ref_channels, slot.ref_samples_per_channel, 2, slot.ref};
+    int ret = -1;
+    if (validLayout(frame.sampleRate, frame.channels, frame.samplesPerChannel) &&
+        validLayout(refFrame.sampleRate, refFrame.channels, refFrame.samplesPerChannel)) {
+      ret = agora_ap_processor_process_stream(stream->processor, &frame, &refFrame);
+      framesProcessed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      framesRejected.fetch_add(1, std::memory_order_relaxed);
+    }
+    slot.ret = ret;
+    processed++;
+    ring->completed.store(processed, std::memory_order_release);
+    ApIpcWake(&ring->completed);
+  }
+}
+
+static Stream* createStream(const _agora_ap_processor_config& requested) {
+  _agora_ap_processor_config config = requested;
+  config.flight_recorder_config.dir = flightDir;
+  AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+  if (processor == nullptr) {
+    return nullptr;
+  }
+  int ringFd = ApIpcCreateRing();
+  ApIpcRing* ring = ringFd >= 0 ? ApIpcMapRing(ringFd) : nullptr;
+  if (ring == nullptr) {
+    if (ringFd >= 0) {
+      close(ringFd);
+    }
+    agora_ap_processor_release(processor);
+    return nullptr;
+  }
+  Stream* stream = new Stream();
+  stream->id = nextStreamId.fetch_add(1);
+  stream->processor = processor;
+  stream->ringFd = ringFd;
+  stream->ring = ring;
+  stream->stop = false;
+  stream->thread = std::thread(runStream, stream);
+  streamsCreated.fetch_add(1, std::memory_order_relaxed);
+  return stream;
+}
+
+static void releaseStream(Stream* stream) {
+  stream->stop.store(true, std::memory_order_release);
+  ApIpcWake(&stream->ring->submitted);
+  stream->thread.join();
+  agora_ap_processor_release(stream->processor);
+  ApIpcUnmapRing(stream->ring);
+  close(stream->ringFd);
+  delete stream;
+}
+
+static void runSession(Session* session) {
+  static thread_local ApIpcRequest request;
+  static thread_local ApIpcResponse response;
+  while (ApIpcReceive(session->socket, &request, sizeof(request))) {
+    memset(&response, 0, sizeof(response));
+    response.type = request.type;
+    response.stream = request.stream;
+    int passFd = -1;
+    // a client only reaches the streams it created
+    std::map<uint32_t, Stream*>::iterator it = session->streams.find(request.stream);
+    Stream* stream = it != session->streams.end() ? it->second : nullptr;
+    if (request.version != AP_IPC_VERSION) {
+      response.ret = -2;
+    } else if (request.type == kApIpcHello) {
+      response.ret = 0;
+    } else if (request.type == kApIpcConfigDefaults) {
+      response.config = agora_ap_processor_config_create();
+      response.config.flight_recorder_config.dir = nullptr;
+    } else if (request.type == kApIpcProcessorCreate) {
+      Stream* created = createStream(request.config);
+      if (created != nullptr) {
+        session->streams[created->id] = created;
+        response.stream = created->id;
+        passFd = created->ringFd;
+      } else {
+        response.ret = -2;
+      }
+    } else if (stream == nullptr) {
+      response.ret = -1;
+    } else if (request.type == kApIpcProcessorRelease) {
+      session->streams.erase(it);
+      releaseStream(stream);
+    } else if (request.type == kApIpcSetStreamDelayMs) {
+      response.ret = agora_ap_processor_set_stream_delay_ms(stream->processor, request.value);
+    } else if (request.type == kApIpcSetStreamAnalogLevel) {
+      response.ret = agora_ap_processor_set_stream_analog_level(stream->processor, request.value);
+    } else if (request.type == kApIpcProcessorReset) {
+      response.ret = agora_ap_processor_reset(stream->processor);
+    } else if (request.type == kApIpcSetConfig) {
+      response.ret = agora_ap_processor_set_config(stream->processor, &request.config);
+    } else if (request.type == kApIpcGetStats) {
+      response.ret = agora_ap_processor_get_stats(stream->processor, &response.stats);
+    } else {
+      response.ret = -1;
+    }
+    if (!ApIpcSend(session->socket, &response, sizeof(response), passFd)) {
+      break;
+    }
+  }
+  // gone, cleanly or not: its streams go with it
+  for (std::map<uint32_t, Stream*>::iterator s = session->streams.begin(); s != session->streams.end(); ++s) {
+    releaseStream(s->second);
+  }
+  session->streams.clear();
+  session->done.store(true, std::memory_order_release);
+}
+
+static void usage() {
+  printf("usage: daemon --socket path [--flight-dir dir] [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  const char* socketPath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (strcmp(argv[i], "--flight-dir") == 0 && i + 1 < argc) {
+      flightDir = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  struct sockaddr_un address;
+  if (socketPath == nullptr || strlen(socketPath) >= sizeof(address.sun_path)) {
+    usage();
+    return 1;
+  }
+
+  benchLogToStderr();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+
+  int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketPath);
+  unlink(socketPath);
+  if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+    fprintf(stderr, "cannot listen on %s: %s\n", socketPath, strerror(errno));
+    agora_ap_service_release(service);
+    return 1;
+  }
+
+  // no SA_RESTART, a signal breaks accept()
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "daemon: listening on %s\n", socketPath);
+
+  std::vector<Session*> sessions;
+  uint64_t clients = 0;
+  while (!stopRequested) {
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    // finished sessions are joined whenever a client comes or a signal arrives
+    for (size_t s = 0; s < sessions.size();) {
+      if (sessions[s]->done.load(std::memory_order_acquire)) {
+        sessions[s]->thread.join();
+        close(sessions[s]->socket);
+        delete sessions[s];
+        sessions.erase(sessions.begin() + s);
+      } else {
+        s++;
+      }
+    }
+    if (fd < 0) {
+      if (errno != EINTR) {
+        fprintf(stderr, "accept: %s\n", strerror(errno));
+      }
+      continue;
+    }
+    Session* session = new Session();
+    session->socket = fd;
+    session->done = false;
+    session->thread = std::thread(runSession, session);
+    sessions.push_back(session);
+    clients++;
+  }
+
+  // wake the sessions out of recvmsg, they release their streams
+  close(listener);
+  unlink(socketPath);
+  for (size_t s = 0; s < sessions.size(); s++) {
+    shutdown(sessions[s]->socket, SHUT_RDWR);
+  }
+  for (size_t s = 0; s < sessions.size(); s++) {
+    sessions[s]->thread.join();
+    close(sessions[s]->socket);
+    delete sessions[s];
+  }
+  fprintf(stderr, "daemon: %llu clients, %llu streams, %llu frames processed, %llu rejected\n",
+    (unsigned long long)clients, (unsigned long long)streamsCreated.load(), (unsigned long long)framesProcessed.load(),
+    (unsigned long long)framesRejected.load());
+  agora_ap_service_release(service);
+  return 0;
+}
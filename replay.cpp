@@ -0,0 +1,251 @@
+// Re-drive a processor from a capture written by agora_ap_processor_start_capture.
+//
+//   replay <capture> [--app-id id] [--license license] [--resource-path dir]
+//          [--realtime] [--out out.pcm] [--repeat n]
+//
+// Runs at full speed unless --realtime, which keeps the captured frame
+// timing. Config changes recorded mid stream are applied with
+// agora_ap_processor_set_config before the frame they preceded. Prints the
+// per frame timing and a checksum of the output, equal checksums mean bit
+// exact output.
+#include "3a.h"
+#include "3a_capture.h"
+#include "3a_stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// the algorithm sections of a config record, the rest of |config| is kept
+static void readCaptureConfig(const char* payload, _agora_ap_processor_config* config) {
+  ApCaptureConfig captureConfig;
+  memcpy(&captureConfig, payload, sizeof(captureConfig));
+  config->aec_config = captureConfig.aec_config;
+  config->ans_config = captureConfig.ans_config;
+  config->agc_config = captureConfig.agc_config;
+  config->bghvs_config = captureConfig.bghvs_config;
+}
+
+static uint64_t getMonotonicTimeNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// FNV-1a 64
+static uint64_t checksum(uint64_t hash, const void* data, size_t bytes) {
+  const unsigned char* p = (const unsigned char*)data;
+  for (size_t i = 0; i < bytes; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static void printHistogram(const char* name, const _agora_ap_latency_histogram& hist) {
+  printf("%-24s count %llu mean %.1f us p50 %.1f us p90 %.1f us p99 %.1f us p999 %.1f us max %.1f us\n", name,
+    hist.count, hist.count ? hist.sum_ns / 1000.0 / hist.count : 0.0,
+    ap_histogram_percentile(hist, 50) / 1000.0, ap_histogram_percentile(hist, 90) / 1000.0,
+    ap_histogram_percentile(hist, 99) / 1000.0, ap_histogram_percentile(hist, 99.9) / 1000.0,
+    hist.max_ns / 1000.0);
+}
+
+static void usage() {
+  printf("usage: replay <capture> [--app-id id] [--license license] [--resource-path dir]\n"
+         "              [--realtime] [--out out.pcm] [--repeat n]\n");
+}
+
+int main(int argc, char* argv[]) {
+  const char* capturePath = nullptr;
+  const char* appId = getenv("AGORA_APP_ID");
+  const char* license = getenv("AGORA_LICENSE");
+  const char* resourcePath = "./";
+  const char* outputFile = nullptr;
+  bool realtime = false;
+  int repeat = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--app-id") == 0 && i + 1 < argc) {
+      appId = argv[++i];
+    } else if (strcmp(argv[i], "--license") == 0 && i + 1 < argc) {
+      license = argv[++i];
+    } else if (strcmp(argv[i], "--resource-path") == 0 && i + 1 < argc) {
+      resourcePath = argv[++i];
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      realtime = true;
+    } else if (argv[i][0] != '-' && capturePath == nullptr) {
+      capturePath = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (capturePath == nullptr || repeat < 1) {
+    usage();
+    return 1;
+  }
+
+  ApCaptureReader reader;
+  if (!reader.Open(capturePath)) {
+    printf("cannot read capture %s\n", capturePath);
+    return 1;
+  }
+  const ApCaptureRecordHeader* record = nullptr;
+  const char* payload = nullptr;
+  if (!reader.Next(&record, &payload) || record->type != kApCaptureConfig) {
+    printf("capture %s does not start with a config record\n", capturePath);
+    return 1;
+  }
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  readCaptureConfig(payload, &config);
+  // a replay must not change its own config
+  config.qos_config.allow_degradation = false;
+  config.recovery_config.auto_recover = false;
+
+  _agora_ap_service_config serviceConfig;
+  serviceConfig.app_id = appId != nullptr ? appId : "";
+  serviceConfig.license = license != nullptr ? license : "";
+  serviceConfig.resource_path = resourcePath;
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    printf("agora_ap_service_initialize failed\n");
+    return 1;
+  }
+  AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+  if (processor == nullptr) {
+    printf("agora_ap_processor_create failed\n");
+    agora_ap_service_release(service);
+    return 1;
+  }
+
+  FILE* out = nullptr;
+  if (outputFile != nullptr) {
+    out = fopen(outputFile, "wb");
+  }
+
+  static ApLatencyHistogram frameHist;
+  std::vector<char> nearBuffer;
+  std::vector<char> refBuffer;
+  uint64_t hash = 14695981039346656037ull;
+  uint64_t frames = 0;
+  uint64_t missingFrames = 0;
+  uint64_t configChanges = 0;
+  uint64_t errors = 0;
+  double audioSeconds = 0;
+  uint64_t processNs = 0;
+  uint64_t wallBeginNs = getMonotonicTimeNs();
+
+  for (int pass = 0; pass < repeat; pass++) {
+    reader.Rewind();
+    // skip the initial config record, a later pass goes back to it
+    reader.Next(&record, &payload);
+    if (pass > 0 && configChanges > 0) {
+      agora_ap_processor_set_config(processor, &config);
+    }
+    uint64_t firstTimeNs = 0;
+    uint64_t passBeginNs = getMonotonicTimeNs();
+    int64_t lastFrame = -1;
+    while (reader.Next(&record, &payload)) {
+      if (record->type == kApCaptureConfig) {
+        if (record->bytes >= sizeof(ApCaptureConfig)) {
+          _agora_ap_processor_config changed = config;
+          readCaptureConfig(payload, &changed);
+          agora_ap_processor_set_config(processor, &changed);
+          configChanges++;
+        }
+        continue;
+      }
+      if (record->type != kApCaptureFrame || record->bytes < sizeof(ApCaptureFrame)) {
+        continue;
+      }
+      ApCaptureFrame frameRecord;
+      memcpy(&frameRecord, payload, sizeof(frameRecord));
+      size_t nearBytes = (size_t)frameRecord.channels * frameRecord.samples_per_channel * frameRecord.bytes_per_sample;
+      size_t refBytes = (size_t)frameRecord.ref_channels * frameRecord.ref_samples_per_channel * frameRecord.ref_bytes_per_sample;
+      if (sizeof(ApCaptureFrame) + nearBytes + refBytes > record->bytes) {
+        printf("frame %llu is truncated\n", (unsigned long long)frameRecord.frame);
+        break;
+      }
+      if (lastFrame >= 0 && (int64_t)frameRecord.frame > lastFrame + 1) {
+        // dropped by the capture writer
+        missingFrames += frameRecord.frame - lastFrame - 1;
+      }
+      lastFrame = (int64_t)frameRecord.frame;
+
+      if (realtime) {
+        if (firstTimeNs == 0) {
+          firstTimeNs = record->time_ns;
+        }
+        uint64_t dueNs = passBeginNs + (record->time_ns - firstTimeNs);
+        uint64_t nowNs = getMonotonicTimeNs();
+        if (dueNs > nowNs) {
+          std::this_thread::sleep_for(std::chrono::nanoseconds(dueNs - nowNs));
+        }
+      }
+
+      // the library processes in place, the mapping is read only
+      nearBuffer.assign(payload + sizeof(ApCaptureFrame), payload + sizeof(ApCaptureFrame) + nearBytes);
+      refBuffer.assign(payload + sizeof(ApCaptureFrame) + nearBytes, payload + sizeof(ApCaptureFrame) + nearBytes + refBytes);
+      _agora_ap_audio_frame nearFrame;
+      nearFrame.type = 0;
+      nearFrame.sampleRate = frameRecord.sample_rate;
+      nearFrame.channels = frameRecord.channels;
+      nearFrame.samplesPerChannel = frameRecord.samples_per_channel;
+      nearFrame.bytesPerSample = frameRecord.bytes_per_sample;
+      nearFrame.buffer = nearBuffer.data();
+      _agora_ap_audio_frame refFrame;
+      refFrame.type = 0;
+      refFrame.sampleRate = frameRecord.ref_sample_rate;
+      refFrame.channels = frameRecord.ref_channels;
+      refFrame.samplesPerChannel = frameRecord.ref_samples_per_channel;
+      refFrame.bytesPerSample = frameRecord.ref_bytes_per_sample;
+      refFrame.buffer = refBytes > 0 ? refBuffer.data() : nullptr;
+
+      agora_ap_processor_set_stream_delay_ms(processor, frameRecord.stream_delay_ms);
+      agora_ap_processor_set_stream_analog_level(processor, frameRecord.stream_analog_level);
+      uint64_t beginNs = getMonotonicTimeNs();
+      int ret = agora_ap_processor_process_stream(processor, &nearFrame, &refFrame);
+      uint64_t endNs = getMonotonicTimeNs();
+      frameHist.Record(endNs - beginNs);
+      processNs += endNs - beginNs;
+      if (ret < 0) {
+        errors++;
+      }
+      if (pass == 0) {
+        hash = checksum(hash, nearBuffer.data(), nearBytes);
+        if (out != nullptr) {
+          fwrite(nearBuffer.data(), 1, nearBytes, out);
+        }
+      }
+      audioSeconds += (double)frameRecord.samples_per_channel / frameRecord.sample_rate;
+      frames++;
+    }
+  }
+  uint64_t wallNs = getMonotonicTimeNs() - wallBeginNs;
+
+  printf("capture %s: processor %u, %d pass(es), %llu frames, %llu missing, %llu config changes, %llu errors\n",
+    capturePath, reader.header().processor_id, repeat, (unsigned long long)frames,
+    (unsigned long long)missingFrames, (unsigned long long)configChanges, (unsigned long long)errors);
+  static _agora_ap_latency_histogram snapshot;
+  frameHist.CopyTo(&snapshot);
+  printHistogram("process_stream (wall)", snapshot);
+  static _agora_ap_processor_stats stats;
+  if (agora_ap_processor_get_stats(processor, &stats) == 0) {
+    printHistogram("ProcessStream", stats.process_stream);
+    printHistogram("ProcessReverseStream", stats.process_reverse_stream);
+  }
+  printf("audio %.2f s, processing %.3f s, wall %.3f s, real time factor %.4f\n", audioSeconds,
+    processNs / 1e9, wallNs / 1e9, audioSeconds > 0 ? processNs / 1e9 / audioSeconds : 0.0);
+  printf("output checksum %016llx\n", (unsigned long long)hash);
+
+  if (out != nullptr) {
+    fclose(out);
+  }
+  agora_ap_processor_release(processor);
+  agora_ap_service_release(service);
+  return 0;
+}
@@ -0,0 +1,480 @@
+// Process one long recording on several processors in parallel.
+//
+//   segment --nearin near.wav [--farin far.wav] --out out.wav [--jobs n]
+//           [--segment-seconds s] [--warmup-seconds s] [--crossfade-ms ms] [--serial]
+//           [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--agc 0|1] [--bghvs 0|1]
+//           [--report result.json] [--app-id id] [--license license] [--resource-path dir]
+//
+// The recording is cut into segments at 10ms frame boundaries, one per
+// worker unless --segment-seconds is given. A worker resets its processor
+// and starts warmup seconds plus the crossfade before its segment, so AEC
+// and ANS have adapted when the segment starts; the warm-up output is
+// dropped. Segments write their part of the output directly at its offset.
+// Over the crossfade before each boundary both neighbours have an output,
+// they are mixed with a linear crossfade once all segments are done.
+//
+// How far the two outputs of a crossfade disagree is the boundary
+// discontinuity: the rms of their difference in dBFS and relative to the
+// signal, and the peak sample difference. --serial also processes the whole
+// recording on one processor first, for the measured speedup and the SNR of
+// the stitched output against the serial one (written to <out>.serial.wav).
+// Without it the speedup is estimated from the processing time spent
+// outside the warm-ups.
+#include "3a.h"
+#include "3a_wav.h"
+#include "bench_common.h"
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Segment {
+  long long begin;  // first frame of the segment
+  long long end;    // one past its last frame
+  // output of the crossfade frames before |begin| and before |end|
+  std::vector<int16_t> head;
+  std::vector<int16_t> tail;
+  long long processedFrames;
+  long long warmupFrames;
+  double seconds;
+  bool ok;
+
+  Segment() : begin(0), end(0), processedFrames(0), warmupFrames(0), seconds(0), ok(false) {}
+};
+
+struct Recording {
+  std::string nearPath;
+  std::string farPath;
+  int sampleRate;
+  int channels;
+  long long samples;  // per channel
+  long long frames;   // 10ms frames, the last one may be short
+};
+
+// buffered positional writes into the output data
+class SegmentOutput {
+ public:
+  SegmentOutput(int fd, off_t offset) : fd_(fd), offset_(offset), ok_(true) {}
+  ~SegmentOutput() { Flush(); }
+
+  void Write(const int16_t* samples, size_t count) {
+    const char* data = reinterpret_cast<const char*>(samples);
+    buffer_.insert(buffer_.end(), data, data + count * sizeof(int16_t));
+    if (buffer_.size() >= (1 << 20)) {
+      Flush();
+    }
+  }
+
+  bool Flush() {
+    if (!buffer_.empty()) {
+      ok_ = pwrite(fd_, buffer_.data(), buffer_.size(), offset_) == (ssize_t)buffer_.size() && ok_;
+      offset_ += buffer_.size();
+      buffer_.clear();
+    }
+    return ok_;
+  }
+
+ private:
+  int fd_;
+  off_t offset_;
+  std::vector<char> buffer_;
+  bool ok_;
+};
+
+static bool openRecording(const Recording& recording, long long frame, std::unique_ptr<ApWavReader>* nearReader,
+                          std::unique_ptr<ApWavReader>* farReader) {
+  *nearReader = ApWavReader::Open(recording.nearPath);
+  if (!*nearReader || !(*nearReader)->Seek(frame * (recording.sampleRate / 100))) {
+    return false;
+  }
+  if (!recording.farPath.empty()) {
+    *farReader = ApWavReader::Open(recording.farPath);
+    if (!*farReader) {
+      return false;
+    }
+    // a far file shorter than the near one continues as silence
+    if (!(*farReader)->Seek(frame * ((*farReader)->format().sample_rate / 100))) {
+      farReader->reset();
+    }
+  }
+  return true;
+}
+
+// feeds frames [first, end) of the recording to |processor| and hands every output frame to |output|
+template <typename Output>
+static bool processFrames(AGORA_API_C_HDL processor, const Recording& recording, long long first, long long end,
+                          Output output) {
+  std::unique_ptr<ApWavReader> nearReader;
+  std::unique_ptr<ApWavReader> farReader;
+  if (!openRecording(recording, first, &nearReader, &farReader)) {
+    return false;
+  }
+  int samplesPerChannel = recording.sampleRate / 100;
+  int farRate = farReader ? farReader->format().sample_rate : recording.sampleRate;
+  int farChannels = farReader ? farReader->format().channels : recording.channels;
+  std::vector<int16_t> silence((size_t)(farRate / 100) * farChannels);
+  _agora_ap_audio_frame nearFrame = {0, recording.sampleRate, recording.channels, samplesPerChannel, 2, nullptr};
+  _agora_ap_audio_frame farFrame = {0, farRate, farChannels, farRate / 100, 2, nullptr};
+  for (long long frame = first; frame < end; frame++) {
+    int samples = 0;
+    int16_t* nearSamples = nearReader->Next(samplesPerChannel, &samples);
+    if (nearSamples == nullptr) {
+      return false;
+    }
+    int16_t* farSamples = farReader ? farReader->Next(farRate / 100) : nullptr;
+    nearFrame.buffer = nearSamples;
+    farFrame.buffer = farSamples != nullptr ? farSamples : silence.data();
+    if (agora_ap_processor_process_stream(processor, &nearFrame, &farFrame) != 0) {
+      return false;
+    }
+    output(frame, nearSamples, samples);
+  }
+  return true;
+}
+
+static void processSegment(AGORA_API_C_HDL processor, const Recording& recording, int fd, long long warmupFrames,
+                           long long crossfadeFrames, bool last, Segment* segment) {
+  uint64_t beginNs = benchNowNs();
+  size_t frameSamples = (size_t)(recording.sampleRate / 100) * recording.channels;
+  long long headBegin = segment->begin > 0 ? segment->begin - crossfadeFrames : 0;
+  long long tailBegin = last ? segment->end : segment->end - crossfadeFrames;
+  long long first = std::max(0ll, headBegin - warmupFrames);
+  segment->head.clear();
+  segment->tail.clear();
+  SegmentOutput output(fd, AP_WAV_HEADER_BYTES + (off_t)(segment->begin * frameSamples * sizeof(int16_t)));
+  segment->ok = processFrames(processor, recording, first, segment->end,
+    [&](long long frame, const int16_t* samples, int count) {
+      if (frame < headBegin) {
+        return;
+      } else if (frame < segment->begin) {
+        segment->head.insert(segment->head.end(), samples, samples + frameSamples);
+      } else if (frame < tailBegin) {
+        output.Write(samples, (size_t)count * recording.channels);
+      } else {
+        segment->tail.insert(segment->tail.end(), samples, samples + frameSamples);
+      }
+    });
+  segment->ok = output.Flush() && segment->ok;
+  segment->processedFrames = segment->end - first;
+  segment->warmupFrames = headBegin - first;
+  segment->seconds = (benchNowNs() - beginNs) / 1e9;
+}
+
+static void runWorker(AGORA_API_C_HDL processor, const Recording* recording, int fd, long long warmupFrames,
+                      long long crossfadeFrames, std::vector<Segment>* segments, std::atomic<size_t>* next) {
+  for (size_t i = next->fetch_add(1); i < segments->size(); i = next->fetch_add(1)) {
+    // every segment starts from a clean state, like the serial run
+    agora_ap_processor_reset(processor);
+    processSegment(processor, *recording, fd, warmupFrames, crossfadeFrames, i + 1 == segments->size(),
+      &(*segments)[i]);
+  }
+}
+
+static bool runSerial(AGORA_API_C_HDL processor, const Recording& recording, const std::string& path) {
+  std::unique_ptr<ApWavWriter> writer = ApWavWriter::Create(path, recording.sampleRate, recording.channels);
+  if (!writer) {
+    return false;
+  }
+  bool ok = processFrames(processor, recording, 0, recording.frames,
+    [&](long long, const int16_t* samples, int count) { writer->Write(samples, (size_t)count * recording.channels); });
+  return writer->Close() && ok;
+}
+
+// SNR of |path| against |reference| in dB, both 16 bit PCM of the same length
+static double compareOutputs(const std::string& path, const std::string& reference) {
+  std::unique_ptr<ApWavReader> a = ApWavReader::Open(path);
+  std::unique_ptr<ApWavReader> b = ApWavReader::Open(reference);
+  if (!a || !b) {
+    return 0;
+  }
+  double signal = 0;
+  double noise = 0;
+  int samples = 0;
+  while (int16_t* x = a->Next(4800, &samples)) {
+    int16_t* y = b->Next(4800);
+    if (y == nullptr) {
+      break;
+    }
+    for (int i = 0; i < samples * a->format().channels; i++) {
+      signal += (double)y[i] * y[i];
+      noise += (double)(x[i] - y[i]) * (x[i] - y[i]);
+    }
+  }
+  return noise > 0 ? 10 * log10(std::max(signal, 1.0) / noise) : 999;
+}
+
+static double toDb(double ratio) {
+  return ratio > 0 ? 20 * log10(ratio) : -999;
+}
+
+static void usage() {
+  printf("usage: segment --nearin near.wav [--farin far.wav] --out out.wav [--jobs n]\n"
+         "               [--segment-seconds s] [--warmup-seconds s] [--crossfade-ms ms] [--serial]\n"
+         "               [--aec off|tr|ll|std] [--ans off|tr|ll|std] [--agc 0|1] [--bghvs 0|1]\n"
+         "               [--report result.json] [--app-id id] [--license license] [--resource-path dir]\n");
+}
+
+int main(int argc, char* argv[]) {
+  BenchServiceOptions serviceOptions;
+  Recording recording;
+  std::string outPath;
+  int jobCount = (int)std::max(1u, std::thread::hardware_concurrency());
+  double segmentSeconds = 0;
+  double warmupSeconds = 5;
+  int crossfadeMs = 20;
+  bool serial = false;
+  int aecModel = 1;
+  int ansModel = 2;
+  bool agc = false;
+  bool bghvs = false;
+  const char* reportFile = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (serviceOptions.Parse(argc, argv, &i)) {
+      continue;
+    } else if (strcmp(argv[i], "--nearin") == 0 && i + 1 < argc) {
+      recording.nearPath = argv[++i];
+    } else if (strcmp(argv[i], "--farin") == 0 && i + 1 < argc) {
+      recording.farPath = argv[++i];
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--segment-seconds") == 0 && i + 1 < argc) {
+      segmentSeconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup-seconds") == 0 && i + 1 < argc) {
+      warmupSeconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--crossfade-ms") == 0 && i + 1 < argc) {
+      crossfadeMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--serial") == 0) {
+      serial = true;
+    } else if (strcmp(argv[i], "--aec") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      aecModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--ans") == 0 && i + 1 < argc) {
+      std::vector<int> models = benchParseModelList(argv[++i]);
+      ansModel = models.empty() ? -1 : models[0];
+    } else if (strcmp(argv[i], "--agc") == 0 && i + 1 < argc) {
+      agc = atoi(argv[++i]) != 0;
+    } else if (strcmp(argv[i], "--bghvs") == 0 && i + 1 < argc) {
+      bghvs = atoi(argv[++i]) != 0;
+    } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+      reportFile = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (recording.nearPath.empty() || outPath.empty() || jobCount < 1 || segmentSeconds < 0 || warmupSeconds < 0 ||
+      crossfadeMs < 0) {
+    usage();
+    return 1;
+  }
+
+  std::unique_ptr<ApWavReader> nearReader = ApWavReader::Open(recording.nearPath);
+  if (!nearReader || nearReader->frames() < 0 || nearReader->format().sample_rate % 100 != 0) {
+    fprintf(stderr, "%s: not a seekable WAV file at a 10ms frame rate\n", recording.nearPath.c_str());
+    return 1;
+  }
+  recording.sampleRate = nearReader->format().sample_rate;
+  recording.channels = nearReader->format().channels;
+  recording.samples = nearReader->frames();
+  nearReader.reset();
+  int samplesPerChannel = recording.sampleRate / 100;
+  recording.frames = (recording.samples + samplesPerChannel - 1) / samplesPerChannel;
+
+  // crossfade whole frames, at least one
+  long long crossfadeFrames = std::max(1, (crossfadeMs + 9) / 10);
+  long long warmupFrames = (long long)(warmupSeconds * 100);
+  long long segmentFrames = segmentSeconds > 0 ? (long long)(segmentSeconds * 100)
+                                               : (recording.frames + jobCount - 1) / jobCount;
+  segmentFrames = std::max(segmentFrames, crossfadeFrames + 1);
+  std::vector<Segment> segments;
+  for (long long begin = 0; begin < recording.frames; begin += segmentFrames) {
+    Segment segment;
+    segment.begin = begin;
+    segment.end = std::min(recording.frames, begin + segmentFrames);
+    segments.push_back(segment);
+  }
+  // a last segment shorter than the crossfade joins the one before it
+  if (segments.size() > 1 && segments.back().end - segments.back().begin <= crossfadeFrames) {
+    segments[segments.size() - 2].end = segments.back().end;
+    segments.pop_back();
+  }
+  jobCount = std::min<int>(jobCount, (int)std::max<size_t>(1, segments.size()));
+
+  FILE* out = stdout;
+  if (reportFile != nullptr) {
+    out = fopen(reportFile, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", reportFile);
+      return 1;
+    }
+  }
+
+  benchLogToStderr();
+  _agora_ap_service_config serviceConfig = serviceOptions.Config();
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    fprintf(stderr, "agora_ap_service_initialize failed\n");
+    return 1;
+  }
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  config.aec_config.enabled = aecModel >= 0;
+  if (aecModel >= 0) {
+    config.aec_config.aecModelType = aecModel;
+  }
+  config.ans_config.enabled = ansModel >= 0;
+  if (ansModel >= 0) {
+    config.ans_config.ansModelType = ansModel;
+  }
+  config.agc_config.enabled = agc;
+  config.bghvs_config.enabled = bghvs;
+  config.qos_config.allow_degradation = false;
+  config.qos_config.expected_sample_rate = recording.sampleRate;
+  config.qos_config.expected_channels = recording.channels;
+
+  std::vector<AGORA_API_C_HDL> processors;
+  for (int t = 0; t < jobCount; t++) {
+    AGORA_API_C_HDL processor = agora_ap_processor_create(service, config);
+    if (processor == nullptr) {
+      fprintf(stderr, "agora_ap_processor_create failed for worker %d\n", t);
+      break;
+    }
+    processors.push_back(processor);
+  }
+  if (processors.empty()) {
+    agora_ap_service_release(service);
+    return 1;
+  }
+
+  std::string serialPath = outPath + ".serial.wav";
+  double serialSeconds = 0;
+  if (serial) {
+    uint64_t beginNs = benchNowNs();
+    if (!runSerial(processors[0], recording, serialPath)) {
+      fprintf(stderr, "serial run failed\n");
+      serial = false;
+    }
+    serialSeconds = (benchNowNs() - beginNs) / 1e9;
+  }
+
+  int fd = open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  uint64_t dataBytes = (uint64_t)recording.samples * recording.channels * sizeof(int16_t);
+  unsigned char header[AP_WAV_HEADER_BYTES];
+  ApWavMakeHeader(header, recording.sampleRate, recording.channels, dataBytes);
+  if (fd < 0 || pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      ftruncate(fd, (off_t)(sizeof(header) + dataBytes)) != 0) {
+    fprintf(stderr, "cannot write %s\n", outPath.c_str());
+    return 1;
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  uint64_t wallBeginNs = benchNowNs();
+  for (size_t t = 0; t < processors.size(); t++) {
+    workers.push_back(std::thread(runWorker, processors[t], &recording, fd, warmupFrames, crossfadeFrames,
+      &segments, &next));
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  // crossfade the overlaps, the later segment fades in
+  size_t frameSamples = (size_t)samplesPerChannel * recording.channels;
+  size_t overlapSamples = (size_t)crossfadeFrames * samplesPerChannel;
+  bool ok = true;
+  double maxDiffDbfs = -999;
+  double maxRelativeDb = -999;
+  double sumRelativeDb = 0;
+  int maxPeak = 0;
+  std::vector<double> boundaryDbfs;
+  std::vector<double> boundaryRelativeDb;
+  std::vector<int> boundaryPeak;
+  for (size_t k = 0; k < segments.size(); k++) {
+    ok = ok && segments[k].ok;
+  }
+  for (size_t k = 1; ok && k < segments.size(); k++) {
+    const std::vector<int16_t>& fadeOut = segments[k - 1].tail;
+    const std::vector<int16_t>& fadeIn = segments[k].head;
+    std::vector<int16_t> mixed(fadeOut.size());
+    double diffEnergy = 0;
+    double signalEnergy = 0;
+    int peak = 0;
+    for (size_t i = 0; i < overlapSamples; i++) {
+      float in = (i + 0.5f) / overlapSamples;
+      for (int c = 0; c < recording.channels; c++) {
+        size_t n = i * recording.channels + c;
+        int difference = fadeIn[n] - fadeOut[n];
+        diffEnergy += (double)difference * difference;
+        signalEnergy += (double)fadeOut[n] * fadeOut[n];
+        peak = std::max(peak, abs(difference));
+        mixed[n] = (int16_t)lrintf(fadeOut[n] * (1 - in) + fadeIn[n] * in);
+      }
+    }
+    off_t offset = AP_WAV_HEADER_BYTES + (off_t)((segments[k].begin - crossfadeFrames) * frameSamples * sizeof(int16_t));
+    ok = pwrite(fd, mixed.data(), mixed.size() * sizeof(int16_t), offset) == (ssize_t)(mixed.size() * sizeof(int16_t));
+    double count = (double)mixed.size();
+    double dbfs = toDb(sqrt(diffEnergy / count) / 32768.0);
+    double relative = signalEnergy > 0 ? toDb(sqrt(diffEnergy / signalEnergy)) : dbfs;
+    boundaryDbfs.push_back(dbfs);
+    boundaryRelativeDb.push_back(relative);
+    boundaryPeak.push_back(peak);
+    maxDiffDbfs = std::max(maxDiffDbfs, dbfs);
+    maxRelativeDb = std::max(maxRelativeDb, relative);
+    sumRelativeDb += relative;
+    maxPeak = std::max(maxPeak, peak);
+  }
+  ok = close(fd) == 0 && ok;
+  double wallSeconds = (benchNowNs() - wallBeginNs) / 1e9;
+  if (!ok) {
+    fprintf(stderr, "segmented processing of %s failed\n", recording.nearPath.c_str());
+  }
+
+  double busySeconds = 0;
+  long long processedFrames = 0;
+  long long warmup = 0;
+  for (size_t k = 0; k < segments.size(); k++) {
+    busySeconds += segments[k].seconds;
+    processedFrames += segments[k].processedFrames;
+    warmup += segments[k].warmupFrames;
+  }
+  double warmupShare = processedFrames > 0 ? (double)warmup / processedFrames : 0;
+  double audioSeconds = (double)recording.samples / recording.sampleRate;
+  fprintf(out, "{\n  \"audio_seconds\": %.3f,\n  \"segments\": %zu,\n  \"workers\": %zu,\n"
+    "  \"segment_seconds\": %.2f,\n  \"warmup_seconds\": %.2f,\n  \"crossfade_ms\": %lld,\n"
+    "  \"wall_seconds\": %.3f,\n  \"busy_seconds\": %.3f,\n  \"warmup_overhead_percent\": %.2f,\n"
+    "  \"realtime_factor\": %.5f,\n  \"estimated_speedup\": %.2f,\n",
+    audioSeconds, segments.size(), processors.size(), segmentFrames / 100.0, warmupFrames / 100.0,
+    crossfadeFrames * 10, wallSeconds, busySeconds, 100 * warmupShare,
+    audioSeconds > 0 ? wallSeconds / audioSeconds : 0.0,
+    wallSeconds > 0 ? busySeconds * (1 - warmupShare) / wallSeconds : 0.0);
+  if (serial) {
+    fprintf(out, "  \"serial_wall_seconds\": %.3f,\n  \"speedup\": %.2f,\n  \"snr_vs_serial_db\": %.1f,\n",
+      serialSeconds, wallSeconds > 0 ? serialSeconds / wallSeconds : 0.0,
+      ok ? compareOutputs(outPath, serialPath) : 0.0);
+  }
+  fprintf(out, "  \"boundary_diff_max_dbfs\": %.1f,\n  \"boundary_diff_max_relative_db\": %.1f,\n"
+    "  \"boundary_diff_mean_relative_db\": %.1f,\n  \"boundary_diff_peak\": %d,\n  \"boundaries\": [",
+    maxDiffDbfs, maxRelativeDb, boundaryRelativeDb.empty() ? -999.0 : sumRelativeDb / boundaryRelativeDb.size(),
+    maxPeak);
+  for (size_t k = 0; k < boundaryDbfs.size(); k++) {
+    fprintf(out, "%s\n    {\"seconds\": %.2f, \"diff_dbfs\": %.1f, \"diff_relative_db\": %.1f, \"peak\": %d}",
+      k == 0 ? "" : ",", segments[k + 1].begin / 100.0, boundaryDbfs[k], boundaryRelativeDb[k], boundaryPeak[k]);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  for (size_t t = 0; t < processors.size(); t++) {
+    agora_ap_processor_release(processors[t]);
+  }
+  agora_ap_service_release(service);
+  return ok ? 0 : 2;
+}
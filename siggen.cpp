@@ -0,0 +1,230 @@
+// Generate deterministic near/far test signals, see 3a_signal.h.
+//
+//   siggen --near near.wav [--far far.wav] [--scenario silence|near|far|doubletalk|noise]
+//          [--rate hz] [--channels n] [--seconds s] [--seed n]
+//          [--noise none|white|pink|nonstationary] [--near-level dbfs] [--far-level dbfs]
+//          [--noise-level dbfs] [--echo-delay-ms ms] [--echo-gain-db db]
+//          [--rir-ms ms] [--rt60-ms ms] [--rir impulse.wav]
+//
+// Paths ending in .wav get a 16 bit PCM WAV header, anything else is raw
+// interleaved PCM; "-" writes raw PCM to stdout. The output feeds alphatest
+// (--nearin/--farin) directly.
+#include "3a_signal.h"
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool endsWith(const std::string& text, const char* suffix) {
+  size_t length = strlen(suffix);
+  return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+static void writeLe16(FILE* file, uint16_t value) {
+  unsigned char bytes[2] = {(unsigned char)value, (unsigned char)(value >> 8)};
+  fwrite(bytes, 1, 2, file);
+}
+
+static void writeLe32(FILE* file, uint32_t value) {
+  unsigned char bytes[4] = {(unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16),
+                            (unsigned char)(value >> 24)};
+  fwrite(bytes, 1, 4, file);
+}
+
+static void writeWavHeader(FILE* file, int sampleRate, int channels, uint32_t dataBytes) {
+  fwrite("RIFF", 1, 4, file);
+  writeLe32(file, 36 + dataBytes);
+  fwrite("WAVEfmt ", 1, 8, file);
+  writeLe32(file, 16);
+  writeLe16(file, 1);
+  writeLe16(file, (uint16_t)channels);
+  writeLe32(file, (uint32_t)sampleRate);
+  writeLe32(file, (uint32_t)(sampleRate * channels * 2));
+  writeLe16(file, (uint16_t)(channels * 2));
+  writeLe16(file, 16);
+  fwrite("data", 1, 4, file);
+  writeLe32(file, dataBytes);
+}
+
+static uint32_t readLe32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// first channel of a 16 bit PCM or 32 bit float WAV
+static bool readImpulseResponse(const char* path, int sampleRate, std::vector<float>* rir) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  std::vector<unsigned char> data;
+  unsigned char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(file);
+  if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0) {
+    fprintf(stderr, "%s is not a WAV file\n", path);
+    return false;
+  }
+  int format = 0;
+  int channels = 0;
+  int rate = 0;
+  int bits = 0;
+  size_t pos = 12;
+  while (pos + 8 <= data.size()) {
+    uint32_t size = readLe32(&data[pos + 4]);
+    const unsigned char* body = &data[pos + 8];
+    size_t available = std::min<size_t>(size, data.size() - pos - 8);
+    if (memcmp(&data[pos], "fmt ", 4) == 0 && available >= 16) {
+      format = body[0] | (body[1] << 8);
+      channels = body[2] | (body[3] << 8);
+      rate = (int)readLe32(body + 4);
+      bits = body[14] | (body[15] << 8);
+    } else if (memcmp(&data[pos], "data", 4) == 0 && channels > 0) {
+      if (rate != sampleRate) {
+        fprintf(stderr, "%s is %d hz, the signal is %d hz\n", path, rate, sampleRate);
+        return false;
+      }
+      if (format == 1 && bits == 16) {
+        for (size_t i = 0; i + 2 * channels <= available; i += 2 * channels) {
+          rir->push_back((int16_t)(body[i] | (body[i + 1] << 8)) / 32768.0f);
+        }
+        return true;
+      }
+      if (format == 3 && bits == 32) {
+        for (size_t i = 0; i + 4 * channels <= available; i += 4 * channels) {
+          float value;
+          memcpy(&value, body + i, sizeof(value));
+          rir->push_back(value);
+        }
+        return true;
+      }
+      fprintf(stderr, "%s: only 16 bit PCM and 32 bit float are supported\n", path);
+      return false;
+    }
+    pos += 8 + size + (size & 1);
+  }
+  fprintf(stderr, "%s has no audio\n", path);
+  return false;
+}
+
+static FILE* openOutput(const std::string& path) {
+  if (path == "-") {
+    return stdout;
+  }
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "cannot write %s\n", path.c_str());
+  }
+  return file;
+}
+
+static void usage() {
+  printf("usage: siggen --near near.wav [--far far.wav] [--scenario silence|near|far|doubletalk|noise]\n"
+         "              [--rate hz] [--channels n] [--seconds s] [--seed n]\n"
+         "              [--noise none|white|pink|nonstationary] [--near-level dbfs] [--far-level dbfs]\n"
+         "              [--noise-level dbfs] [--echo-delay-ms ms] [--echo-gain-db db]\n"
+         "              [--rir-ms ms] [--rt60-ms ms] [--rir impulse.wav]\n");
+}
+
+int main(int argc, char* argv[]) {
+  ApSignalConfig config;
+  std::string nearPath;
+  std::string farPath;
+  const char* rirPath = nullptr;
+  double seconds = 10;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--near") == 0 && hasValue) {
+      nearPath = argv[++i];
+    } else if (strcmp(argv[i], "--far") == 0 && hasValue) {
+      farPath = argv[++i];
+    } else if (strcmp(argv[i], "--scenario") == 0 && hasValue) {
+      if (!ApSignalGenerator::ParseScenario(argv[++i], &config.scenario)) {
+        usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--noise") == 0 && hasValue) {
+      if (!ApSignalGenerator::ParseNoise(argv[++i], &config.noise)) {
+        usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--rate") == 0 && hasValue) {
+      config.sample_rate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--channels") == 0 && hasValue) {
+      config.channels = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      config.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--near-level") == 0 && hasValue) {
+      config.near_level_dbfs = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--far-level") == 0 && hasValue) {
+      config.far_level_dbfs = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--noise-level") == 0 && hasValue) {
+      config.noise_level_dbfs = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--echo-delay-ms") == 0 && hasValue) {
+      config.echo_delay_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--echo-gain-db") == 0 && hasValue) {
+      config.echo_gain_db = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--rir-ms") == 0 && hasValue) {
+      config.rir_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rt60-ms") == 0 && hasValue) {
+      config.rt60_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rir") == 0 && hasValue) {
+      rirPath = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (nearPath.empty() || config.sample_rate < 8000 || config.sample_rate % 100 != 0 || config.channels < 1 ||
+      seconds <= 0 || config.rir_ms < 1) {
+    usage();
+    return 1;
+  }
+  if (rirPath != nullptr && !readImpulseResponse(rirPath, config.sample_rate, &config.rir)) {
+    return 1;
+  }
+
+  FILE* nearFile = openOutput(nearPath);
+  FILE* farFile = farPath.empty() ? nullptr : openOutput(farPath);
+  if (nearFile == nullptr || (!farPath.empty() && farFile == nullptr)) {
+    return 1;
+  }
+  int samplesPerChannel = config.sample_rate / 100;
+  int frames = (int)(seconds * 100);
+  uint32_t dataBytes = (uint32_t)frames * samplesPerChannel * config.channels * 2;
+  if (endsWith(nearPath, ".wav")) {
+    writeWavHeader(nearFile, config.sample_rate, config.channels, dataBytes);
+  }
+  if (farFile != nullptr && endsWith(farPath, ".wav")) {
+    writeWavHeader(farFile, config.sample_rate, config.channels, dataBytes);
+  }
+
+  ApSignalGenerator generator(config);
+  std::vector<int16_t> nearBuffer((size_t)samplesPerChannel * config.channels);
+  std::vector<int16_t> farBuffer((size_t)samplesPerChannel * config.channels);
+  for (int i = 0; i < frames; i++) {
+    generator.Generate(nearBuffer.data(), farFile != nullptr ? farBuffer.data() : nullptr, samplesPerChannel);
+    fwrite(nearBuffer.data(), 2, nearBuffer.size(), nearFile);
+    if (farFile != nullptr) {
+      fwrite(farBuffer.data(), 2, farBuffer.size(), farFile);
+    }
+  }
+  if (nearFile != stdout) {
+    fclose(nearFile);
+  }
+  if (farFile != nullptr && farFile != stdout) {
+    fclose(farFile);
+  }
+  fprintf(stderr, "%s: %d frames, %d hz, %d ch, scenario %s, noise %s, seed %u\n", nearPath.c_str(), frames,
+    config.sample_rate, config.channels, ApSignalGenerator::ScenarioName(config.scenario),
+    ApSignalGenerator::NoiseName(config.noise), config.seed);
+  return 0;
+}
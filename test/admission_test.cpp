@@ -0,0 +1,188 @@
+// Check the cost model and the reservations admission control takes from it.
+//
+//   admission_test
+//
+// ApCostModel keeps the time and the memory of a config apart: a processor
+// create measures only memory, a release only time, and neither may stand
+// in for the other. Through the wrapper: create, look up on the next
+// create, release, look up again, with the stream running at another rate
+// than its admission hints so the key admission looks up differs from the
+// one the stream ran.
+#include "3a.h"
+#include "3a_cost_model.h"
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("%s\n", what);
+    failures++;
+  }
+}
+
+static ApCostKey makeKey(int aec, int ans, int sampleRate, int channels) {
+  ApCostKey key;
+  key.aec_model = aec;
+  key.ans_model = ans;
+  key.sample_rate = sampleRate;
+  key.channels = channels;
+  return key;
+}
+
+static void testCostModel() {
+  ApCostModel model;
+  ApCostKey key = makeKey(1, 2, 48000, 1);
+  ApCostEstimate estimate;
+  check(!model.Lookup(key, &estimate), "unseen key found");
+
+  // create: memory only
+  model.Observe(key, 0, 4000000);
+  check(model.Lookup(key, &estimate), "observed key not found");
+  check(estimate.memory_samples == 1 && estimate.bytes == 4000000, "memory of the first create");
+  check(estimate.cpu_samples == 0, "time counted as measured after a create");
+
+  // release: time only, not averaged with the missing value
+  model.Observe(key, 800, 0);
+  model.Lookup(key, &estimate);
+  check(estimate.cpu_samples == 1 && estimate.us_per_frame == 800, "time of the first release");
+  check(estimate.memory_samples == 1 && estimate.bytes == 4000000, "memory changed by a release");
+
+  model.Observe(key, 0, 2000000);
+  model.Observe(key, 1000, 0);
+  model.Lookup(key, &estimate);
+  check(estimate.memory_samples == 2 && estimate.bytes == 3000000, "memory is the mean of its own samples");
+  check(estimate.cpu_samples == 2 && estimate.us_per_frame == 900, "time is the mean of its own samples");
+
+  // a seed without memory leaves it unmeasured, and so does a save and load
+  ApCostKey seeded = makeKey(-1, 0, 16000, 2);
+  model.Seed(seeded, 300, 0);
+  model.Lookup(seeded, &estimate);
+  check(estimate.cpu_samples == 1 && estimate.memory_samples == 0, "seed without memory");
+
+  char path[] = "/tmp/admission_test.XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0, "cannot create a temporary file");
+  if (fd >= 0) {
+    close(fd);
+    check(model.Save(path) == 2, "saved entries");
+    ApCostModel loaded;
+    check(loaded.Load(path) == 2, "loaded entries");
+    loaded.Lookup(seeded, &estimate);
+    check(estimate.cpu_samples == 1 && estimate.us_per_frame == 300 && estimate.memory_samples == 0,
+          "seed without memory after a save and load");
+    loaded.Lookup(key, &estimate);
+    check(estimate.cpu_samples == 1 && estimate.memory_samples == 1, "measured entry after a save and load");
+    unlink(path);
+  }
+}
+
+static long long committedCpu(AGORA_API_C_HDL service) {
+  _agora_ap_admission_stats stats;
+  agora_ap_service_get_admission_stats(service, &stats);
+  return stats.committed_cpu_us;
+}
+
+// us_per_frame the saved model has for |key|, -1 if it has no line for it
+static double savedCpu(AGORA_API_C_HDL service, const ApCostKey& key) {
+  char path[] = "/tmp/admission_test.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return -1;
+  }
+  close(fd);
+  agora_ap_service_save_cost_model(service, path);
+  ApCostModel model;
+  model.Load(path);
+  unlink(path);
+  ApCostEstimate estimate;
+  if (!model.Lookup(key, &estimate)) {
+    return -1;
+  }
+  return estimate.us_per_frame;
+}
+
+static void processFrames(AGORA_API_C_HDL processor, int sampleRate, int frames) {
+  int samplesPerChannel = sampleRate / 100;
+  std::vector<int16_t> nearBuffer(samplesPerChannel);
+  std::vector<int16_t> farBuffer(samplesPerChannel);
+  _agora_ap_audio_frame nearFrame = {0, sampleRate, 1, samplesPerChannel, 2, nearBuffer.data()};
+  _agora_ap_audio_frame farFrame = {0, sampleRate, 1, samplesPerChannel, 2, farBuffer.data()};
+  for (int i = 0; i < frames; i++) {
+    for (int j = 0; j < samplesPerChannel; j++) {
+      nearBuffer[j] = (int16_t)(8000 * sin(0.05 * (i * samplesPerChannel + j)));
+      farBuffer[j] = (int16_t)(8000 * sin(0.03 * (i * samplesPerChannel + j)));
+    }
+    agora_ap_processor_process_stream(processor, &nearFrame, &farFrame);
+  }
+}
+
+static void testAdmission() {
+  AGORA_API_C_HDL service = agora_ap_service_create();
+  _agora_ap_service_config serviceConfig;
+  serviceConfig.app_id = "";
+  serviceConfig.license = "";
+  serviceConfig.resource_path = "./";
+  if (agora_ap_service_initialize(service, &serviceConfig, nullptr) != 0) {
+    check(false, "agora_ap_service_initialize failed");
+    return;
+  }
+  _agora_ap_admission_config admission = agora_ap_admission_config_create();
+  admission.policy = AGORA_AP_ADMISSION_REFUSE;
+  admission.max_cpu_us = 1000000;
+  admission.default_cpu_us = 3000;
+  agora_ap_service_set_admission(service, &admission);
+
+  _agora_ap_processor_config config = agora_ap_processor_config_create();
+  config.recovery_config.use_spare_processor = false;
+  config.qos_config.allow_degradation = false;
+  config.qos_config.expected_sample_rate = 48000;
+  config.qos_config.expected_channels = 1;
+
+  // create, then the lookup of the second create: the first measured memory, not time
+  AGORA_API_C_HDL first = agora_ap_processor_create(service, config);
+  check(first != nullptr, "first create refused");
+  check(committedCpu(service) == 3000, "first create does not reserve the default time");
+  AGORA_API_C_HDL second = agora_ap_processor_create(service, config);
+  check(second != nullptr, "second create refused");
+  check(committedCpu(service) == 6000, "second create reserves less than the default time");
+
+  // the stream runs at 16 kHz, its hints said 48 kHz
+  processFrames(first, 16000, 200);
+  agora_ap_processor_release(first);
+  check(committedCpu(service) == 3000, "release does not return the reservation");
+
+  // release, then the lookup of the next create with the same hints
+  ApCostKey hinted = makeKey(config.aec_config.enabled ? config.aec_config.aecModelType : -1,
+                             config.ans_config.enabled ? config.ans_config.ansModelType : -1, 48000, 1);
+  ApCostKey ran = makeKey(hinted.aec_model, hinted.ans_model, 16000, 1);
+  double hintedUs = savedCpu(service, hinted);
+  double ranUs = savedCpu(service, ran);
+  check(hintedUs == ranUs, "the release was not recorded under the key admission looks up");
+  AGORA_API_C_HDL third = agora_ap_processor_create(service, config);
+  check(third != nullptr, "third create refused");
+  long long reserved = committedCpu(service) - 3000;
+  check(reserved > 0, "third create reserves no time");
+  if (hintedUs > 0) {
+    check(reserved == (long long)(hintedUs + 0.5) || reserved == (long long)hintedUs, "third create ignores the measured time");
+  } else {
+    check(reserved == 3000, "third create does not fall back to the default time");
+  }
+
+  agora_ap_processor_release(second);
+  agora_ap_processor_release(third);
+  check(committedCpu(service) == 0, "reservations left after every release");
+  agora_ap_service_release(service);
+}
+
+int main() {
+  testCostModel();
+  testAdmission();
+  printf("%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+// Check the SIMD kernels of 3a_mix.cpp against scalar references.
+//
+//   mix_test
+//
+// Runs every kernel over channel counts that take the SIMD paths and
+// those that do not, and frame lengths that leave a scalar tail, with
+// random and full scale samples; ApMixAddScaled over gains around unity
+// and into saturation, ApMixEnergy over runs of -32768. ApRefMixer has to
+// pass tones below the output Nyquist and stop those that would alias when
+// it decimates. test/CMakeLists.txt builds it once as configured and once
+// with -mavx2, which skips on CPUs without AVX2.
+#include "3a_mix.h"
+#include <math.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const char* parameter, int value, int samples) {
+  if (!ok) {
+    printf("%s: mismatch, %s %d, %d samples\n", what, parameter, value, samples);
+    failures++;
+  }
+}
+
+// uniform, with full scale values mixed in
+static void fill(std::vector<int16_t>* samples, uint32_t* seed) {
+  for (size_t i = 0; i < samples->size(); i++) {
+    *seed = *seed * 1664525u + 1013904223u;
+    uint32_t r = *seed >> 8;
+    if ((r & 31) == 0) {
+      (*samples)[i] = (r & 32) ? -32768 : 32767;
+    } else {
+      (*samples)[i] = (int16_t)(r & 0xffff);
+    }
+  }
+}
+
+static void testLayout(uint32_t* seed) {
+  const int channelCounts[] = {1, 2, 3, 4, 6, 8, 16};
+  const int lengths[] = {0, 1, 7, 8, 9, 15, 17, 160, 441, 480};
+  for (int channels : channelCounts) {
+    for (int samples : lengths) {
+      std::vector<int16_t> interleaved((size_t)channels * samples);
+      fill(&interleaved, seed);
+      std::vector<std::vector<int16_t>> planar(channels, std::vector<int16_t>(samples + 1, 0x5a5a));
+      std::vector<int16_t*> out(channels);
+      for (int c = 0; c < channels; c++) {
+        out[c] = planar[c].data();
+      }
+      ApMixDeinterleave(interleaved.data(), channels, samples, out.data());
+      bool ok = true;
+      for (int c = 0; c < channels; c++) {
+        for (int i = 0; i < samples; i++) {
+          ok = ok && planar[c][i] == interleaved[(size_t)i * channels + c];
+        }
+        // nothing written past the end
+        ok = ok && planar[c][samples] == 0x5a5a;
+      }
+      check(ok, "ApMixDeinterleave", "channels", channels, samples);
+
+      std::vector<const int16_t*> in(channels);
+      for (int c = 0; c < channels; c++) {
+        in[c] = planar[c].data();
+      }
+      std::vector<int16_t> back((size_t)channels * samples + 1, 0x5a5a);
+      ApMixInterleave(in.data(), channels, samples, back.data());
+      ok = back[(size_t)channels * samples] == 0x5a5a;
+      for (size_t i = 0; i < interleaved.size(); i++) {
+        ok = ok && back[i] == interleaved[i];
+      }
+      check(ok, "ApMixInterleave", "channels", channels, samples);
+    }
+  }
+}
+
+static int16_t saturate(int32_t value) {
+  return (int16_t)(value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+}
+
+static void testAddScaled(uint32_t* seed) {
+  const int gains[] = {0, 1, 8191, 8192, 16383, AP_MIX_GAIN_UNITY, 16385, 24576, 32767};
+  const int lengths[] = {0, 1, 7, 8, 15, 16, 17, 31, 33, 441, 960};
+  for (int gain : gains) {
+    for (int count : lengths) {
+      std::vector<int16_t> src((size_t)count);
+      std::vector<int16_t> acc((size_t)count + 1);
+      fill(&src, seed);
+      fill(&acc, seed);
+      acc[count] = 0x5a5a;
+      std::vector<int16_t> expected(acc);
+      for (int i = 0; i < count; i++) {
+        // rounded Q14 product, arithmetic shift, then two saturations
+        int16_t scaled = saturate(((int32_t)src[i] * gain + (1 << 13)) >> 14);
+        expected[i] = saturate((int32_t)expected[i] + scaled);
+      }
+      ApMixAddScaled(acc.data(), src.data(), count, gain);
+      check(acc == expected, "ApMixAddScaled", "gain", gain, count);
+    }
+  }
+  // both saturation directions on every lane of the vector paths
+  for (int gain : gains) {
+    std::vector<int16_t> src(37);
+    std::vector<int16_t> acc(37);
+    for (int i = 0; i < 37; i++) {
+      src[i] = (i & 1) ? -32768 : 32767;
+      acc[i] = (i & 1) ? -30000 : 30000;
+    }
+    std::vector<int16_t> expected(acc);
+    for (int i = 0; i < 37; i++) {
+      int16_t scaled = saturate(((int32_t)src[i] * gain + (1 << 13)) >> 14);
+      expected[i] = saturate((int32_t)expected[i] + scaled);
+    }
+    ApMixAddScaled(acc.data(), src.data(), 37, gain);
+    check(acc == expected, "ApMixAddScaled saturation", "gain", gain, 37);
+  }
+}
+
+static void testEnergy(uint32_t* seed) {
+  const int lengths[] = {0, 1, 7, 8, 15, 16, 17, 33, 441, 960, 4801};
+  for (int count : lengths) {
+    std::vector<int16_t> samples((size_t)count);
+    fill(&samples, seed);
+    uint64_t expected = 0;
+    for (int i = 0; i < count; i++) {
+      expected += (uint64_t)((int64_t)samples[i] * samples[i]);
+    }
+    check(ApMixEnergy(samples.data(), count) == expected, "ApMixEnergy", "channels", 1, count);
+
+    // a pair of -32768 squares is 2^31, one past the largest int32
+    std::vector<int16_t> full((size_t)count, -32768);
+    check(ApMixEnergy(full.data(), count) == (uint64_t)count << 30, "ApMixEnergy -32768", "channels", 1, count);
+  }
+}
+
+// output level over input level of a tone at |frequency| through the mixer
+static double refMixerGain(int inRate, int outRate, int channels, double frequency) {
+  ApRefMixer mixer(outRate, channels, -90.0f);
+  int inSamples = inRate / 100;
+  std::vector<int16_t> in((size_t)inSamples * channels);
+  std::vector<int16_t> out((size_t)mixer.samples_per_channel() * channels);
+  double inSquares = 0;
+  double outSquares = 0;
+  for (int frame = 0; frame < 50; frame++) {
+    for (int i = 0; i < inSamples; i++) {
+      double t = (double)(frame * inSamples + i) / inRate;
+      for (int c = 0; c < channels; c++) {
+        in[(size_t)i * channels + c] = (int16_t)lrint(10000.0 * sin(2.0 * M_PI * frequency * t));
+      }
+    }
+    ApRefMixer::Source source = {in.data(), inRate, channels, inSamples, AP_MIX_GAIN_UNITY};
+    mixer.Mix(&source, 1, out.data());
+    // past the filter's transient
+    if (frame >= 10) {
+      for (int16_t s : in) {
+        inSquares += (double)s * s / in.size();
+      }
+      for (int16_t s : out) {
+        outSquares += (double)s * s / out.size();
+      }
+    }
+  }
+  return sqrt(outSquares / inSquares);
+}
+
+static void testRefMixerAntiAlias() {
+  struct Case {
+    int inRate;
+    int outRate;
+    double frequency;
+    bool passes;
+  };
+  // stopped tones fold back to 4 kHz, 5 kHz and 4.1 kHz
+  const Case cases[] = {
+      {48000, 16000, 1000, true},  {48000, 16000, 5000, true},  {48000, 16000, 12000, false},
+      {32000, 8000, 1000, true},   {32000, 8000, 11000, false}, {44100, 16000, 11900, false},
+      {48000, 44100, 8000, true},  {16000, 48000, 2000, true},
+  };
+  for (const Case& c : cases) {
+    for (int channels = 1; channels <= 2; channels++) {
+      double gain = refMixerGain(c.inRate, c.outRate, channels, c.frequency);
+      // within 2 dB in the pass band, 30 dB down in the stop band
+      bool ok = c.passes ? gain > 0.79 && gain < 1.26 : gain < 0.0316;
+      if (!ok) {
+        printf("ApRefMixer %d to %d Hz, %d channels: %.0f Hz tone at %.1f dB\n", c.inRate, c.outRate, channels,
+               c.frequency, 20 * log10(gain));
+        failures++;
+      }
+    }
+  }
+}
+
+int main() {
+#if defined(__AVX2__) && defined(__GNUC__)
+  if (!__builtin_cpu_supports("avx2")) {
+    printf("built for AVX2, the CPU has none\n");
+    return 77;
+  }
+#endif
+  uint32_t seed = 1;
+  testLayout(&seed);
+  testAddScaled(&seed);
+  testEnergy(&seed);
+  testRefMixerAntiAlias();
+  printf("%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
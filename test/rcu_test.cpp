@@ -0,0 +1,172 @@
+// Stress ApRcuSlot with several publishers and one consumer.
+//
+//   rcu_test [--publishers n] [--publishes n]
+//
+// Every value carries its publisher, a per publisher sequence number and a
+// checksum over a payload, and counts its live copies. The consumer checks
+// each value it takes: the checksum (a node freed early and reused no
+// longer matches), versions that only grow, and per publisher sequences
+// that only grow (an older value never wins). At the end every node must
+// be gone. Built with -fsanitize=thread and =address as well, see
+// test/CMakeLists.txt.
+#include "3a_rcu.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define PAYLOAD_WORDS 32
+#define MAX_PUBLISHERS 16
+
+static std::atomic<long> liveValues(0);
+
+struct Value {
+  int publisher;
+  uint64_t sequence;
+  uint64_t payload[PAYLOAD_WORDS];
+  uint64_t checksum;
+
+  Value() : publisher(-1), sequence(0), checksum(0) {
+    memset(payload, 0, sizeof(payload));
+    liveValues++;
+  }
+  Value(const Value& other) {
+    *this = other;
+    liveValues++;
+  }
+  Value& operator=(const Value& other) {
+    publisher = other.publisher;
+    sequence = other.sequence;
+    memcpy(payload, other.payload, sizeof(payload));
+    checksum = other.checksum;
+    return *this;
+  }
+  ~Value() {
+    liveValues--;
+  }
+
+  void Fill(int p, uint64_t s) {
+    publisher = p;
+    sequence = s;
+    checksum = 0;
+    for (int i = 0; i < PAYLOAD_WORDS; i++) {
+      payload[i] = (s + 1) * 0x9e3779b97f4a7c15ull ^ (uint64_t)(p * PAYLOAD_WORDS + i);
+      checksum += payload[i] * (i + 1);
+    }
+  }
+  bool Valid() const {
+    uint64_t sum = 0;
+    for (int i = 0; i < PAYLOAD_WORDS; i++) {
+      sum += payload[i] * (i + 1);
+    }
+    return publisher >= 0 && publisher < MAX_PUBLISHERS && sum == checksum;
+  }
+};
+
+static void usage() {
+  printf("usage: rcu_test [--publishers n] [--publishes n]\n");
+}
+
+int main(int argc, char* argv[]) {
+  int publishers = 4;
+  int publishes = 20000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--publishers") == 0 && i + 1 < argc) {
+      publishers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--publishes") == 0 && i + 1 < argc) {
+      publishes = atoi(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (publishers < 1 || publishers > MAX_PUBLISHERS || publishes < 1) {
+    usage();
+    return 1;
+  }
+
+  int failures = 0;
+  uint64_t taken = 0;
+  uint64_t lastVersion = 0;
+  {
+    ApRcuSlot<Value> slot;
+    std::atomic<int> running(publishers);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < publishers; p++) {
+      threads.emplace_back([&slot, &running, p, publishes]() {
+        Value value;
+        for (int s = 0; s < publishes; s++) {
+          value.Fill(p, (uint64_t)s);
+          slot.Publish(value);
+        }
+        running--;
+      });
+    }
+
+    // the consumer, like the capture thread: take whatever is there
+    uint64_t lastSequence[MAX_PUBLISHERS];
+    bool seen[MAX_PUBLISHERS];
+    memset(seen, 0, sizeof(seen));
+    Value value;
+    uint64_t version = 0;
+    bool draining = false;
+    while (true) {
+      bool done = running.load() == 0;
+      if (slot.Take(&value, &version)) {
+        taken++;
+        if (!value.Valid()) {
+          printf("take %llu: corrupt value, the node was freed or reused early\n", (unsigned long long)taken);
+          failures++;
+        } else if (seen[value.publisher] && value.sequence <= lastSequence[value.publisher]) {
+          printf("take %llu: publisher %d went back from %llu to %llu\n", (unsigned long long)taken, value.publisher,
+                 (unsigned long long)lastSequence[value.publisher], (unsigned long long)value.sequence);
+          failures++;
+        }
+        if (version <= lastVersion) {
+          printf("take %llu: version went back from %llu to %llu\n", (unsigned long long)taken,
+                 (unsigned long long)lastVersion, (unsigned long long)version);
+          failures++;
+        }
+        if (value.publisher >= 0 && value.publisher < MAX_PUBLISHERS) {
+          seen[value.publisher] = true;
+          lastSequence[value.publisher] = value.sequence;
+        }
+        lastVersion = version;
+      } else if (draining) {
+        break;
+      }
+      // one more pass after the publishers are done picks up the last value
+      draining = done;
+    }
+
+    uint64_t expected = (uint64_t)publishers * publishes;
+    if (slot.version() != expected) {
+      printf("version() is %llu after %llu publishes\n", (unsigned long long)slot.version(), (unsigned long long)expected);
+      failures++;
+    }
+    // publishers are serialized, the value left in the slot is the newest
+    if (lastVersion != expected) {
+      printf("last value taken has version %llu, the newest is %llu\n", (unsigned long long)lastVersion,
+             (unsigned long long)expected);
+      failures++;
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    // published and never taken, then freed by the destructor
+    Value last;
+    last.Fill(0, (uint64_t)publishes);
+    slot.Publish(last);
+  }
+  // |value| of the consumer is out of scope too
+  if (liveValues.load() != 0) {
+    printf("%ld values leaked\n", liveValues.load());
+    failures++;
+  }
+  printf("%d publishers, %d publishes each, %llu taken, %d failures\n", publishers, publishes,
+         (unsigned long long)taken, failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+// Check ApWavReader against WAV files built byte by byte.
+//
+//   wav_test
+//
+// One file per case the reader claims to handle: the canonical header,
+// chunks before, between and after fmt and data with odd sizes padded to
+// even, WAVE_FORMAT_EXTENSIBLE, data sizes of 0 and 0xFFFFFFFF, 8, 24 and
+// 32 bit PCM and 32 bit float, and files it has to refuse. Every file is
+// read once mapped and once through a pipe, the path pipes and stdin take.
+#include "3a_wav.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+static std::string tempDir;
+
+static void fail(const char* name, const char* how, const char* what) {
+  printf("%s (%s): %s\n", name, how, what);
+  failures++;
+}
+
+static void le16(std::string* out, uint32_t value) {
+  out->push_back((char)(value & 0xff));
+  out->push_back((char)((value >> 8) & 0xff));
+}
+
+static void le32(std::string* out, uint32_t value) {
+  le16(out, value & 0xffff);
+  le16(out, value >> 16);
+}
+
+static void chunk(std::string* out, const char* id, const std::string& body, uint32_t size) {
+  out->append(id, 4);
+  le32(out, size);
+  out->append(body);
+  // chunks are padded to an even size, the pad is not counted
+  if (body.size() & 1) {
+    out->push_back('\0');
+  }
+}
+
+static void chunk(std::string* out, const char* id, const std::string& body) {
+  chunk(out, id, body, (uint32_t)body.size());
+}
+
+static std::string fmtBody(int tag, int channels, int rate, int bits) {
+  std::string body;
+  le16(&body, (uint32_t)tag);
+  le16(&body, (uint32_t)channels);
+  le32(&body, (uint32_t)rate);
+  le32(&body, (uint32_t)(rate * channels * bits / 8));
+  le16(&body, (uint32_t)(channels * bits / 8));
+  le16(&body, (uint32_t)bits);
+  return body;
+}
+
+// 40 byte WAVE_FORMAT_EXTENSIBLE whose sub format GUID starts with |tag|
+static std::string extensibleBody(int tag, int channels, int rate, int bits) {
+  std::string body = fmtBody(0xFFFE, channels, rate, bits);
+  le16(&body, 22);
+  le16(&body, (uint32_t)bits);
+  le32(&body, channels == 2 ? 3 : 4);
+  le16(&body, (uint32_t)tag);
+  body.append("\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 14);
+  return body;
+}
+
+static std::string riff(const std::string& chunks) {
+  std::string file = "RIFF";
+  le32(&file, (uint32_t)(chunks.size() + 4));
+  return file + "WAVE" + chunks;
+}
+
+// the samples every test file carries, full scale ends included
+static std::vector<int16_t> testSamples(int count) {
+  std::vector<int16_t> samples((size_t)count);
+  for (int i = 0; i < count; i++) {
+    samples[i] = (int16_t)(i * 2731 - 30000);
+  }
+  samples[0] = -32768;
+  samples[count - 1] = 32767;
+  return samples;
+}
+
+// |samples| encoded with |bits|, and what the reader converts them back to
+static std::string encode(const std::vector<int16_t>& samples, int bits, bool isFloat, std::vector<int16_t>* expected) {
+  std::string data;
+  expected->clear();
+  for (int16_t s : samples) {
+    if (isFloat) {
+      // the reader clips to [-1, 1] and scales by 32767
+      float value = s == 32767 ? 1.5f : s / 32768.0f;
+      uint32_t word;
+      memcpy(&word, &value, sizeof(word));
+      le32(&data, word);
+      float clipped = value > 1.0f ? 1.0f : value;
+      float scaled = clipped * 32767.0f;
+      expected->push_back((int16_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f));
+    } else if (bits == 8) {
+      data.push_back((char)(uint8_t)((s >> 8) + 128));
+      expected->push_back((int16_t)((s >> 8) * 256));
+    } else if (bits == 16) {
+      le16(&data, (uint16_t)s);
+      expected->push_back(s);
+    } else if (bits == 24) {
+      // the low byte is below 16 bit resolution and dropped
+      data.push_back('\x5a');
+      le16(&data, (uint16_t)s);
+      expected->push_back(s);
+    } else {
+      le16(&data, 0xa5a5);
+      le16(&data, (uint16_t)s);
+      expected->push_back(s);
+    }
+  }
+  return data;
+}
+
+static std::string writeFile(const char* name, const std::string& bytes) {
+  std::string path = tempDir + "/" + name + ".wav";
+  FILE* file = fopen(path.c_str(), "wb");
+  fwrite(bytes.data(), 1, bytes.size(), file);
+  fclose(file);
+  return path;
+}
+
+// reads the whole file in frames of 7, an odd size that leaves a short last frame
+static bool readAll(ApWavReader* reader, std::vector<int16_t>* out, const char* name, const char* how) {
+  const int frame = 7;
+  int channels = reader->format().channels;
+  out->clear();
+  int samples = 0;
+  while (int16_t* data = reader->Next(frame, &samples)) {
+    out->insert(out->end(), data, data + (size_t)samples * channels);
+    for (int i = samples * channels; i < frame * channels; i++) {
+      if (data[i] != 0) {
+        fail(name, how, "short last frame is not zero padded");
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// the same file through a pipe, so it cannot be mapped
+static std::unique_ptr<ApWavReader> openPiped(const std::string& bytes, std::thread* writer) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return nullptr;
+  }
+  *writer = std::thread([bytes, fds]() {
+    size_t done = 0;
+    while (done < bytes.size()) {
+      ssize_t n = write(fds[1], bytes.data() + done, bytes.size() - done);
+      if (n <= 0) {
+        break;
+      }
+      done += (size_t)n;
+    }
+    close(fds[1]);
+  });
+  std::unique_ptr<ApWavReader> reader = ApWavReader::Open("/dev/fd/" + std::to_string(fds[0]));
+  close(fds[0]);
+  return reader;
+}
+
+static void expectAudio(const char* name, const std::string& bytes, int channels, int rate,
+                        const std::vector<int16_t>& expected) {
+  std::string path = writeFile(name, bytes);
+  for (int piped = 0; piped < 2; piped++) {
+    const char* how = piped ? "piped" : "mapped";
+    std::thread writer;
+    std::unique_ptr<ApWavReader> reader = piped ? openPiped(bytes, &writer) : ApWavReader::Open(path);
+    if (!reader) {
+      fail(name, how, "refused");
+    } else if (reader->format().channels != channels || reader->format().sample_rate != rate) {
+      fail(name, how, "wrong format");
+    } else {
+      std::vector<int16_t> samples;
+      if (readAll(reader.get(), &samples, name, how) && samples != expected) {
+        char what[96];
+        snprintf(what, sizeof(what), "read %zu samples, %zu expected or different values", samples.size(), expected.size());
+        fail(name, how, what);
+      }
+      if (!piped && reader->frames() != (long long)expected.size() / channels) {
+        fail(name, how, "frames() does not match the data");
+      }
+    }
+    reader.reset();
+    if (writer.joinable()) {
+      writer.join();
+    }
+  }
+}
+
+static void expectRefused(const char* name, const std::string& bytes) {
+  std::string path = writeFile(name, bytes);
+  if (ApWavReader::Open(path)) {
+    fail(name, "mapped", "accepted");
+  }
+  std::thread writer;
+  if (openPiped(bytes, &writer)) {
+    fail(name, "piped", "accepted");
+  }
+  writer.join();
+}
+
+int main() {
+  char dirTemplate[] = "/tmp/wav_test.XXXXXX";
+  if (mkdtemp(dirTemplate) == nullptr) {
+    printf("cannot create a temporary directory\n");
+    return 1;
+  }
+  tempDir = dirTemplate;
+
+  std::vector<int16_t> samples = testSamples(2 * 50);
+  std::vector<int16_t> expected;
+  std::string pcm16 = encode(samples, 16, false, &expected);
+
+  {
+    std::string file(AP_WAV_HEADER_BYTES, '\0');
+    ApWavMakeHeader((unsigned char*)&file[0], 16000, 2, pcm16.size());
+    expectAudio("canonical", file + pcm16, 2, 16000, expected);
+  }
+  {
+    // odd sized chunks around fmt and data, the trailing one is not audio
+    std::string chunks;
+    chunk(&chunks, "LIST", std::string("INFOISFT\x05\x00\x00\x00siggn", 17));
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 48000, 16));
+    chunk(&chunks, "fact", std::string("\x64\x00\x00\x00", 4));
+    chunk(&chunks, "junk", "odd");
+    chunk(&chunks, "data", pcm16);
+    chunk(&chunks, "cue ", std::string(23, '\x7f'));
+    expectAudio("chunks", riff(chunks), 2, 48000, expected);
+  }
+  {
+    // fmt with cbSize, 18 bytes
+    std::string chunks;
+    std::string body = fmtBody(1, 1, 8000, 16);
+    le16(&body, 0);
+    chunk(&chunks, "fmt ", body);
+    chunk(&chunks, "data", pcm16);
+    expectAudio("fmt18", riff(chunks), 1, 8000, expected);
+  }
+  {
+    // odd sample count in an 8 bit file, the data chunk itself is padded
+    std::vector<int16_t> odd = testSamples(51);
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(1, 1, 16000, 8));
+    chunk(&chunks, "data", encode(odd, 8, false, &expected));
+    chunk(&chunks, "LIST", "tail");
+    expectAudio("pcm8", riff(chunks), 1, 16000, expected);
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 24));
+    chunk(&chunks, "data", encode(samples, 24, false, &expected));
+    expectAudio("pcm24", riff(chunks), 2, 16000, expected);
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 32));
+    chunk(&chunks, "data", encode(samples, 32, false, &expected));
+    expectAudio("pcm32", riff(chunks), 2, 16000, expected);
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(3, 1, 32000, 32));
+    chunk(&chunks, "data", encode(samples, 32, true, &expected));
+    expectAudio("float32", riff(chunks), 1, 32000, expected);
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", extensibleBody(1, 2, 48000, 24));
+    chunk(&chunks, "data", encode(samples, 24, false, &expected));
+    expectAudio("extensible_pcm24", riff(chunks), 2, 48000, expected);
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", extensibleBody(3, 2, 48000, 32));
+    chunk(&chunks, "data", encode(samples, 32, true, &expected));
+    expectAudio("extensible_float", riff(chunks), 2, 48000, expected);
+  }
+  {
+    // streaming writers leave 0 or 0xFFFFFFFF, the audio runs to the end of the file
+    std::string data = encode(samples, 16, false, &expected);
+    for (uint32_t size : {0u, 0xFFFFFFFFu}) {
+      std::string chunks;
+      chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 16));
+      chunk(&chunks, "data", data, size);
+      expectAudio(size == 0 ? "data_size_0" : "data_size_ffffffff", riff(chunks), 2, 16000, expected);
+    }
+  }
+  {
+    // a data size past the end of the file is cut to what is there
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 16));
+    chunk(&chunks, "data", pcm16, (uint32_t)pcm16.size() * 4);
+    expectAudio("data_size_past_end", riff(chunks), 2, 16000, testSamples(2 * 50));
+  }
+
+  std::string good;
+  chunk(&good, "fmt ", fmtBody(1, 2, 16000, 16));
+  expectRefused("not_riff", "RIFX" + riff(good).substr(4));
+  expectRefused("no_data", riff(good));
+  {
+    std::string chunks;
+    chunk(&chunks, "data", pcm16);
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 16));
+    expectRefused("data_before_fmt", riff(chunks));
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(2, 2, 16000, 4));
+    chunk(&chunks, "data", pcm16);
+    expectRefused("adpcm", riff(chunks));
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 12));
+    chunk(&chunks, "data", pcm16);
+    expectRefused("pcm12", riff(chunks));
+  }
+  {
+    std::string chunks;
+    chunk(&chunks, "fmt ", fmtBody(1, 2, 16000, 16).substr(0, 12), 16);
+    expectRefused("truncated_fmt", riff(chunks));
+  }
+  {
+    std::string chunks = good;
+    chunk(&chunks, "LIST", "abcd", 4000);
+    expectRefused("truncated_chunk", riff(chunks));
+  }
+
+  std::string command = "rm -rf " + tempDir;
+  if (system(command.c_str()) != 0) {
+    printf("cannot remove %s\n", tempDir.c_str());
+  }
+  printf("%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}